@@ -139,6 +139,7 @@ options {\n\
 	allow-recursion-on { any; };\n\
 	allow-update-forwarding {none;};\n\
 #	allow-v6-synthesis <obsolete>;\n\
+	answer-cache-size 0;\n\
 	auth-nxdomain false;\n\
 	check-dup-records warn;\n\
 	check-mx warn;\n\
@@ -147,6 +148,7 @@ options {\n\
 	check-names slave warn;\n\
 	check-spf warn;\n\
 	clients-per-query 10;\n\
+	dnskey-cache-size 1000;\n\
 	dnssec-accept-expired no;\n\
 	dnssec-validation " VALIDATION_DEFAULT "; \n"
 #ifdef HAVE_DNSTAP
@@ -183,16 +185,23 @@ options {\n\
 	query-source address *;\n\
 	query-source-v6 address *;\n\
 	recursion true;\n\
+	refresh-popular-hits 16;\n\
+	refresh-popular-qps 0;\n\
 	request-expire true;\n\
 	request-ixfr true;\n\
 	require-server-cookie no;\n\
+	resolver-hedge-percent 0;\n\
 	resolver-nonbackoff-tries 3;\n\
 	resolver-retry-interval 800; /* in milliseconds */\n\
+	resolver-tcp-connections 0;\n\
+	resolver-tcp-idle-time 10; /* in seconds */\n\
 #	rfc2308-type1 <obsolete>;\n\
 	root-key-sentinel yes;\n\
 	servfail-ttl 1;\n\
+	signature-cache-size 10000;\n\
 #	sortlist <none>\n\
 	stale-answer-enable false;\n\
+	stale-answer-revalidate false;\n\
 	stale-answer-ttl 1; /* 1 second */\n\
 	synth-from-dnssec no;\n\
 #	topology <none>\n\
@@ -237,6 +246,7 @@ options {\n\
 	notify yes;\n\
 	notify-delay 5;\n\
 	notify-to-soa no;\n\
+	proof-cache-size 0;\n\
 	serial-update-method increment;\n\
 	sig-signing-nodes 100;\n\
 	sig-signing-signatures 10;\n\
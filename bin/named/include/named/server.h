@@ -66,6 +66,7 @@ struct named_server {
 	dns_viewlist_t		viewlist;
 	dns_kasplist_t		kasplist;
 	ns_interfacemgr_t *	interfacemgr;
+	dns_verifypool_t *	verifypool;
 	dns_db_t *		in_roothints;
 
 	isc_timer_t *		interface_timer;
@@ -56,6 +56,7 @@
 #include <bind9/check.h>
 
 #include <dns/adb.h>
+#include <dns/anscache.h>
 #include <dns/badcache.h>
 #include <dns/cache.h>
 #include <dns/catz.h>
@@ -71,6 +72,7 @@
 #include <dns/geoip.h>
 #include <dns/journal.h>
 #include <dns/kasp.h>
+#include <dns/keycache.h>
 #include <dns/keytable.h>
 #include <dns/keyvalues.h>
 #include <dns/lib.h>
@@ -90,11 +92,13 @@
 #include <dns/rootns.h>
 #include <dns/rriterator.h>
 #include <dns/secalg.h>
+#include <dns/sigcache.h>
 #include <dns/soa.h>
 #include <dns/stats.h>
 #include <dns/tkey.h>
 #include <dns/tsig.h>
 #include <dns/ttl.h>
+#include <dns/verifypool.h>
 #include <dns/view.h>
 #include <dns/zone.h>
 #include <dns/zt.h>
@@ -4337,6 +4341,11 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist, cfg_obj_t *config,
 	INSIST(result == ISC_R_SUCCESS);
 	view->staleanswersenable = cfg_obj_asboolean(obj);
 
+	obj = NULL;
+	result = named_config_get(maps, "stale-answer-revalidate", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	view->staleanswerrevalidate = cfg_obj_asboolean(obj);
+
 	result = dns_viewlist_find(&named_g_server->viewlist, view->name,
 				   view->rdclass, &pview);
 	if (result == ISC_R_SUCCESS) {
@@ -4684,6 +4693,31 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist, cfg_obj_t *config,
 	if (resolver_param > 0)
 		dns_resolver_setnonbackofftries(view->resolver, resolver_param);
 
+	obj = NULL;
+	CHECK(named_config_get(maps, "resolver-hedge-percent", &obj));
+	dns_resolver_sethedging(view->resolver,
+				ISC_MIN(cfg_obj_asuint32(obj), 100));
+
+	/*
+	 * Out of range values have been rejected by
+	 * bind9_check_namedconf().
+	 */
+	obj = NULL;
+	CHECK(named_config_get(maps, "resolver-tcp-connections", &obj));
+	resolver_param = cfg_obj_asuint32(obj);
+	obj = NULL;
+	CHECK(named_config_get(maps, "resolver-tcp-idle-time", &obj));
+	dns_resolver_settcppool(view->resolver, resolver_param,
+				cfg_obj_asuint32(obj));
+
+	obj = NULL;
+	CHECK(named_config_get(maps, "refresh-popular-qps", &obj));
+	resolver_param = cfg_obj_asuint32(obj);
+	obj = NULL;
+	CHECK(named_config_get(maps, "refresh-popular-hits", &obj));
+	dns_resolver_setrefresh(view->resolver, resolver_param,
+				cfg_obj_asuint32(obj));
+
 	/*
 	 * Set supported DNSSEC algorithms.
 	 */
@@ -5557,6 +5591,72 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist, cfg_obj_t *config,
 		fail_ttl = 30;
 	dns_view_setfailttl(view, fail_ttl);
 
+	/*
+	 * Set up the pre-rendered answer cache for authoritative data.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "answer-cache-size", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	{
+		uint64_t answer_cache_size = cfg_obj_asuint64(obj);
+
+		if (answer_cache_size > SIZE_MAX) {
+			cfg_obj_log(obj, named_g_lctx, ISC_LOG_WARNING,
+				    "'answer-cache-size %" PRIu64 "' "
+				    "is too large for this system; "
+				    "reducing to %lu", answer_cache_size,
+				    (unsigned long)SIZE_MAX);
+			answer_cache_size = SIZE_MAX;
+		}
+		if (view->anscache != NULL) {
+			dns_anscache_destroy(&view->anscache);
+		}
+		if (answer_cache_size != 0) {
+			CHECK(dns_anscache_create(mctx,
+						  (size_t)answer_cache_size,
+						  &view->anscache));
+		}
+	}
+
+	/*
+	 * Set up the cache of parsed DNSKEY records for the validator.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "dnskey-cache-size", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	if (view->keycache != NULL) {
+		dns_keycache_destroy(&view->keycache);
+	}
+	if (cfg_obj_asuint32(obj) != 0) {
+		CHECK(dns_keycache_create(mctx, cfg_obj_asuint32(obj),
+					  &view->keycache));
+	}
+
+	/*
+	 * Set up the cache of RRSIG verification results.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "signature-cache-size", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	if (view->sigcache != NULL) {
+		dns_sigcache_destroy(&view->sigcache);
+	}
+	if (cfg_obj_asuint32(obj) != 0) {
+		CHECK(dns_sigcache_create(mctx, cfg_obj_asuint32(obj),
+					  &view->sigcache));
+	}
+
+	/*
+	 * Hand signature verification to the server's verify pool.
+	 */
+	if (view->verifypool != NULL) {
+		dns_verifypool_detach(&view->verifypool);
+	}
+	if (named_g_server->verifypool != NULL) {
+		dns_verifypool_attach(named_g_server->verifypool,
+				      &view->verifypool);
+	}
+
 	/*
 	 * Name space to look up redirect information in.
 	 */
@@ -8100,6 +8200,7 @@ load_configuration(const char *filename, named_server_t *server,
 	uint32_t reserved;
 	uint32_t udpsize;
 	uint32_t transfer_message_size;
+	uint32_t verifytasks;
 	named_cache_t *nsc;
 	named_cachelist_t cachelist, tmpcachelist;
 	ns_altsecret_t *altsecret;
@@ -8323,6 +8424,29 @@ load_configuration(const char *filename, named_server_t *server,
 
 	isc_quota_soft(&server->sctx->recursionquota, softquota);
 
+	/*
+	 * Set up the DNSSEC verify pool.  By default it has a task for
+	 * each worker thread; zero means signatures are verified by the
+	 * validator itself.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "dnssec-verify-tasks", &obj);
+	if (result == ISC_R_SUCCESS) {
+		verifytasks = cfg_obj_asuint32(obj);
+	} else {
+		verifytasks = named_g_cpus;
+	}
+	if (server->verifypool != NULL &&
+	    dns_verifypool_size(server->verifypool) != verifytasks)
+	{
+		dns_verifypool_detach(&server->verifypool);
+	}
+	if (server->verifypool == NULL && verifytasks != 0) {
+		CHECK(dns_verifypool_create(named_g_mctx, named_g_taskmgr,
+					    verifytasks,
+					    &server->verifypool));
+	}
+
 	/*
 	 * Set "blackhole". Only legal at options level; there is
 	 * no default.
@@ -9671,6 +9795,10 @@ shutdown_server(isc_task_t *task, isc_event_t *event) {
 
 	ns_interfacemgr_detach(&server->interfacemgr);
 
+	if (server->verifypool != NULL) {
+		dns_verifypool_detach(&server->verifypool);
+	}
+
 	dns_dispatchmgr_destroy(&named_g_dispatchmgr);
 
 	dns_zonemgr_shutdown(server->zonemgr);
@@ -9758,6 +9886,7 @@ named_server_create(isc_mem_t *mctx, named_server_t **serverp) {
 
 	/* Initialize server data structures. */
 	server->interfacemgr = NULL;
+	server->verifypool = NULL;
 	ISC_LIST_INIT(server->kasplist);
 	ISC_LIST_INIT(server->viewlist);
 	server->in_roothints = NULL;
@@ -316,6 +316,9 @@ init_desc(void) {
 	SET_NSSTATDESC(nxdomainsynth, "synthesized a NXDOMAIN response", "SynthNXDOMAIN");
 	SET_NSSTATDESC(nodatasynth, "syththesized a no-data response", "SynthNODATA");
 	SET_NSSTATDESC(wildcardsynth, "synthesized a wildcard response", "SynthWILDCARD");
+	SET_NSSTATDESC(synthfallback,
+		       "covering NSEC found but query recursed",
+		       "SynthFallback");
 	SET_NSSTATDESC(trystale,
 		       "attempts to use stale cache data after lookup failure",
 		       "QryTryStale");
@@ -327,6 +330,27 @@ init_desc(void) {
 	SET_NSSTATDESC(reclimitdropped,
 		       "queries dropped due to recursive client limit",
 		       "RecLimitDropped");
+	SET_NSSTATDESC(anscachehit,
+		       "queries answered from the answer cache",
+		       "AnswerCacheHit");
+	SET_NSSTATDESC(anscachemiss,
+		       "queries not found in the answer cache",
+		       "AnswerCacheMiss");
+	SET_NSSTATDESC(truncpredicted,
+		       "truncated responses predicted without rendering",
+		       "TruncPredicted");
+	SET_NSSTATDESC(proofcachehit,
+		       "NXDOMAIN responses built from the proof cache",
+		       "ProofCacheHit");
+	SET_NSSTATDESC(proofcachemiss,
+		       "NXDOMAIN responses not found in the proof cache",
+		       "ProofCacheMiss");
+	SET_NSSTATDESC(stalerevalidate,
+		       "stale answers sent while refreshing",
+		       "QryStaleRevalidate");
+	SET_NSSTATDESC(stalerefresh,
+		       "background refreshes of stale cache data",
+		       "StaleRefresh");
 
 	INSIST(i == ns_statscounter_max);
 
@@ -416,6 +440,23 @@ init_desc(void) {
 			"ServerQuota");
 	SET_RESSTATDESC(nextitem, "waited for next item", "NextItem");
 	SET_RESSTATDESC(priming, "priming queries", "Priming");
+	SET_RESSTATDESC(keycachehit, "DNSKEY cache hits", "KeyCacheHit");
+	SET_RESSTATDESC(keycachemiss, "DNSKEY cache misses", "KeyCacheMiss");
+	SET_RESSTATDESC(sigcachehit, "RRSIG verifications avoided",
+			"SigCacheHit");
+	SET_RESSTATDESC(sigcachemiss, "RRSIG verification cache misses",
+			"SigCacheMiss");
+	SET_RESSTATDESC(hedge, "hedged queries sent", "Hedge");
+	SET_RESSTATDESC(hedgewon, "hedged queries answered first",
+			"HedgeWon");
+	SET_RESSTATDESC(tcpconnect, "TCP connections made", "TCPConnect");
+	SET_RESSTATDESC(tcpreuse, "queries sent over pooled TCP connections",
+			"TCPReuse");
+	SET_RESSTATDESC(refresh, "popular RRsets refreshed", "Refresh");
+	SET_RESSTATDESC(refreshused, "refreshed RRsets looked up again",
+			"RefreshUsed");
+	SET_RESSTATDESC(refreshskipped, "popular RRsets expired unrefreshed",
+			"RefreshSkipped");
 
 	INSIST(i == dns_resstatscounter_max);
 
@@ -438,6 +479,10 @@ init_desc(void) {
 	SET_ADBSTATDESC(entriescnt, "Addresses in hash table", "entriescnt");
 	SET_ADBSTATDESC(nnames, "Name hash table size", "nnames");
 	SET_ADBSTATDESC(namescnt, "Names in hash table", "namescnt");
+	SET_ADBSTATDESC(resizes, "Hash table resizes", "resizes");
+	SET_ADBSTATDESC(resizemax, "Longest hash table resize (usec)",
+			"resizemax");
+	SET_ADBSTATDESC(explore, "Exploratory server selections", "explore");
 
 	INSIST(i == dns_adbstats_max);
 
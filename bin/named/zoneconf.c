@@ -1063,6 +1063,13 @@ named_zone_configure(const cfg_obj_t *config, const cfg_obj_t *vconfig,
 	if (zone != mayberaw)
 		dns_zone_setmaxrecords(zone, 0);
 
+	if (ztype == dns_zone_master || ztype == dns_zone_slave) {
+		obj = NULL;
+		result = named_config_get(maps, "proof-cache-size", &obj);
+		INSIST(result == ISC_R_SUCCESS && obj != NULL);
+		dns_zone_setproofcachesize(zone, cfg_obj_asuint32(obj));
+	}
+
 	if (raw != NULL && filename != NULL) {
 #define SIGNED ".signed"
 		size_t signedlen = strlen(filename) + sizeof(SIGNED);
@@ -0,0 +1,100 @@
+#!/usr/bin/perl -w
+#
+# Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# See the COPYRIGHT file distributed with this work for additional
+# information regarding copyright ownership.
+
+#
+# One of the two servers for "race.", which answer alike.  A query for
+# a name starting with "slow" is answered after two seconds, with
+# 192.0.2.1, by whichever server sees it first, and at once, with
+# 192.0.2.2, by the other one.  Any other A query is answered at once.
+#
+
+use IO::File;
+use IO::Socket;
+use Fcntl;
+use Net::DNS;
+use Net::DNS::Packet;
+
+my $localaddr = "10.53.0.2";
+
+my $localport = int($ENV{'PORT'});
+if (!$localport) { $localport = 5300; }
+
+my $sock = IO::Socket::INET->new(LocalAddr => $localaddr,
+   LocalPort => $localport, Proto => "udp") or die "$!";
+
+my $pidf = new IO::File "ans.pid", "w" or die "cannot open pid file: $!";
+print $pidf "$$\n" or die "cannot write pid file: $!";
+$pidf->close or die "cannot close pid file: $!";
+sub rmpid { unlink "ans.pid"; exit 1; };
+
+$SIG{INT} = \&rmpid;
+$SIG{TERM} = \&rmpid;
+
+for (;;) {
+	$sock->recv($buf, 512);
+
+	print "**** request from " , $sock->peerhost, " port ", $sock->peerport, "\n";
+
+	my $packet;
+
+	if ($Net::DNS::VERSION > 0.68) {
+		$packet = new Net::DNS::Packet(\$buf, 0);
+		$@ and die $@;
+	} else {
+		my $err;
+		($packet, $err) = new Net::DNS::Packet(\$buf, 0);
+		$err and die $err;
+	}
+
+	print "REQUEST:\n";
+	$packet->print;
+
+	$packet->header->qr(1);
+	$packet->header->aa(1);
+
+	my @questions = $packet->question;
+	my $qname = lc($questions[0]->qname);
+	my $qtype = $questions[0]->qtype;
+
+	if ($qname eq "race" && $qtype eq "NS") {
+		$packet->push("answer", new Net::DNS::RR("race 300 NS a.race"));
+		$packet->push("answer", new Net::DNS::RR("race 300 NS b.race"));
+	} elsif ($qname eq "a.race" && $qtype eq "A") {
+		$packet->push("answer",
+			      new Net::DNS::RR("a.race 300 A 10.53.0.2"));
+	} elsif ($qname eq "b.race" && $qtype eq "A") {
+		$packet->push("answer",
+			      new Net::DNS::RR("b.race 300 A 10.53.0.3"));
+	} elsif ($qname =~ /^slow/ && $qtype eq "A") {
+		my $addr = "192.0.2.2";
+		if (sysopen(my $fh, "../race.$qname", O_WRONLY|O_CREAT|O_EXCL)) {
+			print $fh "$localaddr\n";
+			close($fh);
+			sleep(2);
+			$addr = "192.0.2.1";
+		}
+		$packet->push("answer",
+			      new Net::DNS::RR("$qname 300 A $addr"));
+	} elsif ($qtype eq "A") {
+		$packet->push("answer",
+			      new Net::DNS::RR("$qname 300 A 192.0.2.100"));
+	} else {
+		$packet->push("authority",
+			      new Net::DNS::RR("race 300 SOA a.race " .
+					       "hostmaster.race 1 600 600 " .
+					       "1200 300"));
+	}
+
+	$sock->send($packet->data);
+	print "RESPONSE:\n";
+	$packet->print;
+	print "\n";
+}
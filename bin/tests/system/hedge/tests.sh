@@ -0,0 +1,101 @@
+#!/bin/sh
+#
+# Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# See the COPYRIGHT file distributed with this work for additional
+# information regarding copyright ownership.
+
+SYSTEMTESTTOP=..
+. $SYSTEMTESTTOP/conf.sh
+
+DIGOPTS="-p ${PORT} +tries=1 +time=5"
+RNDCCMD="$RNDC -c $SYSTEMTESTTOP/common/rndc.conf -p ${CONTROLPORT} -s"
+
+status=0
+n=0
+
+# Print the value of the resolver statistics counter described as "$1".
+resstat() {
+	rm -f ns4/named.stats
+	$RNDCCMD 10.53.0.4 stats > /dev/null 2>&1
+	sed -n '/++ Resolver Statistics ++/,/++ Cache Statistics ++/p' \
+		ns4/named.stats |
+	awk -v desc="$1" '{
+		v = $1; $1 = "";
+		sub(/^ /, "");
+		if ($0 == desc) { print v; exit }
+	}'
+}
+
+n=`expr $n + 1`
+echo_i "checking that no hedge is sent before RTTs have been seen ($n)"
+ret=0
+# The first server sleeps on the query; the retry goes to the other.
+$DIG $DIGOPTS @10.53.0.4 slow0.race A > dig.out.test$n || ret=1
+grep "status: NOERROR" dig.out.test$n > /dev/null || ret=1
+grep "slow0.race.*192.0.2.2" dig.out.test$n > /dev/null || ret=1
+msec=`sed -n 's/^;; Query time: \([0-9]*\) msec/\1/p' dig.out.test$n`
+[ "$msec" -ge 800 ] || ret=1
+[ -z "`resstat "hedged queries sent"`" ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+# Let the first server wake up.
+sleep 2
+
+#
+# The hedge delay is only known once a window of 1024 RTTs has been
+# counted.
+#
+n=`expr $n + 1`
+echo_i "priming the hedge delay ($n)"
+ret=0
+i=0
+rm -f warm.batch
+while [ $i -lt 1100 ]; do
+	echo "w$i.race A" >> warm.batch
+	i=`expr $i + 1`
+done
+$DIG $DIGOPTS @10.53.0.4 +noall +answer -f warm.batch > dig.out.test$n || ret=1
+lines=`grep -c "192.0.2.100" dig.out.test$n`
+[ "$lines" -eq 1100 ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+timeouts=`resstat "query timeouts"`
+retries=`resstat "query retries"`
+
+n=`expr $n + 1`
+echo_i "checking that a hedge wins the race against a slow server ($n)"
+ret=0
+$DIG $DIGOPTS @10.53.0.4 slow1.race A > dig.out.test$n || ret=1
+grep "status: NOERROR" dig.out.test$n > /dev/null || ret=1
+# Answered by the second server, well before the retry interval.
+grep "slow1.race.*192.0.2.2" dig.out.test$n > /dev/null || ret=1
+msec=`sed -n 's/^;; Query time: \([0-9]*\) msec/\1/p' dig.out.test$n`
+[ "$msec" -lt 800 ] || ret=1
+# Both servers got the query: one of them is still sleeping on it.
+[ -f race.slow1.race ] || ret=1
+[ "`resstat "hedged queries sent"`" = 1 ] || ret=1
+[ "`resstat "hedged queries answered first"`" = 1 ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "checking that the losing query was canceled ($n)"
+ret=0
+# Let the slow server answer; its response must be dropped, not used.
+sleep 3
+$DIG $DIGOPTS @10.53.0.4 slow1.race A > dig.out.test$n || ret=1
+grep "slow1.race.*192.0.2.2" dig.out.test$n > /dev/null || ret=1
+# It was canceled rather than left to time out or be retried.
+[ "`resstat "query timeouts"`" = "$timeouts" ] || ret=1
+[ "`resstat "query retries"`" = "$retries" ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+echo_i "exit status: $status"
+[ $status -eq 0 ] || exit 1
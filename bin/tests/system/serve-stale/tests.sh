@@ -1118,5 +1118,106 @@ grep "#NXDOMAIN" ns4/named.stats.$n.cachedb > /dev/null && ret=1
 status=`expr $status + $ret`
 if [ $ret != 0 ]; then echo_i "failed"; fi
 
+#
+# Test server with stale-answer-revalidate.
+#
+echo_i "test server with stale-answer-revalidate"
+
+# Print the value of the name server statistics counter described as "$1".
+nsstat() {
+	rm -f ns5/named.stats
+	$RNDCCMD 10.53.0.5 stats > /dev/null 2>&1
+	sed -n '/++ Name Server Statistics ++/,/++ Zone Maintenance Statistics ++/p' \
+		ns5/named.stats |
+	awk -v desc="$1" '{
+		v = $1; $1 = "";
+		sub(/^ /, "");
+		if ($0 == desc) { print v; exit }
+	}'
+}
+
+n=`expr $n + 1`
+echo_i "enable responses from authoritative server ($n)"
+ret=0
+$DIG -p ${PORT} @10.53.0.2 txt enable  > dig.out.test$n
+grep "ANSWER: 1," dig.out.test$n > /dev/null || ret=1
+grep "TXT.\"1\"" dig.out.test$n > /dev/null || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "prime cache data.example (stale-answer-revalidate) ($n)"
+ret=0
+$DIG -p ${PORT} @10.53.0.5 data.example TXT > dig.out.test$n
+grep "status: NOERROR" dig.out.test$n > /dev/null || ret=1
+grep "ANSWER: 1," dig.out.test$n > /dev/null || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "disable responses from authoritative server ($n)"
+ret=0
+$DIG -p ${PORT} @10.53.0.2 txt disable  > dig.out.test$n
+grep "ANSWER: 1," dig.out.test$n > /dev/null || ret=1
+grep "TXT.\"0\"" dig.out.test$n > /dev/null || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+sleep 2
+
+# While the refresh waits on the silent server, every query is answered
+# at once from the stale data, with stale-answer-ttl.
+n=`expr $n + 1`
+echo_i "check stale data.example is answered at once (stale-answer-revalidate) ($n)"
+ret=0
+for i in 1 2 3 4 5; do
+	$DIG -p ${PORT} @10.53.0.5 data.example TXT > dig.out.test$n.$i
+	grep "status: NOERROR" dig.out.test$n.$i > /dev/null || ret=1
+	grep "ANSWER: 1," dig.out.test$n.$i > /dev/null || ret=1
+	grep "data\.example\..*4.*IN.*TXT.*A text record with a 2 second ttl" dig.out.test$n.$i > /dev/null || ret=1
+	msec=`sed -n 's/^;; Query time: \([0-9]*\) msec/\1/p' dig.out.test$n.$i`
+	[ "$msec" -lt 500 ] || ret=1
+done
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "check that only one refresh was started (stale-answer-revalidate) ($n)"
+ret=0
+[ "`nsstat "stale answers sent while refreshing"`" = 5 ] || ret=1
+[ "`nsstat "background refreshes of stale cache data"`" = 1 ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "enable responses from authoritative server ($n)"
+ret=0
+$DIG -p ${PORT} @10.53.0.2 txt enable  > dig.out.test$n
+grep "ANSWER: 1," dig.out.test$n > /dev/null || ret=1
+grep "TXT.\"1\"" dig.out.test$n > /dev/null || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+# The refresh is retried, and once it has an answer the fresh data is
+# served.  Check often: with a TTL of 2 seconds it soon goes stale
+# again.
+n=`expr $n + 1`
+echo_i "check the refresh replaces the stale data (stale-answer-revalidate) ($n)"
+ret=0
+fresh=0
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	$DIG -p ${PORT} @10.53.0.5 data.example TXT > dig.out.test$n
+	ttl=`awk '$1 == "data.example." && $4 == "TXT" { print $2 }' dig.out.test$n`
+	if [ -n "$ttl" ] && [ "$ttl" -le 2 ]; then
+		fresh=1
+		break
+	fi
+	sleep 1
+done
+[ $fresh = 1 ] || ret=1
+[ "`nsstat "background refreshes of stale cache data"`" = 1 ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
 echo_i "exit status: $status"
 [ $status -eq 0 ] || exit 1
@@ -0,0 +1,184 @@
+#!/usr/bin/perl -w
+#
+# Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# See the COPYRIGHT file distributed with this work for additional
+# information regarding copyright ownership.
+
+#
+# The server for "tcp.", over UDP and TCP.  Every A query is answered
+# with 192.0.2.1.  TCP connections are numbered, and their opening and
+# closing, and the queries received over them, are logged to tcp.log:
+#
+#	accept <conn>
+#	query <conn> <qname>
+#	pipelined <conn> <count>
+#	close <conn>
+#
+# Answers to names starting with "pipe" are held back until three of
+# them have arrived over the same connection, or for two seconds.
+# Answers to names starting with "ka" carry an EDNS TCP keepalive
+# option with a timeout of zero, asking the client to close the
+# connection once it is idle.
+#
+
+use IO::File;
+use IO::Select;
+use IO::Socket;
+use Net::DNS;
+use Net::DNS::Packet;
+
+my $localaddr = "10.53.0.2";
+
+my $localport = int($ENV{'PORT'});
+if (!$localport) { $localport = 5300; }
+
+my $udpsock = IO::Socket::INET->new(LocalAddr => $localaddr,
+   LocalPort => $localport, Proto => "udp") or die "$!";
+my $tcpsock = IO::Socket::INET->new(LocalAddr => $localaddr,
+   LocalPort => $localport, Proto => "tcp", Listen => 5, Reuse => 1)
+   or die "$!";
+
+my $pidf = new IO::File "ans.pid", "w" or die "cannot open pid file: $!";
+print $pidf "$$\n" or die "cannot write pid file: $!";
+$pidf->close or die "cannot close pid file: $!";
+sub rmpid { unlink "ans.pid"; exit 1; };
+
+$SIG{INT} = \&rmpid;
+$SIG{TERM} = \&rmpid;
+
+sub logline {
+	my $log = new IO::File "tcp.log", "a" or die "cannot open log: $!";
+	print $log "@_\n";
+	$log->close;
+}
+
+#
+# Build the answer to the query in $buf.  Returns the query name and
+# the answer in wire format.
+#
+sub reply {
+	my ($buf) = @_;
+	my $packet;
+
+	if ($Net::DNS::VERSION > 0.68) {
+		$packet = new Net::DNS::Packet(\$buf, 0);
+		$@ and die $@;
+	} else {
+		my $err;
+		($packet, $err) = new Net::DNS::Packet(\$buf, 0);
+		$err and die $err;
+	}
+
+	my @questions = $packet->question;
+	my $qname = lc($questions[0]->qname);
+	my $qtype = $questions[0]->qtype;
+
+	my $reply = new Net::DNS::Packet($qname, $qtype, "IN");
+	$reply->header->id($packet->header->id);
+	$reply->header->qr(1);
+	$reply->header->aa(1);
+	$reply->header->rd($packet->header->rd);
+
+	if ($qname eq "tcp" && $qtype eq "NS") {
+		$reply->push("answer", new Net::DNS::RR("tcp 300 NS ns.tcp"));
+	} elsif ($qname eq "ns.tcp" && $qtype eq "A") {
+		$reply->push("answer",
+			     new Net::DNS::RR("ns.tcp 300 A 10.53.0.2"));
+	} elsif ($qtype eq "A") {
+		$reply->push("answer",
+			     new Net::DNS::RR("$qname 300 A 192.0.2.1"));
+	} else {
+		$reply->push("authority",
+			     new Net::DNS::RR("tcp 300 SOA ns.tcp " .
+					      "hostmaster.tcp 1 600 600 " .
+					      "1200 300"));
+	}
+
+	my $data = $reply->data;
+	if ($qname =~ /^ka/) {
+		#
+		# Append an OPT record with a TCP keepalive option
+		# (code 11) with a timeout of zero.
+		#
+		my $arcount = unpack("n", substr($data, 10, 2));
+		substr($data, 10, 2, pack("n", $arcount + 1));
+		$data .= pack("C n n N n n n n", 0, 41, 4096, 0, 6, 11, 2, 0);
+	}
+
+	return ($qname, $data);
+}
+
+my $select = IO::Select->new($udpsock, $tcpsock);
+my %conns;
+my $nconns = 0;
+
+sub flush {
+	my ($conn) = @_;
+
+	if (@{$conn->{held}} > 0) {
+		logline("pipelined", $conn->{id}, scalar(@{$conn->{held}}));
+		foreach my $data (@{$conn->{held}}) {
+			$conn->{sock}->syswrite(pack("n", length($data)) . $data);
+		}
+		$conn->{held} = [];
+	}
+}
+
+for (;;) {
+	foreach my $sock ($select->can_read(0.5)) {
+		if ($sock == $udpsock) {
+			my $buf;
+			$udpsock->recv($buf, 512);
+			my ($qname, $data) = reply($buf);
+			$udpsock->send($data);
+		} elsif ($sock == $tcpsock) {
+			my $new = $tcpsock->accept or next;
+			$nconns++;
+			$conns{$new} = { sock => $new, id => $nconns,
+					 buf => "", held => [], since => 0 };
+			$select->add($new);
+			logline("accept", $nconns);
+		} else {
+			my $conn = $conns{$sock};
+			my $buf;
+			if (!$sock->sysread($buf, 65535)) {
+				flush($conn);
+				logline("close", $conn->{id});
+				$select->remove($sock);
+				delete $conns{$sock};
+				$sock->close;
+				next;
+			}
+			$conn->{buf} .= $buf;
+			while (length($conn->{buf}) >= 2) {
+				my $len = unpack("n", $conn->{buf});
+				last if (length($conn->{buf}) < 2 + $len);
+				my $msg = substr($conn->{buf}, 2, $len);
+				$conn->{buf} = substr($conn->{buf}, 2 + $len);
+
+				my ($qname, $data) = reply($msg);
+				logline("query", $conn->{id}, $qname);
+				if ($qname =~ /^pipe/) {
+					if (@{$conn->{held}} == 0) {
+						$conn->{since} = time;
+					}
+					push(@{$conn->{held}}, $data);
+					flush($conn) if (@{$conn->{held}} >= 3);
+				} else {
+					$sock->syswrite(pack("n", length($data)) .
+							$data);
+				}
+			}
+		}
+	}
+	foreach my $conn (values %conns) {
+		if (@{$conn->{held}} > 0 && time - $conn->{since} >= 2) {
+			flush($conn);
+		}
+	}
+}
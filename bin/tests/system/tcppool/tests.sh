@@ -0,0 +1,126 @@
+#!/bin/sh
+#
+# Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# See the COPYRIGHT file distributed with this work for additional
+# information regarding copyright ownership.
+
+SYSTEMTESTTOP=..
+. $SYSTEMTESTTOP/conf.sh
+
+DIGOPTS="-p ${PORT} +tries=1 +time=5"
+RNDCCMD="$RNDC -c $SYSTEMTESTTOP/common/rndc.conf -p ${CONTROLPORT} -s"
+
+status=0
+n=0
+
+# Print the value of the resolver statistics counter described as "$1".
+resstat() {
+	rm -f ns4/named.stats
+	$RNDCCMD 10.53.0.4 stats > /dev/null 2>&1
+	sed -n '/++ Resolver Statistics ++/,/++ Cache Statistics ++/p' \
+		ns4/named.stats |
+	awk -v desc="$1" '{
+		v = $1; $1 = "";
+		sub(/^ /, "");
+		if ($0 == desc) { print v; exit }
+	}'
+}
+
+# Print the number of TCP connections ans2 has accepted.
+accepted() {
+	grep -c "^accept " ans2/tcp.log
+}
+
+# Print the connection over which ans2 got the query for "$1".
+connof() {
+	awk -v name="$1" '$1 == "query" && $3 == name { print $2; exit }' \
+		ans2/tcp.log
+}
+
+# Succeed if ans2 has seen connection "$1" closed.
+closed() {
+	grep "^close $1\$" ans2/tcp.log > /dev/null
+}
+
+n=`expr $n + 1`
+echo_i "opening a pooled connection ($n)"
+ret=0
+$DIG $DIGOPTS @10.53.0.4 prime.tcp A > dig.out.test$n || ret=1
+grep "prime.tcp.*192.0.2.1" dig.out.test$n > /dev/null || ret=1
+conn=`connof prime.tcp`
+[ -n "$conn" ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "checking that later queries reuse the connection ($n)"
+ret=0
+accepts=`accepted`
+connects=`resstat "TCP connections made"`
+reuses=`resstat "queries sent over pooled TCP connections"`
+for i in 1 2 3; do
+	$DIG $DIGOPTS @10.53.0.4 a$i.tcp A > dig.out.test$n.$i || ret=1
+	grep "a$i.tcp.*192.0.2.1" dig.out.test$n.$i > /dev/null || ret=1
+	[ "`connof a$i.tcp`" = "$conn" ] || ret=1
+done
+[ "`accepted`" = "$accepts" ] || ret=1
+[ "`resstat "TCP connections made"`" = "$connects" ] || ret=1
+[ "`resstat "queries sent over pooled TCP connections"`" -ge \
+  `expr ${reuses:-0} + 3` ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "checking that queries are pipelined over the connection ($n)"
+ret=0
+# ans2 holds its answers until all three queries have arrived.
+for i in 1 2 3; do
+	$DIG $DIGOPTS @10.53.0.4 pipe$i.tcp A > dig.out.test$n.$i &
+done
+wait
+for i in 1 2 3; do
+	grep "pipe$i.tcp.*192.0.2.1" dig.out.test$n.$i > /dev/null || ret=1
+	[ "`connof pipe$i.tcp`" = "$conn" ] || ret=1
+done
+grep "^pipelined $conn 3\$" ans2/tcp.log > /dev/null || ret=1
+[ "`accepted`" = "$accepts" ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "checking that an idle connection is closed after resolver-tcp-idle-time ($n)"
+ret=0
+sleep 2
+closed $conn && ret=1
+# The idle time is 5 seconds, checked every second.
+sleep 6
+closed $conn || ret=1
+$DIG $DIGOPTS @10.53.0.4 b1.tcp A > dig.out.test$n || ret=1
+grep "b1.tcp.*192.0.2.1" dig.out.test$n > /dev/null || ret=1
+[ "`accepted`" = "`expr $accepts + 1`" ] || ret=1
+conn=`connof b1.tcp`
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+n=`expr $n + 1`
+echo_i "checking that the server's TCP keepalive timeout is honoured ($n)"
+ret=0
+# ans2 asks for the connection to be closed as soon as it is idle.
+$DIG $DIGOPTS @10.53.0.4 ka1.tcp A > dig.out.test$n || ret=1
+grep "ka1.tcp.*192.0.2.1" dig.out.test$n > /dev/null || ret=1
+[ "`connof ka1.tcp`" = "$conn" ] || ret=1
+sleep 1
+closed $conn || ret=1
+$DIG $DIGOPTS @10.53.0.4 c1.tcp A > dig.out.test$n.2 || ret=1
+grep "c1.tcp.*192.0.2.1" dig.out.test$n.2 > /dev/null || ret=1
+[ "`accepted`" = "`expr $accepts + 2`" ] || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+echo_i "exit status: $status"
+[ $status -eq 0 ] || exit 1
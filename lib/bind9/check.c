@@ -45,6 +45,7 @@
 #include <dns/rbt.h>
 #include <dns/rdataclass.h>
 #include <dns/rdatatype.h>
+#include <dns/resolver.h>
 #include <dns/rrl.h>
 #include <dns/secalg.h>
 #include <dns/ssu.h>
@@ -1518,6 +1519,39 @@ check_options(const cfg_obj_t *options, isc_log_t *logctx, isc_mem_t *mctx,
 			result = ISC_R_RANGE;
 	}
 
+	obj = NULL;
+	(void)cfg_map_get(options, "resolver-hedge-percent", &obj);
+	if (obj != NULL && cfg_obj_asuint32(obj) > 100U) {
+		cfg_obj_log(obj, logctx, ISC_LOG_ERROR,
+			    "'resolver-hedge-percent' must be <= 100");
+		if (result == ISC_R_SUCCESS)
+			result = ISC_R_RANGE;
+	}
+
+	obj = NULL;
+	(void)cfg_map_get(options, "resolver-tcp-connections", &obj);
+	if (obj != NULL &&
+	    cfg_obj_asuint32(obj) > DNS_RESOLVER_TCPMAXCONNS)
+	{
+		cfg_obj_log(obj, logctx, ISC_LOG_ERROR,
+			    "'resolver-tcp-connections' must be <= %u",
+			    DNS_RESOLVER_TCPMAXCONNS);
+		if (result == ISC_R_SUCCESS)
+			result = ISC_R_RANGE;
+	}
+
+	obj = NULL;
+	(void)cfg_map_get(options, "resolver-tcp-idle-time", &obj);
+	if (obj != NULL &&
+	    cfg_obj_asuint32(obj) > DNS_RESOLVER_TCPMAXIDLE)
+	{
+		cfg_obj_log(obj, logctx, ISC_LOG_ERROR,
+			    "'resolver-tcp-idle-time' must be <= %u",
+			    DNS_RESOLVER_TCPMAXIDLE);
+		if (result == ISC_R_SUCCESS)
+			result = ISC_R_RANGE;
+	}
+
 	obj = NULL;
 	(void)cfg_map_get(options, "geoip-use-ecs", &obj);
 	if (obj != NULL && cfg_obj_asboolean(obj)) {
@@ -29,6 +29,7 @@
 #include <isc/stats.h>
 #include <isc/string.h>         /* Required for HP/UX (and others?) */
 #include <isc/task.h>
+#include <isc/time.h>
 #include <isc/util.h>
 
 #include <dns/adb.h>
@@ -68,6 +69,12 @@
 #define ADB_CACHE_MAXIMUM       86400   /*%< seconds (86400 = 24 hours) */
 #define ADB_ENTRY_WINDOW        1800    /*%< seconds */
 
+/*%
+ * The highest srtt a lost query can raise an address to; the longest
+ * the resolver waits for a single query.
+ */
+#define ADB_MAXTIMEOUTRTT       10000000 /*%< microsecs */
+
 /*%
  * The period in seconds after which an ADB name entry is regarded as stale
  * and forced to be cleaned up.
@@ -84,6 +91,55 @@
 
 #define DNS_ADB_MINADBSIZE      (1024U*1024U)     /*%< 1 Megabyte */
 
+/*%
+ * Number of lock buckets for names and entries.  This is fixed for the
+ * life of the ADB; lookups within a bucket go through the bucket's own
+ * hash index (see below), which grows as the bucket fills up.
+ */
+#define DNS_ADB_NBUCKETS        1021
+
+/*%
+ * Sizing of the per-bucket hash indexes.  An index is allocated with
+ * 2^ADB_HASH_MINBITS chains on first use and doubled whenever the
+ * average chain length reaches ADB_HASH_LOAD, up to 2^ADB_HASH_MAXBITS
+ * chains.
+ */
+#define ADB_HASH_MINBITS        3
+#define ADB_HASH_MAXBITS        20
+#define ADB_HASH_LOAD           2U
+
+/*%
+ * Per-address RTT histograms.  Bucket 0 holds round trip times below
+ * 256 microseconds; above that there are four buckets per doubling, and
+ * the last bucket takes everything from about 12 seconds up.  Once an
+ * address has ADB_RTTHIST_MAX samples, answered, lost or unfinished,
+ * all counts are halved so that the histogram follows changes in the
+ * server.
+ *
+ * An address's score weighs the ADB_SCORE_QUANTILE'th percentile of
+ * its round trip times three to one against their mean, so that a
+ * server with a slow tail is not chosen for its average alone.
+ */
+#define ADB_RTTBUCKETS          64
+#define ADB_RTTHIST_MAX         128
+#define ADB_SCORE_QUANTILE      90
+
+/*%
+ * The exploration budget.  Every answered query earns ADB_EXPLORE_EARN
+ * credits, and giving an address that has fewer than
+ * ADB_EXPLORE_SAMPLES samples, or none in the last ADB_EXPLORE_AGE
+ * seconds, a score of zero costs ADB_EXPLORE_COST; so about one lookup
+ * in twenty-five is spent on exploration when there is something to
+ * explore.
+ */
+#define ADB_EXPLORE_EARN        4U
+#define ADB_EXPLORE_COST        100U
+#define ADB_EXPLORE_MAXCREDIT   (10 * ADB_EXPLORE_COST)
+#define ADB_EXPLORE_SAMPLES     8
+#define ADB_EXPLORE_AGE         300     /*%< seconds */
+
+#define TIME_NOW(tp)	RUNTIME_CHECK(isc_time_now((tp)) == ISC_R_SUCCESS)
+
 typedef ISC_LIST(dns_adbname_t) dns_adbnamelist_t;
 typedef struct dns_adbnamehook dns_adbnamehook_t;
 typedef ISC_LIST(dns_adbnamehook_t) dns_adbnamehooklist_t;
@@ -92,6 +148,33 @@ typedef ISC_LIST(dns_adbentry_t) dns_adbentrylist_t;
 typedef struct dns_adbfetch dns_adbfetch_t;
 typedef struct dns_adbfetch6 dns_adbfetch6_t;
 
+/*%
+ * The kinds of latency sample, see rtthist_add().
+ */
+typedef enum {
+	rttsample_answered,
+	rttsample_lost,
+	rttsample_unfinished
+} rttsample_t;
+
+/*%
+ * Per-bucket hash index.  Every name or entry bucket has one, covered
+ * by the bucket lock, holding the live (not dead) names or entries of
+ * the bucket.  An index is resized in place while only its own bucket
+ * is locked, so growing the ADB never stalls lookups in other buckets.
+ */
+typedef struct adbnamehash {
+	unsigned int                    bits;
+	unsigned int                    count;
+	dns_adbname_t                 **table;
+} adbnamehash_t;
+
+typedef struct adbentryhash {
+	unsigned int                    bits;
+	unsigned int                    count;
+	dns_adbentry_t                **table;
+} adbentryhash_t;
+
 /*% dns adb structure */
 struct dns_adb {
 	unsigned int                    magic;
@@ -104,7 +187,6 @@ struct dns_adb {
 
 	isc_taskmgr_t                  *taskmgr;
 	isc_task_t                     *task;
-	isc_task_t                     *excl;
 
 	isc_interval_t                  tick_interval;
 	int                             next_cleanbucket;
@@ -129,8 +211,10 @@ struct dns_adb {
 	unsigned int			nnames;
 	isc_mutex_t                     namescntlock;
 	unsigned int			namescnt;
+	unsigned int			nameslots; /*%< namescntlock */
 	dns_adbnamelist_t               *names;
 	dns_adbnamelist_t               *deadnames;
+	adbnamehash_t                   *namehash;
 	isc_mutex_t                     *namelocks;
 	bool                   *name_sd;
 	unsigned int                    *name_refcnt;
@@ -143,8 +227,10 @@ struct dns_adb {
 	unsigned int			nentries;
 	isc_mutex_t                     entriescntlock;
 	unsigned int			entriescnt;
+	unsigned int			entryslots; /*%< entriescntlock */
 	dns_adbentrylist_t              *entries;
 	dns_adbentrylist_t              *deadentries;
+	adbentryhash_t                  *entryhash;
 	isc_mutex_t                     *entrylocks;
 	bool                   *entry_sd; /*%< shutting down */
 	unsigned int                    *entry_refcnt;
@@ -153,16 +239,14 @@ struct dns_adb {
 	bool                   cevent_out;
 	bool                   shutting_down;
 	isc_eventlist_t                 whenshutdown;
-	isc_event_t			growentries;
-	bool			growentries_sent;
-	isc_event_t			grownames;
-	bool			grownames_sent;
 
 	uint32_t			quota;
 	uint32_t			atr_freq;
 	double				atr_low;
 	double				atr_high;
 	double				atr_discount;
+
+	atomic_uint_fast32_t		explorecredit;
 };
 
 /*
@@ -192,6 +276,8 @@ struct dns_adbname {
 	/* for LRU-based management */
 	isc_stdtime_t                   last_used;
 
+	unsigned int                    hashval;
+	dns_adbname_t                  *hnext;
 	ISC_LINK(dns_adbname_t)         plink;
 };
 
@@ -263,6 +349,20 @@ struct dns_adbentry {
 	unsigned char			to1432;		/* Ethernet */
 	unsigned char			to1232;		/* IPv6 nofrag */
 	unsigned char			to512;		/* plain DNS */
+
+	/*
+	 * Latency histogram, see ADB_RTTBUCKETS.  'samples' counts the
+	 * answered queries in 'rtthist', the 'lost' ones, and the
+	 * unfinished ones in 'unfinished', which were given up after
+	 * the time of their bucket; 'score' is worked out from them.
+	 */
+	uint8_t				rtthist[ADB_RTTBUCKETS];
+	uint8_t				unfinished[ADB_RTTBUCKETS];
+	uint8_t				lost;
+	uint8_t				samples;
+	unsigned int			score;
+	isc_stdtime_t			lastsample;
+
 	isc_sockaddr_t                  sockaddr;
 	unsigned char *			cookie;
 	uint16_t			cookielen;
@@ -278,6 +378,8 @@ struct dns_adbentry {
 	 */
 
 	ISC_LIST(dns_adblameinfo_t)     lameinfo;
+	unsigned int                    hashval;
+	dns_adbentry_t                 *hnext;
 	ISC_LINK(dns_adbentry_t)        plink;
 };
 
@@ -298,7 +400,7 @@ static inline void free_adbentry(dns_adb_t *, dns_adbentry_t **);
 static inline dns_adbfind_t *new_adbfind(dns_adb_t *);
 static inline bool free_adbfind(dns_adb_t *, dns_adbfind_t **);
 static inline dns_adbaddrinfo_t *new_adbaddrinfo(dns_adb_t *, dns_adbentry_t *,
-						 in_port_t);
+						 in_port_t, isc_stdtime_t);
 static inline dns_adbfetch_t *new_adbfetch(dns_adb_t *);
 static inline void free_adbfetch(dns_adb_t *, dns_adbfetch_t **);
 static inline dns_adbname_t *find_name_and_lock(dns_adb_t *,
@@ -348,8 +450,9 @@ static bool kill_name(dns_adbname_t **, isc_eventtype_t);
 static void water(void *, int);
 static void dump_entry(FILE *, dns_adb_t *, dns_adbentry_t *,
 		       bool, isc_stdtime_t);
-static void adjustsrtt(dns_adbaddrinfo_t *addr, unsigned int rtt,
-		       unsigned int factor, isc_stdtime_t now);
+static void adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
+		       unsigned int rtt, unsigned int factor,
+		       isc_stdtime_t now);
 static void shutdown_task(isc_task_t *task, isc_event_t *ev);
 static void log_quota(dns_adbentry_t *entry, const char *fmt, ...)
      ISC_FORMAT_PRINTF(2, 3);
@@ -538,328 +641,207 @@ ttlclamp(dns_ttl_t ttl) {
 	return (ttl);
 }
 
-/*
- * Hashing is most efficient if the number of buckets is prime.
- * The sequence below is the closest previous primes to 2^n and
- * 1.5 * 2^n, for values of n from 10 to 28.  (The tables will
- * no longer grow beyond 2^28 entries.)
+/*%
+ * Record a completed index resize in the ADB statistics.
  */
-static const unsigned nbuckets[] = { 1021, 1531, 2039, 3067, 4093, 6143,
-				     8191, 12281, 16381, 24571, 32749,
-				     49193, 65521, 98299, 131071, 199603,
-				     262139, 393209, 524287, 768431, 1048573,
-				     1572853, 2097143, 3145721, 4194301,
-				     6291449, 8388593, 12582893, 16777213,
-				     25165813, 33554393, 50331599, 67108859,
-				     100663291, 134217689, 201326557,
-				     268535431, 0 };
-
 static void
-grow_entries(isc_task_t *task, isc_event_t *ev) {
-	dns_adb_t *adb;
-	dns_adbentry_t *e;
-	dns_adbentrylist_t *newdeadentries = NULL;
-	dns_adbentrylist_t *newentries = NULL;
-	bool *newentry_sd = NULL;
-	isc_mutex_t *newentrylocks = NULL;
-	isc_result_t result;
-	unsigned int *newentry_refcnt = NULL;
-	unsigned int i, n, bucket;
+note_resize(dns_adb_t *adb, const isc_time_t *start) {
+	isc_time_t now;
+	uint64_t usecs;
 
-	adb = ev->ev_arg;
-	INSIST(DNS_ADB_VALID(adb));
-
-	isc_event_free(&ev);
+	TIME_NOW(&now);
+	usecs = isc_time_microdiff(&now, start);
 
-	result = isc_task_beginexclusive(task);
-	if (result != ISC_R_SUCCESS)
-		goto check_exit;
-
-	i = 0;
-	while (nbuckets[i] != 0 && adb->nentries >= nbuckets[i])
-		i++;
-	if (nbuckets[i] != 0)
-		n = nbuckets[i];
-	else
-		goto done;
-
-	DP(ISC_LOG_INFO, "adb: grow_entries to %u starting", n);
-
-	/*
-	 * Are we shutting down?
-	 */
-	for (i = 0; i < adb->nentries; i++)
-		if (adb->entry_sd[i])
-			goto cleanup;
-
-	/*
-	 * Grab all the resources we need.
-	 */
-	newentries = isc_mem_get(adb->mctx, sizeof(*newentries) * n);
-	newdeadentries = isc_mem_get(adb->mctx, sizeof(*newdeadentries) * n);
-	newentrylocks = isc_mem_get(adb->mctx, sizeof(*newentrylocks) * n);
-	newentry_sd = isc_mem_get(adb->mctx, sizeof(*newentry_sd) * n);
-	newentry_refcnt = isc_mem_get(adb->mctx, sizeof(*newentry_refcnt) * n);
-	if (newentries == NULL || newdeadentries == NULL ||
-	    newentrylocks == NULL || newentry_sd == NULL ||
-	    newentry_refcnt == NULL)
-		goto cleanup;
+	inc_adbstats(adb, dns_adbstats_resizes);
+	if (adb->view->adbstats != NULL)
+		isc_stats_update_if_greater(adb->view->adbstats,
+					    dns_adbstats_resizemax,
+					    (isc_statscounter_t)usecs);
+}
 
-	/*
-	 * Initialise the new resources.
-	 */
-	isc_mutexblock_init(newentrylocks, n);
+static inline unsigned int
+name_hashslot(dns_adb_t *adb, const adbnamehash_t *h, unsigned int hashval) {
+	return ((hashval / adb->nnames) & ((1U << h->bits) - 1));
+}
 
-	for (i = 0; i < n; i++) {
-		ISC_LIST_INIT(newentries[i]);
-		ISC_LIST_INIT(newdeadentries[i]);
-		newentry_sd[i] = false;
-		newentry_refcnt[i] = 0;
-		adb->irefcnt++;
-	}
+static inline unsigned int
+entry_hashslot(dns_adb_t *adb, const adbentryhash_t *h, unsigned int hashval) {
+	return ((hashval / adb->nentries) & ((1U << h->bits) - 1));
+}
 
-	/*
-	 * Move entries to new arrays.
-	 */
-	for (i = 0; i < adb->nentries; i++) {
-		e = ISC_LIST_HEAD(adb->entries[i]);
-		while (e != NULL) {
-			ISC_LIST_UNLINK(adb->entries[i], e, plink);
-			bucket = isc_sockaddr_hash(&e->sockaddr, true) % n;
-			e->lock_bucket = bucket;
-			ISC_LIST_APPEND(newentries[bucket], e, plink);
-			INSIST(adb->entry_refcnt[i] > 0);
-			adb->entry_refcnt[i]--;
-			newentry_refcnt[bucket]++;
-			e = ISC_LIST_HEAD(adb->entries[i]);
-		}
-		e = ISC_LIST_HEAD(adb->deadentries[i]);
-		while (e != NULL) {
-			ISC_LIST_UNLINK(adb->deadentries[i], e, plink);
-			bucket = isc_sockaddr_hash(&e->sockaddr, true) % n;
-			e->lock_bucket = bucket;
-			ISC_LIST_APPEND(newdeadentries[bucket], e, plink);
-			INSIST(adb->entry_refcnt[i] > 0);
-			adb->entry_refcnt[i]--;
-			newentry_refcnt[bucket]++;
-			e = ISC_LIST_HEAD(adb->deadentries[i]);
+/*
+ * (Re)size the name index of 'bucket' to 2^bits chains, rehashing the
+ * names it holds.
+ *
+ * Requires the name bucket be locked.
+ */
+static void
+resize_namehash(dns_adb_t *adb, int bucket, unsigned int bits) {
+	adbnamehash_t *h = &adb->namehash[bucket];
+	dns_adbname_t **table, *name, *next;
+	unsigned int i, oldsize, newsize, slot;
+	isc_time_t start;
+
+	TIME_NOW(&start);
+
+	oldsize = (h->table != NULL) ? (1U << h->bits) : 0;
+	newsize = 1U << bits;
+	INSIST(newsize > oldsize);
+
+	table = isc_mem_get(adb->mctx, sizeof(*table) * newsize);
+	memset(table, 0, sizeof(*table) * newsize);
+
+	h->bits = bits;
+	for (i = 0; i < oldsize; i++) {
+		for (name = h->table[i]; name != NULL; name = next) {
+			next = name->hnext;
+			slot = name_hashslot(adb, h, name->hashval);
+			name->hnext = table[slot];
+			table[slot] = name;
 		}
-		INSIST(adb->entry_refcnt[i] == 0);
-		adb->irefcnt--;
 	}
+	if (h->table != NULL)
+		isc_mem_put(adb->mctx, h->table, sizeof(*table) * oldsize);
+	h->table = table;
 
-	/*
-	 * Cleanup old resources.
-	 */
-	isc_mutexblock_destroy(adb->entrylocks, adb->nentries);
-	isc_mem_put(adb->mctx, adb->entries,
-		    sizeof(*adb->entries) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->deadentries,
-		    sizeof(*adb->deadentries) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entrylocks,
-		    sizeof(*adb->entrylocks) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entry_sd,
-		    sizeof(*adb->entry_sd) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entry_refcnt,
-		    sizeof(*adb->entry_refcnt) * adb->nentries);
-
-	/*
-	 * Install new resources.
-	 */
-	adb->entries = newentries;
-	adb->deadentries = newdeadentries;
-	adb->entrylocks = newentrylocks;
-	adb->entry_sd = newentry_sd;
-	adb->entry_refcnt = newentry_refcnt;
-	adb->nentries = n;
-
-	set_adbstat(adb, adb->nentries, dns_adbstats_nentries);
-
-	/*
-	 * Only on success do we set adb->growentries_sent to false.
-	 * This will prevent us being continuously being called on error.
-	 */
-	adb->growentries_sent = false;
-	goto done;
+	LOCK(&adb->namescntlock);
+	adb->nameslots += newsize - oldsize;
+	set_adbstat(adb, adb->nameslots, dns_adbstats_nnames);
+	UNLOCK(&adb->namescntlock);
 
- cleanup:
-	if (newentries != NULL)
-		isc_mem_put(adb->mctx, newentries,
-			    sizeof(*newentries) * n);
-	if (newdeadentries != NULL)
-		isc_mem_put(adb->mctx, newdeadentries,
-			    sizeof(*newdeadentries) * n);
-	if (newentrylocks != NULL)
-		isc_mem_put(adb->mctx, newentrylocks,
-			    sizeof(*newentrylocks) * n);
-	if (newentry_sd != NULL)
-		isc_mem_put(adb->mctx, newentry_sd,
-			    sizeof(*newentry_sd) * n);
-	if (newentry_refcnt != NULL)
-		isc_mem_put(adb->mctx, newentry_refcnt,
-			     sizeof(*newentry_refcnt) * n);
- done:
-	isc_task_endexclusive(task);
-
- check_exit:
-	LOCK(&adb->lock);
-	if (dec_adb_irefcnt(adb))
-		check_exit(adb);
-	UNLOCK(&adb->lock);
-	DP(ISC_LOG_INFO, "adb: grow_entries finished");
+	if (oldsize != 0) {
+		DP(DEF_LEVEL, "adb: name bucket %d index grown to %u",
+		   bucket, newsize);
+		note_resize(adb, &start);
+	}
 }
 
+/*
+ * Requires the name bucket be locked.
+ */
 static void
-grow_names(isc_task_t *task, isc_event_t *ev) {
-	dns_adb_t *adb;
-	dns_adbname_t *name;
-	dns_adbnamelist_t *newdeadnames = NULL;
-	dns_adbnamelist_t *newnames = NULL;
-	bool *newname_sd = NULL;
-	isc_mutex_t *newnamelocks = NULL;
-	isc_result_t result;
-	unsigned int *newname_refcnt = NULL;
-	unsigned int i, n, bucket;
-
-	adb = ev->ev_arg;
-	INSIST(DNS_ADB_VALID(adb));
-
-	isc_event_free(&ev);
-
-	result = isc_task_beginexclusive(task);
-	if (result != ISC_R_SUCCESS)
-		goto check_exit;
-
-	i = 0;
-	while (nbuckets[i] != 0 && adb->nnames >= nbuckets[i])
-		i++;
-	if (nbuckets[i] != 0)
-		n = nbuckets[i];
-	else
-		goto done;
-
-	DP(ISC_LOG_INFO, "adb: grow_names to %u starting", n);
-
-	/*
-	 * Are we shutting down?
-	 */
-	for (i = 0; i < adb->nnames; i++)
-		if (adb->name_sd[i])
-			goto cleanup;
-
-	/*
-	 * Grab all the resources we need.
-	 */
-	newnames = isc_mem_get(adb->mctx, sizeof(*newnames) * n);
-	newdeadnames = isc_mem_get(adb->mctx, sizeof(*newdeadnames) * n);
-	newnamelocks = isc_mem_get(adb->mctx, sizeof(*newnamelocks) * n);
-	newname_sd = isc_mem_get(adb->mctx, sizeof(*newname_sd) * n);
-	newname_refcnt = isc_mem_get(adb->mctx, sizeof(*newname_refcnt) * n);
-	if (newnames == NULL || newdeadnames == NULL ||
-	    newnamelocks == NULL || newname_sd == NULL ||
-	    newname_refcnt == NULL)
-		goto cleanup;
-
-	/*
-	 * Initialise the new resources.
-	 */
-	isc_mutexblock_init(newnamelocks, n);
+hash_name(dns_adb_t *adb, int bucket, dns_adbname_t *name) {
+	adbnamehash_t *h = &adb->namehash[bucket];
+	unsigned int slot;
+
+	if (h->table == NULL)
+		resize_namehash(adb, bucket, ADB_HASH_MINBITS);
+	else if (h->count >= (ADB_HASH_LOAD << h->bits) &&
+		 h->bits < ADB_HASH_MAXBITS)
+		resize_namehash(adb, bucket, h->bits + 1);
+
+	slot = name_hashslot(adb, h, name->hashval);
+	name->hnext = h->table[slot];
+	h->table[slot] = name;
+	h->count++;
+}
 
-	for (i = 0; i < n; i++) {
-		ISC_LIST_INIT(newnames[i]);
-		ISC_LIST_INIT(newdeadnames[i]);
-		newname_sd[i] = false;
-		newname_refcnt[i] = 0;
-		adb->irefcnt++;
+/*
+ * Requires the name bucket be locked.
+ */
+static void
+unhash_name(dns_adb_t *adb, dns_adbname_t *name) {
+	adbnamehash_t *h = &adb->namehash[name->lock_bucket];
+	dns_adbname_t **np;
+
+	np = &h->table[name_hashslot(adb, h, name->hashval)];
+	while (*np != name) {
+		INSIST(*np != NULL);
+		np = &(*np)->hnext;
 	}
+	*np = name->hnext;
+	name->hnext = NULL;
+	INSIST(h->count > 0);
+	h->count--;
+}
 
-	/*
-	 * Move names to new arrays.
-	 */
-	for (i = 0; i < adb->nnames; i++) {
-		name = ISC_LIST_HEAD(adb->names[i]);
-		while (name != NULL) {
-			ISC_LIST_UNLINK(adb->names[i], name, plink);
-			bucket = dns_name_fullhash(&name->name, true) % n;
-			name->lock_bucket = bucket;
-			ISC_LIST_APPEND(newnames[bucket], name, plink);
-			INSIST(adb->name_refcnt[i] > 0);
-			adb->name_refcnt[i]--;
-			newname_refcnt[bucket]++;
-			name = ISC_LIST_HEAD(adb->names[i]);
-		}
-		name = ISC_LIST_HEAD(adb->deadnames[i]);
-		while (name != NULL) {
-			ISC_LIST_UNLINK(adb->deadnames[i], name, plink);
-			bucket = dns_name_fullhash(&name->name, true) % n;
-			name->lock_bucket = bucket;
-			ISC_LIST_APPEND(newdeadnames[bucket], name, plink);
-			INSIST(adb->name_refcnt[i] > 0);
-			adb->name_refcnt[i]--;
-			newname_refcnt[bucket]++;
-			name = ISC_LIST_HEAD(adb->deadnames[i]);
+/*
+ * (Re)size the entry index of 'bucket' to 2^bits chains, rehashing the
+ * entries it holds.
+ *
+ * Requires the entry bucket be locked.
+ */
+static void
+resize_entryhash(dns_adb_t *adb, int bucket, unsigned int bits) {
+	adbentryhash_t *h = &adb->entryhash[bucket];
+	dns_adbentry_t **table, *entry, *next;
+	unsigned int i, oldsize, newsize, slot;
+	isc_time_t start;
+
+	TIME_NOW(&start);
+
+	oldsize = (h->table != NULL) ? (1U << h->bits) : 0;
+	newsize = 1U << bits;
+	INSIST(newsize > oldsize);
+
+	table = isc_mem_get(adb->mctx, sizeof(*table) * newsize);
+	memset(table, 0, sizeof(*table) * newsize);
+
+	h->bits = bits;
+	for (i = 0; i < oldsize; i++) {
+		for (entry = h->table[i]; entry != NULL; entry = next) {
+			next = entry->hnext;
+			slot = entry_hashslot(adb, h, entry->hashval);
+			entry->hnext = table[slot];
+			table[slot] = entry;
 		}
-		INSIST(adb->name_refcnt[i] == 0);
-		adb->irefcnt--;
 	}
+	if (h->table != NULL)
+		isc_mem_put(adb->mctx, h->table, sizeof(*table) * oldsize);
+	h->table = table;
 
-	/*
-	 * Cleanup old resources.
-	 */
-	isc_mutexblock_destroy(adb->namelocks, adb->nnames);
-	isc_mem_put(adb->mctx, adb->names,
-		    sizeof(*adb->names) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->deadnames,
-		    sizeof(*adb->deadnames) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->namelocks,
-		    sizeof(*adb->namelocks) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->name_sd,
-		    sizeof(*adb->name_sd) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->name_refcnt,
-		    sizeof(*adb->name_refcnt) * adb->nnames);
-
-	/*
-	 * Install new resources.
-	 */
-	adb->names = newnames;
-	adb->deadnames = newdeadnames;
-	adb->namelocks = newnamelocks;
-	adb->name_sd = newname_sd;
-	adb->name_refcnt = newname_refcnt;
-	adb->nnames = n;
+	LOCK(&adb->entriescntlock);
+	adb->entryslots += newsize - oldsize;
+	set_adbstat(adb, adb->entryslots, dns_adbstats_nentries);
+	UNLOCK(&adb->entriescntlock);
 
-	set_adbstat(adb, adb->nnames, dns_adbstats_nnames);
+	if (oldsize != 0) {
+		DP(DEF_LEVEL, "adb: entry bucket %d index grown to %u",
+		   bucket, newsize);
+		note_resize(adb, &start);
+	}
+}
 
-	/*
-	 * Only on success do we set adb->grownames_sent to false.
-	 * This will prevent us being continuously being called on error.
-	 */
-	adb->grownames_sent = false;
-	goto done;
+/*
+ * Requires the entry bucket be locked.
+ */
+static void
+hash_entry(dns_adb_t *adb, int bucket, dns_adbentry_t *entry) {
+	adbentryhash_t *h = &adb->entryhash[bucket];
+	unsigned int slot;
+
+	if (h->table == NULL)
+		resize_entryhash(adb, bucket, ADB_HASH_MINBITS);
+	else if (h->count >= (ADB_HASH_LOAD << h->bits) &&
+		 h->bits < ADB_HASH_MAXBITS)
+		resize_entryhash(adb, bucket, h->bits + 1);
+
+	slot = entry_hashslot(adb, h, entry->hashval);
+	entry->hnext = h->table[slot];
+	h->table[slot] = entry;
+	h->count++;
+}
 
- cleanup:
-	if (newnames != NULL)
-		isc_mem_put(adb->mctx, newnames, sizeof(*newnames) * n);
-	if (newdeadnames != NULL)
-		isc_mem_put(adb->mctx, newdeadnames, sizeof(*newdeadnames) * n);
-	if (newnamelocks != NULL)
-		isc_mem_put(adb->mctx, newnamelocks, sizeof(*newnamelocks) * n);
-	if (newname_sd != NULL)
-		isc_mem_put(adb->mctx, newname_sd, sizeof(*newname_sd) * n);
-	if (newname_refcnt != NULL)
-		isc_mem_put(adb->mctx, newname_refcnt,
-			     sizeof(*newname_refcnt) * n);
- done:
-	isc_task_endexclusive(task);
-
- check_exit:
-	LOCK(&adb->lock);
-	if (dec_adb_irefcnt(adb))
-		check_exit(adb);
-	UNLOCK(&adb->lock);
-	DP(ISC_LOG_INFO, "adb: grow_names finished");
+/*
+ * Requires the entry bucket be locked.
+ */
+static void
+unhash_entry(dns_adb_t *adb, dns_adbentry_t *entry) {
+	adbentryhash_t *h = &adb->entryhash[entry->lock_bucket];
+	dns_adbentry_t **ep;
+
+	ep = &h->table[entry_hashslot(adb, h, entry->hashval)];
+	while (*ep != entry) {
+		INSIST(*ep != NULL);
+		ep = &(*ep)->hnext;
+	}
+	*ep = entry->hnext;
+	entry->hnext = NULL;
+	INSIST(h->count > 0);
+	h->count--;
 }
 
+
 /*
  * Requires the adbname bucket be locked and that no entry buckets be locked.
  *
@@ -1059,6 +1041,7 @@ kill_name(dns_adbname_t **n, isc_eventtype_t ev) {
 		cancel_fetches_at_name(name);
 		if (!NAME_DEAD(name)) {
 			bucket = name->lock_bucket;
+			unhash_name(adb, name);
 			ISC_LIST_UNLINK(adb->names[bucket], name, plink);
 			ISC_LIST_APPEND(adb->deadnames[bucket], name, plink);
 			name->flags |= NAME_IS_DEAD;
@@ -1125,6 +1108,8 @@ link_name(dns_adb_t *adb, int bucket, dns_adbname_t *name) {
 
 	ISC_LIST_PREPEND(adb->names[bucket], name, plink);
 	name->lock_bucket = bucket;
+	name->hashval = dns_name_fullhash(&name->name, false);
+	hash_name(adb, bucket, name);
 	adb->name_refcnt[bucket]++;
 }
 
@@ -1139,10 +1124,12 @@ unlink_name(dns_adb_t *adb, dns_adbname_t *name) {
 	bucket = name->lock_bucket;
 	INSIST(bucket != DNS_ADB_INVALIDBUCKET);
 
-	if (NAME_DEAD(name))
+	if (NAME_DEAD(name)) {
 		ISC_LIST_UNLINK(adb->deadnames[bucket], name, plink);
-	else
+	} else {
+		unhash_name(adb, name);
 		ISC_LIST_UNLINK(adb->names[bucket], name, plink);
+	}
 	name->lock_bucket = DNS_ADB_INVALIDBUCKET;
 	INSIST(adb->name_refcnt[bucket] > 0);
 	adb->name_refcnt[bucket]--;
@@ -1170,6 +1157,7 @@ link_entry(dns_adb_t *adb, int bucket, dns_adbentry_t *entry) {
 				continue;
 			}
 			INSIST((e->flags & ENTRY_IS_DEAD) == 0);
+			unhash_entry(adb, e);
 			e->flags |= ENTRY_IS_DEAD;
 			ISC_LIST_UNLINK(adb->entries[bucket], e, plink);
 			ISC_LIST_PREPEND(adb->deadentries[bucket], e, plink);
@@ -1178,6 +1166,8 @@ link_entry(dns_adb_t *adb, int bucket, dns_adbentry_t *entry) {
 
 	ISC_LIST_PREPEND(adb->entries[bucket], entry, plink);
 	entry->lock_bucket = bucket;
+	entry->hashval = isc_sockaddr_hash(&entry->sockaddr, true);
+	hash_entry(adb, bucket, entry);
 	adb->entry_refcnt[bucket]++;
 }
 
@@ -1192,10 +1182,12 @@ unlink_entry(dns_adb_t *adb, dns_adbentry_t *entry) {
 	bucket = entry->lock_bucket;
 	INSIST(bucket != DNS_ADB_INVALIDBUCKET);
 
-	if ((entry->flags & ENTRY_IS_DEAD) != 0)
+	if ((entry->flags & ENTRY_IS_DEAD) != 0) {
 		ISC_LIST_UNLINK(adb->deadentries[bucket], entry, plink);
-	else
+	} else {
+		unhash_entry(adb, entry);
 		ISC_LIST_UNLINK(adb->entries[bucket], entry, plink);
+	}
 	entry->lock_bucket = DNS_ADB_INVALIDBUCKET;
 	INSIST(adb->entry_refcnt[bucket] > 0);
 	adb->entry_refcnt[bucket]--;
@@ -1683,19 +1675,13 @@ new_adbname(dns_adb_t *adb, const dns_name_t *dnsname) {
 	name->fetch_err = FIND_ERR_UNEXPECTED;
 	name->fetch6_err = FIND_ERR_UNEXPECTED;
 	ISC_LIST_INIT(name->finds);
+	name->hashval = 0;
+	name->hnext = NULL;
 	ISC_LINK_INIT(name, plink);
 
 	LOCK(&adb->namescntlock);
 	adb->namescnt++;
 	inc_adbstats(adb, dns_adbstats_namescnt);
-	if (!adb->grownames_sent && adb->excl != NULL &&
-	    adb->namescnt > (adb->nnames * 8))
-	{
-		isc_event_t *event = &adb->grownames;
-		inc_adb_irefcnt(adb);
-		isc_task_send(adb->excl, &event);
-		adb->grownames_sent = true;
-	}
 	UNLOCK(&adb->namescntlock);
 
 	return (name);
@@ -1821,24 +1807,24 @@ new_adbentry(dns_adb_t *adb) {
 	e->cookielen = 0;
 	e->srtt = (isc_random_uniform(0x1f)) + 1;
 	e->lastage = 0;
+	memset(e->rtthist, 0, sizeof(e->rtthist));
+	memset(e->unfinished, 0, sizeof(e->unfinished));
+	e->lost = 0;
+	e->samples = 0;
+	e->score = 0;
+	e->lastsample = 0;
 	e->expires = 0;
 	atomic_init(&e->active, 0);
 	e->mode = 0;
 	atomic_init(&e->quota, adb->quota);
 	e->atr = 0.0;
 	ISC_LIST_INIT(e->lameinfo);
+	e->hashval = 0;
+	e->hnext = NULL;
 	ISC_LINK_INIT(e, plink);
 	LOCK(&adb->entriescntlock);
 	adb->entriescnt++;
 	inc_adbstats(adb, dns_adbstats_entriescnt);
-	if (!adb->growentries_sent && adb->excl != NULL &&
-	    adb->entriescnt > (adb->nentries * 8))
-	{
-		isc_event_t *event = &adb->growentries;
-		inc_adb_irefcnt(adb);
-		isc_task_send(adb->excl, &event);
-		adb->growentries_sent = true;
-	}
 	UNLOCK(&adb->entriescntlock);
 
 	return (e);
@@ -1968,13 +1954,170 @@ free_adbfind(dns_adb_t *adb, dns_adbfind_t **findp) {
 	return (dec_adb_irefcnt(adb));
 }
 
+/*
+ * Return the histogram bucket for a round trip time of 'rtt'
+ * microseconds.
+ */
+static inline unsigned int
+rtthist_bucket(unsigned int rtt) {
+	unsigned int v = rtt >> 8, lg = 0, i;
+
+	if (v == 0) {
+		return (0);
+	}
+	while ((v >> lg) > 1) {
+		lg++;
+	}
+	i = 1 + 4 * lg + (((uint64_t)v << 2 >> lg) & 3);
+	return (ISC_MIN(i, ADB_RTTBUCKETS - 1));
+}
+
+/*
+ * Return the round trip time that stands for histogram bucket 'i', the
+ * middle of its range.
+ */
+static inline unsigned int
+rtthist_value(unsigned int i) {
+	unsigned int low;
+
+	if (i == 0) {
+		return (128);
+	}
+	low = 256U << ((i - 1) / 4);
+	return (low / 8 * (9 + 2 * ((i - 1) % 4)));
+}
+
+static inline void
+explore_earn(dns_adb_t *adb) {
+	uint_fast32_t credit;
+
+	credit = atomic_fetch_add_relaxed(&adb->explorecredit,
+					  ADB_EXPLORE_EARN);
+	if (credit + ADB_EXPLORE_EARN > ADB_EXPLORE_MAXCREDIT) {
+		atomic_store_relaxed(&adb->explorecredit,
+				     ADB_EXPLORE_MAXCREDIT);
+	}
+}
+
+static inline bool
+explore_spend(dns_adb_t *adb) {
+	uint_fast32_t credit = atomic_load_relaxed(&adb->explorecredit);
+
+	do {
+		if (credit < ADB_EXPLORE_COST) {
+			return (false);
+		}
+	} while (!atomic_compare_exchange_weak_relaxed(&adb->explorecredit,
+						       &credit,
+						       credit -
+						       ADB_EXPLORE_COST));
+	inc_adbstats(adb, dns_adbstats_explore);
+	return (true);
+}
+
+/*
+ * Add a sample to the latency histogram of 'entry': a query answered in
+ * 'rtt' microseconds, a lost one, or one given up after 'rtt'
+ * microseconds without an answer.  The score is then worked out again.
+ * The entry must be locked.
+ */
+static void
+rtthist_add(dns_adb_t *adb, dns_adbentry_t *entry, unsigned int rtt,
+	    rttsample_t kind, isc_stdtime_t now)
+{
+	uint64_t total = 0, mass, survive, cumulative = 0, want;
+	unsigned int i, n, lostbucket, atrisk, quantile = 0, tail = 0;
+
+	if (entry->samples >= ADB_RTTHIST_MAX) {
+		entry->lost >>= 1;
+		entry->samples = entry->lost;
+		for (i = 0; i < ADB_RTTBUCKETS; i++) {
+			entry->rtthist[i] >>= 1;
+			entry->unfinished[i] >>= 1;
+			entry->samples += entry->rtthist[i] +
+					  entry->unfinished[i];
+		}
+	}
+
+	switch (kind) {
+	case rttsample_answered:
+		entry->rtthist[rtthist_bucket(rtt)]++;
+		explore_earn(adb);
+		break;
+	case rttsample_lost:
+		entry->lost++;
+		break;
+	case rttsample_unfinished:
+		entry->unfinished[rtthist_bucket(rtt)]++;
+		break;
+	}
+	entry->samples++;
+	entry->lastsample = now;
+
+	/*
+	 * An unfinished query only says that the round trip time was
+	 * longer than its bucket, so the distribution is estimated as
+	 * Kaplan and Meier did for survival times, in 1/2^16ths: at each
+	 * bucket, of the probability left, the share of the queries still
+	 * outstanding that were answered (or, in the bucket of
+	 * DNS_ADB_LOSSPENALTY, lost) there is taken.  What is left once
+	 * the last queries given up have been passed is put in the
+	 * bucket after theirs; all that is known is that it is slower.
+	 */
+	lostbucket = rtthist_bucket(DNS_ADB_LOSSPENALTY);
+	want = ((uint64_t)ADB_SCORE_QUANTILE << 16) / 100;
+	survive = 1 << 16;
+	atrisk = entry->samples;
+	for (i = 0; i < ADB_RTTBUCKETS && atrisk > 0; i++) {
+		n = entry->rtthist[i];
+		if (i == lostbucket) {
+			n += entry->lost;
+		}
+		mass = survive * n / atrisk;
+		survive -= mass;
+		total += mass * rtthist_value(i);
+		cumulative += mass;
+		if (quantile == 0 && cumulative >= want) {
+			quantile = rtthist_value(i);
+		}
+		if (entry->unfinished[i] != 0) {
+			tail = ISC_MIN(i + 1, ADB_RTTBUCKETS - 1);
+		}
+		atrisk -= n + entry->unfinished[i];
+	}
+	if (survive > 0) {
+		total += survive * rtthist_value(tail);
+		if (quantile == 0) {
+			quantile = rtthist_value(tail);
+		}
+	}
+	entry->score = (unsigned int)(((total >> 16) + 3 * (uint64_t)quantile)
+				      / 4);
+}
+
+/*
+ * Return the score of 'entry'.  Until something has been measured the
+ * (small, random) initial srtt stands in, so that new servers are
+ * tried early.  The entry must be locked.
+ */
+static inline unsigned int
+entry_score(dns_adbentry_t *entry) {
+	return (entry->samples != 0 ? entry->score : entry->srtt);
+}
+
 /*
  * Copy bits from the entry into the newly allocated addrinfo.  The entry
  * must be locked, and the reference count must be bumped up by one
  * if this function returns a valid pointer.
+ *
+ * If the entry has few samples, or only old ones, and the exploration
+ * budget allows, the addrinfo is given a score of zero so that the
+ * server is tried again.
  */
 static inline dns_adbaddrinfo_t *
-new_adbaddrinfo(dns_adb_t *adb, dns_adbentry_t *entry, in_port_t port) {
+new_adbaddrinfo(dns_adb_t *adb, dns_adbentry_t *entry, in_port_t port,
+		isc_stdtime_t now)
+{
 	dns_adbaddrinfo_t *ai;
 
 	ai = isc_mempool_get(adb->aimp);
@@ -1985,6 +2128,14 @@ new_adbaddrinfo(dns_adb_t *adb, dns_adbentry_t *entry, in_port_t port) {
 	ai->sockaddr = entry->sockaddr;
 	isc_sockaddr_setport(&ai->sockaddr, port);
 	ai->srtt = entry->srtt;
+	ai->score = entry_score(entry);
+	if (entry->samples != 0 && ai->score != 0 &&
+	    (entry->samples < ADB_EXPLORE_SAMPLES ||
+	     entry->lastsample + ADB_EXPLORE_AGE < now) &&
+	    explore_spend(adb))
+	{
+		ai->score = 0;
+	}
 	ai->flags = entry->flags;
 	ai->entry = entry;
 	ai->dscp = -1;
@@ -2021,9 +2172,12 @@ find_name_and_lock(dns_adb_t *adb, const dns_name_t *name,
 		   unsigned int options, int *bucketp)
 {
 	dns_adbname_t *adbname;
+	adbnamehash_t *h;
+	unsigned int hashval;
 	int bucket;
 
-	bucket = dns_name_fullhash(name, false) % adb->nnames;
+	hashval = dns_name_fullhash(name, false);
+	bucket = hashval % adb->nnames;
 
 	if (*bucketp == DNS_ADB_INVALIDBUCKET) {
 		LOCK(&adb->namelocks[bucket]);
@@ -2034,15 +2188,20 @@ find_name_and_lock(dns_adb_t *adb, const dns_name_t *name,
 		*bucketp = bucket;
 	}
 
-	adbname = ISC_LIST_HEAD(adb->names[bucket]);
-	while (adbname != NULL) {
-		if (!NAME_DEAD(adbname)) {
-			if (dns_name_equal(name, &adbname->name)
-			    && GLUEHINT_OK(adbname, options)
-			    && STARTATZONE_MATCHES(adbname, options))
-				return (adbname);
-		}
-		adbname = ISC_LIST_NEXT(adbname, plink);
+	h = &adb->namehash[bucket];
+	if (h->table == NULL)
+		return (NULL);
+
+	for (adbname = h->table[name_hashslot(adb, h, hashval)];
+	     adbname != NULL;
+	     adbname = adbname->hnext)
+	{
+		INSIST(!NAME_DEAD(adbname));
+		if (adbname->hashval == hashval &&
+		    dns_name_equal(name, &adbname->name) &&
+		    GLUEHINT_OK(adbname, options) &&
+		    STARTATZONE_MATCHES(adbname, options))
+			return (adbname);
 	}
 
 	return (NULL);
@@ -2063,9 +2222,12 @@ find_entry_and_lock(dns_adb_t *adb, const isc_sockaddr_t *addr, int *bucketp,
 	isc_stdtime_t now)
 {
 	dns_adbentry_t *entry, *entry_next;
-	int bucket;
+	adbentryhash_t *h;
+	unsigned int hashval;
+	int bucket, i;
 
-	bucket = isc_sockaddr_hash(addr, true) % adb->nentries;
+	hashval = isc_sockaddr_hash(addr, true);
+	bucket = hashval % adb->nentries;
 
 	if (*bucketp == DNS_ADB_INVALIDBUCKET) {
 		LOCK(&adb->entrylocks[bucket]);
@@ -2076,15 +2238,34 @@ find_entry_and_lock(dns_adb_t *adb, const isc_sockaddr_t *addr, int *bucketp,
 		*bucketp = bucket;
 	}
 
-	/* Search the list, while cleaning up expired entries. */
-	for (entry = ISC_LIST_HEAD(adb->entries[bucket]);
+	/*
+	 * Opportunistically clean up expired entries from the LRU end
+	 * of the bucket.
+	 */
+	for (i = 0; i < 2; i++) {
+		entry = ISC_LIST_TAIL(adb->entries[bucket]);
+		if (entry == NULL)
+			break;
+		(void)check_expire_entry(adb, &entry, now);
+		if (entry != NULL)
+			break;
+	}
+
+	h = &adb->entryhash[bucket];
+	if (h->table == NULL)
+		return (NULL);
+
+	/* Search the chain, while cleaning up expired entries. */
+	for (entry = h->table[entry_hashslot(adb, h, hashval)];
 	     entry != NULL;
 	     entry = entry_next) {
-		entry_next = ISC_LIST_NEXT(entry, plink);
+		entry_next = entry->hnext;
+		if (entry->hashval != hashval ||
+		    !isc_sockaddr_equal(addr, &entry->sockaddr))
+			continue;
 		(void)check_expire_entry(adb, &entry, now);
 		if (entry != NULL &&
-		    (entry->expires == 0 || entry->expires > now) &&
-		    isc_sockaddr_equal(addr, &entry->sockaddr)) {
+		    (entry->expires == 0 || entry->expires > now)) {
 			ISC_LIST_UNLINK(adb->entries[bucket], entry, plink);
 			ISC_LIST_PREPEND(adb->entries[bucket], entry, plink);
 			return (entry);
@@ -2189,7 +2370,8 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 				find->options |= DNS_ADBFIND_LAMEPRUNED;
 				goto nextv4;
 			}
-			addrinfo = new_adbaddrinfo(adb, entry, find->port);
+			addrinfo = new_adbaddrinfo(adb, entry, find->port,
+						   now);
 			if (addrinfo == NULL) {
 				find->partial_result |= DNS_ADBFIND_INET;
 				goto out;
@@ -2227,7 +2409,8 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 				find->options |= DNS_ADBFIND_LAMEPRUNED;
 				goto nextv6;
 			}
-			addrinfo = new_adbaddrinfo(adb, entry, find->port);
+			addrinfo = new_adbaddrinfo(adb, entry, find->port,
+						   now);
 			if (addrinfo == NULL) {
 				find->partial_result |= DNS_ADBFIND_INET6;
 				goto out;
@@ -2443,11 +2626,11 @@ cleanup_entries(dns_adb_t *adb, int bucket, isc_stdtime_t now) {
 
 static void
 destroy(dns_adb_t *adb) {
+	unsigned int i;
+
 	adb->magic = 0;
 
 	isc_task_detach(&adb->task);
-	if (adb->excl != NULL)
-		isc_task_detach(&adb->excl);
 
 	isc_mempool_destroy(&adb->nmp);
 	isc_mempool_destroy(&adb->nhmp);
@@ -2468,6 +2651,15 @@ destroy(dns_adb_t *adb) {
 		    sizeof(*adb->entry_sd) * adb->nentries);
 	isc_mem_put(adb->mctx, adb->entry_refcnt,
 		    sizeof(*adb->entry_refcnt) * adb->nentries);
+	for (i = 0; i < adb->nentries; i++) {
+		INSIST(adb->entryhash[i].count == 0);
+		if (adb->entryhash[i].table != NULL)
+			isc_mem_put(adb->mctx, adb->entryhash[i].table,
+				    sizeof(dns_adbentry_t *) <<
+				    adb->entryhash[i].bits);
+	}
+	isc_mem_put(adb->mctx, adb->entryhash,
+		    sizeof(*adb->entryhash) * adb->nentries);
 
 	isc_mutexblock_destroy(adb->namelocks, adb->nnames);
 	isc_mem_put(adb->mctx, adb->names,
@@ -2480,6 +2672,15 @@ destroy(dns_adb_t *adb) {
 		    sizeof(*adb->name_sd) * adb->nnames);
 	isc_mem_put(adb->mctx, adb->name_refcnt,
 		    sizeof(*adb->name_refcnt) * adb->nnames);
+	for (i = 0; i < adb->nnames; i++) {
+		INSIST(adb->namehash[i].count == 0);
+		if (adb->namehash[i].table != NULL)
+			isc_mem_put(adb->mctx, adb->namehash[i].table,
+				    sizeof(dns_adbname_t *) <<
+				    adb->namehash[i].bits);
+	}
+	isc_mem_put(adb->mctx, adb->namehash,
+		    sizeof(*adb->namehash) * adb->nnames);
 
 	isc_mutex_destroy(&adb->reflock);
 	isc_mutex_destroy(&adb->lock);
@@ -2529,7 +2730,6 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	adb->aimp = NULL;
 	adb->afmp = NULL;
 	adb->task = NULL;
-	adb->excl = NULL;
 	adb->mctx = NULL;
 	adb->view = view;
 	adb->taskmgr = taskmgr;
@@ -2540,44 +2740,32 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	adb->shutting_down = false;
 	ISC_LIST_INIT(adb->whenshutdown);
 
-	adb->nentries = nbuckets[0];
+	adb->nentries = DNS_ADB_NBUCKETS;
 	adb->entriescnt = 0;
+	adb->entryslots = 0;
 	adb->entries = NULL;
 	adb->deadentries = NULL;
+	adb->entryhash = NULL;
 	adb->entry_sd = NULL;
 	adb->entry_refcnt = NULL;
 	adb->entrylocks = NULL;
-	ISC_EVENT_INIT(&adb->growentries, sizeof(adb->growentries), 0, NULL,
-		       DNS_EVENT_ADBGROWENTRIES, grow_entries, adb,
-		       adb, NULL, NULL);
-	adb->growentries_sent = false;
 
 	adb->quota = 0;
 	adb->atr_freq = 0;
 	adb->atr_low = 0.0;
 	adb->atr_high = 0.0;
 	adb->atr_discount = 0.0;
+	atomic_init(&adb->explorecredit, 0);
 
-	adb->nnames = nbuckets[0];
+	adb->nnames = DNS_ADB_NBUCKETS;
 	adb->namescnt = 0;
+	adb->nameslots = 0;
 	adb->names = NULL;
 	adb->deadnames = NULL;
+	adb->namehash = NULL;
 	adb->name_sd = NULL;
 	adb->name_refcnt = NULL;
 	adb->namelocks = NULL;
-	ISC_EVENT_INIT(&adb->grownames, sizeof(adb->grownames), 0, NULL,
-		       DNS_EVENT_ADBGROWNAMES, grow_names, adb,
-		       adb, NULL, NULL);
-	adb->grownames_sent = false;
-
-	result = isc_taskmgr_excltask(adb->taskmgr, &adb->excl);
-	if (result != ISC_R_SUCCESS) {
-		DP(DEF_LEVEL, "adb: task-exclusive mode unavailable, "
-			      "initializing table sizes to %u\n",
-			      nbuckets[11]);
-		adb->nentries = nbuckets[11];
-		adb->nnames = nbuckets[11];
-	}
 
 	isc_mem_attach(mem, &adb->mctx);
 
@@ -2599,6 +2787,7 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	} while (0)
 	ALLOCENTRY(adb, entries);
 	ALLOCENTRY(adb, deadentries);
+	ALLOCENTRY(adb, entryhash);
 	ALLOCENTRY(adb, entrylocks);
 	ALLOCENTRY(adb, entry_sd);
 	ALLOCENTRY(adb, entry_refcnt);
@@ -2615,6 +2804,7 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	} while (0)
 	ALLOCNAME(adb, names);
 	ALLOCNAME(adb, deadnames);
+	ALLOCNAME(adb, namehash);
 	ALLOCNAME(adb, namelocks);
 	ALLOCNAME(adb, name_sd);
 	ALLOCNAME(adb, name_refcnt);
@@ -2629,6 +2819,9 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	for (i = 0; i < adb->nnames; i++) {
 		ISC_LIST_INIT(adb->names[i]);
 		ISC_LIST_INIT(adb->deadnames[i]);
+		adb->namehash[i].bits = 0;
+		adb->namehash[i].count = 0;
+		adb->namehash[i].table = NULL;
 		adb->name_sd[i] = false;
 		adb->name_refcnt[i] = 0;
 		adb->irefcnt++;
@@ -2636,6 +2829,9 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	for (i = 0; i < adb->nentries; i++) {
 		ISC_LIST_INIT(adb->entries[i]);
 		ISC_LIST_INIT(adb->deadentries[i]);
+		adb->entryhash[i].bits = 0;
+		adb->entryhash[i].count = 0;
+		adb->entryhash[i].table = NULL;
 		adb->entry_sd[i] = false;
 		adb->entry_refcnt[i] = 0;
 		adb->irefcnt++;
@@ -2676,9 +2872,6 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	if (result != ISC_R_SUCCESS)
 		goto fail2;
 
-	set_adbstat(adb, adb->nentries, dns_adbstats_nentries);
-	set_adbstat(adb, adb->nnames, dns_adbstats_nnames);
-
 	/*
 	 * Normal return.
 	 */
@@ -2701,6 +2894,9 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	if (adb->deadentries != NULL)
 		isc_mem_put(adb->mctx, adb->deadentries,
 			    sizeof(*adb->deadentries) * adb->nentries);
+	if (adb->entryhash != NULL)
+		isc_mem_put(adb->mctx, adb->entryhash,
+			    sizeof(*adb->entryhash) * adb->nentries);
 	if (adb->entrylocks != NULL)
 		isc_mem_put(adb->mctx, adb->entrylocks,
 			    sizeof(*adb->entrylocks) * adb->nentries);
@@ -2716,6 +2912,9 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	if (adb->deadnames != NULL)
 		isc_mem_put(adb->mctx, adb->deadnames,
 			    sizeof(*adb->deadnames) * adb->nnames);
+	if (adb->namehash != NULL)
+		isc_mem_put(adb->mctx, adb->namehash,
+			    sizeof(*adb->namehash) * adb->nnames);
 	if (adb->namelocks != NULL)
 		isc_mem_put(adb->mctx, adb->namelocks,
 			    sizeof(*adb->namelocks) * adb->nnames);
@@ -2746,8 +2945,6 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	isc_mutex_destroy(&adb->reflock);
 	isc_mutex_destroy(&adb->mplock);
 	isc_mutex_destroy(&adb->lock);
-	if (adb->excl != NULL)
-		isc_task_detach(&adb->excl);
 	isc_mem_putanddetach(&adb->mctx, adb, sizeof(dns_adb_t));
 
 	return (result);
@@ -3511,6 +3708,14 @@ dump_entry(FILE *f, dns_adb_t *adb, dns_adbentry_t *entry,
 		entry->to512, entry->plain, entry->plainto);
 	if (entry->udpsize != 0U)
 		fprintf(f, " [udpsize %u]", entry->udpsize);
+	if (entry->samples != 0U) {
+		unsigned int i, unfinished = 0;
+		for (i = 0; i < ADB_RTTBUCKETS; i++)
+			unfinished += entry->unfinished[i];
+		fprintf(f, " [score %u] [lost %u/%u] [unfinished %u]",
+			entry->score, entry->lost, entry->samples,
+			unfinished);
+	}
 	if (entry->cookie != NULL) {
 		unsigned int i;
 		fprintf(f, " [cookie=");
@@ -4097,10 +4302,9 @@ dns_adb_marklame(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 
 void
 dns_adb_adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
-		   unsigned int rtt, unsigned int factor)
+		   unsigned int rtt, unsigned int factor, isc_stdtime_t now)
 {
 	int bucket;
-	isc_stdtime_t now = 0;
 
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
@@ -4109,9 +4313,7 @@ dns_adb_adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	bucket = addr->entry->lock_bucket;
 	LOCK(&adb->entrylocks[bucket]);
 
-	if (addr->entry->expires == 0 || factor == DNS_ADB_RTTADJAGE)
-		isc_stdtime_get(&now);
-	adjustsrtt(addr, rtt, factor, now);
+	adjustsrtt(adb, addr, rtt, factor, now);
 
 	UNLOCK(&adb->entrylocks[bucket]);
 }
@@ -4126,14 +4328,84 @@ dns_adb_agesrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr, isc_stdtime_t now) {
 	bucket = addr->entry->lock_bucket;
 	LOCK(&adb->entrylocks[bucket]);
 
-	adjustsrtt(addr, 0, DNS_ADB_RTTADJAGE, now);
+	adjustsrtt(adb, addr, 0, DNS_ADB_RTTADJAGE, now);
+
+	UNLOCK(&adb->entrylocks[bucket]);
+}
+
+void
+dns_adb_noresponse(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
+		   bool ednsunknown, isc_stdtime_t now)
+{
+	int bucket;
+	uint32_t mask;
+	unsigned int rtt;
+
+	REQUIRE(DNS_ADB_VALID(adb));
+	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
+
+	bucket = addr->entry->lock_bucket;
+	LOCK(&adb->entrylocks[bucket]);
+
+	rtthist_add(adb, addr->entry, 0, rttsample_lost, now);
+
+	/*
+	 * We don't know whether the packet was lost or the server is
+	 * very slow, so raise the srtt by a random amount, less the
+	 * slower the server already is.
+	 */
+	if (addr->entry->srtt > 800000)
+		mask = 0x3fff;
+	else if (addr->entry->srtt > 400000)
+		mask = 0x7fff;
+	else if (addr->entry->srtt > 200000)
+		mask = 0xffff;
+	else if (addr->entry->srtt > 100000)
+		mask = 0x1ffff;
+	else if (addr->entry->srtt > 50000)
+		mask = 0x3ffff;
+	else if (addr->entry->srtt > 25000)
+		mask = 0x7ffff;
+	else
+		mask = 0xfffff;
+
+	/*
+	 * The query may have been lost to EDNS rather than to the
+	 * server; don't raise the srtt as much.
+	 */
+	if (ednsunknown)
+		mask >>= 2;
+
+	rtt = addr->entry->srtt + (isc_random32() & mask);
+	if (rtt > ADB_MAXTIMEOUTRTT)
+		rtt = ADB_MAXTIMEOUTRTT;
+
+	adjustsrtt(adb, addr, rtt, DNS_ADB_RTTADJREPLACE, now);
+
+	UNLOCK(&adb->entrylocks[bucket]);
+}
+
+void
+dns_adb_unfinished(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
+		   unsigned int waited, isc_stdtime_t now)
+{
+	int bucket;
+
+	REQUIRE(DNS_ADB_VALID(adb));
+	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
+
+	bucket = addr->entry->lock_bucket;
+	LOCK(&adb->entrylocks[bucket]);
+
+	rtthist_add(adb, addr->entry, waited, rttsample_unfinished, now);
+	addr->score = entry_score(addr->entry);
 
 	UNLOCK(&adb->entrylocks[bucket]);
 }
 
 static void
-adjustsrtt(dns_adbaddrinfo_t *addr, unsigned int rtt, unsigned int factor,
-	   isc_stdtime_t now)
+adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr, unsigned int rtt,
+	   unsigned int factor, isc_stdtime_t now)
 {
 	uint64_t new_srtt;
 
@@ -4153,6 +4425,11 @@ adjustsrtt(dns_adbaddrinfo_t *addr, unsigned int rtt, unsigned int factor,
 	addr->entry->srtt = (unsigned int) new_srtt;
 	addr->srtt = (unsigned int) new_srtt;
 
+	if (factor != DNS_ADB_RTTADJAGE && factor != DNS_ADB_RTTADJREPLACE) {
+		rtthist_add(adb, addr->entry, rtt, rttsample_answered, now);
+	}
+	addr->score = entry_score(addr->entry);
+
 	if (addr->entry->expires == 0)
 		addr->entry->expires = now + ADB_ENTRY_WINDOW;
 }
@@ -4548,11 +4825,14 @@ dns_adb_findaddrinfo(dns_adb_t *adb, const isc_sockaddr_t *sa,
 	dns_adbaddrinfo_t *addr;
 	isc_result_t result;
 	in_port_t port;
+	isc_stdtime_t when = now;
 
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(addrp != NULL && *addrp == NULL);
 
-	UNUSED(now);
+	if (when == 0) {
+		isc_stdtime_get(&when);
+	}
 
 	result = ISC_R_SUCCESS;
 	bucket = DNS_ADB_INVALIDBUCKET;
@@ -4578,7 +4858,7 @@ dns_adb_findaddrinfo(dns_adb_t *adb, const isc_sockaddr_t *sa,
 		DP(ENTER_LEVEL, "findaddrinfo: found entry %p", entry);
 
 	port = isc_sockaddr_getport(sa);
-	addr = new_adbaddrinfo(adb, entry, port);
+	addr = new_adbaddrinfo(adb, entry, port, when);
 	if (addr == NULL) {
 		result = ISC_R_NOMEMORY;
 	} else {
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/atomic.h>
+#include <isc/buffer.h>
+#include <isc/hash.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/region.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#include <dns/anscache.h>
+#include <dns/types.h>
+
+typedef struct dns_acentry dns_acentry_t;
+
+typedef struct dns_acbucket {
+	isc_mutex_t			lock;
+	ISC_LIST(dns_acentry_t)		entries;	/* MRU first */
+} dns_acbucket_t;
+
+struct dns_anscache {
+	unsigned int			magic;
+	isc_mem_t			*mctx;
+	size_t				maxsize;
+	atomic_uint_fast64_t		size;
+	atomic_uint_fast64_t		count;
+	atomic_uint_fast32_t		sweep;
+	unsigned int			nbuckets;
+	dns_acbucket_t			*buckets;
+};
+
+#define ANSCACHE_MAGIC			ISC_MAGIC('A', 'n', 's', 'C')
+#define VALID_ANSCACHE(m)		ISC_MAGIC_VALID(m, ANSCACHE_MAGIC)
+
+/*
+ * The key and the response are stored right after the entry.
+ */
+struct dns_acentry {
+	ISC_LINK(dns_acentry_t)		link;
+	uint64_t			generation;
+	uint32_t			hashval;
+	unsigned int			flags;
+	unsigned int			keylen;
+	unsigned int			length;
+};
+
+#define ENTRY_KEY(e)			((unsigned char *)((e) + 1))
+#define ENTRY_DATA(e)			(ENTRY_KEY(e) + (e)->keylen)
+#define ENTRY_SIZE(e)			(sizeof(*(e)) + (e)->keylen + \
+					 (e)->length)
+
+/*
+ * Size the table for entries of about this many bytes, with a few
+ * entries per bucket.
+ */
+#define ANSCACHE_BUCKETSIZE		2048
+#define ANSCACHE_MINBUCKETS		16
+#define ANSCACHE_MAXBUCKETS		65536
+
+static void
+free_entry(dns_anscache_t *ac, dns_acbucket_t *bucket, dns_acentry_t *entry) {
+	size_t size = ENTRY_SIZE(entry);
+
+	ISC_LIST_UNLINK(bucket->entries, entry, link);
+	(void)atomic_fetch_sub_relaxed(&ac->size, size);
+	(void)atomic_fetch_sub_relaxed(&ac->count, 1);
+	isc_mem_put(ac->mctx, entry, size);
+}
+
+isc_result_t
+dns_anscache_create(isc_mem_t *mctx, size_t maxsize, dns_anscache_t **acp) {
+	dns_anscache_t *ac = NULL;
+	unsigned int i;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(maxsize > 0);
+	REQUIRE(acp != NULL && *acp == NULL);
+
+	ac = isc_mem_get(mctx, sizeof(*ac));
+	memset(ac, 0, sizeof(*ac));
+	isc_mem_attach(mctx, &ac->mctx);
+
+	ac->maxsize = maxsize;
+	atomic_init(&ac->size, 0);
+	atomic_init(&ac->count, 0);
+	atomic_init(&ac->sweep, 0);
+
+	ac->nbuckets = ANSCACHE_MINBUCKETS;
+	while (ac->nbuckets < ANSCACHE_MAXBUCKETS &&
+	       (size_t)ac->nbuckets * ANSCACHE_BUCKETSIZE < maxsize)
+	{
+		ac->nbuckets *= 2;
+	}
+
+	ac->buckets = isc_mem_get(mctx, ac->nbuckets * sizeof(ac->buckets[0]));
+	for (i = 0; i < ac->nbuckets; i++) {
+		isc_mutex_init(&ac->buckets[i].lock);
+		ISC_LIST_INIT(ac->buckets[i].entries);
+	}
+
+	ac->magic = ANSCACHE_MAGIC;
+	*acp = ac;
+
+	return (ISC_R_SUCCESS);
+}
+
+void
+dns_anscache_destroy(dns_anscache_t **acp) {
+	dns_anscache_t *ac;
+	unsigned int i;
+
+	REQUIRE(acp != NULL && VALID_ANSCACHE(*acp));
+	ac = *acp;
+	*acp = NULL;
+
+	dns_anscache_flush(ac);
+	INSIST(atomic_load_relaxed(&ac->count) == 0);
+
+	ac->magic = 0;
+	for (i = 0; i < ac->nbuckets; i++) {
+		isc_mutex_destroy(&ac->buckets[i].lock);
+	}
+	isc_mem_put(ac->mctx, ac->buckets,
+		    ac->nbuckets * sizeof(ac->buckets[0]));
+	isc_mem_putanddetach(&ac->mctx, ac, sizeof(*ac));
+}
+
+static inline dns_acentry_t *
+find_entry(dns_acbucket_t *bucket, const isc_region_t *key, uint32_t hashval) {
+	dns_acentry_t *entry;
+
+	for (entry = ISC_LIST_HEAD(bucket->entries);
+	     entry != NULL;
+	     entry = ISC_LIST_NEXT(entry, link))
+	{
+		if (entry->hashval == hashval &&
+		    entry->keylen == key->length &&
+		    memcmp(ENTRY_KEY(entry), key->base, key->length) == 0)
+		{
+			break;
+		}
+	}
+
+	return (entry);
+}
+
+isc_result_t
+dns_anscache_find(dns_anscache_t *ac, const isc_region_t *key,
+		  uint64_t generation, isc_buffer_t *target,
+		  unsigned int *flagsp)
+{
+	dns_acbucket_t *bucket;
+	dns_acentry_t *entry;
+	isc_result_t result;
+	uint32_t hashval;
+
+	REQUIRE(VALID_ANSCACHE(ac));
+	REQUIRE(key != NULL && key->length > 0);
+	REQUIRE(ISC_BUFFER_VALID(target));
+
+	if (atomic_load_relaxed(&ac->count) == 0) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	hashval = (uint32_t)isc_hash_function(key->base, key->length, true);
+	bucket = &ac->buckets[hashval & (ac->nbuckets - 1)];
+
+	LOCK(&bucket->lock);
+	entry = find_entry(bucket, key, hashval);
+	if (entry == NULL) {
+		result = ISC_R_NOTFOUND;
+	} else if (entry->generation != generation) {
+		/*
+		 * The zone has changed since this was rendered.
+		 */
+		free_entry(ac, bucket, entry);
+		result = ISC_R_NOTFOUND;
+	} else if (isc_buffer_availablelength(target) < entry->length) {
+		result = ISC_R_NOSPACE;
+	} else {
+		isc_buffer_putmem(target, ENTRY_DATA(entry), entry->length);
+		if (flagsp != NULL) {
+			*flagsp = entry->flags;
+		}
+		if (entry != ISC_LIST_HEAD(bucket->entries)) {
+			ISC_LIST_UNLINK(bucket->entries, entry, link);
+			ISC_LIST_PREPEND(bucket->entries, entry, link);
+		}
+		result = ISC_R_SUCCESS;
+	}
+	UNLOCK(&bucket->lock);
+
+	return (result);
+}
+
+void
+dns_anscache_add(dns_anscache_t *ac, const isc_region_t *key,
+		 uint64_t generation, const isc_region_t *response,
+		 unsigned int flags)
+{
+	dns_acbucket_t *bucket;
+	dns_acentry_t *entry, *old;
+	uint32_t hashval;
+	size_t size;
+	unsigned int tries;
+
+	REQUIRE(VALID_ANSCACHE(ac));
+	REQUIRE(key != NULL && key->length > 0);
+	REQUIRE(response != NULL && response->length > 0);
+
+	size = sizeof(*entry) + key->length + response->length;
+	if (size > ac->maxsize / 16) {
+		return;
+	}
+
+	hashval = (uint32_t)isc_hash_function(key->base, key->length, true);
+	bucket = &ac->buckets[hashval & (ac->nbuckets - 1)];
+
+	entry = isc_mem_get(ac->mctx, size);
+	ISC_LINK_INIT(entry, link);
+	entry->generation = generation;
+	entry->hashval = hashval;
+	entry->flags = flags;
+	entry->keylen = key->length;
+	entry->length = response->length;
+	memmove(ENTRY_KEY(entry), key->base, key->length);
+	memmove(ENTRY_DATA(entry), response->base, response->length);
+
+	LOCK(&bucket->lock);
+	old = find_entry(bucket, key, hashval);
+	if (old != NULL) {
+		free_entry(ac, bucket, old);
+	}
+	ISC_LIST_PREPEND(bucket->entries, entry, link);
+	(void)atomic_fetch_add_relaxed(&ac->size, size);
+	(void)atomic_fetch_add_relaxed(&ac->count, 1);
+
+	/*
+	 * Make room in this bucket first, it is already locked.
+	 */
+	while (atomic_load_relaxed(&ac->size) > ac->maxsize) {
+		old = ISC_LIST_TAIL(bucket->entries);
+		if (old == entry) {
+			break;
+		}
+		free_entry(ac, bucket, old);
+	}
+	UNLOCK(&bucket->lock);
+
+	/*
+	 * Then take the least recently used entries from the other
+	 * buckets in turn.
+	 */
+	for (tries = 0;
+	     tries < ac->nbuckets &&
+	     atomic_load_relaxed(&ac->size) > ac->maxsize;
+	     tries++)
+	{
+		uint32_t i = atomic_fetch_add_relaxed(&ac->sweep, 1);
+
+		bucket = &ac->buckets[i & (ac->nbuckets - 1)];
+		LOCK(&bucket->lock);
+		old = ISC_LIST_TAIL(bucket->entries);
+		if (old != NULL && old != entry) {
+			free_entry(ac, bucket, old);
+		}
+		UNLOCK(&bucket->lock);
+	}
+}
+
+void
+dns_anscache_flush(dns_anscache_t *ac) {
+	dns_acentry_t *entry;
+	unsigned int i;
+
+	REQUIRE(VALID_ANSCACHE(ac));
+
+	for (i = 0; i < ac->nbuckets; i++) {
+		dns_acbucket_t *bucket = &ac->buckets[i];
+
+		LOCK(&bucket->lock);
+		while ((entry = ISC_LIST_HEAD(bucket->entries)) != NULL) {
+			free_entry(ac, bucket, entry);
+		}
+		UNLOCK(&bucket->lock);
+	}
+}
+
+void
+dns_anscache_getstats(dns_anscache_t *ac, uint64_t *entriesp,
+		      uint64_t *sizep)
+{
+	REQUIRE(VALID_ANSCACHE(ac));
+
+	if (entriesp != NULL) {
+		*entriesp = atomic_load_relaxed(&ac->count);
+	}
+	if (sizep != NULL) {
+		*sizep = atomic_load_relaxed(&ac->size);
+	}
+}
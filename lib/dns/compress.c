@@ -67,74 +67,165 @@ static unsigned char maptolower[] = {
 };
 
 /*
- * The tableindex array below is of size 256, one entry for each
- * unsigned char value. The tableindex array elements are dependent on
- * DNS_COMPRESS_TABLESIZE. The table was created using the following
- * function.
- *
- * static void
- * gentable(unsigned char *table) {
- *         unsigned int i;
- *         const unsigned int left = DNS_COMPRESS_TABLESIZE - 38;
- *         long r;
- *
- *         for (i = 0; i < 26; i++) {
- *                 table['A' + i] = i;
- *                 table['a' + i] = i;
- *         }
- *
- *         for (i = 0; i <= 9; i++)
- *                 table['0' + i] = i + 26;
- *
- *         table['-'] = 36;
- *         table['_'] = 37;
+ * Suffixes are hashed one label at a time, starting from the label
+ * nearest to the root, so that the hashes of all the suffixes of a
+ * name are computed in a single pass.  The hash is case-insensitive,
+ * which lets the same table serve case-sensitive compression.
+ */
+#define HASH_INIT	0x811c9dc5U
+#define HASH_MULT	0x01000193U
+
+/*
+ * The node count is bounded by the number of 14 bit offsets.
+ */
+#define MAXNODES	0x4000U
+
+static inline uint32_t
+hash_label(uint32_t hash, const unsigned char *label) {
+	unsigned int count = *label++;
+
+	hash = (hash ^ count) * HASH_MULT;
+	while (count-- > 0) {
+		hash = (hash ^ maptolower[*label++]) * HASH_MULT;
+	}
+
+	return (hash);
+}
+
+/*
+ * Fill in the label offsets of 'name' and the hashes of all its
+ * suffixes; hashes[n] is the hash of the suffix starting at label n.
+ * Returns the number of labels.
+ */
+static unsigned int
+suffix_hashes(const dns_name_t *name, unsigned char *offsets,
+	      uint32_t *hashes)
+{
+	unsigned int labels, n, offset;
+	uint32_t hash;
+
+	labels = dns_name_countlabels(name);
+	INSIST(labels > 0 && labels <= 128);
+
+	if (name->offsets != NULL) {
+		memmove(offsets, name->offsets, labels);
+	} else {
+		offset = 0;
+		for (n = 0; n < labels; n++) {
+			offsets[n] = offset;
+			offset += name->ndata[offset] + 1;
+		}
+	}
+
+	hash = HASH_INIT;
+	hashes[labels - 1] = hash;
+	for (n = labels - 1; n-- > 0;) {
+		hash = hash_label(hash, name->ndata + offsets[n]);
+		hashes[n] = hash;
+	}
+
+	return (labels);
+}
+
+static inline bool
+node_match(dns_compress_t *cctx, const dns_compressnode_t *node,
+	   const unsigned char *data, unsigned int length,
+	   unsigned int labels)
+{
+	const unsigned char *p = node->data;
+
+	if (node->length != length || node->labels != labels)
+		return (false);
+
+	if (ISC_LIKELY((cctx->allowed & DNS_COMPRESS_CASESENSITIVE) != 0))
+		return (memcmp(p, data, length) == 0);
+
+	/*
+	 * Label lengths are below 0x40 and are unchanged by maptolower,
+	 * so the suffixes can be compared as flat strings.
+	 */
+	while (length > 0 && maptolower[*p] == maptolower[*data]) {
+		p++;
+		data++;
+		length--;
+	}
+
+	return (length == 0);
+}
+
+static inline dns_compressnode_t *
+find_node(dns_compress_t *cctx, uint32_t hash, const unsigned char *data,
+	  unsigned int length, unsigned int labels)
+{
+	unsigned int mask = cctx->tablesize - 1;
+	unsigned int i = hash & mask;
+	dns_compressnode_t *node;
+
+	while (cctx->table[i] != 0) {
+		node = &cctx->nodes[cctx->table[i] - 1];
+		if (node->hash == hash &&
+		    node_match(cctx, node, data, length, labels))
+		{
+			return (node);
+		}
+		i = (i + 1) & mask;
+	}
+
+	return (NULL);
+}
+
+static inline void
+insert_node(dns_compress_t *cctx, unsigned int index) {
+	unsigned int mask = cctx->tablesize - 1;
+	dns_compressnode_t *node = &cctx->nodes[index];
+	unsigned int i = node->hash & mask;
+
+	while (cctx->table[i] != 0) {
+		i = (i + 1) & mask;
+	}
+	cctx->table[i] = index + 1;
+	node->slot = i;
+}
+
+/*
+ * Make room for one more node, keeping the table at most half full.
  *
- *         for (i = 0; i < 256; i++) {
- *                 if ((i >= 'a' && i <= 'z') ||
- *                     (i >= 'A' && i <= 'Z') ||
- *                     (i >= '0' && i <= '9') ||
- *                     (i == '-') ||
- *                     (i == '_'))
- *                         continue;
- *                 r = random() % left;
- *                 table[i] = 38 + r;
- *         }
- * }
+ * The table is rebuilt by inserting the nodes in the order they were
+ * added, so that removing them in reverse order (see
+ * dns_compress_rollback()) never leaves a gap in a probe sequence.
  */
-static unsigned char tableindex[256] = {
-	0x3e, 0x3e, 0x33, 0x2d, 0x30, 0x38, 0x31, 0x3c,
-	0x2b, 0x33, 0x30, 0x3f, 0x2d, 0x3c, 0x36, 0x3a,
-	0x28, 0x2c, 0x2a, 0x37, 0x3d, 0x34, 0x35, 0x2d,
-	0x39, 0x2b, 0x2f, 0x2c, 0x3b, 0x32, 0x2b, 0x39,
-	0x30, 0x38, 0x28, 0x3c, 0x32, 0x33, 0x39, 0x38,
-	0x27, 0x2b, 0x39, 0x30, 0x27, 0x24, 0x2f, 0x2b,
-	0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21,
-	0x22, 0x3a, 0x29, 0x36, 0x31, 0x3c, 0x35, 0x26,
-	0x31, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
-	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
-	0x17, 0x18, 0x19, 0x3e, 0x3b, 0x39, 0x2f, 0x25,
-	0x27, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
-	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
-	0x17, 0x18, 0x19, 0x36, 0x3b, 0x2f, 0x2f, 0x2e,
-	0x29, 0x33, 0x2a, 0x36, 0x28, 0x3f, 0x2e, 0x29,
-	0x2c, 0x29, 0x36, 0x2d, 0x32, 0x3d, 0x33, 0x2a,
-	0x2e, 0x2f, 0x3b, 0x30, 0x3d, 0x39, 0x2b, 0x36,
-	0x2a, 0x2f, 0x2c, 0x26, 0x3a, 0x37, 0x30, 0x3d,
-	0x2a, 0x36, 0x33, 0x2c, 0x38, 0x3d, 0x32, 0x3e,
-	0x26, 0x2a, 0x2c, 0x35, 0x27, 0x39, 0x3b, 0x31,
-	0x2a, 0x37, 0x3c, 0x27, 0x32, 0x29, 0x39, 0x37,
-	0x34, 0x3f, 0x39, 0x2e, 0x38, 0x2b, 0x2c, 0x3e,
-	0x3b, 0x3b, 0x2d, 0x33, 0x3b, 0x3b, 0x32, 0x3d,
-	0x3f, 0x3a, 0x34, 0x26, 0x35, 0x30, 0x31, 0x39,
-	0x27, 0x2f, 0x3d, 0x35, 0x35, 0x36, 0x2e, 0x29,
-	0x38, 0x27, 0x34, 0x32, 0x2c, 0x3c, 0x31, 0x28,
-	0x37, 0x38, 0x37, 0x34, 0x33, 0x29, 0x32, 0x34,
-	0x3f, 0x26, 0x34, 0x34, 0x32, 0x27, 0x30, 0x33,
-	0x33, 0x2d, 0x2b, 0x28, 0x3f, 0x33, 0x2b, 0x39,
-	0x37, 0x39, 0x2c, 0x3d, 0x35, 0x39, 0x27, 0x2f
-};
+static void
+grow(dns_compress_t *cctx) {
+	unsigned int i, size;
+
+	if (cctx->count == cctx->nodesize) {
+		dns_compressnode_t *nodes;
+
+		size = cctx->nodesize * 2;
+		nodes = isc_mem_get(cctx->mctx, size * sizeof(*nodes));
+		memmove(nodes, cctx->nodes, cctx->count * sizeof(*nodes));
+		if (cctx->nodes != cctx->initialnodes)
+			isc_mem_put(cctx->mctx, cctx->nodes,
+				    cctx->nodesize * sizeof(*nodes));
+		cctx->nodes = nodes;
+		cctx->nodesize = size;
+	}
+
+	if ((cctx->count + 1U) * 2 > cctx->tablesize) {
+		uint16_t *table;
+
+		size = cctx->tablesize * 2;
+		table = isc_mem_get(cctx->mctx, size * sizeof(*table));
+		memset(table, 0, size * sizeof(*table));
+		if (cctx->table != cctx->initialtable)
+			isc_mem_put(cctx->mctx, cctx->table,
+				    cctx->tablesize * sizeof(*table));
+		cctx->table = table;
+		cctx->tablesize = size;
+		for (i = 0; i < cctx->count; i++)
+			insert_node(cctx, i);
+	}
+}
 
 /***
  ***	Compression
@@ -150,7 +241,11 @@ dns_compress_init(dns_compress_t *cctx, int edns, isc_mem_t *mctx) {
 	cctx->count = 0;
 	cctx->allowed = DNS_COMPRESS_ENABLED;
 
-	memset(&cctx->table[0], 0, sizeof(cctx->table));
+	memset(&cctx->initialtable[0], 0, sizeof(cctx->initialtable));
+	cctx->table = cctx->initialtable;
+	cctx->tablesize = DNS_COMPRESS_INITIALSLOTS;
+	cctx->nodes = cctx->initialnodes;
+	cctx->nodesize = DNS_COMPRESS_INITIALNODES;
 
 	cctx->magic = CCTX_MAGIC;
 
@@ -164,18 +259,21 @@ dns_compress_invalidate(dns_compress_t *cctx) {
 
 	REQUIRE(VALID_CCTX(cctx));
 
-	for (i = 0; i < DNS_COMPRESS_TABLESIZE; i++) {
-		while (cctx->table[i] != NULL) {
-			node = cctx->table[i];
-			cctx->table[i] = cctx->table[i]->next;
-			if ((node->offset & 0x8000) != 0)
-				isc_mem_put(cctx->mctx, node->r.base,
-					    node->r.length);
-			if (node->count < DNS_COMPRESS_INITIALNODES)
-				continue;
-			isc_mem_put(cctx->mctx, node, sizeof(*node));
-		}
+	for (i = 0; i < cctx->count; i++) {
+		node = &cctx->nodes[i];
+		if ((node->offset & 0x8000) != 0)
+			isc_mem_put(cctx->mctx, node->data, node->length);
 	}
+	cctx->count = 0;
+
+	if (cctx->table != cctx->initialtable)
+		isc_mem_put(cctx->mctx, cctx->table,
+			    cctx->tablesize * sizeof(cctx->table[0]));
+	if (cctx->nodes != cctx->initialnodes)
+		isc_mem_put(cctx->mctx, cctx->nodes,
+			    cctx->nodesize * sizeof(cctx->nodes[0]));
+	cctx->table = NULL;
+	cctx->nodes = NULL;
 
 	cctx->magic = 0;
 	cctx->allowed = 0;
@@ -234,11 +332,10 @@ bool
 dns_compress_findglobal(dns_compress_t *cctx, const dns_name_t *name,
 			dns_name_t *prefix, uint16_t *offset)
 {
-	dns_name_t tname;
 	dns_compressnode_t *node = NULL;
-	unsigned int labels, i, n;
-	unsigned int numlabels;
-	unsigned char *p;
+	unsigned char offsets[128];
+	uint32_t hashes[128];
+	unsigned int labels, n;
 
 	REQUIRE(VALID_CCTX(cctx));
 	REQUIRE(dns_name_isabsolute(name) == true);
@@ -250,105 +347,18 @@ dns_compress_findglobal(dns_compress_t *cctx, const dns_name_t *name,
 	if (cctx->count == 0)
 		return (false);
 
-	labels = dns_name_countlabels(name);
-	INSIST(labels > 0);
-
-	dns_name_init(&tname, NULL);
-
-	numlabels = labels > 3U ? 3U : labels;
-	p = name->ndata;
-
-	for (n = 0; n < numlabels - 1; n++) {
-		unsigned char ch, llen;
-		unsigned int firstoffset, length;
-
-		firstoffset = (unsigned int)(p - name->ndata);
-		length = name->length - firstoffset;
-
-		/*
-		 * We calculate the table index using the first
-		 * character in the first label of the suffix name.
-		 */
-		ch = p[1];
-		i = tableindex[ch];
-		if (ISC_LIKELY((cctx->allowed &
-				DNS_COMPRESS_CASESENSITIVE) != 0))
-		{
-			for (node = cctx->table[i];
-			     node != NULL;
-			     node = node->next)
-			{
-				if (ISC_UNLIKELY(node->name.length != length))
-					continue;
-
-				if (ISC_LIKELY(memcmp(node->name.ndata,
-						      p, length) == 0))
-					goto found;
-			}
-		} else {
-			for (node = cctx->table[i];
-			     node != NULL;
-			     node = node->next)
-			{
-				unsigned int l, count;
-				unsigned char c;
-				unsigned char *label1, *label2;
-
-				if (ISC_UNLIKELY(node->name.length != length))
-					continue;
-
-				l = labels - n;
-				if (ISC_UNLIKELY(node->name.labels != l))
-					continue;
-
-				label1 = node->name.ndata;
-				label2 = p;
-				while (ISC_LIKELY(l-- > 0)) {
-					count = *label1++;
-					if (count != *label2++)
-						goto cont1;
-
-					/* no bitstring support */
-					INSIST(count <= 63);
-
-					/* Loop unrolled for performance */
-					while (ISC_LIKELY(count > 3)) {
-						c = maptolower[label1[0]];
-						if (c != maptolower[label2[0]])
-							goto cont1;
-						c = maptolower[label1[1]];
-						if (c != maptolower[label2[1]])
-							goto cont1;
-						c = maptolower[label1[2]];
-						if (c != maptolower[label2[2]])
-							goto cont1;
-						c = maptolower[label1[3]];
-						if (c != maptolower[label2[3]])
-							goto cont1;
-						count -= 4;
-						label1 += 4;
-						label2 += 4;
-					}
-					while (ISC_LIKELY(count-- > 0)) {
-						c = maptolower[*label1++];
-						if (c != maptolower[*label2++])
-							goto cont1;
-					}
-				}
-				break;
- cont1:
-				continue;
-			}
-		}
+	labels = suffix_hashes(name, offsets, hashes);
 
+	/*
+	 * Try every suffix but the root, longest first.
+	 */
+	for (n = 0; n < labels - 1; n++) {
+		node = find_node(cctx, hashes[n], name->ndata + offsets[n],
+				 name->length - offsets[n], labels - n);
 		if (node != NULL)
 			break;
-
-		llen = *p;
-		p += llen + 1;
 	}
 
- found:
 	/*
 	 * If node == NULL, we found no match at all.
 	 */
@@ -364,28 +374,16 @@ dns_compress_findglobal(dns_compress_t *cctx, const dns_name_t *name,
 	return (true);
 }
 
-static inline unsigned int
-name_length(const dns_name_t *name) {
-	isc_region_t r;
-	dns_name_toregion(name, &r);
-	return (r.length);
-}
-
 void
 dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 		 const dns_name_t *prefix, uint16_t offset)
 {
-	dns_name_t tname, xname;
-	unsigned int start;
-	unsigned int n;
-	unsigned int count;
-	unsigned int i;
 	dns_compressnode_t *node;
-	unsigned int length;
-	unsigned int tlength;
+	unsigned char offsets[128];
+	uint32_t hashes[128];
+	unsigned int start, count, labels, length;
 	uint16_t toffset;
 	unsigned char *tmp;
-	isc_region_t r;
 
 	REQUIRE(VALID_CCTX(cctx));
 	REQUIRE(dns_name_isabsolute(name));
@@ -395,71 +393,42 @@ dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 
 	if (offset >= 0x4000)
 		return;
-	dns_name_init(&tname, NULL);
-	dns_name_init(&xname, NULL);
 
-	n = dns_name_countlabels(name);
 	count = dns_name_countlabels(prefix);
 	if (dns_name_isabsolute(prefix))
 		count--;
 	if (count == 0)
 		return;
-	start = 0;
-	dns_name_toregion(name, &r);
-	length = r.length;
-	tmp = isc_mem_get(cctx->mctx, length);
-	/*
-	 * Copy name data to 'tmp' and make 'r' use 'tmp'.
-	 */
-	memmove(tmp, r.base, r.length);
-	r.base = tmp;
-	dns_name_fromregion(&xname, &r);
 
-	if (count > 2U)
-		count = 2U;
+	labels = suffix_hashes(name, offsets, hashes);
 
-	while (count > 0) {
-		unsigned char ch;
+	/*
+	 * Copy name data to 'tmp'; the nodes point into it.
+	 */
+	length = name->length;
+	tmp = isc_mem_get(cctx->mctx, length);
+	memmove(tmp, name->ndata, length);
 
-		dns_name_getlabelsequence(&xname, start, n, &tname);
-		/*
-		 * We calculate the table index using the first
-		 * character in the first label of tname.
-		 */
-		ch = tname.ndata[1];
-		i = tableindex[ch];
-		tlength = name_length(&tname);
-		toffset = (uint16_t)(offset + (length - tlength));
-		if (toffset >= 0x4000)
+	for (start = 0; start < count; start++) {
+		toffset = (uint16_t)(offset + offsets[start]);
+		if (toffset >= 0x4000 || cctx->count >= MAXNODES)
 			break;
+
+		grow(cctx);
+		node = &cctx->nodes[cctx->count];
+		node->data = tmp + offsets[start];
+		node->hash = hashes[start];
+		node->length = length - offsets[start];
+		node->labels = labels - start;
 		/*
-		 * Create a new node and add it.
-		 */
-		if (cctx->count < DNS_COMPRESS_INITIALNODES)
-			node = &cctx->initialnodes[cctx->count];
-		else {
-			node = isc_mem_get(cctx->mctx,
-					   sizeof(dns_compressnode_t));
-		}
-		node->count = cctx->count++;
-		/*
-		 * 'node->r.base' becomes 'tmp' when start == 0.
+		 * 'node->data' is 'tmp' when start == 0.
 		 * Record this by setting 0x8000 so it can be freed later.
 		 */
 		if (start == 0)
 			toffset |= 0x8000;
 		node->offset = toffset;
-		dns_name_toregion(&tname, &node->r);
-		dns_name_init(&node->name, NULL);
-		node->name.length = node->r.length;
-		node->name.ndata = node->r.base;
-		node->name.labels = tname.labels;
-		node->name.attributes = DNS_NAMEATTR_ABSOLUTE;
-		node->next = cctx->table[i];
-		cctx->table[i] = node;
-		start++;
-		n--;
-		count--;
+		insert_node(cctx, cctx->count);
+		cctx->count++;
 	}
 
 	if (start == 0)
@@ -468,7 +437,6 @@ dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 
 void
 dns_compress_rollback(dns_compress_t *cctx, uint16_t offset) {
-	unsigned int i;
 	dns_compressnode_t *node;
 
 	REQUIRE(VALID_CCTX(cctx));
@@ -476,24 +444,19 @@ dns_compress_rollback(dns_compress_t *cctx, uint16_t offset) {
 	if (ISC_UNLIKELY((cctx->allowed & DNS_COMPRESS_ENABLED) == 0))
 		return;
 
-	for (i = 0; i < DNS_COMPRESS_TABLESIZE; i++) {
-		node = cctx->table[i];
-		/*
-		 * This relies on nodes with greater offsets being
-		 * closer to the beginning of the list, and the
-		 * items with the greatest offsets being at the end
-		 * of the initialnodes[] array.
-		 */
-		while (node != NULL && (node->offset & 0x7fff) >= offset) {
-			cctx->table[i] = node->next;
-			if ((node->offset & 0x8000) != 0)
-				isc_mem_put(cctx->mctx, node->r.base,
-					    node->r.length);
-			if (node->count >= DNS_COMPRESS_INITIALNODES)
-				isc_mem_put(cctx->mctx, node, sizeof(*node));
-			cctx->count--;
-			node = cctx->table[i];
-		}
+	/*
+	 * The nodes with the greatest offsets are the most recently
+	 * added ones.  Removing them in reverse order restores the
+	 * table to the state it was in before they were added.
+	 */
+	while (cctx->count > 0) {
+		node = &cctx->nodes[cctx->count - 1];
+		if ((node->offset & 0x7fff) < offset)
+			break;
+		cctx->table[node->slot] = 0;
+		if ((node->offset & 0x8000) != 0)
+			isc_mem_put(cctx->mctx, node->data, node->length);
+		cctx->count--;
 	}
 }
 
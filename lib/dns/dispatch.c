@@ -3439,6 +3439,19 @@ dns_dispatch_cancel(dns_dispatch_t *disp) {
 	return;
 }
 
+bool
+dns_dispatch_isshuttingdown(dns_dispatch_t *disp) {
+	bool shutting_down;
+
+	REQUIRE(VALID_DISPATCH(disp));
+
+	LOCK(&disp->lock);
+	shutting_down = (disp->shutting_down != 0);
+	UNLOCK(&disp->lock);
+
+	return (shutting_down);
+}
+
 unsigned int
 dns_dispatch_getattributes(dns_dispatch_t *disp) {
 	REQUIRE(VALID_DISPATCH(disp));
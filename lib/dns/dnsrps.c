@@ -972,6 +972,7 @@ static dns_rdatasetmethods_t rpsdb_rdataset_methods = {
 	NULL,
 	NULL,
 	NULL,
+	NULL,
 	NULL
 };
 
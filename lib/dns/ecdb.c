@@ -114,7 +114,8 @@ static dns_rdatasetmethods_t rdataset_methods = {
 	NULL,			/* clearprefetch */
 	NULL,			/* setownercase */
 	NULL,			/* getownercase */
-	NULL			/* addglue */
+	NULL,			/* addglue */
+	NULL			/* getslab */
 };
 
 typedef struct ecdb_rdatasetiter {
@@ -47,6 +47,15 @@
  * address field.  When an address is marked lame for a given tuple the address
  * will not be returned to a caller.
  *
+ * Each address also keeps a small histogram of the round trip times of
+ * queries sent to it, of those given up unanswered, and a count of
+ * those that were lost.  From these the ADB works out the address's
+ * score, a blend of the mean and the 90th percentile of the time a
+ * query to it takes, which callers use to choose between servers.  So
+ * that a server that was slow or lossy once is not shunned forever, a
+ * small exploration budget, earned as queries are answered, is spent
+ * on giving addresses with few or old samples a score of zero.
+ *
  *
  * MP:
  *
@@ -216,6 +225,7 @@ struct dns_adbaddrinfo {
 
 	isc_sockaddr_t			sockaddr;	/*%< [rw] */
 	unsigned int			srtt;		/*%< [rw] microsecs */
+	unsigned int			score;		/*%< [rw] microsecs */
 	isc_dscp_t			dscp;
 
 	unsigned int			flags;		/*%< [rw] */
@@ -526,11 +536,20 @@ dns_adb_marklame(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 #define DNS_ADB_RTTADJREPLACE		0	/*%< replace with our rtt */
 #define DNS_ADB_RTTADJAGE		10	/*%< age this rtt */
 
+/*%
+ * The time a lost query is taken to cost when working out a server's
+ * expected latency; the resolver's default retry interval.
+ */
+#define DNS_ADB_LOSSPENALTY		800000	/*%< microsecs */
+
 void
 dns_adb_adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
-		   unsigned int rtt, unsigned int factor);
+		   unsigned int rtt, unsigned int factor, isc_stdtime_t now);
 /*%<
- * Mix the round trip time into the existing smoothed rtt.
+ * Mix the round trip time into the existing smoothed rtt.  Unless
+ * 'factor' is DNS_ADB_RTTADJREPLACE or DNS_ADB_RTTADJAGE, 'rtt' is also
+ * added to the address's latency histogram as an answered query,
+ * stamped with 'now'.
  *
  * Requires:
  *
@@ -542,8 +561,53 @@ dns_adb_adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
  *
  * Note:
  *
- *\li	The srtt in addr will be updated to reflect the new global
- *	srtt value.  This may include changes made by others.
+ *\li	The srtt and score in addr will be updated to reflect the new
+ *	global values.  This may include changes made by others.
+ */
+
+void
+dns_adb_noresponse(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
+		   bool ednsunknown, isc_stdtime_t now);
+/*%<
+ * Record that a query sent to addr got no response in time.  Lost
+ * queries count as DNS_ADB_LOSSPENALTY in the address's score, and
+ * the srtt is replaced by a randomly raised one; by less if
+ * 'ednsunknown', i.e. the query used EDNS and the address is not yet
+ * known to answer it.
+ *
+ * Requires:
+ *
+ *\li	adb be valid.
+ *
+ *\li	addr be valid.
+ *
+ * Note:
+ *
+ *\li	The srtt and score in addr will be updated to reflect the new
+ *	global values.  This may include changes made by others.
+ */
+
+void
+dns_adb_unfinished(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
+		   unsigned int waited, isc_stdtime_t now);
+/*%<
+ * Record that a query sent to addr was given up after 'waited'
+ * microseconds without an answer, because another server answered
+ * first.  This says only that the round trip time was longer than
+ * 'waited': it is kept apart from the answered queries, so that it
+ * raises the address's score without being taken as a round trip
+ * time, and the srtt is not changed.
+ *
+ * Requires:
+ *
+ *\li	adb be valid.
+ *
+ *\li	addr be valid.
+ *
+ * Note:
+ *
+ *\li	The score in addr will be updated to reflect the new global
+ *	value.
  */
 
 void
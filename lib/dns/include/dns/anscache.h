@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_ANSCACHE_H
+#define DNS_ANSCACHE_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/anscache.h
+ * \brief
+ * Defines dns_anscache_t, the "answer cache" object.
+ *
+ * Notes:
+ *\li	An answer cache holds fully rendered responses in wire format,
+ *	indexed by an opaque key built by the caller from the question
+ *	and from whatever properties of the client affect the rendering.
+ *	It is used by the view to answer repeated authoritative queries
+ *	without looking up and rendering the response again.
+ *
+ *\li	Every entry is tagged with a generation number supplied by the
+ *	caller.  An entry is only returned if its generation matches the
+ *	one supplied to dns_anscache_find(); stale entries are removed as
+ *	they are found, so invalidating all the answers from a zone only
+ *	requires the zone to change its generation (see
+ *	dns_zone_getgeneration()).
+ *
+ *\li	The total size of the stored keys and responses is bounded;
+ *	when the bound is reached the least recently used entries of
+ *	each hash bucket are evicted.
+ *
+ * MP:
+ *\li	The answer cache is safe for concurrent use by multiple threads.
+ *
+ * Reliability:
+ *
+ * Resources:
+ *
+ * Security:
+ *
+ * Standards:
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <inttypes.h>
+
+#include <isc/buffer.h>
+#include <isc/region.h>
+
+#include <dns/types.h>
+
+ISC_LANG_BEGINDECLS
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_anscache_create(isc_mem_t *mctx, size_t maxsize, dns_anscache_t **acp);
+/*%
+ * Create an answer cache which will use at most 'maxsize' bytes for
+ * keys and responses, and store it in '*acp'.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	maxsize > 0
+ * \li	acp != NULL && *acp == NULL
+ */
+
+void
+dns_anscache_destroy(dns_anscache_t **acp);
+/*%
+ * Flush and then free the answer cache in '*acp'.  '*acp' is set to
+ * NULL on return.
+ *
+ * Requires:
+ * \li	'*acp' to be a valid answer cache
+ */
+
+isc_result_t
+dns_anscache_find(dns_anscache_t *ac, const isc_region_t *key,
+		  uint64_t generation, isc_buffer_t *target,
+		  unsigned int *flagsp);
+/*%
+ * Look for a response stored under 'key' with generation 'generation'.
+ * If one is found, copy it to the available space of 'target' and, if
+ * 'flagsp' is not NULL, store the flags it was added with in '*flagsp'.
+ *
+ * An entry stored under 'key' with a different generation is removed.
+ *
+ * Requires:
+ * \li	'ac' to be a valid answer cache
+ * \li	'key' to be a non-empty region
+ * \li	'target' to be a valid buffer
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTFOUND
+ * \li	#ISC_R_NOSPACE		a response was found but does not fit in
+ *				'target'
+ */
+
+void
+dns_anscache_add(dns_anscache_t *ac, const isc_region_t *key,
+		 uint64_t generation, const isc_region_t *response,
+		 unsigned int flags);
+/*%
+ * Store 'response' under 'key' with generation 'generation', replacing
+ * any response already stored under 'key'.  'flags' are not interpreted
+ * by the cache and are returned by dns_anscache_find().
+ *
+ * Responses that would use more than a small fraction of the cache
+ * are not stored.
+ *
+ * Requires:
+ * \li	'ac' to be a valid answer cache
+ * \li	'key' and 'response' to be non-empty regions
+ */
+
+void
+dns_anscache_flush(dns_anscache_t *ac);
+/*%
+ * Remove all the entries from the answer cache.
+ *
+ * Requires:
+ * \li	'ac' to be a valid answer cache
+ */
+
+void
+dns_anscache_getstats(dns_anscache_t *ac, uint64_t *entriesp,
+		      uint64_t *sizep);
+/*%
+ * Return the number of entries in the answer cache and the number of
+ * bytes they use.  Either pointer may be NULL.
+ *
+ * Requires:
+ * \li	'ac' to be a valid answer cache
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_ANSCACHE_H */
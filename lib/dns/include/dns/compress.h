@@ -45,34 +45,41 @@ ISC_LANG_BEGINDECLS
 #define DNS_COMPRESS_ENABLED		0x04
 
 /*
- * DNS_COMPRESS_TABLESIZE must be a power of 2. The compress code
- * utilizes this assumption.
+ * The global compression table is an open-addressed hash table of
+ * the name suffixes rendered so far, keyed by a case-insensitive hash
+ * of the whole suffix.  DNS_COMPRESS_INITIALSLOTS must be a power of 2
+ * and at least twice DNS_COMPRESS_INITIALNODES; both the table and the
+ * node array are grown on demand beyond their initial sizes.
  */
-#define DNS_COMPRESS_TABLEBITS 6
-#define DNS_COMPRESS_TABLESIZE (1U << DNS_COMPRESS_TABLEBITS)
-#define DNS_COMPRESS_TABLEMASK (DNS_COMPRESS_TABLESIZE - 1)
-#define DNS_COMPRESS_INITIALNODES 16
+#define DNS_COMPRESS_INITIALSLOTS 64
+#define DNS_COMPRESS_INITIALNODES 32
 
 typedef struct dns_compressnode dns_compressnode_t;
 
 struct dns_compressnode {
-	dns_compressnode_t	*next;
-	uint16_t		offset;
-	uint16_t		count;
-	isc_region_t            r;
-	dns_name_t              name;
+	unsigned char		*data;		/*%< Suffix in wire format. */
+	uint32_t		hash;		/*%< Hash of the suffix. */
+	uint16_t		offset;		/*%< Offset in the message. */
+	uint16_t		length;		/*%< Length of the suffix. */
+	uint16_t		slot;		/*%< Position in the table. */
+	uint16_t		labels;		/*%< Number of labels. */
 };
 
 struct dns_compress {
 	unsigned int		magic;		/*%< Magic number. */
 	unsigned int		allowed;	/*%< Allowed methods. */
 	int			edns;		/*%< Edns version or -1. */
-	/*% Global compression table. */
-	dns_compressnode_t	*table[DNS_COMPRESS_TABLESIZE];
-	/*% Preallocated nodes for the table. */
-	dns_compressnode_t	initialnodes[DNS_COMPRESS_INITIALNODES];
+	/*% Global compression table, node index + 1 or 0 if unused. */
+	uint16_t		*table;
+	unsigned int		tablesize;	/*%< Slots in the table. */
+	/*% Nodes, in the order they were added. */
+	dns_compressnode_t	*nodes;
+	unsigned int		nodesize;	/*%< Size of the node array. */
 	uint16_t		count;		/*%< Number of nodes. */
 	isc_mem_t		*mctx;		/*%< Memory context. */
+	/*% Preallocated table and nodes. */
+	uint16_t		initialtable[DNS_COMPRESS_INITIALSLOTS];
+	dns_compressnode_t	initialnodes[DNS_COMPRESS_INITIALNODES];
 };
 
 typedef enum {
@@ -224,6 +231,8 @@ dns_compress_rollback(dns_compress_t *cctx, uint16_t offset);
 
 /*%<
  *	Remove any compression pointers from global table >= offset.
+ *	This relies on pointers being added in increasing offset order,
+ *	which is the case when rendering a message from start to end.
  *
  *	Requires:
  *\li		'cctx' is initialized.
@@ -473,6 +473,16 @@ dns_dispatch_cancel(dns_dispatch_t *disp);
  *\li	disp is valid.
  */
 
+bool
+dns_dispatch_isshuttingdown(dns_dispatch_t *disp);
+/*%<
+ * Return true if 'disp' is shutting down, e.g. because its TCP
+ * connection was closed by the peer, and will accept no new responses.
+ *
+ * Requires:
+ *\li	disp is valid.
+ */
+
 unsigned int
 dns_dispatch_getattributes(dns_dispatch_t *disp);
 /*%<
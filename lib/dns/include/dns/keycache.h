@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_KEYCACHE_H
+#define DNS_KEYCACHE_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/keycache.h
+ * \brief
+ * Defines dns_keycache_t, a cache of parsed DNSKEY records.
+ *
+ * Notes:
+ *\li	Turning a DNSKEY record into a dst_key_t means building the
+ *	crypto library's public key object, which for RSA and ECDSA is
+ *	far more expensive than looking the result up.  The validator
+ *	does this for the same few zone keys over and over, so the view
+ *	keeps the parsed keys in a key cache, indexed by owner name and
+ *	DNSKEY rdata.
+ *
+ *\li	Each entry expires at a time given by the caller, normally when
+ *	the DNSKEY RRset it came from expires from the cache.
+ *
+ *\li	The number of entries is bounded; when the bound is reached the
+ *	least recently used entries of each hash bucket are evicted.
+ *
+ *\li	The cache holds a reference to each key it stores, and hands out
+ *	new references; callers release them with dst_key_free().
+ *
+ * MP:
+ *\li	The key cache is safe for concurrent use by multiple threads.
+ *
+ * Reliability:
+ *
+ * Resources:
+ *
+ * Security:
+ *
+ * Standards:
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <isc/stdtime.h>
+
+#include <dns/types.h>
+
+#include <dst/dst.h>
+
+ISC_LANG_BEGINDECLS
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_keycache_create(isc_mem_t *mctx, unsigned int maxentries,
+		    dns_keycache_t **kcp);
+/*%
+ * Create a key cache which will hold at most 'maxentries' keys, and
+ * store it in '*kcp'.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	maxentries > 0
+ * \li	kcp != NULL && *kcp == NULL
+ */
+
+void
+dns_keycache_destroy(dns_keycache_t **kcp);
+/*%
+ * Flush and then free the key cache in '*kcp'.  '*kcp' is set to NULL
+ * on return.
+ *
+ * Requires:
+ * \li	'*kcp' to be a valid key cache
+ */
+
+isc_result_t
+dns_keycache_find(dns_keycache_t *kc, const dns_name_t *name,
+		  const dns_rdata_t *rdata, isc_stdtime_t now,
+		  dst_key_t **keyp);
+/*%
+ * Look for the key built from the DNSKEY record 'rdata' owned by
+ * 'name'.  If one is found and has not expired at 'now', attach
+ * '*keyp' to it.
+ *
+ * An expired entry is removed.
+ *
+ * Requires:
+ * \li	'kc' to be a valid key cache
+ * \li	'name' to be a valid absolute name
+ * \li	'rdata' to be a DNSKEY record
+ * \li	keyp != NULL && *keyp == NULL
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTFOUND
+ */
+
+void
+dns_keycache_add(dns_keycache_t *kc, const dns_name_t *name,
+		 const dns_rdata_t *rdata, isc_stdtime_t expire,
+		 dst_key_t *key);
+/*%
+ * Store 'key', which was built from the DNSKEY record 'rdata' owned by
+ * 'name', until 'expire'.  Any key already stored for the same record
+ * is replaced.
+ *
+ * Requires:
+ * \li	'kc' to be a valid key cache
+ * \li	'name' to be a valid absolute name
+ * \li	'rdata' to be a DNSKEY record
+ * \li	'key' to be a valid key
+ */
+
+void
+dns_keycache_flush(dns_keycache_t *kc);
+/*%
+ * Remove all the entries from the key cache.
+ *
+ * Requires:
+ * \li	'kc' to be a valid key cache
+ */
+
+unsigned int
+dns_keycache_count(dns_keycache_t *kc);
+/*%
+ * Return the number of keys in the key cache.
+ *
+ * Requires:
+ * \li	'kc' to be a valid key cache
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_KEYCACHE_H */
@@ -188,6 +188,8 @@ typedef int dns_messagetextflag_t;
 
 typedef struct dns_msgblock dns_msgblock_t;
 
+typedef bool (*dns_message_tempowner_t)(void *arg, const void *item);
+
 struct dns_sortlist_arg {
 	dns_aclenv_t *env;
 	const dns_acl_t *acl;
@@ -227,6 +229,7 @@ struct dns_message {
 	unsigned int			cc_bad : 1;
 	unsigned int			tkey : 1;
 	unsigned int			rdclass_set : 1;
+	unsigned int			nospace_predicted : 1;
 
 	unsigned int			opt_reserved;
 	unsigned int			sig_reserved;
@@ -241,6 +244,8 @@ struct dns_message {
 	isc_mem_t		       *mctx;
 	isc_mempool_t		       *namepool;
 	isc_mempool_t		       *rdspool;
+	dns_message_tempowner_t		tempowner;
+	void			       *tempowner_arg;
 
 	isc_bufferlist_t		scratchpad;
 	isc_bufferlist_t		cleanup;
@@ -267,6 +272,10 @@ struct dns_message {
 	isc_region_t			query;
 	isc_region_t			saved;
 
+	/* Question name storage for plain queries (see dns_message_parse) */
+	unsigned char			qnamedata[DNS_NAME_MAXWIRE];
+	dns_offsets_t			qnameoffsets;
+
 	dns_rdatasetorderfunc_t		order;
 	dns_sortlist_arg_t		order_arg;
 
@@ -619,6 +628,24 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t section,
  *				   all records requested.
  *\li	#DNS_R_MOREDATA		-- All requested records written, and there
  *				   are records remaining for this section.
+ *
+ * Notes:
+ *\li	Unless #DNS_MESSAGERENDER_PARTIAL applies, an RRset whose size,
+ *	as estimated by dns_rdataset_minwiresize(), exceeds the space left
+ *	is not rendered at all; the result is the same as if it had been
+ *	rendered and rolled back.
+ */
+
+bool
+dns_message_nospacepredicted(dns_message_t *msg);
+/*%<
+ * Return true if the last call to dns_message_rendersection() returned
+ * #ISC_R_NOSPACE without trying to render the RRset that did not fit,
+ * because dns_rdataset_minwiresize() showed it could not fit in the
+ * space left.
+ *
+ * Requires:
+ *\li	'msg' be valid.
  */
 
 void
@@ -959,6 +986,22 @@ dns_message_gettemprdatalist(dns_message_t *msg, dns_rdatalist_t **item);
  *\li	#ISC_R_NOMEMORY		-- No item can be allocated.
  */
 
+void
+dns_message_settempowner(dns_message_t *msg, dns_message_tempowner_t owner,
+			 void *arg);
+/*%<
+ * Tell 'msg' that names and rdatasets for which 'owner' returns true
+ * were allocated by the caller rather than taken from the message's
+ * pools.  They are not returned to the pools when they are released
+ * with dns_message_puttempname() or dns_message_puttemprdataset(), or
+ * when the message is reset; the caller must keep them valid until
+ * then and reclaim them itself.  'owner' is called with 'arg' and the
+ * name or rdataset being released.
+ *
+ * Requires:
+ *\li	msg be a valid message.
+ */
+
 void
 dns_message_puttempname(dns_message_t *msg, dns_name_t **item);
 /*%<
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_PROOFCACHE_H
+#define DNS_PROOFCACHE_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/proofcache.h
+ * \brief
+ * Defines dns_proofcache_t, a per-zone cache of the records that
+ * prove the nonexistence of names in an NSEC-signed zone.
+ *
+ * Notes:
+ *\li	The cache holds the zone's SOA and the NSEC RRsets, with their
+ *	signatures, taken from NXDOMAIN and NODATA responses built from
+ *	the zone database, indexed by owner name in a qp-trie (see
+ *	dns/qp.h).  A later query for a name that falls strictly inside
+ *	one of the cached NSEC ranges, and whose source of synthesis is
+ *	covered by another (or the same) cached range, can then be
+ *	answered with NXDOMAIN by two predecessor lookups in the trie,
+ *	instead of the four or more database lookups it otherwise takes.
+ *	A query for a type that the cached NSEC record at the query name
+ *	says is absent can be answered with NODATA by one lookup.
+ *
+ *\li	The rdatasets are bound to the zone database, so they are
+ *	rendered straight from its rdataslabs.
+ *
+ *\li	Every entry is tagged with the zone generation (see
+ *	dns_zone_getgeneration()) it was found in; the cache is flushed
+ *	as soon as a newer generation is seen.
+ *
+ *\li	The number of NSEC RRsets kept is bounded; the oldest ones are
+ *	removed first.  A cache with a limit of zero keeps nothing.
+ *
+ *\li	NSEC3 proofs are not cached.
+ *
+ * MP:
+ *\li	The cache is safe for concurrent use by multiple threads.
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <inttypes.h>
+
+#include <isc/lang.h>
+
+#include <dns/fixedname.h>
+#include <dns/rdataset.h>
+#include <dns/types.h>
+
+ISC_LANG_BEGINDECLS
+
+/*%
+ * The records proving that a name does not exist, as returned by
+ * dns_proofcache_findnxdomain(), or that it has no data of a type, as
+ * returned by dns_proofcache_findnodata().  'wild' and 'wildsig' are
+ * not associated when the NSEC covering the name also covers the
+ * wildcard, or for NODATA.
+ */
+typedef struct dns_nxproof {
+	dns_rdataset_t		soa;
+	dns_rdataset_t		soasig;
+	dns_fixedname_t		nsecname;
+	dns_rdataset_t		nsec;
+	dns_rdataset_t		nsecsig;
+	dns_fixedname_t		wildname;
+	dns_rdataset_t		wild;
+	dns_rdataset_t		wildsig;
+} dns_nxproof_t;
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_proofcache_create(isc_mem_t *mctx, dns_proofcache_t **pcp);
+/*%
+ * Create an empty proof cache with a limit of zero entries, and store
+ * it in '*pcp'.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	pcp != NULL && *pcp == NULL
+ */
+
+void
+dns_proofcache_destroy(dns_proofcache_t **pcp);
+/*%
+ * Flush and free '*pcp', and set it to NULL.
+ *
+ * Requires:
+ * \li	'*pcp' to be a valid proof cache
+ */
+
+void
+dns_proofcache_setmaxentries(dns_proofcache_t *pc, unsigned int maxentries);
+/*%
+ * Keep at most 'maxentries' NSEC RRsets in 'pc', removing the oldest
+ * ones if there are more.  Zero disables the cache.
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ */
+
+unsigned int
+dns_proofcache_getmaxentries(dns_proofcache_t *pc);
+/*%
+ * Return the limit set by dns_proofcache_setmaxentries().
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ */
+
+isc_result_t
+dns_proofcache_add(dns_proofcache_t *pc, uint64_t generation,
+		   const dns_name_t *name, dns_rdataset_t *rdataset,
+		   dns_rdataset_t *sigrdataset);
+/*%
+ * Store the SOA or NSEC RRset 'rdataset', owned by 'name', and its
+ * signatures 'sigrdataset', read from the zone when its generation was
+ * 'generation'.  If 'generation' is newer than that of the records
+ * already in the cache, they are flushed first; if it is older,
+ * nothing is stored.
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ * \li	'name' to be a valid absolute name
+ * \li	'rdataset' and 'sigrdataset' to be valid rdatasets
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS		the RRset was stored, or was not stored
+ *				because the cache is disabled or the
+ *				generation is old
+ * \li	#ISC_R_EXISTS		an NSEC RRset is already stored for 'name'
+ * \li	#ISC_R_NOTIMPLEMENTED	'rdataset' is neither an SOA nor an NSEC
+ *				RRset, or 'sigrdataset' is not associated
+ */
+
+isc_result_t
+dns_proofcache_findnxdomain(dns_proofcache_t *pc, uint64_t generation,
+			    const dns_name_t *name, dns_nxproof_t *proof);
+/*%
+ * Look for the records proving that 'name', a name below the zone
+ * apex, does not exist in the zone generation 'generation': an NSEC
+ * record whose owner is before 'name' and whose next name is after it,
+ * and which shows that no name exists below 'name' and that 'name' is
+ * not below a zone cut or a DNAME; one covering the wildcard at the
+ * closest encloser of 'name'; and the SOA.  If found, bind them to
+ * 'proof'.
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ * \li	'name' to be a valid absolute name
+ * \li	'proof' to have been initialized by dns_nxproof_init() and not
+ *	to be bound
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTFOUND
+ */
+
+isc_result_t
+dns_proofcache_findnodata(dns_proofcache_t *pc, uint64_t generation,
+			  const dns_name_t *name, dns_rdatatype_t type,
+			  dns_nxproof_t *proof);
+/*%
+ * Look for the records proving that 'name' has no 'type' RRset in the
+ * zone generation 'generation': the NSEC record owned by 'name', if
+ * it has neither 'type' nor CNAME in its type bitmap and 'name' is
+ * neither a delegation point nor a DNAME owner; and the SOA.  If found,
+ * bind them to 'proof'.
+ *
+ * Wildcard and empty non-terminal NODATA proofs are not cached.
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ * \li	'name' to be a valid absolute name
+ * \li	'proof' to have been initialized by dns_nxproof_init() and not
+ *	to be bound
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTFOUND		also when 'type' is a meta type
+ */
+
+void
+dns_proofcache_flush(dns_proofcache_t *pc);
+/*%
+ * Remove everything from 'pc'.
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ */
+
+unsigned int
+dns_proofcache_count(dns_proofcache_t *pc);
+/*%
+ * Return the number of NSEC RRsets in 'pc'.
+ *
+ * Requires:
+ * \li	'pc' to be a valid proof cache
+ */
+
+void
+dns_nxproof_init(dns_nxproof_t *proof);
+/*%
+ * Initialize 'proof'.
+ */
+
+void
+dns_nxproof_invalidate(dns_nxproof_t *proof);
+/*%
+ * Disassociate the rdatasets bound to 'proof', if any.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_PROOFCACHE_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_QP_H
+#define DNS_QP_H 1
+
+/*! \file dns/qp.h
+ * \brief
+ * A qp-trie is a compact radix tree keyed on domain names.
+ *
+ * Names are converted to keys in which every byte (a "shift") selects
+ * one of the twigs of a branch node.  The conversion is arranged so
+ * that the lexical order of keys is the DNS canonical order of the
+ * names, so the trie can be used both for exact lookups and for
+ * finding the closest predecessor of a name (e.g. for NSEC proofs).
+ *
+ * Unlike the red/black tree of trees (dns/rbt.h), the trie does not
+ * store the names: each leaf holds a pointer to caller-owned data, and
+ * the name of a leaf is obtained from that data through a callback
+ * when it is needed to complete a search.  Every node is two words,
+ * and branch nodes have only as many twigs as they need, so the trie
+ * uses much less memory per name than the RBT, and a lookup touches at
+ * most one node per differing byte of the key without ever comparing
+ * names label by label.
+ *
+ * MP:
+ *\li	The trie does no locking; callers are expected to serialize
+ *	modifications and to exclude readers while they happen.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/lang.h>
+#include <isc/types.h>
+
+#include <dns/types.h>
+
+ISC_LANG_BEGINDECLS
+
+/*%
+ * The maximum length of a key: every byte of a name may need two
+ * shifts, plus one for each label separator.
+ */
+#define DNS_QP_MAXKEY	512
+
+typedef uint8_t dns_qpkey_t[DNS_QP_MAXKEY];
+
+typedef const dns_name_t *(*dns_qpgetname_t)(void *data, void *arg);
+/*%<
+ * Return the name under which 'data' was inserted.  The name must
+ * remain valid and unchanged for as long as 'data' is in the trie.
+ */
+
+typedef void (*dns_qpdeleter_t)(void *data, void *arg);
+
+/***
+ *** Functions
+ ***/
+
+size_t
+dns_qpkey_fromname(dns_qpkey_t key, const dns_name_t *name);
+/*%<
+ * Convert 'name' into a qp-trie key, returning the length of the key.
+ *
+ * Keys of different names compare (with memcmp() over the shorter
+ * length, the shorter key sorting first on a tie) in the same order as
+ * dns_name_compare() orders the names.
+ *
+ * Requires:
+ *\li	'name' is a valid absolute name.
+ */
+
+isc_result_t
+dns_qp_create(isc_mem_t *mctx, dns_qpgetname_t getname,
+	      dns_qpdeleter_t deleter, void *arg, dns_qp_t **qpp);
+/*%<
+ * Create an empty qp-trie.
+ *
+ * 'getname' is used to obtain the name of the data stored in a leaf.
+ * 'deleter', if not NULL, is called for the data of every leaf that is
+ * removed from the trie or still present when it is destroyed.  'arg'
+ * is passed to both.
+ *
+ * Requires:
+ *\li	'mctx' is a valid memory context.
+ *\li	'getname' is not NULL.
+ *\li	qpp != NULL && *qpp == NULL
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ */
+
+void
+dns_qp_destroy(dns_qp_t **qpp);
+/*%<
+ * Destroy a qp-trie, calling the deleter for all data still in it.
+ *
+ * Requires:
+ *\li	'*qpp' is a valid qp-trie.
+ *
+ * Ensures:
+ *\li	*qpp == NULL
+ */
+
+unsigned int
+dns_qp_count(dns_qp_t *qp);
+/*%<
+ * Return the number of names in the trie.
+ */
+
+isc_result_t
+dns_qp_insert(dns_qp_t *qp, void *data);
+/*%<
+ * Add 'data' to the trie, under the name returned by the getname
+ * callback.
+ *
+ * Requires:
+ *\li	'qp' is a valid qp-trie.
+ *\li	'data' is not NULL.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_EXISTS	The name is already in the trie; the trie is
+ *			unaltered.
+ */
+
+isc_result_t
+dns_qp_findname(dns_qp_t *qp, const dns_name_t *name, void **datap);
+/*%<
+ * Find the data stored under exactly 'name'.
+ *
+ * Requires:
+ *\li	'qp' is a valid qp-trie.
+ *\li	datap != NULL && *datap == NULL
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND
+ */
+
+isc_result_t
+dns_qp_findprevious(dns_qp_t *qp, const dns_name_t *name, void **datap);
+/*%<
+ * Find the data stored under the greatest name that is less than or
+ * equal to 'name' in DNS canonical order.
+ *
+ * Requires:
+ *\li	'qp' is a valid qp-trie.
+ *\li	datap != NULL && *datap == NULL
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND	All the names in the trie are greater than
+ *			'name', or the trie is empty.
+ */
+
+isc_result_t
+dns_qp_deletename(dns_qp_t *qp, const dns_name_t *name);
+/*%<
+ * Remove 'name' from the trie, calling the deleter for its data.
+ *
+ * Requires:
+ *\li	'qp' is a valid qp-trie.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_QP_H */
@@ -165,11 +165,14 @@ typedef isc_result_t (*dns_rbtfindcallback_t)(dns_rbtnode_t *node,
 
 typedef isc_result_t (*dns_rbtdatawriter_t)(FILE *file,
 					    unsigned char *data,
+					    uintptr_t base,
+					    uintptr_t node,
 					    void *arg,
 					    uint64_t *crc);
 
 typedef isc_result_t (*dns_rbtdatafixer_t)(dns_rbtnode_t *rbtnode,
 					   void *base, size_t offset,
+					   uintptr_t filebase,
 					   void *arg, uint64_t *crc);
 
 typedef void (*dns_rbtdeleter_t)(void *, void *);
@@ -717,15 +720,24 @@ dns_rbt_serialize_align(off_t target);
  */
 
 isc_result_t
-dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
+dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt, uintptr_t base,
 		       dns_rbtdatawriter_t datawriter,
 		       void *writer_arg, off_t *offset);
 /*%<
  * Write out the RBT structure and its data to a file.
  *
+ * Every pointer is written as the address it will have when the file is
+ * mapped at 'base', together with a node hash table for that mapping.
+ * 'datawriter' is called for each node with data, with the file
+ * positioned where the data goes; it is passed 'base' and the address
+ * the node will have, and must write its own pointers the same way.
+ *
  * Notes:
  * \li  The file must be an actual file which allows seek() calls, so it cannot
  *      be a stream.  Returns ISC_R_INVALIDFILE if not.
+ *
+ * \li  A 'base' of zero means the file is not meant to be mapped at any
+ *      particular address.
  */
 
 isc_result_t
@@ -739,6 +751,14 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
  *
  * If 'originp' is not NULL, then it is pointed to the root node of the RBT.
  *
+ * If the file is mapped at the address it was written for, the tree is
+ * used in place: every node is checked, and 'datafixer' is called for
+ * each node with data with 'filebase' equal to 'base', to check the
+ * data without changing it.  Otherwise, every node is relocated and
+ * checked, and 'datafixer' is called for each node with data, with
+ * 'filebase' set to the address the file was written for.  Either way,
+ * the file's CRC is checked.
+ *
  * Notes:
  * \li  The file must be an actual file which allows seek() calls, so it cannot
  *      be a stream.  This condition is not checked in the code.
@@ -93,6 +93,12 @@ typedef struct dns_rdatasetmethods {
 	isc_result_t		(*addglue)(dns_rdataset_t *rdataset,
 					   dns_dbversion_t *version,
 					   dns_message_t *msg);
+	/*
+	 * Return the rdataslab (see dns/rdataslab.h) holding the rdata,
+	 * without its reserved header, or NULL if the rdata cannot be
+	 * read from it directly.  Used to speed up rendering.
+	 */
+	unsigned char *		(*getslab)(dns_rdataset_t *rdataset);
 } dns_rdatasetmethods_t;
 
 #define DNS_RDATASET_MAGIC	       ISC_MAGIC('D','N','S','R')
@@ -462,6 +468,23 @@ dns_rdataset_towirepartial(dns_rdataset_t *rdataset,
  *		      written.
  */
 
+unsigned int
+dns_rdataset_minwiresize(dns_rdataset_t *rdataset,
+			 const dns_name_t *owner_name);
+/*%<
+ * Return a lower bound of the number of bytes dns_rdataset_towire()
+ * would write for 'rdataset', owned by 'owner_name', without rendering
+ * it.  The bound is exact, save for name compression, when the rdata
+ * are read from an rdataslab and contain no names; otherwise it only
+ * accounts for the fixed part of each record.  0 is returned for
+ * question and negative rdatasets.
+ *
+ * Requires:
+ *\li	'rdataset' is a valid rdataset.
+ *
+ *\li	'owner_name' is a valid name.
+ */
+
 isc_result_t
 dns_rdataset_additionaldata(dns_rdataset_t *rdataset,
 			    dns_additionaldatafunc_t add, void *arg);
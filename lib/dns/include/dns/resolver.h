@@ -154,6 +154,13 @@ typedef enum {
 #define DNS_RESOLVER_CHECKNAMES		0x01
 #define DNS_RESOLVER_CHECKNAMESFAIL	0x02
 
+/*
+ * Limits of the TCP connection pool settings, see
+ * dns_resolver_settcppool().
+ */
+#define DNS_RESOLVER_TCPMAXCONNS	16
+#define DNS_RESOLVER_TCPMAXIDLE		300	/*%< seconds */
+
 #define DNS_QMIN_MAXLABELS		7
 #define DNS_QMIN_MAX_NO_DELEGATION	3
 #define DNS_MAX_LABELS			127
@@ -558,6 +565,16 @@ dns_resolver_gettimeout(dns_resolver_t *resolver);
  * \li  resolver to be valid.
  */
 
+unsigned int
+dns_resolver_retrywait(unsigned int interval, unsigned int srtt);
+/*%<
+ * Return how long, in microseconds, the resolver waits for an answer
+ * from a server whose smoothed round trip time is 'srtt' microseconds,
+ * when the retry interval (after any backoff) is 'interval'
+ * microseconds: at least the srtt with some margin, but no more than
+ * ten seconds.
+ */
+
 void
 dns_resolver_setclientsperquery(dns_resolver_t *resolver,
 				uint32_t min, uint32_t max);
@@ -607,6 +624,100 @@ dns_resolver_setnonbackofftries(dns_resolver_t *resolver, unsigned int tries);
  * \li  tries > 0.
  */
 
+unsigned int
+dns_resolver_gethedging(dns_resolver_t *resolver);
+
+void
+dns_resolver_sethedging(dns_resolver_t *resolver, unsigned int percent);
+/*%<
+ * Sets the number of hedged queries the resolver may send, as a
+ * percentage of the queries it sends.  When a UDP query to a server
+ * goes unanswered for longer than the 95th percentile of recent query
+ * RTTs (or the server's own smoothed RTT, if that is longer), the same
+ * query is also sent to the next server, and the first answer is used.
+ * 0, the default, disables hedging.
+ *
+ * Requires:
+ * \li	resolver to be valid.
+ * \li  percent <= 100.
+ */
+
+void
+dns_resolver_gettcppool(dns_resolver_t *resolver, unsigned int *maxconns,
+			unsigned int *idletime);
+
+void
+dns_resolver_settcppool(dns_resolver_t *resolver, unsigned int maxconns,
+			unsigned int idletime);
+/*%<
+ * Configures the pool of TCP connections to remote servers.  When
+ * 'maxconns' is non-zero, a TCP connection opened for a query is kept
+ * open afterwards, up to 'maxconns' connections per server, and later
+ * TCP queries to the same server are pipelined over it rather than
+ * opening a new one.  An idle connection is closed after 'idletime'
+ * seconds, or sooner if the server asks for that with the EDNS TCP
+ * keepalive option, which is sent on every query over TCP while the
+ * pool is enabled.  A connection over which a query times out is not
+ * reused.
+ *
+ * 0 for either value, 'maxconns' being the default, disables the pool
+ * and closes the connections in it once they have no queries in flight.
+ *
+ * Requires:
+ * \li	resolver to be valid.
+ * \li	maxconns != NULL and idletime != NULL (get).
+ * \li	maxconns <= DNS_RESOLVER_TCPMAXCONNS and
+ *	idletime <= DNS_RESOLVER_TCPMAXIDLE (set).
+ */
+
+void
+dns_resolver_getrefresh(dns_resolver_t *resolver, unsigned int *qps,
+			unsigned int *hits);
+
+void
+dns_resolver_setrefresh(dns_resolver_t *resolver, unsigned int qps,
+			unsigned int hits);
+/*%<
+ * Configures the refreshing of popular cache entries.  When 'qps' is
+ * non-zero, RRsets reported with dns_resolver_refreshhit() are fetched
+ * again shortly before they expire, provided they were looked up at
+ * least 'hits' times since they were last fetched, so that clients
+ * asking for them do not wait for a cache miss.  At most 'qps' such
+ * fetches are started per second; entries that cannot be refreshed in
+ * time are left to expire.
+ *
+ * 0 for 'qps', the default, disables refreshing and forgets the
+ * entries being tracked.  A 'hits' value of 0 is taken as 1.
+ *
+ * Requires:
+ * \li	resolver to be valid.
+ * \li	qps != NULL and hits != NULL (get).
+ */
+
+void
+dns_resolver_refreshhit(dns_resolver_t *resolver, const dns_name_t *name,
+			dns_rdataset_t *rdataset);
+/*%<
+ * Note that 'rdataset', owned by 'name', was found in the cache while
+ * answering a query.  The lookup count kept with the cached RRset is
+ * sampled, so only some calls do any work; those for negative, stale
+ * or short-lived RRsets do none.
+ *
+ * Requires:
+ * \li	resolver to be valid.
+ * \li	'rdataset' to be a valid rdataset bound to the cache.
+ */
+
+unsigned int
+dns_resolver_gethedgedelay(dns_resolver_t *resolver);
+/*%<
+ * Returns the current hedge delay in microseconds, or 0 if hedging is
+ * disabled or not enough query RTTs have been seen yet to set it.
+ *
+ * Requires:
+ * \li	resolver to be valid.
+ */
+
 unsigned int
 dns_resolver_getoptions(dns_resolver_t *resolver);
 /*%<
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_SIGCACHE_H
+#define DNS_SIGCACHE_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/sigcache.h
+ * \brief
+ * Defines dns_sigcache_t, a cache of RRSIG verification results.
+ *
+ * Notes:
+ *\li	The public key operation in dns_dnssec_verify() is the most
+ *	expensive part of validation, and the validator repeats it for
+ *	the same signature over the same RRset whenever the data is
+ *	fetched again.  The signature cache remembers the outcome.
+ *
+ *\li	Entries are indexed by a SHA-256 digest of everything the
+ *	outcome depends on: the owner name, type and class, the sorted
+ *	rdata of the RRset, the RRSIG rdata, the key and the size limit
+ *	on keys.  See dns_sigcache_digest().
+ *
+ *\li	Each entry is only used between the inception and expiration
+ *	times of the RRSIG it was made for, and is removed once that
+ *	window has passed.
+ *
+ *\li	The number of entries is bounded; when the bound is reached the
+ *	least recently used entries of each hash bucket are evicted.
+ *
+ * MP:
+ *\li	The signature cache is safe for concurrent use by multiple threads.
+ *
+ * Reliability:
+ *
+ * Resources:
+ *
+ * Security:
+ *\li	A verification result is only reused for the exact same input,
+ *	so the cache cannot make a signature valid that would not have
+ *	been; the digest is long enough that collisions can be ignored.
+ *
+ * Standards:
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <isc/stdtime.h>
+
+#include <dns/types.h>
+
+#include <dst/dst.h>
+
+ISC_LANG_BEGINDECLS
+
+#define DNS_SIGCACHE_DIGESTLENGTH	32
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_sigcache_create(isc_mem_t *mctx, unsigned int maxentries,
+		    dns_sigcache_t **scp);
+/*%
+ * Create a signature cache which will hold at most 'maxentries'
+ * results, and store it in '*scp'.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	maxentries > 0
+ * \li	scp != NULL && *scp == NULL
+ */
+
+void
+dns_sigcache_destroy(dns_sigcache_t **scp);
+/*%
+ * Flush and then free the signature cache in '*scp'.  '*scp' is set to
+ * NULL on return.
+ *
+ * Requires:
+ * \li	'*scp' to be a valid signature cache
+ */
+
+isc_result_t
+dns_sigcache_digest(const dns_name_t *name, dns_rdataset_t *rdataset,
+		    dns_rdata_t *sigrdata, dst_key_t *key,
+		    unsigned int maxbits, isc_mem_t *mctx,
+		    unsigned char *digest);
+/*%
+ * Compute the digest identifying the verification of the signature
+ * 'sigrdata' over 'rdataset', owned by 'name', with 'key' and a key
+ * size limit of 'maxbits', as dns_dnssec_verify() would do it.  The
+ * rdata are sorted so that the order of the RRset does not matter.
+ *
+ * Requires:
+ * \li	'name' to be a valid absolute name
+ * \li	'rdataset' to be a valid rdataset
+ * \li	'sigrdata' to be an RRSIG record
+ * \li	'key' to be a valid key
+ * \li	'digest' to point to DNS_SIGCACHE_DIGESTLENGTH bytes
+ */
+
+isc_result_t
+dns_sigcache_find(dns_sigcache_t *sc, const unsigned char *digest,
+		  isc_stdtime_t now, isc_result_t *resultp, dns_name_t *wild);
+/*%
+ * Look for the result of the verification identified by 'digest'.  If
+ * one is found and 'now' is within the signature's validity period,
+ * store it in '*resultp'.  If the result is #DNS_R_FROMWILDCARD and
+ * 'wild' is not NULL, the wildcard name is copied to 'wild'.
+ *
+ * An entry whose validity period has passed is removed.
+ *
+ * Requires:
+ * \li	'sc' to be a valid signature cache
+ * \li	digest != NULL
+ * \li	resultp != NULL
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTFOUND
+ */
+
+void
+dns_sigcache_add(dns_sigcache_t *sc, const unsigned char *digest,
+		 isc_stdtime_t inception, isc_stdtime_t expire,
+		 isc_result_t result, const dns_name_t *wild);
+/*%
+ * Store 'result' as the result of the verification identified by
+ * 'digest', for a signature valid from 'inception' until 'expire'.
+ * 'wild' is the wildcard name when 'result' is #DNS_R_FROMWILDCARD.
+ * Any result already stored for the same digest is replaced.
+ *
+ * Requires:
+ * \li	'sc' to be a valid signature cache
+ * \li	digest != NULL
+ * \li	'wild' to be a valid absolute name if 'result' is
+ *	#DNS_R_FROMWILDCARD
+ */
+
+void
+dns_sigcache_flush(dns_sigcache_t *sc);
+/*%
+ * Remove all the entries from the signature cache.
+ *
+ * Requires:
+ * \li	'sc' to be a valid signature cache
+ */
+
+unsigned int
+dns_sigcache_count(dns_sigcache_t *sc);
+/*%
+ * Return the number of results in the signature cache.
+ *
+ * Requires:
+ * \li	'sc' to be a valid signature cache
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_SIGCACHE_H */
@@ -70,7 +70,18 @@ enum {
 	dns_resstatscounter_serverquota = 42,
 	dns_resstatscounter_nextitem = 43,
 	dns_resstatscounter_priming = 44,
-	dns_resstatscounter_max = 45,
+	dns_resstatscounter_keycachehit = 45,
+	dns_resstatscounter_keycachemiss = 46,
+	dns_resstatscounter_sigcachehit = 47,
+	dns_resstatscounter_sigcachemiss = 48,
+	dns_resstatscounter_hedge = 49,
+	dns_resstatscounter_hedgewon = 50,
+	dns_resstatscounter_tcpconnect = 51,
+	dns_resstatscounter_tcpreuse = 52,
+	dns_resstatscounter_refresh = 53,
+	dns_resstatscounter_refreshused = 54,
+	dns_resstatscounter_refreshskipped = 55,
+	dns_resstatscounter_max = 56,
 
 	/*
 	 * DNSSEC stats.
@@ -108,8 +119,11 @@ enum {
 	dns_adbstats_entriescnt = 1,
 	dns_adbstats_nnames = 2,
 	dns_adbstats_namescnt = 3,
+	dns_adbstats_resizes = 4,
+	dns_adbstats_resizemax = 5,
+	dns_adbstats_explore = 6,
 
-	dns_adbstats_max = 4,
+	dns_adbstats_max = 7,
 
 	/*
 	 * Cache statistics values.
@@ -36,6 +36,7 @@ typedef ISC_LIST(dns_adbaddrinfo_t)		dns_adbaddrinfolist_t;
 typedef struct dns_adbentry			dns_adbentry_t;
 typedef struct dns_adbfind			dns_adbfind_t;
 typedef ISC_LIST(dns_adbfind_t)			dns_adbfindlist_t;
+typedef struct dns_anscache			dns_anscache_t;
 typedef struct dns_badcache 			dns_badcache_t;
 typedef struct dns_byaddr			dns_byaddr_t;
 typedef struct dns_catz_zonemodmethods		dns_catz_zonemodmethods_t;
@@ -96,6 +97,7 @@ typedef ISC_LIST(dns_kasp_t)			dns_kasplist_t;
 typedef struct dns_kasp_key			dns_kasp_key_t;
 typedef ISC_LIST(dns_kasp_key_t)		dns_kasp_keylist_t;
 typedef uint16_t				dns_keyflags_t;
+typedef struct dns_keycache			dns_keycache_t;
 typedef struct dns_keynode			dns_keynode_t;
 typedef ISC_LIST(dns_keynode_t)			dns_keynodelist_t;
 typedef struct dns_keytable			dns_keytable_t;
@@ -118,6 +120,8 @@ typedef struct dns_order			dns_order_t;
 typedef struct dns_peer				dns_peer_t;
 typedef struct dns_peerlist			dns_peerlist_t;
 typedef struct dns_portlist			dns_portlist_t;
+typedef struct dns_proofcache			dns_proofcache_t;
+typedef struct dns_qp				dns_qp_t;
 typedef struct dns_rbt				dns_rbt_t;
 typedef uint16_t				dns_rcode_t;
 typedef struct dns_rdata			dns_rdata_t;
@@ -134,6 +138,7 @@ typedef struct dns_resolver			dns_resolver_t;
 typedef struct dns_sdbimplementation		dns_sdbimplementation_t;
 typedef uint8_t					dns_secalg_t;
 typedef uint8_t					dns_secproto_t;
+typedef struct dns_sigcache			dns_sigcache_t;
 typedef struct dns_signature			dns_signature_t;
 typedef struct dns_sortlist_arg			dns_sortlist_arg_t;
 typedef struct dns_ssurule			dns_ssurule_t;
@@ -148,6 +153,7 @@ typedef struct dns_tsigkey			dns_tsigkey_t;
 typedef uint32_t				dns_ttl_t;
 typedef struct dns_update_state			dns_update_state_t;
 typedef struct dns_validator			dns_validator_t;
+typedef struct dns_verifypool			dns_verifypool_t;
 typedef struct dns_view				dns_view_t;
 typedef ISC_LIST(dns_view_t)			dns_viewlist_t;
 typedef struct dns_zone				dns_zone_t;
@@ -56,6 +56,7 @@
 #include <dns/types.h>
 #include <dns/rdataset.h>
 #include <dns/rdatastruct.h> /* for dns_rdata_rrsig_t */
+#include <dns/sigcache.h>
 
 #include <dst/dst.h>
 
@@ -149,6 +150,12 @@ struct dns_validator {
 	unsigned int			authcount;
 	unsigned int			authfail;
 	isc_stdtime_t			start;
+	/* Result of a verification done by the view's verify pool. */
+	isc_result_t			vresult;
+	bool				vignore;
+	dns_fixedname_t			vwild;
+	bool				vcached;
+	unsigned char			vdigest[DNS_SIGCACHE_DIGESTLENGTH];
 };
 
 /*%
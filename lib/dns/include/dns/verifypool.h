@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_VERIFYPOOL_H
+#define DNS_VERIFYPOOL_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/verifypool.h
+ * \brief
+ * Defines dns_verifypool_t, a set of tasks for DNSSEC signature
+ * verification.
+ *
+ * Notes:
+ *\li	A public key verification takes from tens of microseconds to
+ *	milliseconds.  Done inline, it holds up every other event queued
+ *	to the same task, such as the completion of unrelated fetches.
+ *	A verify pool runs dns_dnssec_verify() on tasks of its own,
+ *	bound in turn to the worker threads of a task manager it is
+ *	given, and sends the result back to the caller's task.
+ *
+ *\li	Requests are spread over the pool's tasks, each of which
+ *	verifies one signature at a time before letting the other tasks
+ *	of its worker thread run.  None of the supported crypto libraries
+ *	offers batch verification, so each signature is verified on its
+ *	own.
+ *
+ *\li	The pool does not own the task manager, so it may be detached
+ *	for the last time from any task, including its own.
+ *
+ * MP:
+ *\li	The verify pool is safe for concurrent use by multiple threads.
+ *
+ * Reliability:
+ *
+ * Resources:
+ *\li	The pool creates 'ntasks' tasks, and no threads.
+ *
+ * Security:
+ *
+ * Standards:
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <stdbool.h>
+
+#include <isc/event.h>
+#include <isc/lang.h>
+
+#include <dns/fixedname.h>
+#include <dns/rdata.h>
+#include <dns/rdataset.h>
+#include <dns/types.h>
+
+#include <dst/dst.h>
+
+ISC_LANG_BEGINDECLS
+
+/*%
+ * The event sent to the caller of dns_verifypool_verify() when the
+ * verification is done.  'result' and 'ignoretime' are as described
+ * there; when 'result' is #DNS_R_FROMWILDCARD, 'wild' holds the
+ * wildcard name.  The remaining fields are private.
+ */
+typedef struct dns_verifyevent {
+	ISC_EVENT_COMMON(struct dns_verifyevent);
+	isc_result_t			result;
+	bool				ignoretime;
+	dns_fixedname_t			wild;
+	/* Private. */
+	dns_verifypool_t		*pool;
+	isc_task_t			*task;
+	isc_taskaction_t		action;
+	void				*arg;
+	dns_fixedname_t			name;
+	dns_rdataset_t			rdataset;
+	dst_key_t			*key;
+	dns_rdata_t			sigrdata;
+	bool				acceptexpired;
+	unsigned int			maxbits;
+} dns_verifyevent_t;
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_verifypool_create(isc_mem_t *mctx, isc_taskmgr_t *taskmgr,
+		      unsigned int ntasks, dns_verifypool_t **poolp);
+/*%
+ * Create a verify pool with 'ntasks' tasks of 'taskmgr', and store it
+ * in '*poolp'.  'taskmgr' must outlive the pool.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	taskmgr != NULL
+ * \li	ntasks > 0
+ * \li	poolp != NULL && *poolp == NULL
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	Other results if the tasks could not be created.
+ */
+
+void
+dns_verifypool_attach(dns_verifypool_t *source, dns_verifypool_t **targetp);
+/*%
+ * Attach '*targetp' to 'source'.
+ *
+ * Requires:
+ * \li	'source' to be a valid verify pool
+ * \li	targetp != NULL && *targetp == NULL
+ */
+
+void
+dns_verifypool_detach(dns_verifypool_t **poolp);
+/*%
+ * Detach '*poolp' from its verify pool.  When the last reference goes
+ * the pool's tasks are detached and the pool is freed.
+ *
+ * Requires:
+ * \li	'*poolp' to be a valid verify pool
+ */
+
+unsigned int
+dns_verifypool_size(dns_verifypool_t *pool);
+/*%
+ * Return the number of tasks of 'pool'.
+ *
+ * Requires:
+ * \li	'pool' to be a valid verify pool
+ */
+
+isc_result_t
+dns_verifypool_verify(dns_verifypool_t *pool, const dns_name_t *name,
+		      dns_rdataset_t *rdataset, dst_key_t *key,
+		      bool acceptexpired, unsigned int maxbits,
+		      dns_rdata_t *sigrdata, isc_task_t *task,
+		      isc_taskaction_t action, void *arg);
+/*%
+ * Verify the RRSIG 'sigrdata' over 'rdataset', owned by 'name', with
+ * 'key' as dns_dnssec_verify() would, on one of the pool's tasks.
+ * When done, a #DNS_EVENT_VERIFYDONE dns_verifyevent_t is sent to
+ * 'task' with 'action' and 'arg'; the receiver frees it with
+ * isc_event_free().
+ *
+ * If 'acceptexpired' is true and the signature is outside its validity
+ * period, it is verified again ignoring the time, and 'ignoretime' is
+ * set in the event.
+ *
+ * 'name', 'sigrdata' and the reference to 'rdataset' are copied, and
+ * 'key' is attached, so the caller need not keep them until the event
+ * arrives.
+ *
+ * Requires:
+ * \li	'pool' to be a valid verify pool
+ * \li	'name' to be a valid absolute name
+ * \li	'rdataset' to be a valid rdataset
+ * \li	'key' to be a valid key
+ * \li	'sigrdata' to be an RRSIG record
+ * \li	'task' to be a valid task, not one of the pool's own
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_VERIFYPOOL_H */
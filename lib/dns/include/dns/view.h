@@ -172,6 +172,7 @@ struct dns_view {
 	dns_ttl_t			staleanswerttl;
 	dns_stale_answer_t		staleanswersok;		/* rndc setting */
 	bool				staleanswersenable;	/* named.conf setting */
+	bool				staleanswerrevalidate;
 	uint16_t			nocookieudp;
 	uint16_t			padding;
 	dns_acl_t *			pad_acl;
@@ -184,6 +185,10 @@ struct dns_view {
 	dns_dlzdblist_t 		dlz_unsearched;
 	uint32_t			fail_ttl;
 	dns_badcache_t			*failcache;
+	dns_anscache_t			*anscache;
+	dns_keycache_t			*keycache;
+	dns_sigcache_t			*sigcache;
+	dns_verifypool_t		*verifypool;
 
 	/*
 	 * Configurable data for server use only,
@@ -304,6 +304,26 @@ dns_zone_setmaxrecords(dns_zone_t *zone, uint32_t records);
  *\li	void
  */
 
+void
+dns_zone_setproofcachesize(dns_zone_t *zone, uint32_t size);
+/*%<
+ * 	Sets the maximum number of NSEC RRsets the zone's proof cache
+ *	keeps (see dns/proofcache.h).  0 disables the cache.
+ *
+ * Requires:
+ *\li	'zone' to be valid initialised zone.
+ */
+
+dns_proofcache_t *
+dns_zone_getproofcache(dns_zone_t *zone);
+/*%<
+ *	Return the zone's proof cache.  It is valid for as long as the
+ *	zone is, and is flushed whenever the zone's database is detached.
+ *
+ * Requires:
+ *\li	'zone' to be valid initialised zone.
+ */
+
 uint32_t
 dns_zone_getmaxrecords(dns_zone_t *zone);
 /*%<
@@ -471,6 +491,20 @@ dns_zone_getdb(dns_zone_t *zone, dns_db_t **dbp);
  *\li	DNS_R_NOTLOADED
  */
 
+uint64_t
+dns_zone_getgeneration(dns_zone_t *zone);
+/*%<
+ *	Return the zone's generation number.  It changes whenever the
+ *	zone's database is replaced or a new version of it is committed,
+ *	and is never reused, even by a different zone.  Callers that
+ *	derive data from the zone contents can tag it with the generation
+ *	read before looking at the database, and discard it once the
+ *	generation has changed.
+ *
+ * Require:
+ *\li	'zone' to be a valid zone.
+ */
+
 void
 dns_zone_setdb(dns_zone_t *zone, dns_db_t *db);
 /*%<
@@ -15,6 +15,7 @@
 
 /*! \file dns/zt.h */
 
+#include <inttypes.h>
 #include <stdbool.h>
 
 #include <isc/lang.h>
@@ -109,6 +110,29 @@ dns_zt_find(dns_zt_t *zt, const dns_name_t *name, unsigned int options,
  * \li	#ISC_R_NOSPACE
  */
 
+bool
+dns_zt_isleaf(dns_zt_t *zt, const dns_name_t *name);
+/*%<
+ * Return true if a zone named 'name' is mounted in 'zt' and no other
+ * zone in 'zt' is below it, that is, if dns_zt_find() would return that
+ * zone for every name at or below 'name'.  This is only true until the
+ * generation of 'zt' changes (see dns_zt_getgeneration()).
+ *
+ * Requires:
+ * \li	'zt' to be valid
+ * \li	'name' to be valid
+ */
+
+uint64_t
+dns_zt_getgeneration(dns_zt_t *zt);
+/*%<
+ * Return the generation number of 'zt', which changes whenever a zone
+ * is mounted on or unmounted from it.
+ *
+ * Requires:
+ * \li	'zt' to be valid
+ */
+
 void
 dns_zt_detach(dns_zt_t **ztp);
 /*%<
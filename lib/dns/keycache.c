@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/atomic.h>
+#include <isc/hash.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/region.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#include <dns/keycache.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/types.h>
+
+#include <dst/dst.h>
+
+typedef struct dns_kcentry dns_kcentry_t;
+
+typedef struct dns_kcbucket {
+	isc_mutex_t			lock;
+	ISC_LIST(dns_kcentry_t)		entries;	/* MRU first */
+} dns_kcbucket_t;
+
+struct dns_keycache {
+	unsigned int			magic;
+	isc_mem_t			*mctx;
+	unsigned int			maxentries;
+	atomic_uint_fast32_t		count;
+	atomic_uint_fast32_t		sweep;
+	unsigned int			nbuckets;
+	dns_kcbucket_t			*buckets;
+};
+
+#define KEYCACHE_MAGIC			ISC_MAGIC('K', 'e', 'y', 'C')
+#define VALID_KEYCACHE(m)		ISC_MAGIC_VALID(m, KEYCACHE_MAGIC)
+
+/*
+ * The DNSKEY rdata is stored right after the entry; the owner name is
+ * the name of the key itself.
+ */
+struct dns_kcentry {
+	ISC_LINK(dns_kcentry_t)		link;
+	uint32_t			hashval;
+	isc_stdtime_t			expire;
+	dst_key_t			*key;
+	unsigned int			length;
+};
+
+#define ENTRY_DATA(e)			((unsigned char *)((e) + 1))
+#define ENTRY_SIZE(e)			(sizeof(*(e)) + (e)->length)
+
+/*
+ * Size the table for a few entries per bucket.
+ */
+#define KEYCACHE_BUCKETENTRIES		4
+#define KEYCACHE_MINBUCKETS		16
+#define KEYCACHE_MAXBUCKETS		16384
+
+static void
+free_entry(dns_keycache_t *kc, dns_kcbucket_t *bucket, dns_kcentry_t *entry) {
+	ISC_LIST_UNLINK(bucket->entries, entry, link);
+	dst_key_free(&entry->key);
+	(void)atomic_fetch_sub_relaxed(&kc->count, 1);
+	isc_mem_put(kc->mctx, entry, ENTRY_SIZE(entry));
+}
+
+static inline uint32_t
+hash_key(const dns_name_t *name, const isc_region_t *r) {
+	return (dns_name_fullhash(name, false) ^
+		(uint32_t)isc_hash_function(r->base, r->length, true));
+}
+
+isc_result_t
+dns_keycache_create(isc_mem_t *mctx, unsigned int maxentries,
+		    dns_keycache_t **kcp)
+{
+	dns_keycache_t *kc = NULL;
+	unsigned int i;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(maxentries > 0);
+	REQUIRE(kcp != NULL && *kcp == NULL);
+
+	kc = isc_mem_get(mctx, sizeof(*kc));
+	memset(kc, 0, sizeof(*kc));
+	isc_mem_attach(mctx, &kc->mctx);
+
+	kc->maxentries = maxentries;
+	atomic_init(&kc->count, 0);
+	atomic_init(&kc->sweep, 0);
+
+	kc->nbuckets = KEYCACHE_MINBUCKETS;
+	while (kc->nbuckets < KEYCACHE_MAXBUCKETS &&
+	       kc->nbuckets * KEYCACHE_BUCKETENTRIES < maxentries)
+	{
+		kc->nbuckets *= 2;
+	}
+
+	kc->buckets = isc_mem_get(mctx, kc->nbuckets * sizeof(kc->buckets[0]));
+	for (i = 0; i < kc->nbuckets; i++) {
+		isc_mutex_init(&kc->buckets[i].lock);
+		ISC_LIST_INIT(kc->buckets[i].entries);
+	}
+
+	kc->magic = KEYCACHE_MAGIC;
+	*kcp = kc;
+
+	return (ISC_R_SUCCESS);
+}
+
+void
+dns_keycache_destroy(dns_keycache_t **kcp) {
+	dns_keycache_t *kc;
+	unsigned int i;
+
+	REQUIRE(kcp != NULL && VALID_KEYCACHE(*kcp));
+	kc = *kcp;
+	*kcp = NULL;
+
+	dns_keycache_flush(kc);
+	INSIST(atomic_load_relaxed(&kc->count) == 0);
+
+	kc->magic = 0;
+	for (i = 0; i < kc->nbuckets; i++) {
+		isc_mutex_destroy(&kc->buckets[i].lock);
+	}
+	isc_mem_put(kc->mctx, kc->buckets,
+		    kc->nbuckets * sizeof(kc->buckets[0]));
+	isc_mem_putanddetach(&kc->mctx, kc, sizeof(*kc));
+}
+
+static inline dns_kcentry_t *
+find_entry(dns_kcbucket_t *bucket, const dns_name_t *name,
+	   const isc_region_t *r, uint32_t hashval)
+{
+	dns_kcentry_t *entry;
+
+	for (entry = ISC_LIST_HEAD(bucket->entries);
+	     entry != NULL;
+	     entry = ISC_LIST_NEXT(entry, link))
+	{
+		if (entry->hashval == hashval &&
+		    entry->length == r->length &&
+		    memcmp(ENTRY_DATA(entry), r->base, r->length) == 0 &&
+		    dns_name_equal(dst_key_name(entry->key), name))
+		{
+			break;
+		}
+	}
+
+	return (entry);
+}
+
+isc_result_t
+dns_keycache_find(dns_keycache_t *kc, const dns_name_t *name,
+		  const dns_rdata_t *rdata, isc_stdtime_t now,
+		  dst_key_t **keyp)
+{
+	dns_kcbucket_t *bucket;
+	dns_kcentry_t *entry;
+	isc_result_t result;
+	isc_region_t r;
+	uint32_t hashval;
+
+	REQUIRE(VALID_KEYCACHE(kc));
+	REQUIRE(name != NULL && dns_name_isabsolute(name));
+	REQUIRE(rdata != NULL && rdata->type == dns_rdatatype_dnskey);
+	REQUIRE(keyp != NULL && *keyp == NULL);
+
+	if (atomic_load_relaxed(&kc->count) == 0) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	dns_rdata_toregion(rdata, &r);
+	hashval = hash_key(name, &r);
+	bucket = &kc->buckets[hashval & (kc->nbuckets - 1)];
+
+	LOCK(&bucket->lock);
+	entry = find_entry(bucket, name, &r, hashval);
+	if (entry == NULL) {
+		result = ISC_R_NOTFOUND;
+	} else if (entry->expire <= now) {
+		free_entry(kc, bucket, entry);
+		result = ISC_R_NOTFOUND;
+	} else {
+		dst_key_attach(entry->key, keyp);
+		if (entry != ISC_LIST_HEAD(bucket->entries)) {
+			ISC_LIST_UNLINK(bucket->entries, entry, link);
+			ISC_LIST_PREPEND(bucket->entries, entry, link);
+		}
+		result = ISC_R_SUCCESS;
+	}
+	UNLOCK(&bucket->lock);
+
+	return (result);
+}
+
+void
+dns_keycache_add(dns_keycache_t *kc, const dns_name_t *name,
+		 const dns_rdata_t *rdata, isc_stdtime_t expire,
+		 dst_key_t *key)
+{
+	dns_kcbucket_t *bucket;
+	dns_kcentry_t *entry, *old;
+	isc_region_t r;
+	uint32_t hashval;
+	unsigned int tries;
+
+	REQUIRE(VALID_KEYCACHE(kc));
+	REQUIRE(name != NULL && dns_name_isabsolute(name));
+	REQUIRE(rdata != NULL && rdata->type == dns_rdatatype_dnskey);
+	REQUIRE(key != NULL);
+
+	dns_rdata_toregion(rdata, &r);
+	hashval = hash_key(name, &r);
+	bucket = &kc->buckets[hashval & (kc->nbuckets - 1)];
+
+	entry = isc_mem_get(kc->mctx, sizeof(*entry) + r.length);
+	ISC_LINK_INIT(entry, link);
+	entry->hashval = hashval;
+	entry->expire = expire;
+	entry->key = NULL;
+	dst_key_attach(key, &entry->key);
+	entry->length = r.length;
+	memmove(ENTRY_DATA(entry), r.base, r.length);
+
+	LOCK(&bucket->lock);
+	old = find_entry(bucket, name, &r, hashval);
+	if (old != NULL) {
+		free_entry(kc, bucket, old);
+	}
+	ISC_LIST_PREPEND(bucket->entries, entry, link);
+	(void)atomic_fetch_add_relaxed(&kc->count, 1);
+
+	/*
+	 * Make room in this bucket first, it is already locked.
+	 */
+	while (atomic_load_relaxed(&kc->count) > kc->maxentries) {
+		old = ISC_LIST_TAIL(bucket->entries);
+		if (old == entry) {
+			break;
+		}
+		free_entry(kc, bucket, old);
+	}
+	UNLOCK(&bucket->lock);
+
+	/*
+	 * Then take the least recently used entries from the other
+	 * buckets in turn.
+	 */
+	for (tries = 0;
+	     tries < kc->nbuckets &&
+	     atomic_load_relaxed(&kc->count) > kc->maxentries;
+	     tries++)
+	{
+		uint32_t i = atomic_fetch_add_relaxed(&kc->sweep, 1);
+
+		bucket = &kc->buckets[i & (kc->nbuckets - 1)];
+		LOCK(&bucket->lock);
+		old = ISC_LIST_TAIL(bucket->entries);
+		if (old != NULL && old != entry) {
+			free_entry(kc, bucket, old);
+		}
+		UNLOCK(&bucket->lock);
+	}
+}
+
+void
+dns_keycache_flush(dns_keycache_t *kc) {
+	dns_kcentry_t *entry;
+	unsigned int i;
+
+	REQUIRE(VALID_KEYCACHE(kc));
+
+	for (i = 0; i < kc->nbuckets; i++) {
+		dns_kcbucket_t *bucket = &kc->buckets[i];
+
+		LOCK(&bucket->lock);
+		while ((entry = ISC_LIST_HEAD(bucket->entries)) != NULL) {
+			free_entry(kc, bucket, entry);
+		}
+		UNLOCK(&bucket->lock);
+	}
+}
+
+unsigned int
+dns_keycache_count(dns_keycache_t *kc) {
+	REQUIRE(VALID_KEYCACHE(kc));
+
+	return ((unsigned int)atomic_load_relaxed(&kc->count));
+}
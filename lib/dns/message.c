@@ -424,11 +424,36 @@ msginit(dns_message_t *m) {
 	m->cc_bad = 0;
 	m->tkey = 0;
 	m->rdclass_set = 0;
+	m->nospace_predicted = 0;
 	m->querytsig = NULL;
 	m->indent.string = "\t";
 	m->indent.count = 0;
 }
 
+/*
+ * Return a temporary name or rdataset to its pool, unless it belongs
+ * to the message's user (see dns_message_settempowner()).
+ */
+static inline void
+putname(dns_message_t *msg, dns_name_t *name) {
+	if (msg->tempowner != NULL &&
+	    (msg->tempowner)(msg->tempowner_arg, name))
+	{
+		return;
+	}
+	isc_mempool_put(msg->namepool, name);
+}
+
+static inline void
+putrdataset(dns_message_t *msg, dns_rdataset_t *rdataset) {
+	if (msg->tempowner != NULL &&
+	    (msg->tempowner)(msg->tempowner_arg, rdataset))
+	{
+		return;
+	}
+	isc_mempool_put(msg->rdspool, rdataset);
+}
+
 static inline void
 msgresetnames(dns_message_t *msg, unsigned int first_section) {
 	unsigned int i;
@@ -451,12 +476,12 @@ msgresetnames(dns_message_t *msg, unsigned int first_section) {
 
 				INSIST(dns_rdataset_isassociated(rds));
 				dns_rdataset_disassociate(rds);
-				isc_mempool_put(msg->rdspool, rds);
+				putrdataset(msg, rds);
 				rds = next_rds;
 			}
 			if (dns_name_dynamic(name))
 				dns_name_free(name, msg->mctx);
-			isc_mempool_put(msg->namepool, name);
+			putname(msg, name);
 			name = next_name;
 		}
 	}
@@ -729,6 +754,8 @@ dns_message_create(isc_mem_t *mctx, unsigned int intent, dns_message_t **msgp)
 	ISC_LIST_INIT(m->cleanup);
 	m->namepool = NULL;
 	m->rdspool = NULL;
+	m->tempowner = NULL;
+	m->tempowner_arg = NULL;
 	ISC_LIST_INIT(m->rdatas);
 	ISC_LIST_INIT(m->rdatalists);
 	ISC_LIST_INIT(m->offsets);
@@ -1634,6 +1661,165 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 	return (result);
 }
 
+/*
+ * Return true if the message in 'source', positioned just after the
+ * header, is a query with a single question and no records other than
+ * an optional OPT record.  Nearly every query a server receives has
+ * this shape, and getplainquery() parses it without the general
+ * machinery of getquestions() and getsection().
+ *
+ * Anything unusual, such as a compressed or overlong question name,
+ * is left to the general parser so that it is reported in the same way.
+ */
+static bool
+isplainquery(dns_message_t *msg, isc_buffer_t *source) {
+	isc_region_t r;
+	unsigned int i = 0;
+
+	if (msg->opcode != dns_opcode_query ||
+	    (msg->flags & DNS_MESSAGEFLAG_QR) != 0 ||
+	    msg->counts[DNS_SECTION_QUESTION] != 1 ||
+	    msg->counts[DNS_SECTION_ANSWER] != 0 ||
+	    msg->counts[DNS_SECTION_AUTHORITY] != 0 ||
+	    msg->counts[DNS_SECTION_ADDITIONAL] > 1)
+	{
+		return (false);
+	}
+
+	isc_buffer_remainingregion(source, &r);
+	while (i < r.length && r.base[i] != 0) {
+		if (r.base[i] > 63)
+			return (false);
+		i += r.base[i] + 1;
+	}
+	if (i >= DNS_NAME_MAXWIRE)
+		return (false);
+
+	/* Root label, type and class. */
+	i += 1 + 4;
+	if (i > r.length)
+		return (false);
+
+	if (msg->counts[DNS_SECTION_ADDITIONAL] == 0)
+		return (true);
+
+	/*
+	 * The owner name of the OPT record must be the root name; the
+	 * rest of the fixed part of the record must be present.
+	 */
+	return (r.length - i >= 1 + 2 + 2 + 4 + 2 &&
+		r.base[i] == 0 &&
+		r.base[i + 1] == 0 && r.base[i + 2] == dns_rdatatype_opt);
+}
+
+static isc_result_t
+getplainquery(isc_buffer_t *source, dns_message_t *msg,
+	      dns_decompress_t *dctx)
+{
+	isc_buffer_t target;
+	isc_region_t r;
+	dns_name_t *name;
+	dns_rdataset_t *rdataset;
+	dns_rdatalist_t *rdatalist;
+	dns_rdata_t *rdata;
+	dns_rdatatype_t rdtype;
+	dns_rdataclass_t rdclass;
+	dns_ttl_t ttl;
+	unsigned int rdatalen;
+	isc_result_t result;
+
+	/*
+	 * The question name is decoded into storage in the message
+	 * itself, saving the offsets block and scratch space.
+	 */
+	name = isc_mempool_get(msg->namepool);
+	if (name == NULL)
+		return (ISC_R_NOMEMORY);
+	dns_name_init(name, msg->qnameoffsets);
+	isc_buffer_init(&target, msg->qnamedata, sizeof(msg->qnamedata));
+
+	isc_buffer_remainingregion(source, &r);
+	isc_buffer_setactive(source, r.length);
+	result = dns_name_fromwire(name, source, dctx, 0, &target);
+	if (result != ISC_R_SUCCESS) {
+		isc_mempool_put(msg->namepool, name);
+		return (result);
+	}
+	ISC_LIST_APPEND(msg->sections[DNS_SECTION_QUESTION], name, link);
+
+	/* isplainquery() has checked that these are present. */
+	rdtype = isc_buffer_getuint16(source);
+	rdclass = isc_buffer_getuint16(source);
+
+	msg->rdclass = rdclass;
+	msg->rdclass_set = 1;
+	if (rdtype == dns_rdatatype_tkey)
+		msg->tkey = 1;
+
+	rdatalist = newrdatalist(msg);
+	if (rdatalist == NULL)
+		return (ISC_R_NOMEMORY);
+	rdataset = isc_mempool_get(msg->rdspool);
+	if (rdataset == NULL)
+		return (ISC_R_NOMEMORY);
+
+	rdatalist->type = rdtype;
+	rdatalist->rdclass = rdclass;
+
+	dns_rdataset_init(rdataset);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(rdatalist, rdataset)
+		      == ISC_R_SUCCESS);
+	rdataset->attributes |= DNS_RDATASETATTR_QUESTION;
+	ISC_LIST_APPEND(name->list, rdataset, link);
+
+	msg->question_ok = 1;
+
+	if (msg->counts[DNS_SECTION_ADDITIONAL] == 0)
+		return (ISC_R_SUCCESS);
+
+	/*
+	 * The OPT record: skip the root name and the type, which
+	 * isplainquery() has checked, and take the EDNS fields from
+	 * the class and TTL.
+	 */
+	isc_buffer_forward(source, 1 + 2);
+	rdclass = isc_buffer_getuint16(source);
+	ttl = isc_buffer_getuint32(source);
+	rdatalen = isc_buffer_getuint16(source);
+	if (isc_buffer_remaininglength(source) < rdatalen)
+		return (ISC_R_UNEXPECTEDEND);
+
+	rdata = newrdata(msg);
+	if (rdata == NULL)
+		return (ISC_R_NOMEMORY);
+	result = getrdata(source, msg, dctx, rdclass, dns_rdatatype_opt,
+			  rdatalen, rdata);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	rdata->rdclass = rdclass;
+
+	rdatalist = newrdatalist(msg);
+	if (rdatalist == NULL)
+		return (ISC_R_NOMEMORY);
+	rdataset = isc_mempool_get(msg->rdspool);
+	if (rdataset == NULL)
+		return (ISC_R_NOMEMORY);
+
+	rdatalist->type = dns_rdatatype_opt;
+	rdatalist->rdclass = rdclass;
+	rdatalist->ttl = ttl;
+	ISC_LIST_APPEND(rdatalist->rdata, rdata, link);
+
+	dns_rdataset_init(rdataset);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(rdatalist, rdataset)
+		      == ISC_R_SUCCESS);
+
+	msg->opt = rdataset;
+	msg->rcode |= (dns_rcode_t)((ttl & DNS_MESSAGE_EDNSRCODE_MASK) >> 20);
+
+	return (ISC_R_SUCCESS);
+}
+
 isc_result_t
 dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
 		  unsigned int options)
@@ -1683,6 +1869,15 @@ dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
 
 	dns_decompress_setmethods(&dctx, DNS_COMPRESS_GLOBAL14);
 
+	if (isplainquery(msg, source)) {
+		ret = getplainquery(source, msg, &dctx);
+		if (ret == ISC_R_UNEXPECTEDEND && ignore_tc)
+			goto truncated;
+		if (ret != ISC_R_SUCCESS)
+			return (ret);
+		goto parsed;
+	}
+
 	ret = getquestions(source, msg, &dctx, options);
 	if (ret == ISC_R_UNEXPECTEDEND && ignore_tc)
 		goto truncated;
@@ -1724,6 +1919,7 @@ dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
 	if (ret != ISC_R_SUCCESS)
 		return (ret);
 
+ parsed:
 	isc_buffer_remainingregion(source, &r);
 	if (r.length != 0) {
 		isc_log_write(dns_lctx, ISC_LOGCATEGORY_GENERAL,
@@ -1905,6 +2101,25 @@ maybe_clear_ad(dns_message_t *msg, dns_section_t sectionid) {
 		msg->flags &= ~DNS_MESSAGEFLAG_AD;
 }
 
+/*
+ * Return true if 'rdataset' is known not to fit in the space left in
+ * the message buffer, so that it need not be rendered and then rolled
+ * back to find out.
+ */
+static inline bool
+predict_nospace(dns_message_t *msg, const dns_name_t *name,
+		dns_rdataset_t *rdataset)
+{
+	unsigned int size;
+
+	size = dns_rdataset_minwiresize(rdataset, name);
+	if (size <= isc_buffer_availablelength(msg->buffer))
+		return (false);
+
+	msg->nospace_predicted = 1;
+	return (true);
+}
+
 isc_result_t
 dns_message_rendersection(dns_message_t *msg, dns_section_t sectionid,
 			  unsigned int options)
@@ -1925,6 +2140,7 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t sectionid,
 	REQUIRE(VALID_NAMED_SECTION(sectionid));
 
 	section = &msg->sections[sectionid];
+	msg->nospace_predicted = 0;
 
 	if ((sectionid == DNS_SECTION_ADDITIONAL)
 	    && (options & DNS_MESSAGERENDER_ORDERED) == 0) {
@@ -1977,6 +2193,8 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t sectionid,
 								    rd_options,
 								    &count,
 								    NULL);
+			else if (predict_nospace(msg, name, rdataset))
+				result = ISC_R_NOSPACE;
 			else
 				result = dns_rdataset_towiresorted(rdataset,
 								   name,
@@ -2048,6 +2266,8 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t sectionid,
 							  rd_options,
 							  &count,
 							  NULL);
+				else if (predict_nospace(msg, name, rdataset))
+					result = ISC_R_NOSPACE;
 				else
 					result = dns_rdataset_towiresorted(
 							  rdataset,
@@ -2118,6 +2338,13 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t sectionid,
 	return (ISC_R_SUCCESS);
 }
 
+bool
+dns_message_nospacepredicted(dns_message_t *msg) {
+	REQUIRE(DNS_MESSAGE_VALID(msg));
+
+	return (msg->nospace_predicted);
+}
+
 void
 dns_message_renderheader(dns_message_t *msg, isc_buffer_t *target) {
 	uint16_t tmp;
@@ -2548,6 +2775,16 @@ dns_message_gettemprdatalist(dns_message_t *msg, dns_rdatalist_t **item) {
 	return (ISC_R_SUCCESS);
 }
 
+void
+dns_message_settempowner(dns_message_t *msg, dns_message_tempowner_t owner,
+			 void *arg)
+{
+	REQUIRE(DNS_MESSAGE_VALID(msg));
+
+	msg->tempowner = owner;
+	msg->tempowner_arg = arg;
+}
+
 void
 dns_message_puttempname(dns_message_t *msg, dns_name_t **itemp) {
 	dns_name_t *item;
@@ -2561,7 +2798,7 @@ dns_message_puttempname(dns_message_t *msg, dns_name_t **itemp) {
 
 	if (dns_name_dynamic(item))
 		dns_name_free(item, msg->mctx);
-	isc_mempool_put(msg->namepool, item);
+	putname(msg, item);
 }
 
 void
@@ -2579,7 +2816,7 @@ dns_message_puttemprdataset(dns_message_t *msg, dns_rdataset_t **item) {
 	REQUIRE(item != NULL && *item != NULL);
 
 	REQUIRE(!dns_rdataset_isassociated(*item));
-	isc_mempool_put(msg->rdspool, *item);
+	putrdataset(msg, *item);
 	*item = NULL;
 }
 
@@ -104,6 +104,73 @@ static unsigned char maptolower[] = {
 	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 };
 
+/*
+ * Case-insensitive comparison of name data a 64-bit word at a time.
+ * The ASCII upper case letters in a word are folded to lower case
+ * without branches or table lookups: after clearing the top bit of
+ * each byte, adding (0x80 - 'A') sets it for bytes from 'A' upwards
+ * and adding (0x7f - 'Z') for bytes above 'Z', neither carrying into
+ * the next byte.  Bytes which had the top bit set are left alone, as
+ * maptolower[] does.
+ */
+#define WORD_ONES	0x0101010101010101ULL
+#define WORD_HIGHS	0x8080808080808080ULL
+
+static inline uint64_t
+word_tolower(uint64_t word) {
+	uint64_t heptets = word & ~WORD_HIGHS;
+	uint64_t above_z = heptets + (0x7f - 'Z') * WORD_ONES;
+	uint64_t from_a = heptets + (0x80 - 'A') * WORD_ONES;
+	uint64_t upper = ~word & (from_a ^ above_z) & WORD_HIGHS;
+
+	return (word | (upper >> 2));
+}
+
+static inline uint64_t
+word_load(const unsigned char *p) {
+	uint64_t word;
+
+	memmove(&word, p, sizeof(word));
+	return (word);
+}
+
+/*
+ * Return the number of leading bytes of 'p1' and 'p2', up to 'length',
+ * which are equal when case is ignored.
+ */
+static inline unsigned int
+caseequal_prefix(const unsigned char *p1, const unsigned char *p2,
+		 unsigned int length)
+{
+	unsigned int i = 0;
+
+	while (length - i >= sizeof(uint64_t)) {
+		uint64_t diff = word_tolower(word_load(p1 + i)) ^
+				word_tolower(word_load(p2 + i));
+		if (diff != 0) {
+#ifdef HAVE_BUILTIN_CLZ
+			/*
+			 * The first differing byte is the lowest
+			 * addressed non-zero byte of 'diff'.
+			 */
+#ifdef WORDS_BIGENDIAN
+			return (i + __builtin_clzll(diff) / 8);
+#else
+			return (i + __builtin_ctzll(diff) / 8);
+#endif
+#else
+			break;
+#endif
+		}
+		i += sizeof(uint64_t);
+	}
+	while (i < length && maptolower[p1[i]] == maptolower[p2[i]]) {
+		i++;
+	}
+
+	return (i);
+}
+
 #define CONVERTTOASCII(c)
 #define CONVERTFROMASCII(c)
 
@@ -482,8 +549,8 @@ dns_namereln_t
 dns_name_fullcompare(const dns_name_t *name1, const dns_name_t *name2,
 		     int *orderp, unsigned int *nlabelsp)
 {
-	unsigned int l1, l2, l, count1, count2, count, nlabels;
-	int cdiff, ldiff, chdiff;
+	unsigned int l1, l2, l, count1, count2, count, nlabels, i;
+	int cdiff, ldiff;
 	unsigned char *label1, *label2;
 	unsigned char *offsets1, *offsets2;
 	dns_offsets_t odata1, odata2;
@@ -554,43 +621,11 @@ dns_name_fullcompare(const dns_name_t *name1, const dns_name_t *name2,
 		else
 			count = count2;
 
-		/* Loop unrolled for performance */
-		while (ISC_LIKELY(count > 3)) {
-			chdiff = (int)maptolower[label1[0]] -
-				 (int)maptolower[label2[0]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			chdiff = (int)maptolower[label1[1]] -
-				 (int)maptolower[label2[1]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			chdiff = (int)maptolower[label1[2]] -
-				 (int)maptolower[label2[2]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			chdiff = (int)maptolower[label1[3]] -
-				 (int)maptolower[label2[3]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			count -= 4;
-			label1 += 4;
-			label2 += 4;
-		}
-		while (ISC_LIKELY(count-- > 0)) {
-			chdiff = (int)maptolower[*label1++] -
-				 (int)maptolower[*label2++];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
+		i = caseequal_prefix(label1, label2, count);
+		if (i < count) {
+			*orderp = (int)maptolower[label1[i]] -
+				  (int)maptolower[label2[i]];
+			goto done;
 		}
 		if (cdiff != 0) {
 			*orderp = cdiff;
@@ -639,9 +674,6 @@ dns_name_compare(const dns_name_t *name1, const dns_name_t *name2) {
 
 bool
 dns_name_equal(const dns_name_t *name1, const dns_name_t *name2) {
-	unsigned int l, count;
-	unsigned char c;
-	unsigned char *label1, *label2;
 
 	/*
 	 * Are 'name1' and 'name2' equal?
@@ -666,46 +698,16 @@ dns_name_equal(const dns_name_t *name1, const dns_name_t *name2) {
 	if (name1->length != name2->length)
 		return (false);
 
-	l = name1->labels;
-
-	if (l != name2->labels)
+	if (name1->labels != name2->labels)
 		return (false);
 
-	label1 = name1->ndata;
-	label2 = name2->ndata;
-	while (ISC_LIKELY(l-- > 0)) {
-		count = *label1++;
-		if (count != *label2++)
-			return (false);
-
-		INSIST(count <= 63); /* no bitstring support */
-
-		/* Loop unrolled for performance */
-		while (ISC_LIKELY(count > 3)) {
-			c = maptolower[label1[0]];
-			if (c != maptolower[label2[0]])
-				return (false);
-			c = maptolower[label1[1]];
-			if (c != maptolower[label2[1]])
-				return (false);
-			c = maptolower[label1[2]];
-			if (c != maptolower[label2[2]])
-				return (false);
-			c = maptolower[label1[3]];
-			if (c != maptolower[label2[3]])
-				return (false);
-			count -= 4;
-			label1 += 4;
-			label2 += 4;
-		}
-		while (ISC_LIKELY(count-- > 0)) {
-			c = maptolower[*label1++];
-			if (c != maptolower[*label2++])
-				return (false);
-		}
-	}
-
-	return (true);
+	/*
+	 * Label lengths are below 0x40 and are not changed by case
+	 * folding, so names of the same length can be compared as
+	 * flat strings.
+	 */
+	return (caseequal_prefix(name1->ndata, name2->ndata,
+				 name1->length) == name1->length);
 }
 
 bool
@@ -739,9 +741,8 @@ dns_name_caseequal(const dns_name_t *name1, const dns_name_t *name2) {
 
 int
 dns_name_rdatacompare(const dns_name_t *name1, const dns_name_t *name2) {
-	unsigned int l1, l2, l, count1, count2, count;
+	unsigned int length, i;
 	unsigned char c1, c2;
-	unsigned char *label1, *label2;
 
 	/*
 	 * Compare two absolute names as rdata.
@@ -754,43 +755,27 @@ dns_name_rdatacompare(const dns_name_t *name1, const dns_name_t *name2) {
 	REQUIRE(name2->labels > 0);
 	REQUIRE((name2->attributes & DNS_NAMEATTR_ABSOLUTE) != 0);
 
-	l1 = name1->labels;
-	l2 = name2->labels;
-
-	l = (l1 < l2) ? l1 : l2;
-
-	label1 = name1->ndata;
-	label2 = name2->ndata;
-	while (l > 0) {
-		l--;
-		count1 = *label1++;
-		count2 = *label2++;
-
-		/* no bitstring support */
-		INSIST(count1 <= 63 && count2 <= 63);
-
-		if (count1 != count2)
-			return ((count1 < count2) ? -1 : 1);
-		count = count1;
-		while (count > 0) {
-			count--;
-			c1 = maptolower[*label1++];
-			c2 = maptolower[*label2++];
-			if (c1 < c2)
-				return (-1);
-			else if (c1 > c2)
-				return (1);
-		}
+	/*
+	 * The names are compared label by label from the left, shorter
+	 * labels first, which is how their case folded wire forms
+	 * compare: the first difference is either in a label length
+	 * or in the data of labels of the same length.
+	 */
+	length = ISC_MIN(name1->length, name2->length);
+	i = caseequal_prefix(name1->ndata, name2->ndata, length);
+	if (i < length) {
+		c1 = maptolower[name1->ndata[i]];
+		c2 = maptolower[name2->ndata[i]];
+		return ((c1 < c2) ? -1 : 1);
 	}
 
 	/*
-	 * If one name had more labels than the other, their common
-	 * prefix must have been different because the shorter name
-	 * ended with the root label and the longer one can't have
-	 * a root label in the middle of it.  Therefore, if we get
-	 * to this point, the lengths must be equal.
+	 * If one name were longer than the other, their common prefix
+	 * would have been different because the shorter name ends
+	 * with the root label and the longer one can't have a root
+	 * label in the middle of it.
 	 */
-	INSIST(l1 == l2);
+	INSIST(name1->length == name2->length);
 
 	return (0);
 }
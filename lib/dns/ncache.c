@@ -505,7 +505,8 @@ static dns_rdatasetmethods_t rdataset_methods = {
 	NULL,			/* clearprefetch */
 	NULL,			/* setownercase */
 	NULL,			/* getownercase */
-	NULL			/* addglue */
+	NULL,			/* addglue */
+	NULL			/* getslab */
 };
 
 isc_result_t
@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/atomic.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/rwlock.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/nsec.h>
+#include <dns/proofcache.h>
+#include <dns/qp.h>
+#include <dns/rdata.h>
+#include <dns/rdataset.h>
+#include <dns/rdatastruct.h>
+
+typedef struct dns_pcentry dns_pcentry_t;
+
+struct dns_proofcache {
+	unsigned int			magic;
+	isc_mem_t			*mctx;
+	isc_rwlock_t			rwlock;
+	atomic_uint_fast32_t		maxentries;
+	/* Locked by rwlock. */
+	uint64_t			generation;
+	dns_qp_t			*qp;
+	ISC_LIST(dns_pcentry_t)		entries;	/* oldest first */
+	unsigned int			count;
+	dns_rdataset_t			soa;
+	dns_rdataset_t			soasig;
+};
+
+#define PROOFCACHE_MAGIC		ISC_MAGIC('P', 'r', 'f', 'C')
+#define VALID_PROOFCACHE(m)		ISC_MAGIC_VALID(m, PROOFCACHE_MAGIC)
+
+/*
+ * An NSEC RRset.  'cut' is set when its owner is a delegation point or
+ * has a DNAME, so that the names below it are not in the NSEC chain.
+ */
+struct dns_pcentry {
+	ISC_LINK(dns_pcentry_t)		link;
+	dns_name_t			owner;
+	dns_name_t			next;
+	bool				cut;
+	dns_rdataset_t			nsec;
+	dns_rdataset_t			nsecsig;
+};
+
+static const dns_name_t *
+entry_getname(void *data, void *arg) {
+	dns_pcentry_t *entry = data;
+
+	UNUSED(arg);
+
+	return (&entry->owner);
+}
+
+static void
+entry_free(void *data, void *arg) {
+	dns_pcentry_t *entry = data;
+	dns_proofcache_t *pc = arg;
+
+	ISC_LIST_UNLINK(pc->entries, entry, link);
+	pc->count--;
+	dns_rdataset_disassociate(&entry->nsec);
+	dns_rdataset_disassociate(&entry->nsecsig);
+	dns_name_free(&entry->owner, pc->mctx);
+	dns_name_free(&entry->next, pc->mctx);
+	isc_mem_put(pc->mctx, entry, sizeof(*entry));
+}
+
+/*
+ * The caller must hold the write lock.
+ */
+static void
+flush(dns_proofcache_t *pc) {
+	if (pc->qp != NULL) {
+		dns_qp_destroy(&pc->qp);
+	}
+	INSIST(pc->count == 0);
+	if (dns_rdataset_isassociated(&pc->soa)) {
+		dns_rdataset_disassociate(&pc->soa);
+		dns_rdataset_disassociate(&pc->soasig);
+	}
+}
+
+/*
+ * The caller must hold the write lock.
+ */
+static void
+trim(dns_proofcache_t *pc, unsigned int maxentries) {
+	dns_pcentry_t *entry;
+	isc_result_t result;
+
+	while (pc->count > maxentries) {
+		entry = ISC_LIST_HEAD(pc->entries);
+		result = dns_qp_deletename(pc->qp, &entry->owner);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	}
+}
+
+isc_result_t
+dns_proofcache_create(isc_mem_t *mctx, dns_proofcache_t **pcp) {
+	dns_proofcache_t *pc = NULL;
+	isc_result_t result;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(pcp != NULL && *pcp == NULL);
+
+	pc = isc_mem_get(mctx, sizeof(*pc));
+	memset(pc, 0, sizeof(*pc));
+
+	result = isc_rwlock_init(&pc->rwlock, 0, 0);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_put(mctx, pc, sizeof(*pc));
+		return (result);
+	}
+	isc_mem_attach(mctx, &pc->mctx);
+	atomic_init(&pc->maxentries, 0);
+	ISC_LIST_INIT(pc->entries);
+	dns_rdataset_init(&pc->soa);
+	dns_rdataset_init(&pc->soasig);
+
+	pc->magic = PROOFCACHE_MAGIC;
+	*pcp = pc;
+
+	return (ISC_R_SUCCESS);
+}
+
+void
+dns_proofcache_destroy(dns_proofcache_t **pcp) {
+	dns_proofcache_t *pc;
+
+	REQUIRE(pcp != NULL && VALID_PROOFCACHE(*pcp));
+	pc = *pcp;
+	*pcp = NULL;
+
+	flush(pc);
+	pc->magic = 0;
+	isc_rwlock_destroy(&pc->rwlock);
+	isc_mem_putanddetach(&pc->mctx, pc, sizeof(*pc));
+}
+
+void
+dns_proofcache_setmaxentries(dns_proofcache_t *pc, unsigned int maxentries) {
+	REQUIRE(VALID_PROOFCACHE(pc));
+
+	RWLOCK(&pc->rwlock, isc_rwlocktype_write);
+	atomic_store_relaxed(&pc->maxentries, maxentries);
+	if (maxentries == 0) {
+		flush(pc);
+	} else {
+		trim(pc, maxentries);
+	}
+	RWUNLOCK(&pc->rwlock, isc_rwlocktype_write);
+}
+
+unsigned int
+dns_proofcache_getmaxentries(dns_proofcache_t *pc) {
+	REQUIRE(VALID_PROOFCACHE(pc));
+
+	return ((unsigned int)atomic_load_relaxed(&pc->maxentries));
+}
+
+static isc_result_t
+add_nsec(dns_proofcache_t *pc, const dns_name_t *name,
+	 dns_rdataset_t *rdataset, dns_rdataset_t *sigrdataset)
+{
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdata_nsec_t nsec;
+	dns_pcentry_t *entry;
+	void *data = NULL;
+	isc_result_t result;
+
+	if (pc->qp == NULL) {
+		result = dns_qp_create(pc->mctx, entry_getname, entry_free,
+				       pc, &pc->qp);
+		if (result != ISC_R_SUCCESS) {
+			return (result);
+		}
+	} else if (dns_qp_findname(pc->qp, name, &data) == ISC_R_SUCCESS) {
+		return (ISC_R_EXISTS);
+	}
+
+	result = dns_rdataset_first(rdataset);
+	if (result != ISC_R_SUCCESS) {
+		return (ISC_R_NOTIMPLEMENTED);
+	}
+	dns_rdataset_current(rdataset, &rdata);
+	result = dns_rdata_tostruct(&rdata, &nsec, NULL);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+
+	entry = isc_mem_get(pc->mctx, sizeof(*entry));
+	ISC_LINK_INIT(entry, link);
+	dns_name_init(&entry->owner, NULL);
+	dns_name_init(&entry->next, NULL);
+	dns_name_dup(name, pc->mctx, &entry->owner);
+	dns_name_dup(&nsec.next, pc->mctx, &entry->next);
+	entry->cut = ((dns_nsec_typepresent(&rdata, dns_rdatatype_ns) &&
+		       !dns_nsec_typepresent(&rdata, dns_rdatatype_soa)) ||
+		      dns_nsec_typepresent(&rdata, dns_rdatatype_dname));
+	dns_rdataset_init(&entry->nsec);
+	dns_rdataset_init(&entry->nsecsig);
+	dns_rdataset_clone(rdataset, &entry->nsec);
+	dns_rdataset_clone(sigrdataset, &entry->nsecsig);
+	dns_rdata_freestruct(&nsec);
+
+	ISC_LIST_APPEND(pc->entries, entry, link);
+	pc->count++;
+	result = dns_qp_insert(pc->qp, entry);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+
+	trim(pc, (unsigned int)atomic_load_relaxed(&pc->maxentries));
+
+	return (ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_proofcache_add(dns_proofcache_t *pc, uint64_t generation,
+		   const dns_name_t *name, dns_rdataset_t *rdataset,
+		   dns_rdataset_t *sigrdataset)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+
+	REQUIRE(VALID_PROOFCACHE(pc));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(DNS_RDATASET_VALID(rdataset));
+	REQUIRE(DNS_RDATASET_VALID(sigrdataset));
+
+	if ((rdataset->type != dns_rdatatype_soa &&
+	     rdataset->type != dns_rdatatype_nsec) ||
+	    !dns_rdataset_isassociated(rdataset) ||
+	    !dns_rdataset_isassociated(sigrdataset))
+	{
+		return (ISC_R_NOTIMPLEMENTED);
+	}
+
+	if (atomic_load_relaxed(&pc->maxentries) == 0) {
+		return (ISC_R_SUCCESS);
+	}
+
+	RWLOCK(&pc->rwlock, isc_rwlocktype_write);
+	if (generation < pc->generation) {
+		goto unlock;
+	}
+	if (generation > pc->generation) {
+		flush(pc);
+		pc->generation = generation;
+	}
+
+	if (rdataset->type == dns_rdatatype_soa) {
+		if (dns_rdataset_isassociated(&pc->soa)) {
+			dns_rdataset_disassociate(&pc->soa);
+			dns_rdataset_disassociate(&pc->soasig);
+		}
+		dns_rdataset_clone(rdataset, &pc->soa);
+		dns_rdataset_clone(sigrdataset, &pc->soasig);
+	} else {
+		result = add_nsec(pc, name, rdataset, sigrdataset);
+	}
+
+ unlock:
+	RWUNLOCK(&pc->rwlock, isc_rwlocktype_write);
+
+	return (result);
+}
+
+/*
+ * Return the entry whose NSEC record proves that 'name' does not
+ * exist, ignoring wildcards.  The caller must hold the lock.
+ */
+static dns_pcentry_t *
+find_covering(dns_proofcache_t *pc, const dns_name_t *name) {
+	dns_pcentry_t *entry;
+	void *data = NULL;
+
+	if (dns_qp_findprevious(pc->qp, name, &data) != ISC_R_SUCCESS) {
+		return (NULL);
+	}
+	entry = data;
+
+	/*
+	 * 'name' exists, or is after the next name (the last NSEC record
+	 * of the zone points back at the apex, and covers everything
+	 * after its owner).
+	 */
+	if (dns_name_equal(name, &entry->owner) ||
+	    (dns_name_compare(&entry->owner, &entry->next) < 0 &&
+	     dns_name_compare(name, &entry->next) >= 0))
+	{
+		return (NULL);
+	}
+
+	/*
+	 * 'name' is below a zone cut or a DNAME, or is an empty
+	 * non-terminal.
+	 */
+	if ((entry->cut && dns_name_issubdomain(name, &entry->owner)) ||
+	    dns_name_issubdomain(&entry->next, name))
+	{
+		return (NULL);
+	}
+
+	return (entry);
+}
+
+isc_result_t
+dns_proofcache_findnxdomain(dns_proofcache_t *pc, uint64_t generation,
+			    const dns_name_t *name, dns_nxproof_t *proof)
+{
+	dns_pcentry_t *entry, *wentry;
+	dns_fixedname_t fixed;
+	dns_name_t *wname;
+	unsigned int olabels, nlabels, labels;
+	int order;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	REQUIRE(VALID_PROOFCACHE(pc));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(proof != NULL && !dns_rdataset_isassociated(&proof->nsec));
+
+	if (atomic_load_relaxed(&pc->maxentries) == 0) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	RWLOCK(&pc->rwlock, isc_rwlocktype_read);
+	if (pc->generation != generation || pc->qp == NULL ||
+	    !dns_rdataset_isassociated(&pc->soa))
+	{
+		goto unlock;
+	}
+
+	entry = find_covering(pc, name);
+	if (entry == NULL) {
+		goto unlock;
+	}
+
+	/*
+	 * The closest encloser is the longest common suffix of 'name'
+	 * with the owner and next names (see query_addwildcardproof()).
+	 */
+	(void)dns_name_fullcompare(name, &entry->owner, &order, &olabels);
+	(void)dns_name_fullcompare(name, &entry->next, &order, &nlabels);
+	labels = ISC_MAX(olabels, nlabels);
+	if (labels >= dns_name_countlabels(name)) {
+		goto unlock;
+	}
+	wname = dns_fixedname_initname(&fixed);
+	dns_name_split(name, labels, NULL, wname);
+	if (dns_name_concatenate(dns_wildcardname, wname, wname,
+				 NULL) != ISC_R_SUCCESS)
+	{
+		goto unlock;
+	}
+
+	wentry = find_covering(pc, wname);
+	if (wentry == NULL) {
+		goto unlock;
+	}
+
+	dns_rdataset_clone(&pc->soa, &proof->soa);
+	dns_rdataset_clone(&pc->soasig, &proof->soasig);
+	dns_name_copynf(&entry->owner, dns_fixedname_name(&proof->nsecname));
+	dns_rdataset_clone(&entry->nsec, &proof->nsec);
+	dns_rdataset_clone(&entry->nsecsig, &proof->nsecsig);
+	if (wentry != entry) {
+		dns_name_copynf(&wentry->owner,
+				dns_fixedname_name(&proof->wildname));
+		dns_rdataset_clone(&wentry->nsec, &proof->wild);
+		dns_rdataset_clone(&wentry->nsecsig, &proof->wildsig);
+	}
+	result = ISC_R_SUCCESS;
+
+ unlock:
+	RWUNLOCK(&pc->rwlock, isc_rwlocktype_read);
+
+	return (result);
+}
+
+isc_result_t
+dns_proofcache_findnodata(dns_proofcache_t *pc, uint64_t generation,
+			  const dns_name_t *name, dns_rdatatype_t type,
+			  dns_nxproof_t *proof)
+{
+	dns_pcentry_t *entry;
+	dns_rdataset_t nsec;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	void *data = NULL;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	REQUIRE(VALID_PROOFCACHE(pc));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(proof != NULL && !dns_rdataset_isassociated(&proof->nsec));
+
+	if (atomic_load_relaxed(&pc->maxentries) == 0 ||
+	    dns_rdatatype_ismeta(type))
+	{
+		return (ISC_R_NOTFOUND);
+	}
+
+	RWLOCK(&pc->rwlock, isc_rwlocktype_read);
+	if (pc->generation != generation || pc->qp == NULL ||
+	    !dns_rdataset_isassociated(&pc->soa) ||
+	    dns_qp_findname(pc->qp, name, &data) != ISC_R_SUCCESS)
+	{
+		goto unlock;
+	}
+	entry = data;
+	if (entry->cut) {
+		goto unlock;
+	}
+
+	/*
+	 * Other readers may be using the entry, so iterate over a clone.
+	 */
+	dns_rdataset_init(&nsec);
+	dns_rdataset_clone(&entry->nsec, &nsec);
+	if (dns_rdataset_first(&nsec) == ISC_R_SUCCESS) {
+		dns_rdataset_current(&nsec, &rdata);
+		if (!dns_nsec_typepresent(&rdata, type) &&
+		    !dns_nsec_typepresent(&rdata, dns_rdatatype_cname))
+		{
+			result = ISC_R_SUCCESS;
+		}
+	}
+	dns_rdataset_disassociate(&nsec);
+	if (result != ISC_R_SUCCESS) {
+		goto unlock;
+	}
+
+	dns_rdataset_clone(&pc->soa, &proof->soa);
+	dns_rdataset_clone(&pc->soasig, &proof->soasig);
+	dns_name_copynf(&entry->owner, dns_fixedname_name(&proof->nsecname));
+	dns_rdataset_clone(&entry->nsec, &proof->nsec);
+	dns_rdataset_clone(&entry->nsecsig, &proof->nsecsig);
+
+ unlock:
+	RWUNLOCK(&pc->rwlock, isc_rwlocktype_read);
+
+	return (result);
+}
+
+void
+dns_proofcache_flush(dns_proofcache_t *pc) {
+	REQUIRE(VALID_PROOFCACHE(pc));
+
+	RWLOCK(&pc->rwlock, isc_rwlocktype_write);
+	flush(pc);
+	RWUNLOCK(&pc->rwlock, isc_rwlocktype_write);
+}
+
+unsigned int
+dns_proofcache_count(dns_proofcache_t *pc) {
+	unsigned int count;
+
+	REQUIRE(VALID_PROOFCACHE(pc));
+
+	RWLOCK(&pc->rwlock, isc_rwlocktype_read);
+	count = pc->count;
+	RWUNLOCK(&pc->rwlock, isc_rwlocktype_read);
+
+	return (count);
+}
+
+void
+dns_nxproof_init(dns_nxproof_t *proof) {
+	REQUIRE(proof != NULL);
+
+	dns_rdataset_init(&proof->soa);
+	dns_rdataset_init(&proof->soasig);
+	dns_fixedname_init(&proof->nsecname);
+	dns_rdataset_init(&proof->nsec);
+	dns_rdataset_init(&proof->nsecsig);
+	dns_fixedname_init(&proof->wildname);
+	dns_rdataset_init(&proof->wild);
+	dns_rdataset_init(&proof->wildsig);
+}
+
+void
+dns_nxproof_invalidate(dns_nxproof_t *proof) {
+	dns_rdataset_t *rdatasets[] = {
+		&proof->soa, &proof->soasig, &proof->nsec, &proof->nsecsig,
+		&proof->wild, &proof->wildsig
+	};
+	unsigned int i;
+
+	REQUIRE(proof != NULL);
+
+	for (i = 0; i < sizeof(rdatasets) / sizeof(rdatasets[0]); i++) {
+		if (dns_rdataset_isassociated(rdatasets[i])) {
+			dns_rdataset_disassociate(rdatasets[i]);
+		}
+	}
+}
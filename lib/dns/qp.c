@@ -0,0 +1,594 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/once.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#include <dns/name.h>
+#include <dns/qp.h>
+#include <dns/result.h>
+
+#define QP_MAGIC		ISC_MAGIC('Q', 'P', 't', 'r')
+#define VALID_QP(qp)		ISC_MAGIC_VALID(qp, QP_MAGIC)
+
+/*
+ * Every node is two words.  A leaf has a zero index word and points
+ * to the caller's data.  A branch has the low bit of the index word
+ * set, followed by a bitmap of the shifts that have a twig, and the
+ * offset in the key of the shift that selects the twig; it points to
+ * a packed array of its twigs, in shift order.
+ */
+typedef struct qpnode qpnode_t;
+struct qpnode {
+	uint64_t		index;
+	void *			ptr;
+};
+
+struct dns_qp {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	dns_qpgetname_t		getname;
+	dns_qpdeleter_t		deleter;
+	void *			arg;
+	unsigned int		count;
+	qpnode_t		root;
+};
+
+/*
+ * Shift values.  SHIFT_NOBYTE is implied past the end of a key, so
+ * a name sorts before all of its subdomains; SHIFT_LABEL separates
+ * labels, so a label sorts before any longer label it is a prefix of.
+ * The characters that are common in host names get a shift each;
+ * every other byte is escaped into two shifts.
+ */
+#define SHIFT_NOBYTE		0
+#define SHIFT_LABEL		1
+#define SHIFT_OFFSET		2
+#define SHIFT_MAX		48
+
+#define BRANCH_TAG		1ULL
+#define BITMAP_SHIFT		1
+#define BITMAP_MASK		(((1ULL << SHIFT_MAX) - 1) << BITMAP_SHIFT)
+#define OFFSET_SHIFT		(BITMAP_SHIFT + SHIFT_MAX)
+
+/*
+ * For each byte value, the shift (low byte) and, for escaped bytes,
+ * the second shift (high byte) it is converted to.
+ */
+static uint16_t bits_for_byte[256];
+static isc_once_t once = ISC_ONCE_INIT;
+
+static bool
+common_character(unsigned int byte) {
+	return (byte == '-' || byte == '_' ||
+		(byte >= '0' && byte <= '9') ||
+		(byte >= 'a' && byte <= 'z'));
+}
+
+static void
+init_bits_for_byte(void) {
+	unsigned int byte;
+	unsigned int bit_one = SHIFT_OFFSET;
+	unsigned int bit_two = SHIFT_OFFSET;
+	unsigned int escape = 0;
+
+	/*
+	 * Walk the bytes in order, giving each common character the next
+	 * shift, and each run of other characters between two common
+	 * ones an escape shift of its own (or more than one, if the run
+	 * is too long), so that the order of bytes is preserved.
+	 * Upper case letters sort like lower case ones.
+	 */
+	for (byte = 0; byte < 256; byte++) {
+		if (byte >= 'A' && byte <= 'Z') {
+			continue;
+		}
+		if (common_character(byte)) {
+			bits_for_byte[byte] = bit_one++;
+			escape = 0;
+			continue;
+		}
+		if (escape == 0 || bit_two == SHIFT_MAX) {
+			escape = bit_one++;
+			bit_two = SHIFT_OFFSET;
+		}
+		bits_for_byte[byte] = escape | (bit_two++ << 8);
+	}
+	INSIST(bit_one <= SHIFT_MAX);
+
+	for (byte = 'A'; byte <= 'Z'; byte++) {
+		bits_for_byte[byte] = bits_for_byte[byte - 'A' + 'a'];
+	}
+}
+
+size_t
+dns_qpkey_fromname(dns_qpkey_t key, const dns_name_t *name) {
+	unsigned int labels, i, j;
+	dns_label_t label;
+	uint16_t bits;
+	size_t len = 0;
+
+	REQUIRE(ISC_MAGIC_VALID(name, DNS_NAME_MAGIC));
+	REQUIRE(dns_name_isabsolute(name));
+
+	RUNTIME_CHECK(isc_once_do(&once, init_bits_for_byte) == ISC_R_SUCCESS);
+
+	/*
+	 * Skip the root label, and convert the rest from the top down.
+	 */
+	labels = dns_name_countlabels(name) - 1;
+	for (i = labels; i-- > 0; ) {
+		dns_name_getlabel(name, i, &label);
+		for (j = 1; j < label.length; j++) {
+			bits = bits_for_byte[label.base[j]];
+			key[len++] = bits & 0xff;
+			if ((bits >> 8) != 0) {
+				key[len++] = bits >> 8;
+			}
+		}
+		key[len++] = SHIFT_LABEL;
+	}
+	INSIST(len <= DNS_QP_MAXKEY);
+
+	return (len);
+}
+
+/*
+ * Node accessors.
+ */
+static inline bool
+isbranch(const qpnode_t *n) {
+	return ((n->index & BRANCH_TAG) != 0);
+}
+
+static inline uint64_t
+bitmap(const qpnode_t *n) {
+	return (n->index & BITMAP_MASK);
+}
+
+static inline size_t
+keyoffset(const qpnode_t *n) {
+	return ((size_t)(n->index >> OFFSET_SHIFT));
+}
+
+static inline qpnode_t *
+twigs(const qpnode_t *n) {
+	return (n->ptr);
+}
+
+static inline uint64_t
+shiftbit(unsigned int shift) {
+	return (1ULL << (shift + BITMAP_SHIFT));
+}
+
+static inline unsigned int
+keyshift(const dns_qpkey_t key, size_t len, size_t offset) {
+	return (offset < len ? key[offset] : SHIFT_NOBYTE);
+}
+
+static inline unsigned int
+popcount(uint64_t w) {
+	w -= (w >> 1) & 0x5555555555555555ULL;
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return ((unsigned int)((w * 0x0101010101010101ULL) >> 56));
+}
+
+static inline unsigned int
+twigcount(const qpnode_t *n) {
+	return (popcount(bitmap(n)));
+}
+
+/*
+ * The position in the twig array of the twig for 'bit', whether or
+ * not it is present.
+ */
+static inline unsigned int
+twigpos(const qpnode_t *n, uint64_t bit) {
+	return (popcount(bitmap(n) & (bit - 1)));
+}
+
+static inline size_t
+leafkey(dns_qp_t *qp, const qpnode_t *n, dns_qpkey_t key) {
+	return (dns_qpkey_fromname(key, qp->getname(n->ptr, qp->arg)));
+}
+
+/*
+ * Return the offset of the first shift at which the keys differ, or
+ * DNS_QP_MAXKEY if they are equal.
+ */
+static size_t
+keydiff(const dns_qpkey_t key1, size_t len1,
+	const dns_qpkey_t key2, size_t len2)
+{
+	size_t offset, len = ISC_MAX(len1, len2);
+
+	for (offset = 0; offset < len; offset++) {
+		if (keyshift(key1, len1, offset) !=
+		    keyshift(key2, len2, offset))
+		{
+			return (offset);
+		}
+	}
+	return (DNS_QP_MAXKEY);
+}
+
+/*
+ * Find the leaf whose key is most similar to 'key': follow the twig
+ * for the key's shift where there is one, and any twig otherwise.
+ * The first difference between the keys tells where 'key' belongs.
+ */
+static qpnode_t *
+closest_leaf(dns_qp_t *qp, const dns_qpkey_t key, size_t len) {
+	qpnode_t *n = &qp->root;
+
+	while (isbranch(n)) {
+		uint64_t bit = shiftbit(keyshift(key, len, keyoffset(n)));
+		if ((bitmap(n) & bit) != 0) {
+			n = twigs(n) + twigpos(n, bit);
+		} else {
+			n = twigs(n);
+		}
+	}
+	return (n);
+}
+
+/*
+ * Find the leaf for exactly 'key', recording its parent.
+ */
+static qpnode_t *
+find_leaf(dns_qp_t *qp, const dns_qpkey_t key, size_t len,
+	  qpnode_t **parentp)
+{
+	qpnode_t *parent = NULL;
+	qpnode_t *n = &qp->root;
+	dns_qpkey_t found;
+	size_t foundlen;
+
+	if (qp->count == 0) {
+		return (NULL);
+	}
+
+	while (isbranch(n)) {
+		uint64_t bit = shiftbit(keyshift(key, len, keyoffset(n)));
+		if ((bitmap(n) & bit) == 0) {
+			return (NULL);
+		}
+		parent = n;
+		n = twigs(n) + twigpos(n, bit);
+	}
+
+	foundlen = leafkey(qp, n, found);
+	if (foundlen != len || memcmp(found, key, len) != 0) {
+		return (NULL);
+	}
+
+	if (parentp != NULL) {
+		*parentp = parent;
+	}
+	return (n);
+}
+
+static inline qpnode_t *
+last_leaf(qpnode_t *n) {
+	while (isbranch(n)) {
+		n = twigs(n) + twigcount(n) - 1;
+	}
+	return (n);
+}
+
+isc_result_t
+dns_qp_create(isc_mem_t *mctx, dns_qpgetname_t getname,
+	      dns_qpdeleter_t deleter, void *arg, dns_qp_t **qpp)
+{
+	dns_qp_t *qp;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(getname != NULL);
+	REQUIRE(qpp != NULL && *qpp == NULL);
+
+	RUNTIME_CHECK(isc_once_do(&once, init_bits_for_byte) == ISC_R_SUCCESS);
+
+	qp = isc_mem_get(mctx, sizeof(*qp));
+	qp->mctx = NULL;
+	isc_mem_attach(mctx, &qp->mctx);
+	qp->getname = getname;
+	qp->deleter = deleter;
+	qp->arg = arg;
+	qp->count = 0;
+	qp->root.index = 0;
+	qp->root.ptr = NULL;
+	qp->magic = QP_MAGIC;
+
+	*qpp = qp;
+
+	return (ISC_R_SUCCESS);
+}
+
+static void
+destroy_node(dns_qp_t *qp, qpnode_t *n) {
+	unsigned int i, count;
+
+	if (!isbranch(n)) {
+		if (qp->deleter != NULL) {
+			qp->deleter(n->ptr, qp->arg);
+		}
+		return;
+	}
+
+	count = twigcount(n);
+	for (i = 0; i < count; i++) {
+		destroy_node(qp, twigs(n) + i);
+	}
+	isc_mem_put(qp->mctx, n->ptr, count * sizeof(qpnode_t));
+}
+
+void
+dns_qp_destroy(dns_qp_t **qpp) {
+	dns_qp_t *qp;
+
+	REQUIRE(qpp != NULL && VALID_QP(*qpp));
+
+	qp = *qpp;
+	*qpp = NULL;
+
+	if (qp->count != 0) {
+		destroy_node(qp, &qp->root);
+	}
+
+	qp->magic = 0;
+	isc_mem_putanddetach(&qp->mctx, qp, sizeof(*qp));
+}
+
+unsigned int
+dns_qp_count(dns_qp_t *qp) {
+	REQUIRE(VALID_QP(qp));
+
+	return (qp->count);
+}
+
+isc_result_t
+dns_qp_insert(dns_qp_t *qp, void *data) {
+	dns_qpkey_t newkey, oldkey;
+	size_t newlen, oldlen, offset;
+	unsigned int newshift, oldshift, pos, count;
+	uint64_t newbit, oldbit;
+	qpnode_t *n, *twig;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(data != NULL);
+
+	newlen = dns_qpkey_fromname(newkey, qp->getname(data, qp->arg));
+
+	if (qp->count == 0) {
+		qp->root.index = 0;
+		qp->root.ptr = data;
+		qp->count++;
+		return (ISC_R_SUCCESS);
+	}
+
+	n = closest_leaf(qp, newkey, newlen);
+	oldlen = leafkey(qp, n, oldkey);
+	offset = keydiff(newkey, newlen, oldkey, oldlen);
+	if (offset == DNS_QP_MAXKEY) {
+		return (ISC_R_EXISTS);
+	}
+	newshift = keyshift(newkey, newlen, offset);
+	oldshift = keyshift(oldkey, oldlen, offset);
+	newbit = shiftbit(newshift);
+	oldbit = shiftbit(oldshift);
+
+	/*
+	 * All the branches above the point of difference have a twig
+	 * for the new key, or closest_leaf() would have strayed from
+	 * it earlier.
+	 */
+	n = &qp->root;
+	while (isbranch(n) && keyoffset(n) < offset) {
+		uint64_t bit = shiftbit(keyshift(newkey, newlen,
+						 keyoffset(n)));
+		INSIST((bitmap(n) & bit) != 0);
+		n = twigs(n) + twigpos(n, bit);
+	}
+
+	if (isbranch(n) && keyoffset(n) == offset) {
+		/*
+		 * Add a twig to an existing branch.
+		 */
+		INSIST((bitmap(n) & newbit) == 0);
+		count = twigcount(n);
+		pos = twigpos(n, newbit);
+		twig = isc_mem_get(qp->mctx, (count + 1) * sizeof(qpnode_t));
+		memmove(twig, twigs(n), pos * sizeof(qpnode_t));
+		memmove(twig + pos + 1, twigs(n) + pos,
+			(count - pos) * sizeof(qpnode_t));
+		twig[pos].index = 0;
+		twig[pos].ptr = data;
+		isc_mem_put(qp->mctx, n->ptr, count * sizeof(qpnode_t));
+		n->index |= newbit;
+		n->ptr = twig;
+	} else {
+		/*
+		 * Replace the node with a new branch, holding the node
+		 * and the new leaf as twigs.  Everything under the node
+		 * has the same shift as the old key at this offset.
+		 */
+		twig = isc_mem_get(qp->mctx, 2 * sizeof(qpnode_t));
+		pos = (newshift < oldshift) ? 0 : 1;
+		twig[pos].index = 0;
+		twig[pos].ptr = data;
+		twig[1 - pos] = *n;
+		n->index = BRANCH_TAG | newbit | oldbit |
+			   ((uint64_t)offset << OFFSET_SHIFT);
+		n->ptr = twig;
+	}
+
+	qp->count++;
+	return (ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_qp_findname(dns_qp_t *qp, const dns_name_t *name, void **datap) {
+	dns_qpkey_t key;
+	size_t len;
+	qpnode_t *n;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(datap != NULL && *datap == NULL);
+
+	len = dns_qpkey_fromname(key, name);
+	n = find_leaf(qp, key, len, NULL);
+	if (n == NULL) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	*datap = n->ptr;
+	return (ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_qp_findprevious(dns_qp_t *qp, const dns_name_t *name, void **datap) {
+	dns_qpkey_t key, found;
+	size_t len, foundlen, offset;
+	unsigned int shift, foundshift;
+	qpnode_t *stack[DNS_QP_MAXKEY + 1];
+	unsigned int depth = 0;
+	qpnode_t *n;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(datap != NULL && *datap == NULL);
+
+	if (qp->count == 0) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	len = dns_qpkey_fromname(key, name);
+	n = closest_leaf(qp, key, len);
+	foundlen = leafkey(qp, n, found);
+	offset = keydiff(key, len, found, foundlen);
+	if (offset == DNS_QP_MAXKEY) {
+		goto done;
+	}
+	shift = keyshift(key, len, offset);
+	foundshift = keyshift(found, foundlen, offset);
+
+	/*
+	 * Go back down to where the key diverges from the trie,
+	 * remembering the way.
+	 */
+	n = &qp->root;
+	while (isbranch(n) && keyoffset(n) < offset) {
+		stack[depth++] = n;
+		n = twigs(n) + twigpos(n, shiftbit(keyshift(key, len,
+							    keyoffset(n))));
+	}
+
+	if (isbranch(n) && keyoffset(n) == offset) {
+		/*
+		 * The predecessor is the last leaf under the closest
+		 * twig before the one the key would be in, if any.
+		 */
+		uint64_t below = bitmap(n) & (shiftbit(shift) - 1);
+		if (below != 0) {
+			n = last_leaf(twigs(n) + popcount(below) - 1);
+			goto done;
+		}
+	} else if (foundshift < shift) {
+		/*
+		 * The whole subtree sorts before the key.
+		 */
+		n = last_leaf(n);
+		goto done;
+	}
+
+	/*
+	 * The whole subtree sorts after the key: look for the closest
+	 * preceding twig on the way back up.
+	 */
+	while (depth > 0) {
+		qpnode_t *parent = stack[--depth];
+		if (n != twigs(parent)) {
+			n = last_leaf(n - 1);
+			goto done;
+		}
+		n = parent;
+	}
+	return (ISC_R_NOTFOUND);
+
+ done:
+	*datap = n->ptr;
+	return (ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_qp_deletename(dns_qp_t *qp, const dns_name_t *name) {
+	dns_qpkey_t key;
+	size_t len;
+	qpnode_t *n, *parent = NULL, *twig;
+	unsigned int pos, count;
+	void *data;
+
+	REQUIRE(VALID_QP(qp));
+
+	len = dns_qpkey_fromname(key, name);
+	n = find_leaf(qp, key, len, &parent);
+	if (n == NULL) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	data = n->ptr;
+
+	if (parent == NULL) {
+		INSIST(n == &qp->root);
+		qp->root.index = 0;
+		qp->root.ptr = NULL;
+	} else {
+		count = twigcount(parent);
+		pos = (unsigned int)(n - twigs(parent));
+		twig = twigs(parent);
+		if (count == 2) {
+			/*
+			 * The remaining twig takes the place of the branch.
+			 */
+			*parent = twig[1 - pos];
+			isc_mem_put(qp->mctx, twig, 2 * sizeof(qpnode_t));
+		} else {
+			uint64_t bit = shiftbit(keyshift(key, len,
+							 keyoffset(parent)));
+			qpnode_t *newtwig;
+
+			newtwig = isc_mem_get(qp->mctx,
+					      (count - 1) * sizeof(qpnode_t));
+			memmove(newtwig, twig, pos * sizeof(qpnode_t));
+			memmove(newtwig + pos, twig + pos + 1,
+				(count - pos - 1) * sizeof(qpnode_t));
+			isc_mem_put(qp->mctx, twig, count * sizeof(qpnode_t));
+			parent->index &= ~bit;
+			parent->ptr = newtwig;
+		}
+	}
+
+	qp->count--;
+
+	if (qp->deleter != NULL) {
+		qp->deleter(data, qp->arg);
+	}
+
+	return (ISC_R_SUCCESS);
+}
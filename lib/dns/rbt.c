@@ -17,12 +17,14 @@
 
 #include <isc/crc64.h>
 #include <isc/file.h>
+#include <isc/hash.h>
 #include <isc/hex.h>
 #include <isc/mem.h>
 #include <isc/once.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/refcount.h>
+#include <isc/siphash.h>
 #include <isc/socket.h>
 #include <isc/stdio.h>
 #include <isc/string.h>
@@ -74,11 +76,30 @@ struct dns_rbt {
 	void			(*data_deleter)(void *, void *);
 	void *			deleter_arg;
 	unsigned int		nodecount;
-	size_t			hashsize;
-	dns_rbtnode_t **	hashtable;
+	size_t			hashsize[2];
+	dns_rbtnode_t **	hashtable[2];
+	uint8_t			hindex;
+	uint32_t		hiter;
+	uint8_t			hashkey[16];
 	void *			mmap_location;
+	dns_rbtnode_t **	mmap_hashtable;
 };
 
+/*
+ * The node hash table is grown incrementally: when the load factor
+ * gets too high, a new, larger table is allocated and becomes
+ * hashtable[hindex], and new nodes are only ever added to it.  The
+ * old table is kept in hashtable[RBT_HASH_NEXTTABLE(hindex)] and a
+ * few of its buckets (starting from 'hiter') are migrated to the new
+ * table on each subsequent insertion or removal, until it is empty
+ * and can be freed.  Lookups have to search both tables while the
+ * migration is in progress.
+ */
+#define RBT_HASH_NEXTTABLE(hindex)	((hindex == 0) ? 1 : 0)
+#define RBT_HASH_MIGRATE		4	/*%< buckets moved per call */
+#define REHASHING(rbt) \
+	((rbt)->hashtable[RBT_HASH_NEXTTABLE((rbt)->hindex)] != NULL)
+
 #define RED 0
 #define BLACK 1
 
@@ -108,6 +129,15 @@ struct file_header {
 	unsigned int rdataset_fixed:1;	/* compiled with --enable-rrset-fixed */
 	unsigned int nodecount;		/* shadow from rbt structure */
 	uint64_t crc;
+	/*
+	 * The address the image was written to be mapped at, and the
+	 * node hash table for that address: its offset in the file, its
+	 * size and the key the nodes were hashed with.
+	 */
+	uint64_t base;
+	uint64_t hashtable;
+	uint64_t hashsize;
+	uint8_t hashkey[16];
 	char version2[32];  		/* repeated; must match version1 */
 };
 
@@ -116,13 +146,20 @@ struct file_header {
  *
  * step one: write out a zeroed header of 1024 bytes
  * step two: walk the tree in a depth-first, left-right-down order, writing
- * out the nodes, reserving space as we go, correcting addresses to point
- * at the proper offset in the file, and setting a flag for each pointer to
- * indicate that it is a reference to a location in the file, rather than in
- * memory.
+ * out the nodes, reserving space as we go.  Every pointer is written as
+ * the address it will have when the file is mapped at 'base', and the
+ * node hash table for that mapping is built along the way and written
+ * out after the nodes.
  * step three: write out the header, adding the information that will be
  * needed to re-create the tree object itself.
  *
+ * A file mapped at its 'base' address is used as it is: no node is read
+ * until a search reaches it, and a page of the mapping is only copied
+ * when something on it is written to (which includes the reference
+ * count of a node being looked up in an RBTDB).  Mapped anywhere else,
+ * every pointer is relocated and the hash table is rebuilt when the
+ * tree is loaded.
+ *
  * The RBTDB object will do this three times, once for each of the three
  * RBT objects it contains.
  *
@@ -130,25 +167,34 @@ struct file_header {
  * and fseeked, not to a pipe or stream
  */
 
+typedef struct rbt_serializer {
+	FILE *			file;
+	uintptr_t		base;
+	dns_rbtdatawriter_t	datawriter;
+	void *			writer_arg;
+	size_t			hashsize;
+	uintptr_t *		hashtable;
+	uint64_t *		crc;
+} rbt_serializer_t;
+
 static isc_result_t
 dns_rbt_zero_header(FILE *file);
 
 static isc_result_t
-write_header(FILE *file, dns_rbt_t *rbt, uint64_t first_node_offset,
-	     uint64_t crc);
+write_header(rbt_serializer_t *s, dns_rbt_t *rbt, uint64_t first_node_offset,
+	     uint64_t hashtable, uint64_t crc);
 
 static bool
 match_header_version(file_header_t *header);
 
 static isc_result_t
-serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
+serialize_node(rbt_serializer_t *s, dns_rbtnode_t *node, uintptr_t left,
 	       uintptr_t right, uintptr_t down, uintptr_t parent,
-	       uintptr_t data, uint64_t *crc);
+	       uintptr_t data, uintptr_t upper, uintptr_t hashnext);
 
 static isc_result_t
-serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
-		dns_rbtdatawriter_t datawriter, void *writer_arg,
-		uintptr_t *where, uint64_t *crc);
+serialize_nodes(rbt_serializer_t *s, dns_rbtnode_t *node, uintptr_t parent,
+		uintptr_t upper, uintptr_t *where);
 
 /*
  * The following functions allow you to get the actual address of a pointer
@@ -345,27 +391,6 @@ get_upper_node(dns_rbtnode_t *node) {
 	return (UPPERNODE(node));
 }
 
-static void
-fixup_uppernodes_helper(dns_rbtnode_t *node, dns_rbtnode_t *uppernode) {
-	if (node == NULL)
-		return;
-
-	UPPERNODE(node) = uppernode;
-
-	fixup_uppernodes_helper(LEFT(node), uppernode);
-	fixup_uppernodes_helper(RIGHT(node), uppernode);
-	fixup_uppernodes_helper(DOWN(node), node);
-}
-
-/*
- * This function is used to fixup uppernode members of all dns_rbtnodes
- * after deserialization.
- */
-static void
-fixup_uppernodes(dns_rbt_t *rbt) {
-	fixup_uppernodes_helper(rbt->root, NULL);
-}
-
 size_t
 dns__rbtnode_getdistance(dns_rbtnode_t *node) {
 	size_t nodes = 1;
@@ -389,12 +414,25 @@ create_node(isc_mem_t *mctx, const dns_name_t *name, dns_rbtnode_t **nodep);
 static isc_result_t
 inithash(dns_rbt_t *rbt);
 
+static inline unsigned int
+rbt_hash(dns_rbt_t *rbt, const dns_name_t *name);
+
 static inline void
 hash_node(dns_rbt_t *rbt, dns_rbtnode_t *node, const dns_name_t *name);
 
 static inline void
 unhash_node(dns_rbt_t *rbt, dns_rbtnode_t *node);
 
+static inline dns_rbtnode_t *
+hash_lookup(dns_rbt_t *rbt, unsigned int hash, dns_rbtnode_t *upper,
+	    const dns_name_t *name);
+
+static void
+hashtable_free(dns_rbt_t *rbt, uint8_t index);
+
+static size_t
+rehash_size(size_t oldsize, unsigned int newcount);
+
 static void
 rehash(dns_rbt_t *rbt, unsigned int newcount);
 
@@ -411,11 +449,16 @@ static void
 deletefromlevel(dns_rbtnode_t *item, dns_rbtnode_t **rootp);
 
 static isc_result_t
-treefix(dns_rbt_t *rbt, void *base, size_t size,
-	dns_rbtnode_t *n, const dns_name_t *name,
+treefix(dns_rbt_t *rbt, void *base, size_t size, uintptr_t filebase,
+	dns_rbtnode_t *n, const dns_name_t *name, dns_rbtnode_t *upper,
 	dns_rbtdatafixer_t datafixer, void *fixer_arg,
 	uint64_t *crc);
 
+static isc_result_t
+treecheck(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
+	  dns_rbtnode_t *upper, dns_rbtdatafixer_t datafixer,
+	  void *fixer_arg, uint64_t *crc);
+
 static void
 deletetreeflat(dns_rbt_t *rbt, unsigned int quantum, bool unhash,
 	       dns_rbtnode_t **nodep);
@@ -468,12 +511,13 @@ init_file_version(void) {
  * here.
  */
 static isc_result_t
-write_header(FILE *file, dns_rbt_t *rbt, uint64_t first_node_offset,
-	     uint64_t crc)
+write_header(rbt_serializer_t *s, dns_rbt_t *rbt, uint64_t first_node_offset,
+	     uint64_t hashtable, uint64_t crc)
 {
 	file_header_t header;
 	isc_result_t result;
 	off_t location;
+	FILE *file = s->file;
 
 	RUNTIME_CHECK(isc_once_do(&once, init_file_version) == ISC_R_SUCCESS);
 
@@ -494,6 +538,11 @@ write_header(FILE *file, dns_rbt_t *rbt, uint64_t first_node_offset,
 
 	header.crc = crc;
 
+	header.base = s->base;
+	header.hashtable = hashtable;
+	header.hashsize = s->hashsize;
+	memmove(header.hashkey, rbt->hashkey, sizeof(header.hashkey));
+
 	CHECK(isc_stdio_tell(file, &location));
 	location = dns_rbt_serialize_align(location);
 	CHECK(isc_stdio_seek(file, location, SEEK_SET));
@@ -523,9 +572,9 @@ match_header_version(file_header_t *header) {
 }
 
 static isc_result_t
-serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
+serialize_node(rbt_serializer_t *s, dns_rbtnode_t *node, uintptr_t left,
 	       uintptr_t right, uintptr_t down, uintptr_t parent,
-	       uintptr_t data, uint64_t *crc)
+	       uintptr_t data, uintptr_t upper, uintptr_t hashnext)
 {
 	dns_rbtnode_t temp_node;
 	off_t file_position;
@@ -538,9 +587,9 @@ serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
 
 	INSIST(node != NULL);
 
-	CHECK(isc_stdio_tell(file, &file_position));
+	CHECK(isc_stdio_tell(s->file, &file_position));
 	file_position = dns_rbt_serialize_align(file_position);
-	CHECK(isc_stdio_seek(file, file_position, SEEK_SET));
+	CHECK(isc_stdio_seek(s->file, file_position, SEEK_SET));
 
 	temp_node = *node;
 	temp_node.down_is_relative = 0;
@@ -550,39 +599,27 @@ serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
 	temp_node.data_is_relative = 0;
 	temp_node.is_mmapped = 1;
 
+	temp_node.parent = (dns_rbtnode_t *)parent;
+	temp_node.left = (dns_rbtnode_t *)left;
+	temp_node.right = (dns_rbtnode_t *)right;
+	temp_node.down = (dns_rbtnode_t *)down;
+	temp_node.data = (void *)data;
+	temp_node.uppernode = (dns_rbtnode_t *)upper;
+	temp_node.hashnext = (dns_rbtnode_t *)hashnext;
+
 	/*
-	 * If the next node is not NULL, calculate the next node's location
-	 * in the file.  Note that this will have to change when the data
-	 * structure changes, and it also assumes that we always write the
-	 * nodes out in list order (which we currently do.)
-	*/
-	if (temp_node.parent != NULL) {
-		temp_node.parent = (dns_rbtnode_t *)(parent);
-		temp_node.parent_is_relative = 1;
-	}
-	if (temp_node.left != NULL) {
-		temp_node.left = (dns_rbtnode_t *)(left);
-		temp_node.left_is_relative = 1;
-	}
-	if (temp_node.right != NULL) {
-		temp_node.right = (dns_rbtnode_t *)(right);
-		temp_node.right_is_relative = 1;
-	}
-	if (temp_node.down != NULL) {
-		temp_node.down = (dns_rbtnode_t *)(down);
-		temp_node.down_is_relative = 1;
-	}
-	if (temp_node.data != NULL) {
-		temp_node.data = (dns_rbtnode_t *)(data);
-		temp_node.data_is_relative = 1;
-	}
+	 * Whoever had the node in use in this process has nothing to
+	 * do with whoever will map the file.
+	 */
+	ISC_LINK_INIT(&temp_node, deadlink);
+	isc_refcount_init(&temp_node.references, 0);
 
 	node_data = (unsigned char *) node + sizeof(dns_rbtnode_t);
 	datasize = NODE_SIZE(node) - sizeof(dns_rbtnode_t);
 
 	CHECK(isc_stdio_write(&temp_node, 1, sizeof(dns_rbtnode_t),
-			      file, NULL));
-	CHECK(isc_stdio_write(node_data, 1, datasize, file, NULL));
+			      s->file, NULL));
+	CHECK(isc_stdio_write(node_data, 1, datasize, s->file, NULL));
 
 #ifdef DEBUG
 	dns_name_init(&nodename, NULL);
@@ -595,21 +632,22 @@ serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
 	hexdump("node data", node_data, datasize);
 #endif
 
-	isc_crc64_update(crc, (const uint8_t *) &temp_node,
+	isc_crc64_update(s->crc, (const uint8_t *) &temp_node,
 			 sizeof(dns_rbtnode_t));
-	isc_crc64_update(crc, (const uint8_t *) node_data, datasize);
+	isc_crc64_update(s->crc, (const uint8_t *) node_data, datasize);
 
  cleanup:
 	return (result);
 }
 
 static isc_result_t
-serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
-		dns_rbtdatawriter_t datawriter, void *writer_arg,
-		uintptr_t *where, uint64_t *crc)
+serialize_nodes(rbt_serializer_t *s, dns_rbtnode_t *node, uintptr_t parent,
+		uintptr_t upper, uintptr_t *where)
 {
 	uintptr_t left = 0, right = 0, down = 0, data = 0;
+	uintptr_t self, hashnext;
 	off_t location = 0, offset_adjust;
+	unsigned int bucket;
 	isc_result_t result;
 
 	if (node == NULL) {
@@ -619,12 +657,13 @@ serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
 	}
 
 	/* Reserve space for current node. */
-	CHECK(isc_stdio_tell(file, &location));
+	CHECK(isc_stdio_tell(s->file, &location));
 	location = dns_rbt_serialize_align(location);
-	CHECK(isc_stdio_seek(file, location, SEEK_SET));
+	CHECK(isc_stdio_seek(s->file, location, SEEK_SET));
+	self = s->base + (uintptr_t)location;
 
 	offset_adjust = dns_rbt_serialize_align(location + NODE_SIZE(node));
-	CHECK(isc_stdio_seek(file, offset_adjust, SEEK_SET));
+	CHECK(isc_stdio_seek(s->file, offset_adjust, SEEK_SET));
 
 	/*
 	 * Serialize the rest of the tree.
@@ -632,35 +671,42 @@ serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
 	 * WARNING: A change in the order (from left, right, down)
 	 * will break the way the crc hash is computed.
 	 */
-	CHECK(serialize_nodes(file, getleft(node, NULL), location,
-			      datawriter, writer_arg, &left, crc));
-	CHECK(serialize_nodes(file, getright(node, NULL), location,
-			      datawriter, writer_arg, &right, crc));
-	CHECK(serialize_nodes(file, getdown(node, NULL), location,
-			      datawriter, writer_arg, &down, crc));
+	CHECK(serialize_nodes(s, getleft(node, NULL), self, upper, &left));
+	CHECK(serialize_nodes(s, getright(node, NULL), self, upper, &right));
+	CHECK(serialize_nodes(s, getdown(node, NULL), self, self, &down));
 
 	if (node->data != NULL) {
 		off_t ret;
 
-		CHECK(isc_stdio_tell(file, &ret));
+		CHECK(isc_stdio_tell(s->file, &ret));
 		ret = dns_rbt_serialize_align(ret);
-		CHECK(isc_stdio_seek(file, ret, SEEK_SET));
-		data = ret;
+		CHECK(isc_stdio_seek(s->file, ret, SEEK_SET));
+		data = s->base + (uintptr_t)ret;
 
-		datawriter(file, node->data, writer_arg, crc);
+		CHECK(s->datawriter(s->file, node->data, s->base, self,
+				    s->writer_arg, s->crc));
 	}
 
+	/*
+	 * Chain the node into its bucket of the hash table that is
+	 * written out after the nodes.
+	 */
+	bucket = HASHVAL(node) % s->hashsize;
+	hashnext = s->hashtable[bucket];
+	s->hashtable[bucket] = self;
+
 	/* Seek back to reserved space. */
-	CHECK(isc_stdio_seek(file, location, SEEK_SET));
+	CHECK(isc_stdio_seek(s->file, location, SEEK_SET));
 
 	/* Serialize the current node. */
-	CHECK(serialize_node(file, node, left, right, down, parent, data, crc));
+	CHECK(serialize_node(s, node, left, right, down, parent, data,
+			     upper, hashnext));
 
 	/* Ensure we are always at the end of the file. */
-	CHECK(isc_stdio_seek(file, 0, SEEK_END));
+	CHECK(isc_stdio_seek(s->file, 0, SEEK_END));
 
 	if (where != NULL)
-		*where = (uintptr_t) location;
+		*where = self;
 
  cleanup:
 	return (result);
@@ -677,20 +723,40 @@ dns_rbt_serialize_align(off_t target) {
 }
 
 isc_result_t
-dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
+dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt, uintptr_t base,
 		       dns_rbtdatawriter_t datawriter,
 		       void *writer_arg, off_t *offset)
 {
 	isc_result_t result;
-	off_t header_position, node_position, end_position;
+	off_t header_position, node_position, end_position, hash_position;
+	rbt_serializer_t s;
+	size_t hashbytes;
 	uint64_t crc;
 
 	REQUIRE(file != NULL);
 
-	CHECK(isc_file_isplainfilefd(fileno(file)));
+	result = isc_file_isplainfilefd(fileno(file));
+	if (result != ISC_R_SUCCESS)
+		return (result);
 
 	isc_crc64_init(&crc);
 
+	s = (rbt_serializer_t){
+		.file = file,
+		.base = base,
+		.datawriter = datawriter,
+		.writer_arg = writer_arg,
+		.crc = &crc,
+	};
+	if (rbt->nodecount < RBT_HASH_SIZE * 3) {
+		s.hashsize = RBT_HASH_SIZE;
+	} else {
+		s.hashsize = rehash_size(RBT_HASH_SIZE, rbt->nodecount);
+	}
+	hashbytes = s.hashsize * sizeof(s.hashtable[0]);
+	s.hashtable = isc_mem_get(rbt->mctx, hashbytes);
+	memset(s.hashtable, 0, hashbytes);
+
 	CHECK(isc_stdio_tell(file, &header_position));
 
 	/* Write dummy header */
@@ -698,16 +764,21 @@ dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 
 	/* Serialize nodes */
 	CHECK(isc_stdio_tell(file, &node_position));
-	CHECK(serialize_nodes(file, rbt->root, 0, datawriter,
-			      writer_arg, NULL, &crc));
+	CHECK(serialize_nodes(&s, rbt->root, 0, 0, NULL));
 
 	CHECK(isc_stdio_tell(file, &end_position));
 	if (node_position == end_position) {
 		CHECK(isc_stdio_seek(file, header_position, SEEK_SET));
 		*offset = 0;
-		return (ISC_R_SUCCESS);
+		goto cleanup;
 	}
 
+	/* Serialize the node hash table */
+	hash_position = dns_rbt_serialize_align(end_position);
+	CHECK(isc_stdio_seek(file, hash_position, SEEK_SET));
+	CHECK(isc_stdio_write(s.hashtable, sizeof(s.hashtable[0]),
+			      s.hashsize, file, NULL));
+
 	isc_crc64_final(&crc);
 #ifdef DEBUG
 	hexdump("serializing CRC", (unsigned char *)&crc, sizeof(crc));
@@ -715,13 +786,14 @@ dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 
 	/* Serialize header */
 	CHECK(isc_stdio_seek(file, header_position, SEEK_SET));
-	CHECK(write_header(file, rbt, HEADER_LENGTH, crc));
+	CHECK(write_header(&s, rbt, HEADER_LENGTH, hash_position, crc));
 
 	/* Ensure we are always at the end of the file. */
 	CHECK(isc_stdio_seek(file, 0, SEEK_END));
 	*offset = dns_rbt_serialize_align(header_position);
 
  cleanup:
+	isc_mem_put(rbt->mctx, s.hashtable, hashbytes);
 	return (result);
 }
 
@@ -732,10 +804,20 @@ dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 	} \
 } while(0);
 
+/*
+ * Turn a pointer written for a mapping at 'filebase' into one into the
+ * actual mapping at 'base', confirming that it stays inside the file.
+ */
+#define RELOCATE(p, max) do { \
+	uintptr_t off_ = (uintptr_t)(p) - filebase; \
+	CONFIRM(off_ <= (max)); \
+	(p) = (void *)((char *)base + off_); \
+} while (0)
+
 static isc_result_t
-treefix(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
-	const dns_name_t *name, dns_rbtdatafixer_t datafixer,
-	void *fixer_arg, uint64_t *crc)
+treefix(dns_rbt_t *rbt, void *base, size_t filesize, uintptr_t filebase,
+	dns_rbtnode_t *n, const dns_name_t *name, dns_rbtnode_t *upper,
+	dns_rbtdatafixer_t datafixer, void *fixer_arg, uint64_t *crc)
 {
 	isc_result_t result = ISC_R_SUCCESS;
 	dns_fixedname_t fixed;
@@ -765,63 +847,60 @@ treefix(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
 	/* memorize header contents prior to fixup */
 	memmove(&header, n, sizeof(header));
 
-	if (n->left_is_relative) {
-		CONFIRM(n->left <= (dns_rbtnode_t *) nodemax);
-		n->left = getleft(n, rbt->mmap_location);
-		n->left_is_relative = 0;
+	CONFIRM(!n->left_is_relative && !n->right_is_relative &&
+		!n->down_is_relative && !n->parent_is_relative &&
+		!n->data_is_relative);
+
+	if (n->left != NULL) {
+		RELOCATE(n->left, nodemax);
 		CONFIRM(DNS_RBTNODE_VALID(n->left));
-	} else
-		CONFIRM(n->left == NULL);
+	}
 
-	if (n->right_is_relative) {
-		CONFIRM(n->right <= (dns_rbtnode_t *) nodemax);
-		n->right = getright(n, rbt->mmap_location);
-		n->right_is_relative = 0;
+	if (n->right != NULL) {
+		RELOCATE(n->right, nodemax);
 		CONFIRM(DNS_RBTNODE_VALID(n->right));
-	} else
-		CONFIRM(n->right == NULL);
+	}
 
-	if (n->down_is_relative) {
-		CONFIRM(n->down <= (dns_rbtnode_t *) nodemax);
-		n->down = getdown(n, rbt->mmap_location);
-		n->down_is_relative = 0;
+	if (n->down != NULL) {
+		RELOCATE(n->down, nodemax);
 		CONFIRM(n->down > (dns_rbtnode_t *) n);
 		CONFIRM(DNS_RBTNODE_VALID(n->down));
-	} else
-		CONFIRM(n->down == NULL);
+	}
 
-	if (n->parent_is_relative) {
-		CONFIRM(n->parent <= (dns_rbtnode_t *) nodemax);
-		n->parent = getparent(n, rbt->mmap_location);
-		n->parent_is_relative = 0;
+	if (n->parent != NULL) {
+		RELOCATE(n->parent, nodemax);
 		CONFIRM(n->parent < (dns_rbtnode_t *) n);
 		CONFIRM(DNS_RBTNODE_VALID(n->parent));
-	} else
-		CONFIRM(n->parent == NULL);
+	}
 
-	if (n->data_is_relative) {
-		CONFIRM(n->data <= (void *) filesize);
-		n->data = getdata(n, rbt->mmap_location);
-		n->data_is_relative = 0;
+	if (n->data != NULL) {
+		RELOCATE(n->data, filesize);
 		CONFIRM(n->data > (void *) n);
-	} else
-		CONFIRM(n->data == NULL);
+	}
+
+	/*
+	 * The uppernode pointer was written for the mapping at 'filebase'
+	 * too, but it is cheaper to set it from the walk than to check it.
+	 * The hash chain is rebuilt from scratch, with the hash values
+	 * recomputed under this tree's key.
+	 */
+	UPPERNODE(n) = upper;
 
 	hash_node(rbt, n, fullname);
 
 	/* a change in the order (from left, right, down) will break hashing*/
 	if (n->left != NULL)
-		CHECK(treefix(rbt, base, filesize, n->left, name,
-			      datafixer, fixer_arg, crc));
+		CHECK(treefix(rbt, base, filesize, filebase, n->left, name,
+			      upper, datafixer, fixer_arg, crc));
 	if (n->right != NULL)
-		CHECK(treefix(rbt, base, filesize, n->right, name,
-			      datafixer, fixer_arg, crc));
+		CHECK(treefix(rbt, base, filesize, filebase, n->right, name,
+			      upper, datafixer, fixer_arg, crc));
 	if (n->down != NULL)
-		CHECK(treefix(rbt, base, filesize, n->down, fullname,
-			      datafixer, fixer_arg, crc));
+		CHECK(treefix(rbt, base, filesize, filebase, n->down,
+			      fullname, n, datafixer, fixer_arg, crc));
 
 	if (datafixer != NULL && n->data != NULL)
-		CHECK(datafixer(n, base, filesize, fixer_arg, crc));
+		CHECK(datafixer(n, base, filesize, filebase, fixer_arg, crc));
 
 	rbt->nodecount++;
 	node_data = (unsigned char *) n + sizeof(dns_rbtnode_t);
@@ -844,6 +923,88 @@ treefix(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
 	return (result);
 }
 
+/*
+ * Confirm that 'p' points at a node inside the file mapped at 'base'.
+ */
+#define INFILE(p, base, max) do { \
+	CONFIRM((uintptr_t)(p) >= (uintptr_t)(base) && \
+		(uintptr_t)(p) - (uintptr_t)(base) <= (max)); \
+	CONFIRM(DNS_RBTNODE_VALID((dns_rbtnode_t *)(p))); \
+} while (0)
+
+/*
+ * Check a node of a tree that is used where it was mapped, and the
+ * nodes below it, as treefix() does for a tree it relocates, but
+ * without writing to them.  The CRC and the number of nodes come out
+ * as they do from treefix().
+ */
+static isc_result_t
+treecheck(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
+	  dns_rbtnode_t *upper, dns_rbtdatafixer_t datafixer,
+	  void *fixer_arg, uint64_t *crc)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+	dns_name_t nodename;
+	size_t nodemax = filesize - sizeof(dns_rbtnode_t);
+
+	INFILE(n, base, nodemax);
+	CONFIRM(NODE_SIZE(n) <= filesize - ((uintptr_t)n - (uintptr_t)base));
+
+	dns_name_init(&nodename, NULL);
+	NODENAME(n, &nodename);
+	CONFIRM(dns_name_isvalid(&nodename));
+
+	CONFIRM(!n->left_is_relative && !n->right_is_relative &&
+		!n->down_is_relative && !n->parent_is_relative &&
+		!n->data_is_relative);
+	CONFIRM(UPPERNODE(n) == upper);
+
+	if (n->left != NULL) {
+		INFILE(n->left, base, nodemax);
+	}
+	if (n->right != NULL) {
+		INFILE(n->right, base, nodemax);
+	}
+	if (n->down != NULL) {
+		INFILE(n->down, base, nodemax);
+		CONFIRM(n->down > n);
+	}
+	if (n->parent != NULL) {
+		INFILE(n->parent, base, nodemax);
+		CONFIRM(n->parent < n);
+	}
+	if (HASHNEXT(n) != NULL) {
+		INFILE(HASHNEXT(n), base, nodemax);
+	}
+	if (n->data != NULL) {
+		CONFIRM((uintptr_t)n->data - (uintptr_t)base <= filesize);
+		CONFIRM(n->data > (void *) n);
+	}
+
+	/* The order (left, right, down) is the one the CRC was taken in. */
+	if (n->left != NULL)
+		CHECK(treecheck(rbt, base, filesize, n->left, upper,
+				datafixer, fixer_arg, crc));
+	if (n->right != NULL)
+		CHECK(treecheck(rbt, base, filesize, n->right, upper,
+				datafixer, fixer_arg, crc));
+	if (n->down != NULL)
+		CHECK(treecheck(rbt, base, filesize, n->down, n,
+				datafixer, fixer_arg, crc));
+
+	if (datafixer != NULL && n->data != NULL)
+		CHECK(datafixer(n, base, filesize, (uintptr_t)base,
+				fixer_arg, crc));
+
+	rbt->nodecount++;
+	isc_crc64_update(crc, (const uint8_t *)n, sizeof(dns_rbtnode_t));
+	isc_crc64_update(crc, (const uint8_t *)n + sizeof(dns_rbtnode_t),
+			 NODE_SIZE(n) - sizeof(dns_rbtnode_t));
+
+ cleanup:
+	return (result);
+}
+
 isc_result_t
 dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 			 off_t header_offset, isc_mem_t *mctx,
@@ -897,17 +1058,59 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 	}
 
 	/* Copy other data items from the header into our rbt. */
+	CONFIRM(header_offset + header->first_node_offset <=
+		filesize - sizeof(dns_rbtnode_t));
 	rbt->root = (dns_rbtnode_t *)((char *)base_address +
 				header_offset + header->first_node_offset);
+	CONFIRM(DNS_RBTNODE_VALID(rbt->root));
 
 	if ((header->nodecount * sizeof(dns_rbtnode_t)) > filesize) {
 		result = ISC_R_INVALIDFILE;
 		goto cleanup;
 	}
-	rehash(rbt, header->nodecount);
 
-	CHECK(treefix(rbt, base_address, filesize, rbt->root,
-		      dns_rootname, datafixer, fixer_arg, &crc));
+	if (header->base != 0 &&
+	    header->base == (uintptr_t)base_address)
+	{
+		dns_rbtnode_t **table;
+		size_t i;
+
+		/*
+		 * The file is mapped where it was written to be: the
+		 * nodes, and the hash table built for them under the
+		 * key recorded in the header, are used in place.  They
+		 * are read through once, to check the CRC and that no
+		 * pointer leads out of the file, but not written to, so
+		 * their pages are only copied when a node is changed.
+		 */
+		CONFIRM(header->hashsize > 0 &&
+			header->hashsize <= filesize / sizeof(void *));
+		CONFIRM(header->hashtable <=
+			filesize - header->hashsize * sizeof(void *));
+		CHECK(treecheck(rbt, base_address, filesize, rbt->root, NULL,
+				datafixer, fixer_arg, &crc));
+
+		table = (dns_rbtnode_t **)
+			((char *)base_address + header->hashtable);
+		for (i = 0; i < header->hashsize; i++) {
+			if (table[i] != NULL) {
+				INFILE(table[i], base_address,
+				       filesize - sizeof(dns_rbtnode_t));
+			}
+		}
+
+		hashtable_free(rbt, 0);
+		rbt->hashtable[0] = table;
+		rbt->hashsize[0] = header->hashsize;
+		rbt->mmap_hashtable = rbt->hashtable[0];
+		memmove(rbt->hashkey, header->hashkey, sizeof(rbt->hashkey));
+	} else {
+		rehash(rbt, header->nodecount);
+
+		CHECK(treefix(rbt, base_address, filesize, header->base,
+			      rbt->root, dns_rootname, NULL, datafixer,
+			      fixer_arg, &crc));
+	}
 
 	isc_crc64_final(&crc);
 #ifdef DEBUG
@@ -925,8 +1128,6 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 		goto cleanup;
 	}
 
-	fixup_uppernodes(rbt);
-
 	*rbtp = rbt;
 	if (originp != NULL)
 		*originp = rbt->root;
@@ -963,9 +1164,16 @@ dns_rbt_create(isc_mem_t *mctx, dns_rbtdeleter_t deleter,
 	rbt->deleter_arg = deleter_arg;
 	rbt->root = NULL;
 	rbt->nodecount = 0;
-	rbt->hashtable = NULL;
-	rbt->hashsize = 0;
+	rbt->hashtable[0] = NULL;
+	rbt->hashtable[1] = NULL;
+	rbt->hashsize[0] = 0;
+	rbt->hashsize[1] = 0;
+	rbt->hindex = 0;
+	rbt->hiter = 0;
 	rbt->mmap_location = NULL;
+	rbt->mmap_hashtable = NULL;
+	memmove(rbt->hashkey, isc_hash_get_initializer(),
+		sizeof(rbt->hashkey));
 
 	result = inithash(rbt);
 	if (result != ISC_R_SUCCESS) {
@@ -991,6 +1199,7 @@ dns_rbt_destroy(dns_rbt_t **rbtp) {
 isc_result_t
 dns_rbt_destroy2(dns_rbt_t **rbtp, unsigned int quantum) {
 	dns_rbt_t *rbt;
+	uint8_t i;
 
 	REQUIRE(rbtp != NULL && VALID_RBT(*rbtp));
 
@@ -1006,9 +1215,10 @@ dns_rbt_destroy2(dns_rbt_t **rbtp, unsigned int quantum) {
 
 	rbt->mmap_location = NULL;
 
-	if (rbt->hashtable != NULL)
-		isc_mem_put(rbt->mctx, rbt->hashtable,
-			    rbt->hashsize * sizeof(dns_rbtnode_t *));
+	for (i = 0; i < 2; i++) {
+		if (rbt->hashtable[i] != NULL)
+			hashtable_free(rbt, i);
+	}
 
 	rbt->magic = 0;
 
@@ -1029,7 +1239,7 @@ dns_rbt_hashsize(dns_rbt_t *rbt) {
 
 	REQUIRE(VALID_RBT(rbt));
 
-	return (rbt->hashsize);
+	return (rbt->hashsize[rbt->hindex]);
 }
 
 static inline isc_result_t
@@ -1560,7 +1770,7 @@ dns_rbt_findnode(dns_rbt_t *rbt, const dns_name_t *name, dns_name_t *foundname,
 						  nlabels - tlabels,
 						  hlabels + tlabels,
 						  &hash_name);
-			hash = dns_name_fullhash(&hash_name, false);
+			hash = rbt_hash(rbt, &hash_name);
 			dns_name_getlabelsequence(search_name,
 						  nlabels - tlabels,
 						  tlabels, &hash_name);
@@ -1569,35 +1779,8 @@ dns_rbt_findnode(dns_rbt_t *rbt, const dns_name_t *name, dns_name_t *foundname,
 			 * Walk all the nodes in the hash bucket pointed
 			 * by the computed hash value.
 			 */
-			for (hnode = rbt->hashtable[hash % rbt->hashsize];
-			     hnode != NULL;
-			     hnode = hnode->hashnext)
-			{
-				dns_name_t hnode_name;
-
-				if (ISC_LIKELY(hash != HASHVAL(hnode)))
-					continue;
-				/*
-				 * This checks that the hashed label
-				 * sequence being looked up is at the
-				 * same tree level, so that we don't
-				 * match a labelsequence from some other
-				 * subdomain.
-				 */
-				if (ISC_LIKELY(get_upper_node(hnode) !=
-					       up_current))
-				{
-					continue;
-				}
-
-				dns_name_init(&hnode_name, NULL);
-				NODENAME(hnode, &hnode_name);
-				if (ISC_LIKELY(dns_name_equal(&hnode_name,
-							      &hash_name)))
-				{
-					break;
-				}
-			}
+			hnode = hash_lookup(rbt, hash, up_current,
+					    &hash_name);
 
 			if (hnode != NULL) {
 				current = hnode;
@@ -2247,6 +2430,30 @@ create_node(isc_mem_t *mctx, const dns_name_t *name, dns_rbtnode_t **nodep) {
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * Hash a name for the node hash table.  This is dns_name_fullhash()
+ * under the tree's own key rather than the process-wide one, so that
+ * a tree mapped in from a file can use the hash values and the table
+ * that were computed when it was written.
+ */
+static inline unsigned int
+rbt_hash(dns_rbt_t *rbt, const dns_name_t *name) {
+	uint8_t input[DNS_NAME_MAXWIRE];
+	uint64_t hval;
+	unsigned int i;
+
+	if (name->labels == 0)
+		return (0);
+
+	for (i = 0; i < name->length; i++) {
+		uint8_t c = name->ndata[i];
+		input[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+	}
+	isc_siphash24(rbt->hashkey, input, name->length, (uint8_t *)&hval);
+
+	return ((unsigned int)hval);
+}
+
 /*
  * Add a node to the hash table
  */
@@ -2256,12 +2463,87 @@ hash_add_node(dns_rbt_t *rbt, dns_rbtnode_t *node, const dns_name_t *name) {
 
 	REQUIRE(name != NULL);
 
-	HASHVAL(node) = dns_name_fullhash(name, false);
+	HASHVAL(node) = rbt_hash(rbt, name);
+
+	hash = HASHVAL(node) % rbt->hashsize[rbt->hindex];
+	HASHNEXT(node) = rbt->hashtable[rbt->hindex][hash];
+
+	rbt->hashtable[rbt->hindex][hash] = node;
+}
+
+/*
+ * Look for a node with the given hash value and name whose upper
+ * node is 'upper'.  While a rehash is in progress, the buckets of
+ * the old table which haven't been migrated yet are searched too.
+ */
+static inline dns_rbtnode_t *
+hash_lookup(dns_rbt_t *rbt, unsigned int hash, dns_rbtnode_t *upper,
+	    const dns_name_t *name)
+{
+	dns_rbtnode_t *hnode;
+	uint8_t hindex = rbt->hindex;
+	unsigned int bucket;
+
+ nexttable:
+	bucket = hash % rbt->hashsize[hindex];
+	for (hnode = rbt->hashtable[hindex][bucket];
+	     hnode != NULL;
+	     hnode = HASHNEXT(hnode))
+	{
+		dns_name_t hnode_name;
+
+		if (ISC_LIKELY(hash != HASHVAL(hnode)))
+			continue;
+		/*
+		 * This checks that the hashed label sequence being
+		 * looked up is at the same tree level, so that we
+		 * don't match a labelsequence from some other
+		 * subdomain.
+		 */
+		if (ISC_LIKELY(get_upper_node(hnode) != upper))
+			continue;
+
+		dns_name_init(&hnode_name, NULL);
+		NODENAME(hnode, &hnode_name);
+		if (ISC_LIKELY(dns_name_equal(&hnode_name, name)))
+			return (hnode);
+	}
+
+	if (hindex == rbt->hindex && REHASHING(rbt)) {
+		hindex = RBT_HASH_NEXTTABLE(hindex);
+		if (hash % rbt->hashsize[hindex] >= rbt->hiter)
+			goto nexttable;
+	}
 
-	hash = HASHVAL(node) % rbt->hashsize;
-	HASHNEXT(node) = rbt->hashtable[hash];
+	return (NULL);
+}
+
+/*
+ * Allocate an empty hash table of 'size' buckets in slot 'index'.
+ */
+static void
+hashtable_new(dns_rbt_t *rbt, uint8_t index, size_t size) {
+	size_t bytes;
+
+	REQUIRE(rbt->hashtable[index] == NULL);
+
+	bytes = size * sizeof(dns_rbtnode_t *);
+	rbt->hashsize[index] = size;
+	rbt->hashtable[index] = isc_mem_get(rbt->mctx, bytes);
+	memset(rbt->hashtable[index], 0, bytes);
+}
 
-	rbt->hashtable[hash] = node;
+static void
+hashtable_free(dns_rbt_t *rbt, uint8_t index) {
+	if (rbt->hashtable[index] == rbt->mmap_hashtable) {
+		/* Part of the mapped file. */
+		rbt->mmap_hashtable = NULL;
+	} else {
+		isc_mem_put(rbt->mctx, rbt->hashtable[index],
+			    rbt->hashsize[index] * sizeof(dns_rbtnode_t *));
+	}
+	rbt->hashtable[index] = NULL;
+	rbt->hashsize[index] = 0;
 }
 
 /*
@@ -2269,51 +2551,91 @@ hash_add_node(dns_rbt_t *rbt, dns_rbtnode_t *node, const dns_name_t *name) {
  */
 static isc_result_t
 inithash(dns_rbt_t *rbt) {
-	unsigned int bytes;
-
-	rbt->hashsize = RBT_HASH_SIZE;
-	bytes = (unsigned int)rbt->hashsize * sizeof(dns_rbtnode_t *);
-	rbt->hashtable = isc_mem_get(rbt->mctx, bytes);
-
-	memset(rbt->hashtable, 0, bytes);
+	hashtable_new(rbt, 0, RBT_HASH_SIZE);
 
 	return (ISC_R_SUCCESS);
 }
 
 /*
- * Rebuild the hashtable to reduce the load factor
+ * Move up to RBT_HASH_MIGRATE buckets of the old hash table into the
+ * current one, and free the old table once it has been drained.
  */
 static void
-rehash(dns_rbt_t *rbt, unsigned int newcount) {
-	unsigned int oldsize;
-	dns_rbtnode_t **oldtable;
-	dns_rbtnode_t *node;
-	dns_rbtnode_t *nextnode;
+hashtable_rehash_one(dns_rbt_t *rbt) {
+	uint8_t oldindex = RBT_HASH_NEXTTABLE(rbt->hindex);
+	dns_rbtnode_t **oldtable = rbt->hashtable[oldindex];
+	dns_rbtnode_t **newtable = rbt->hashtable[rbt->hindex];
+	size_t newsize = rbt->hashsize[rbt->hindex];
+	dns_rbtnode_t *node, *nextnode;
 	unsigned int hash;
 	unsigned int i;
 
-	oldsize = (unsigned int)rbt->hashsize;
-	oldtable = rbt->hashtable;
-	do {
-		INSIST((rbt->hashsize * 2 + 1) > rbt->hashsize);
-		rbt->hashsize = rbt->hashsize * 2 + 1;
-	} while (newcount >= (rbt->hashsize * 3));
-	rbt->hashtable = isc_mem_get(rbt->mctx,
-				     rbt->hashsize * sizeof(dns_rbtnode_t *));
-
-	for (i = 0; i < rbt->hashsize; i++)
-		rbt->hashtable[i] = NULL;
-
-	for (i = 0; i < oldsize; i++) {
-		for (node = oldtable[i]; node != NULL; node = nextnode) {
-			hash = HASHVAL(node) % rbt->hashsize;
+	REQUIRE(REHASHING(rbt));
+
+	for (i = 0;
+	     i < RBT_HASH_MIGRATE && rbt->hiter < rbt->hashsize[oldindex];
+	     i++, rbt->hiter++)
+	{
+		for (node = oldtable[rbt->hiter];
+		     node != NULL;
+		     node = nextnode)
+		{
+			hash = HASHVAL(node) % newsize;
 			nextnode = HASHNEXT(node);
-			HASHNEXT(node) = rbt->hashtable[hash];
-			rbt->hashtable[hash] = node;
+			HASHNEXT(node) = newtable[hash];
+			newtable[hash] = node;
 		}
+		oldtable[rbt->hiter] = NULL;
 	}
 
-	isc_mem_put(rbt->mctx, oldtable, oldsize * sizeof(dns_rbtnode_t *));
+	if (rbt->hiter == rbt->hashsize[oldindex]) {
+		hashtable_free(rbt, oldindex);
+		rbt->hiter = 0;
+	}
+}
+
+static size_t
+rehash_size(size_t oldsize, unsigned int newcount) {
+	size_t newsize = oldsize;
+
+	do {
+		INSIST((newsize * 2 + 1) > newsize);
+		newsize = newsize * 2 + 1;
+	} while (newcount >= (newsize * 3));
+
+	return (newsize);
+}
+
+/*
+ * Start an incremental rehash into a larger table if the node count
+ * has risen above a critical level.  If a previous rehash hasn't
+ * completed yet, it is finished first.
+ */
+static inline void
+maybe_rehash(dns_rbt_t *rbt, unsigned int newcount) {
+	uint8_t newindex;
+
+	if (newcount < (rbt->hashsize[rbt->hindex] * 3))
+		return;
+
+	while (REHASHING(rbt))
+		hashtable_rehash_one(rbt);
+
+	newindex = RBT_HASH_NEXTTABLE(rbt->hindex);
+	hashtable_new(rbt, newindex,
+		      rehash_size(rbt->hashsize[rbt->hindex], newcount));
+	rbt->hindex = newindex;
+	rbt->hiter = 0;
+}
+
+/*
+ * Rebuild the hashtable to reduce the load factor, in one go.
+ */
+static void
+rehash(dns_rbt_t *rbt, unsigned int newcount) {
+	maybe_rehash(rbt, newcount);
+	while (REHASHING(rbt))
+		hashtable_rehash_one(rbt);
 }
 
 /*
@@ -2324,8 +2646,10 @@ static inline void
 hash_node(dns_rbt_t *rbt, dns_rbtnode_t *node, const dns_name_t *name) {
 	REQUIRE(DNS_RBTNODE_VALID(node));
 
-	if (rbt->nodecount >= (rbt->hashsize * 3))
-		rehash(rbt, rbt->nodecount);
+	if (REHASHING(rbt))
+		hashtable_rehash_one(rbt);
+	else
+		maybe_rehash(rbt, rbt->nodecount);
 
 	hash_add_node(rbt, node, name);
 }
@@ -2336,15 +2660,29 @@ hash_node(dns_rbt_t *rbt, dns_rbtnode_t *node, const dns_name_t *name) {
 static inline void
 unhash_node(dns_rbt_t *rbt, dns_rbtnode_t *node) {
 	unsigned int bucket;
+	uint8_t hindex = rbt->hindex;
+	dns_rbtnode_t **table;
 	dns_rbtnode_t *bucket_node;
 
 	REQUIRE(DNS_RBTNODE_VALID(node));
 
-	bucket = HASHVAL(node) % rbt->hashsize;
-	bucket_node = rbt->hashtable[bucket];
+	/*
+	 * If the node's bucket in the old table hasn't been migrated
+	 * yet, that's where it lives.
+	 */
+	if (REHASHING(rbt)) {
+		uint8_t oldindex = RBT_HASH_NEXTTABLE(hindex);
+		bucket = HASHVAL(node) % rbt->hashsize[oldindex];
+		if (bucket >= rbt->hiter)
+			hindex = oldindex;
+	}
+
+	table = rbt->hashtable[hindex];
+	bucket = HASHVAL(node) % rbt->hashsize[hindex];
+	bucket_node = table[bucket];
 
 	if (bucket_node == node) {
-		rbt->hashtable[bucket] = HASHNEXT(node);
+		table[bucket] = HASHNEXT(node);
 	} else {
 		while (HASHNEXT(bucket_node) != node) {
 			INSIST(HASHNEXT(bucket_node) != NULL);
@@ -2352,6 +2690,9 @@ unhash_node(dns_rbt_t *rbt, dns_rbtnode_t *node) {
 		}
 		HASHNEXT(bucket_node) = HASHNEXT(node);
 	}
+
+	if (REHASHING(rbt))
+		hashtable_rehash_one(rbt);
 }
 
 static inline void
@@ -100,9 +100,29 @@ struct rbtdb_file_header {
 	uint64_t nsec;
 	uint64_t nsec3;
 
+	/*
+	 * The address the image was written to be mapped at; when it
+	 * is, the trees are used in place and these stand in for the
+	 * walk over every rdataset that would otherwise rebuild them.
+	 */
+	uint64_t base;
+	uint64_t resign;		/* offset of re-signing headers */
+	uint64_t resigncount;
+	uint64_t records;
+	uint64_t bytes;
+
 	char version2[32];  		/* repeated; must match version1 */
 };
 
+/*
+ * Images are written to be mapped at a randomly chosen 4GB-aligned
+ * address in this range, which is normally unused.  If the address
+ * is taken when the image is loaded, it is mapped elsewhere and
+ * relocated instead.
+ */
+#define RBTDB_MAP_BASE		0x100000000000ULL
+#define RBTDB_MAP_SLOTS		4096
+
 
 /*%
  * Note that "impmagic" is not the first four bytes of the struct, so
@@ -265,6 +285,8 @@ typedef ISC_LIST(dns_rbtnode_t)         rbtnodelist_t;
 #define RDATASET_ATTR_CASEFULLYLOWER    0x1000
 /*%< Ancient - awaiting cleanup. */
 #define RDATASET_ATTR_ANCIENT           0x2000
+/*%< NSEC: positive data has been cached for a name in its range. */
+#define RDATASET_ATTR_RANGEDATA         0x4000
 
 /*
  * XXX
@@ -304,6 +326,8 @@ typedef ISC_LIST(dns_rbtnode_t)         rbtnodelist_t;
 	(((header)->attributes & RDATASET_ATTR_CASEFULLYLOWER) != 0)
 #define ANCIENT(header) \
 	(((header)->attributes & RDATASET_ATTR_ANCIENT) != 0)
+#define RANGEDATA(header) \
+	(((header)->attributes & RDATASET_ATTR_RANGEDATA) != 0)
 
 #define ACTIVE(header, now) \
 	(((header)->rdh_ttl > (now)) || \
@@ -422,7 +446,13 @@ struct dns_rbtdb {
 	dns_db_t                        common;
 	/* Locks the data in this struct */
 	isc_rwlock_t                    lock;
-	/* Locks the tree structure (prevents nodes appearing/disappearing) */
+	/*
+	 * Locks the tree structure (prevents nodes appearing/disappearing).
+	 * Zone readers still wait while a writer holds it to add a node
+	 * (findnodeintree(), or addrdataset() for a new delegation or
+	 * NSEC node) or to delete dead nodes: the RBT has no copy-on-write
+	 * mode that would let lookups carry on against the old tree.
+	 */
 	isc_rwlock_t                    tree_lock;
 	/* Locks for individual tree nodes */
 	unsigned int                    node_lock_count;
@@ -521,6 +551,19 @@ typedef struct {
 	isc_stdtime_t           now;
 } rbtdb_load_t;
 
+/*%
+ * Serialization Context
+ */
+typedef struct {
+	rbtdb_version_t *       version;
+	isc_mem_t *             mctx;
+	uint64_t *              resign;
+	size_t                  resigncount;
+	size_t                  resignsize;
+	uint64_t                records;
+	uint64_t                bytes;
+} rbtdb_serialize_t;
+
 static void delete_callback(void *data, void *arg);
 static void rdataset_disassociate(dns_rdataset_t *rdataset);
 static isc_result_t rdataset_first(dns_rdataset_t *rdataset);
@@ -559,6 +602,7 @@ static void rdataset_getownercase(const dns_rdataset_t *rdataset,
 static isc_result_t rdataset_addglue(dns_rdataset_t *rdataset,
 				     dns_dbversion_t *version,
 				     dns_message_t *msg);
+static unsigned char *rdataset_getslab(dns_rdataset_t *rdataset);
 static void free_gluetable(rbtdb_version_t *version);
 
 static dns_rdatasetmethods_t rdataset_methods = {
@@ -577,7 +621,8 @@ static dns_rdatasetmethods_t rdataset_methods = {
 	rdataset_clearprefetch,
 	rdataset_setownercase,
 	rdataset_getownercase,
-	rdataset_addglue
+	rdataset_addglue,
+	rdataset_getslab
 };
 
 static dns_rdatasetmethods_t slab_methods = {
@@ -596,7 +641,8 @@ static dns_rdatasetmethods_t slab_methods = {
 	NULL, /* clearprefetch */
 	NULL, /* setownercase */
 	NULL, /* getownercase */
-	NULL  /* addglue */
+	NULL, /* addglue */
+	rdataset_getslab
 };
 
 static void rdatasetiter_destroy(dns_rdatasetiter_t **iteratorp);
@@ -2362,10 +2408,25 @@ static void
 cleanup_dead_nodes_callback(isc_task_t *task, isc_event_t *event) {
 	dns_rbtdb_t *rbtdb = event->ev_arg;
 	bool again = false;
+	bool empty;
 	unsigned int locknum;
 
-	RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
+	/*
+	 * Take the tree write lock separately for each bucket that has
+	 * dead nodes, rather than across the whole loop, so that readers
+	 * of a busy zone are held up for at most one bucket's worth of
+	 * node deletions at a time.
+	 */
 	for (locknum = 0; locknum < rbtdb->node_lock_count; locknum++) {
+		NODE_LOCK(&rbtdb->node_locks[locknum].lock,
+			  isc_rwlocktype_read);
+		empty = ISC_LIST_EMPTY(rbtdb->deadnodes[locknum]);
+		NODE_UNLOCK(&rbtdb->node_locks[locknum].lock,
+			    isc_rwlocktype_read);
+		if (empty)
+			continue;
+
+		RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
 		NODE_LOCK(&rbtdb->node_locks[locknum].lock,
 			  isc_rwlocktype_write);
 		cleanup_dead_nodes(rbtdb, locknum);
@@ -2373,8 +2434,8 @@ cleanup_dead_nodes_callback(isc_task_t *task, isc_event_t *event) {
 			again = true;
 		NODE_UNLOCK(&rbtdb->node_locks[locknum].lock,
 			    isc_rwlocktype_write);
+		RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
 	}
-	RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
 	if (again)
 		isc_task_send(task, &event);
 	else {
@@ -4600,91 +4661,440 @@ find_deepest_zonecut(rbtdb_search_t *search, dns_rbtnode_t *node,
 	return (result);
 }
 
+/*
+ * Look through the rdatasets at a cache node for an NSEC record and its
+ * signature, cleaning up stale ones on the way.  Returns false if the
+ * node holds live positive data other than the NSEC record or RRSIGs.
+ *
+ * The node lock must be held by the caller.
+ */
+static bool
+coveringnsec_scan(rbtdb_search_t *search, dns_rbtnode_t *node,
+		  nodelock_t *lock, isc_rwlocktype_t *locktypep,
+		  rdatasetheader_t **foundp, rdatasetheader_t **foundsigp)
+{
+	rdatasetheader_t *header, *header_next, *header_prev = NULL;
+	rbtdb_rdatatype_t matchtype, sigmatchtype;
+	bool empty_node = true;
+
+	matchtype = RBTDB_RDATATYPE_VALUE(dns_rdatatype_nsec, 0);
+	sigmatchtype = RBTDB_RDATATYPE_VALUE(dns_rdatatype_rrsig,
+					     dns_rdatatype_nsec);
+
+	*foundp = NULL;
+	*foundsigp = NULL;
+	for (header = node->data; header != NULL; header = header_next) {
+		header_next = header->next;
+		if (check_stale_header(node, header, locktypep, lock, search,
+				       &header_prev))
+		{
+			continue;
+		}
+		if (NONEXISTENT(header) ||
+		    RBTDB_RDATATYPE_BASE(header->type) == 0)
+		{
+			header_prev = header;
+			continue;
+		}
+		/*
+		 * Don't stop on provable noqname / RRSIG.
+		 */
+		if (header->noqname == NULL &&
+		    RBTDB_RDATATYPE_BASE(header->type) != dns_rdatatype_rrsig)
+		{
+			empty_node = false;
+		}
+		if (header->type == matchtype)
+			*foundp = header;
+		else if (header->type == sigmatchtype)
+			*foundsigp = header;
+		header_prev = header;
+	}
+
+	return (*foundp != NULL || empty_node);
+}
+
+/*
+ * Find the NSEC record in the cache at 'node', if there is one.
+ *
+ * The node lock must be held by the caller.
+ */
+static rdatasetheader_t *
+find_nsecheader(dns_rbtnode_t *node) {
+	rdatasetheader_t *header;
+
+	for (header = node->data; header != NULL; header = header->next) {
+		if (header->type == RBTDB_RDATATYPE_VALUE(dns_rdatatype_nsec,
+							  0) &&
+		    EXISTS(header))
+		{
+			return (header);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Does the range of the NSEC record in 'header', owned by 'owner',
+ * cover 'name'?  The last NSEC record in a zone points back to the
+ * apex, and covers the names in the zone after its owner.
+ */
+static bool
+nsec_covers(rdatasetheader_t *header, const dns_name_t *owner,
+	    const dns_name_t *name)
+{
+	dns_name_t next;
+	isc_region_t region;
+	unsigned char *raw;                     /* RDATASLAB */
+	unsigned int count;
+
+	raw = (unsigned char *)header + sizeof(*header);
+	count = raw[0] * 256 + raw[1];
+	raw += DNS_RDATASET_COUNT + DNS_RDATASET_LENGTH;
+	INSIST(count > 0);
+	region.length = raw[0] * 256 + raw[1];
+	raw += DNS_RDATASET_ORDER + DNS_RDATASET_LENGTH;
+	region.base = raw;
+
+	/*
+	 * XXX Until we have rdata structures, we have no choice but
+	 * to directly access the rdata format.
+	 */
+	dns_name_init(&next, NULL);
+	dns_name_fromregion(&next, &region);
+
+	if (dns_name_compare(name, owner) <= 0)
+		return (false);
+	if (dns_name_compare(owner, &next) < 0)
+		return (dns_name_compare(name, &next) < 0);
+	return (dns_name_issubdomain(name, &next));
+}
+
+/*
+ * Does 'node' hold live positive data, other than NSEC records,
+ * that a covering NSEC record would deny?  This is what stops
+ * coveringnsec_scan(), without the cleaning.
+ *
+ * The node lock must be held by the caller.
+ */
+static bool
+has_rangedata(dns_rbtnode_t *node, isc_stdtime_t now) {
+	rdatasetheader_t *header;
+	dns_rdatatype_t base;
+
+	for (header = node->data; header != NULL; header = header->next) {
+		base = RBTDB_RDATATYPE_BASE(header->type);
+		if (NONEXISTENT(header) || ANCIENT(header) ||
+		    !ACTIVE(header, now) || header->noqname != NULL ||
+		    base == 0 || base == dns_rdatatype_rrsig ||
+		    base == dns_rdatatype_nsec)
+		{
+			continue;
+		}
+		return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * Positive data has been cached at 'name'.  Mark the NSEC record whose
+ * range covers 'name', if one is cached, so that find_coveringnsec()
+ * checks the names between its owner and the query name before using
+ * it.
+ */
+static void
+nsec_markrange(dns_rbtdb_t *rbtdb, const dns_name_t *name) {
+	isc_result_t result;
+	dns_rbtnode_t *node, *nsecnode = NULL;
+	dns_rbtnodechain_t chain;
+	dns_fixedname_t fprefix, forigin, fowner;
+	dns_name_t *prefix, *origin, *owner;
+	rdatasetheader_t *header;
+	nodelock_t *lock;
+
+	prefix = dns_fixedname_initname(&fprefix);
+	origin = dns_fixedname_initname(&forigin);
+	owner = dns_fixedname_initname(&fowner);
+
+	RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
+	if (dns_rbt_nodecount(rbtdb->nsec) == 0) {
+		RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
+		return;
+	}
+
+	dns_rbtnodechain_init(&chain);
+	result = dns_rbt_findnode(rbtdb->nsec, name, NULL, &nsecnode, &chain,
+				  DNS_RBTFIND_EMPTYDATA, NULL, NULL);
+	if (result != DNS_R_PARTIALMATCH && result != ISC_R_NOTFOUND)
+		goto unlock;
+
+	/*
+	 * Step back over nodes of the auxiliary tree whose NSEC record
+	 * is gone, as find_coveringnsec() does.
+	 */
+	do {
+		result = dns_rbtnodechain_current(&chain, prefix, origin, NULL);
+		if (result != ISC_R_SUCCESS)
+			break;
+		result = dns_name_concatenate(prefix, origin, owner, NULL);
+		if (result != ISC_R_SUCCESS)
+			break;
+
+		node = NULL;
+		result = dns_rbt_findnode(rbtdb->tree, owner, NULL, &node,
+					  NULL, DNS_RBTFIND_EMPTYDATA, NULL,
+					  NULL);
+		if (result == ISC_R_SUCCESS) {
+			lock = &rbtdb->node_locks[node->locknum].lock;
+			NODE_LOCK(lock, isc_rwlocktype_write);
+			header = find_nsecheader(node);
+			if (header != NULL && nsec_covers(header, owner, name))
+				header->attributes |= RDATASET_ATTR_RANGEDATA;
+			NODE_UNLOCK(lock, isc_rwlocktype_write);
+			if (header != NULL)
+				break;
+		}
+
+		result = dns_rbtnodechain_prev(&chain, NULL, NULL);
+		if (result == DNS_R_NEWORIGIN)
+			result = ISC_R_SUCCESS;
+	} while (result == ISC_R_SUCCESS);
+
+ unlock:
+	dns_rbtnodechain_invalidate(&chain);
+	RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
+}
+
+/*
+ * An NSEC record has been cached at 'rbtnode'.  Walk forward through
+ * the names its range covers, and mark it if any of them already has
+ * live positive data.  Data cached later marks it in nsec_markrange().
+ */
+static void
+nsec_checkrange(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode,
+		isc_stdtime_t now)
+{
+	isc_result_t result;
+	dns_rbtnode_t *node = NULL;
+	dns_rbtnodechain_t chain;
+	dns_fixedname_t fprefix, forigin, fowner, fname;
+	dns_name_t *prefix, *origin, *owner, *name;
+	rdatasetheader_t *header;
+	nodelock_t *lock;
+	bool rangedata = false;
+
+	prefix = dns_fixedname_initname(&fprefix);
+	origin = dns_fixedname_initname(&forigin);
+	owner = dns_fixedname_initname(&fowner);
+	name = dns_fixedname_initname(&fname);
+
+	RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
+	dns_rbt_fullnamefromnode(rbtnode, owner);
+
+	dns_rbtnodechain_init(&chain);
+	result = dns_rbt_findnode(rbtdb->tree, owner, NULL, &node, &chain,
+				  DNS_RBTFIND_EMPTYDATA, NULL, NULL);
+	while (result == ISC_R_SUCCESS && !rangedata) {
+		result = dns_rbtnodechain_next(&chain, NULL, NULL);
+		if (result != ISC_R_SUCCESS && result != DNS_R_NEWORIGIN)
+			break;
+		node = NULL;
+		result = dns_rbtnodechain_current(&chain, prefix, origin,
+						  &node);
+		if (result != ISC_R_SUCCESS)
+			break;
+		result = dns_name_concatenate(prefix, origin, name, NULL);
+		if (result != ISC_R_SUCCESS)
+			break;
+
+		/*
+		 * The owner's record is looked at afresh for each name,
+		 * since it may have been replaced in the meantime.
+		 */
+		lock = &rbtdb->node_locks[rbtnode->locknum].lock;
+		NODE_LOCK(lock, isc_rwlocktype_read);
+		header = find_nsecheader(rbtnode);
+		if (header == NULL || !nsec_covers(header, owner, name))
+			result = ISC_R_NOMORE;
+		NODE_UNLOCK(lock, isc_rwlocktype_read);
+		if (result != ISC_R_SUCCESS)
+			break;
+
+		lock = &rbtdb->node_locks[node->locknum].lock;
+		NODE_LOCK(lock, isc_rwlocktype_read);
+		rangedata = has_rangedata(node, now);
+		NODE_UNLOCK(lock, isc_rwlocktype_read);
+	}
+	dns_rbtnodechain_invalidate(&chain);
+
+	if (rangedata) {
+		lock = &rbtdb->node_locks[rbtnode->locknum].lock;
+		NODE_LOCK(lock, isc_rwlocktype_write);
+		header = find_nsecheader(rbtnode);
+		if (header != NULL)
+			header->attributes |= RDATASET_ATTR_RANGEDATA;
+		NODE_UNLOCK(lock, isc_rwlocktype_write);
+	}
+	RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
+}
+
+/*
+ * Find the NSEC record that may cover 'name', which is not in the cache.
+ *
+ * The candidate is the DNSSEC predecessor of 'name' in the auxiliary
+ * NSEC tree, which only contains the names for which NSEC records were
+ * cached.  Unless the candidate's record has been marked as having
+ * positive data cached inside its range, it is the answer, found in
+ * logarithmic time.  Otherwise the main tree is walked back from
+ * 'name' to the candidate, as search->chain is positioned at the
+ * predecessor of 'name': a live node with other data in between means
+ * the cached NSEC record does not describe the names around 'name',
+ * and ends the search.  Empty nodes and negative cache entries are
+ * passed over.
+ *
+ * The tree lock must be held by the caller.
+ */
 static isc_result_t
-find_coveringnsec(rbtdb_search_t *search, dns_dbnode_t **nodep,
-		  isc_stdtime_t now, dns_name_t *foundname,
-		  dns_rdataset_t *rdataset, dns_rdataset_t *sigrdataset)
+find_coveringnsec(rbtdb_search_t *search, const dns_name_t *name,
+		  dns_dbnode_t **nodep, isc_stdtime_t now,
+		  dns_name_t *foundname, dns_rdataset_t *rdataset,
+		  dns_rdataset_t *sigrdataset)
 {
-	dns_rbtnode_t *node;
-	rdatasetheader_t *header, *header_next, *header_prev;
+	dns_rbtnode_t *node, *nsecnode, *owner = NULL;
 	rdatasetheader_t *found, *foundsig;
-	bool empty_node;
 	isc_result_t result;
-	dns_fixedname_t fname, forigin;
-	dns_name_t *name, *origin;
-	rbtdb_rdatatype_t matchtype, sigmatchtype;
-	nodelock_t *lock;
+	dns_fixedname_t fprefix, forigin, ftarget;
+	dns_name_t *prefix, *origin, *target;
+	nodelock_t *lock = NULL;
 	isc_rwlocktype_t locktype;
 	dns_rbtnodechain_t chain;
+	bool usable;
 
-	chain = search->chain;
+	prefix = dns_fixedname_initname(&fprefix);
+	origin = dns_fixedname_initname(&forigin);
+	target = dns_fixedname_initname(&ftarget);
 
-	matchtype = RBTDB_RDATATYPE_VALUE(dns_rdatatype_nsec, 0);
-	sigmatchtype = RBTDB_RDATATYPE_VALUE(dns_rdatatype_rrsig,
-					     dns_rdatatype_nsec);
+	dns_rbtnodechain_init(&chain);
+	nsecnode = NULL;
+	result = dns_rbt_findnode(search->rbtdb->nsec, name, NULL, &nsecnode,
+				  &chain, DNS_RBTFIND_EMPTYDATA, NULL, NULL);
+	if (result != ISC_R_SUCCESS && result != DNS_R_PARTIALMATCH &&
+	    result != ISC_R_NOTFOUND)
+	{
+		dns_rbtnodechain_invalidate(&chain);
+		return (result);
+	}
 
 	do {
-		node = NULL;
-		name = dns_fixedname_initname(&fname);
-		origin = dns_fixedname_initname(&forigin);
-		result = dns_rbtnodechain_current(&chain, name, origin, &node);
+		/*
+		 * Nodes of the auxiliary tree that were created by
+		 * splitting names have no counterpart with an NSEC record
+		 * in the main tree; they are skipped below, like empty
+		 * nodes are.
+		 */
+		result = dns_rbtnodechain_current(&chain, prefix, origin, NULL);
+		if (result != ISC_R_SUCCESS) {
+			result = ISC_R_NOTFOUND;
+			break;
+		}
+		result = dns_name_concatenate(prefix, origin, target, NULL);
 		if (result != ISC_R_SUCCESS)
-			return (result);
-		locktype = isc_rwlocktype_read;
-		lock = &(search->rbtdb->node_locks[node->locknum].lock);
-		NODE_LOCK(lock, locktype);
-		found = NULL;
-		foundsig = NULL;
-		empty_node = true;
-		header_prev = NULL;
-		for (header = node->data; header != NULL; header = header_next)
-		{
-			header_next = header->next;
-			if (check_stale_header(node, header,
-					       &locktype, lock, search,
-					       &header_prev)) {
-				continue;
-			}
-			if (NONEXISTENT(header) ||
-			    RBTDB_RDATATYPE_BASE(header->type) == 0) {
-				header_prev = header;
-				continue;
+			break;
+
+		node = NULL;
+		result = dns_rbt_findnode(search->rbtdb->tree, target, NULL,
+					  &node, NULL, DNS_RBTFIND_EMPTYDATA,
+					  NULL, NULL);
+		if (result == ISC_R_SUCCESS) {
+			locktype = isc_rwlocktype_read;
+			lock = &(search->rbtdb->node_locks[node->locknum].lock);
+			NODE_LOCK(lock, locktype);
+			usable = coveringnsec_scan(search, node, lock,
+						   &locktype, &found,
+						   &foundsig);
+			if (usable && found != NULL) {
+				/* The owner node stays locked. */
+				owner = node;
+				break;
 			}
-			/*
-			 * Don't stop on provable noqname / RRSIG.
-			 */
-			if (header->noqname == NULL &&
-			    RBTDB_RDATATYPE_BASE(header->type)
-			     != dns_rdatatype_rrsig)
-			{
-				empty_node = false;
+			NODE_UNLOCK(lock, locktype);
+			if (!usable) {
+				result = ISC_R_NOTFOUND;
+				break;
 			}
-			if (header->type == matchtype)
-				found = header;
-			else if (header->type == sigmatchtype)
-				foundsig = header;
-			header_prev = header;
+		} else if (result != DNS_R_PARTIALMATCH &&
+			   result != ISC_R_NOTFOUND)
+		{
+			break;
 		}
-		if (found != NULL) {
-			result = dns_name_concatenate(name, origin,
-						      foundname, NULL);
-			if (result != ISC_R_SUCCESS)
-				goto unlock_node;
-			bind_rdataset(search->rbtdb, node, found,
-				      now, rdataset);
-			if (foundsig != NULL)
-				bind_rdataset(search->rbtdb, node, foundsig,
-					      now, sigrdataset);
-			new_reference(search->rbtdb, node);
-			*nodep = node;
-			result = DNS_R_COVERINGNSEC;
-		} else if (!empty_node) {
+
+		result = dns_rbtnodechain_prev(&chain, NULL, NULL);
+		if (result == DNS_R_NEWORIGIN)
+			result = ISC_R_SUCCESS;
+	} while (result == ISC_R_SUCCESS);
+	dns_rbtnodechain_invalidate(&chain);
+
+	if (owner == NULL) {
+		if (result == ISC_R_NOMORE || result == ISC_R_SUCCESS)
 			result = ISC_R_NOTFOUND;
-		} else
-			result = dns_rbtnodechain_prev(&chain, NULL, NULL);
- unlock_node:
+		return (result);
+	}
+
+	if (RANGEDATA(found)) {
 		NODE_UNLOCK(lock, locktype);
-	} while (empty_node && result == ISC_R_SUCCESS);
+
+		/*
+		 * Walk back through the main tree to the NSEC owner.  The
+		 * tree lock held by the caller keeps the owner node in
+		 * place.
+		 */
+		chain = search->chain;
+		for (;;) {
+			node = NULL;
+			result = dns_rbtnodechain_current(&chain, prefix,
+							  origin, &node);
+			if (result != ISC_R_SUCCESS)
+				return (ISC_R_NOTFOUND);
+
+			locktype = isc_rwlocktype_read;
+			lock = &(search->rbtdb->node_locks[node->locknum].lock);
+			NODE_LOCK(lock, locktype);
+			usable = coveringnsec_scan(search, node, lock,
+						   &locktype, &found,
+						   &foundsig);
+			if (node == owner) {
+				break;
+			}
+			NODE_UNLOCK(lock, locktype);
+			if (!usable || found != NULL)
+				return (ISC_R_NOTFOUND);
+
+			result = dns_rbtnodechain_prev(&chain, NULL, NULL);
+			if (result != ISC_R_SUCCESS &&
+			    result != DNS_R_NEWORIGIN)
+			{
+				return (ISC_R_NOTFOUND);
+			}
+		}
+	}
+
+	/* The owner node is locked. */
+	if (found != NULL) {
+		dns_name_copynf(target, foundname);
+		bind_rdataset(search->rbtdb, owner, found, now, rdataset);
+		if (foundsig != NULL)
+			bind_rdataset(search->rbtdb, owner, foundsig, now,
+				      sigrdataset);
+		new_reference(search->rbtdb, owner);
+		*nodep = owner;
+		result = DNS_R_COVERINGNSEC;
+	} else {
+		result = ISC_R_NOTFOUND;
+	}
+	NODE_UNLOCK(lock, locktype);
+
 	return (result);
 }
 
@@ -4744,7 +5154,7 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 
 	if (result == DNS_R_PARTIALMATCH) {
 		if ((search.options & DNS_DBFIND_COVERINGNSEC) != 0) {
-			result = find_coveringnsec(&search, nodep, now,
+			result = find_coveringnsec(&search, name, nodep, now,
 						   foundname, rdataset,
 						   sigrdataset);
 			if (result == DNS_R_COVERINGNSEC)
@@ -6431,6 +6841,7 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	rdatasetheader_t *header;
 	isc_result_t result;
 	bool delegating;
+	bool setcallback = false;
 	bool newnsec;
 	bool tree_locked = false;
 	bool cache_is_overmem = false;
@@ -6440,17 +6851,6 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	REQUIRE(VALID_RBTDB(rbtdb));
 	INSIST(rbtversion == NULL || rbtversion->rbtdb == rbtdb);
 
-	if (rbtdb->common.methods == &zone_methods) {
-		RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
-		REQUIRE(((rbtnode->nsec == DNS_RBT_NSEC_NSEC3 &&
-			  (rdataset->type == dns_rdatatype_nsec3 ||
-			   rdataset->covers == dns_rdatatype_nsec3)) ||
-			 (rbtnode->nsec != DNS_RBT_NSEC_NSEC3 &&
-			   rdataset->type != dns_rdatatype_nsec3 &&
-			   rdataset->covers != dns_rdatatype_nsec3)));
-		RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
-	}
-
 	if (rbtversion == NULL) {
 		if (now == 0)
 			isc_stdtime_get(&now);
@@ -6462,9 +6862,42 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	if (result != ISC_R_SUCCESS)
 		return (result);
 
+	/*
+	 * Gather everything we need to know about the node under a
+	 * single acquisition of the tree read lock.
+	 */
 	name = dns_fixedname_initname(&fixed);
 	RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
+	if (rbtdb->common.methods == &zone_methods) {
+		REQUIRE(((rbtnode->nsec == DNS_RBT_NSEC_NSEC3 &&
+			  (rdataset->type == dns_rdatatype_nsec3 ||
+			   rdataset->covers == dns_rdatatype_nsec3)) ||
+			 (rbtnode->nsec != DNS_RBT_NSEC_NSEC3 &&
+			   rdataset->type != dns_rdatatype_nsec3 &&
+			   rdataset->covers != dns_rdatatype_nsec3)));
+	}
 	dns_rbt_fullnamefromnode(node, name);
+
+	/*
+	 * If we're adding a delegation type (e.g. NS or DNAME for a zone,
+	 * just DNAME for the cache), then we need to set the callback bit
+	 * on the node, unless it's already set (e.g. when an existing
+	 * delegation is updated).
+	 */
+	delegating = delegating_type(rbtdb, rbtnode, rdataset->type);
+	if (delegating && rbtnode->find_callback == 0)
+		setcallback = true;
+
+	/*
+	 * Add to the auxiliary NSEC tree if we're adding an NSEC record.
+	 */
+	if (rbtnode->nsec != DNS_RBT_NSEC_HAS_NSEC &&
+	    rdataset->type == dns_rdatatype_nsec)
+	{
+		newnsec = true;
+	} else {
+		newnsec = false;
+	}
 	RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
 	dns_rdataset_getownercase(rdataset, name);
 
@@ -6528,37 +6961,16 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	}
 
 	/*
-	 * If we're adding a delegation type (e.g. NS or DNAME for a zone,
-	 * just DNAME for the cache), then we need to set the callback bit
-	 * on the node.
-	 */
-	if (delegating_type(rbtdb, rbtnode, rdataset->type))
-		delegating = true;
-	else
-		delegating = false;
-
-	/*
-	 * Add to the auxiliary NSEC tree if we're adding an NSEC record.
-	 */
-	RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
-	if (rbtnode->nsec != DNS_RBT_NSEC_HAS_NSEC &&
-	    rdataset->type == dns_rdatatype_nsec)
-	{
-		newnsec = true;
-	} else {
-		newnsec = false;
-	}
-	RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_read);
-
-	/*
-	 * If we're adding a delegation type, adding to the auxiliary NSEC tree,
-	 * or the DB is a cache in an overmem state, hold an exclusive lock on
-	 * the tree.  In the latter case the lock does not necessarily have to
-	 * be acquired but it will help purge ancient entries more effectively.
+	 * If we need to set the callback bit for a delegation, are adding
+	 * to the auxiliary NSEC tree, or the DB is a cache in an overmem
+	 * state, hold an exclusive lock on the tree.  In the latter case
+	 * the lock does not necessarily have to be acquired but it will
+	 * help purge ancient entries more effectively.  Zone updates
+	 * that do neither leave readers of the tree undisturbed.
 	 */
 	if (IS_CACHE(rbtdb) && isc_mem_isovermem(rbtdb->common.mctx))
 		cache_is_overmem = true;
-	if (delegating || newnsec || cache_is_overmem) {
+	if (setcallback || newnsec || cache_is_overmem) {
 		tree_locked = true;
 		RWLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
 	}
@@ -6588,7 +7000,7 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 		 * cleaning, we can release it now.  However, we still need the
 		 * node lock.
 		 */
-		if (tree_locked && !delegating && !newnsec) {
+		if (tree_locked && !setcallback && !newnsec) {
 			RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
 			tree_locked = false;
 		}
@@ -6613,7 +7025,7 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	if (result == ISC_R_SUCCESS)
 		result = add32(rbtdb, rbtnode, rbtversion, newheader, options,
 			       false, addedrdataset, now);
-	if (result == ISC_R_SUCCESS && delegating)
+	if (result == ISC_R_SUCCESS && setcallback)
 		rbtnode->find_callback = 1;
 
 	NODE_UNLOCK(&rbtdb->node_locks[rbtnode->locknum].lock,
@@ -6622,6 +7034,23 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	if (tree_locked)
 		RWUNLOCK(&rbtdb->tree_lock, isc_rwlocktype_write);
 
+	/*
+	 * Keep track of cached NSEC records whose range holds names with
+	 * positive data, for find_coveringnsec().
+	 */
+	if (result == ISC_R_SUCCESS && IS_CACHE(rbtdb)) {
+		if (rdataset->type == dns_rdatatype_nsec) {
+			nsec_checkrange(rbtdb, rbtnode, now);
+		} else if (rdataset->type != dns_rdatatype_none &&
+			   rdataset->type != dns_rdatatype_rrsig &&
+			   (rdataset->attributes &
+			    (DNS_RDATASETATTR_NEGATIVE |
+			     DNS_RDATASETATTR_NOQNAME)) == 0)
+		{
+			nsec_markrange(rbtdb, name);
+		}
+	}
+
 	/*
 	 * Update the zone's secure status.  If version is non-NULL
 	 * this is deferred until closeversion() is called.
@@ -7103,7 +7532,7 @@ loading_addrdataset(void *arg, const dns_name_t *name,
 
 static isc_result_t
 rbt_datafixer(dns_rbtnode_t *rbtnode, void *base, size_t filesize,
-	      void *arg, uint64_t *crc)
+	      uintptr_t filebase, void *arg, uint64_t *crc)
 {
 	isc_result_t result;
 	dns_rbtdb_t *rbtdb = (dns_rbtdb_t *) arg;
@@ -7115,17 +7544,44 @@ rbt_datafixer(dns_rbtnode_t *rbtnode, void *base, size_t filesize,
 
 	for (header = rbtnode->data; header != NULL; header = header->next) {
 		unsigned char *p = (unsigned char *) header;
-		size_t size = dns_rdataslab_size(p, sizeof(*header));
+		size_t size;
+
+		if (limit - p < (ptrdiff_t)(sizeof(*header) + 2))
+			return (ISC_R_INVALIDFILE);
+		size = dns_rdataslab_size(p, sizeof(*header));
+		if ((size_t)(limit - p) < size)
+			return (ISC_R_INVALIDFILE);
 		isc_crc64_update(crc, p, size);
 #ifdef DEBUG
 		hexdump("hashing header", p, sizeof(rdatasetheader_t));
 		hexdump("hashing slab", p + sizeof(rdatasetheader_t),
 			size - sizeof(rdatasetheader_t));
 #endif
+
+		if (filebase == (uintptr_t)base) {
+			/*
+			 * The image is used in place; check that the
+			 * header is as rbt_datawriter() left it.
+			 */
+			if (header->node != rbtnode || !header->is_mmapped ||
+			    header->node_is_relative ||
+			    header->next_is_relative)
+			{
+				return (ISC_R_INVALIDFILE);
+			}
+			if (header->next != NULL &&
+			    (unsigned char *)header->next !=
+			    p + dns_rbt_serialize_align(size))
+			{
+				return (ISC_R_INVALIDFILE);
+			}
+			continue;
+		}
 		header->serial = 1;
 		header->is_mmapped = 1;
 		header->node = rbtnode;
 		header->node_is_relative = 0;
+		header->heap_index = 0;
 
 		if (RESIGN(header) &&
 		    (header->resign != 0 || header->resign_lsb != 0))
@@ -7138,8 +7594,9 @@ rbt_datafixer(dns_rbtnode_t *rbtnode, void *base, size_t filesize,
 
 		if (header->next != NULL) {
 			size_t cooked = dns_rbt_serialize_align(size);
-			if ((uintptr_t)header->next !=
-				    (p - (unsigned char *)base) + cooked)
+			uintptr_t where = filebase + cooked +
+					  (p - (unsigned char *)base);
+			if ((uintptr_t)header->next != where)
 				return (ISC_R_INVALIDFILE);
 			header->next = (rdatasetheader_t *)(p + cooked);
 			header->next_is_relative = 0;
@@ -7153,6 +7610,59 @@ rbt_datafixer(dns_rbtnode_t *rbtnode, void *base, size_t filesize,
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * The image was mapped where it was written to be, so its trees are
+ * used in place: put the headers due for re-signing on the heaps, and
+ * take the size of the zone from the file header, rather than finding
+ * both by walking every rdataset in the file.
+ */
+static isc_result_t
+mapped_in_place(dns_rbtdb_t *rbtdb, char *base, size_t filesize,
+		rbtdb_file_header_t *header)
+{
+	isc_result_t result;
+	rbtdb_version_t *version = rbtdb->current_version;
+	uint64_t *resign;
+	size_t i;
+
+	if (header->resigncount > filesize / sizeof(*resign) ||
+	    header->resign > filesize - header->resigncount * sizeof(*resign))
+	{
+		return (ISC_R_INVALIDFILE);
+	}
+
+	resign = (uint64_t *)(base + header->resign);
+	for (i = 0; i < header->resigncount; i++) {
+		rdatasetheader_t *rdh;
+
+		if (resign[i] < header->base ||
+		    resign[i] - header->base > filesize - sizeof(*rdh))
+		{
+			return (ISC_R_INVALIDFILE);
+		}
+		rdh = (rdatasetheader_t *)(uintptr_t)resign[i];
+		if ((uintptr_t)rdh->node < (uintptr_t)base ||
+		    (uintptr_t)rdh->node - (uintptr_t)base >
+		    filesize - sizeof(dns_rbtnode_t) ||
+		    !DNS_RBTNODE_VALID(rdh->node) ||
+		    rdh->node->locknum >= rbtdb->node_lock_count)
+		{
+			return (ISC_R_INVALIDFILE);
+		}
+		result = isc_heap_insert(rbtdb->heaps[rdh->node->locknum],
+					 rdh);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
+
+	RWLOCK(&version->rwlock, isc_rwlocktype_write);
+	version->records += header->records;
+	version->bytes += header->bytes;
+	RWUNLOCK(&version->rwlock, isc_rwlocktype_write);
+
+	return (ISC_R_SUCCESS);
+}
+
 /*
  * Load the RBT database from the image in 'f'
  */
@@ -7161,13 +7671,14 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 	isc_result_t result;
 	rbtdb_load_t *loadctx = arg;
 	dns_rbtdb_t *rbtdb = loadctx->rbtdb;
-	rbtdb_file_header_t *header;
+	rbtdb_file_header_t *header, fileheader;
 	int fd;
 	off_t filesize = 0;
 	char *base;
 	dns_rbt_t *tree = NULL, *nsec = NULL, *nsec3 = NULL;
 	int protect, flags;
 	dns_rbtnode_t *origin_node = NULL;
+	bool inplace;
 
 	REQUIRE(VALID_RBTDB(rbtdb));
 
@@ -7177,6 +7688,19 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 	 * the nodes in the file.
 	 */
 
+	/*
+	 * Read the header first to find the address the image was
+	 * written for, and ask for it to be mapped there.
+	 */
+	result = isc_stdio_seek(f, offset, SEEK_SET);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	result = isc_stdio_read(&fileheader, 1, sizeof(fileheader), f, NULL);
+	if (result != ISC_R_SUCCESS)
+		return (ISC_R_INVALIDFILE);
+	if (!match_header_version(&fileheader))
+		return (ISC_R_INVALIDFILE);
+
 	/* Map in the whole file in one go */
 	fd = fileno(f);
 	isc_file_getsizefd(fd, &filesize);
@@ -7186,7 +7710,8 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 	flags |= MAP_FILE;
 #endif
 
-	base = isc_file_mmap(NULL, filesize, protect, flags, fd, 0);
+	base = isc_file_mmap((void *)(uintptr_t)fileheader.base, filesize,
+			     protect, flags, fd, 0);
 	if (base == NULL || base == MAP_FAILED) {
 		return (ISC_R_FAILURE);
 	}
@@ -7197,6 +7722,18 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 		goto cleanup;
 	}
 
+	inplace = (header->base != 0 && header->base == (uintptr_t)base);
+#ifdef MADV_WILLNEED
+	if (!inplace) {
+		/*
+		 * Every node is visited while relocating the trees
+		 * below, so ask for the whole file to be read ahead
+		 * rather than faulting it in a page at a time.
+		 */
+		(void)madvise(base, filesize, MADV_WILLNEED);
+	}
+#endif /* MADV_WILLNEED */
+
 	if (header->tree != 0) {
 		result = dns_rbt_deserialize_tree(base, filesize,
 						  (off_t) header->tree,
@@ -7236,6 +7773,12 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 			goto cleanup;
 	}
 
+	if (inplace) {
+		result = mapped_in_place(rbtdb, base, filesize, header);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+
 	/*
 	 * We have a successfully loaded all the rbt trees now update
 	 * rbtdb to use them.
@@ -7352,10 +7895,11 @@ endload(dns_db_t *db, dns_rdatacallbacks_t *callbacks) {
  * by the void *data pointer in the dns_rbtnode
  */
 static isc_result_t
-rbt_datawriter(FILE *rbtfile, unsigned char *data, void *arg,
-	       uint64_t *crc)
+rbt_datawriter(FILE *rbtfile, unsigned char *data, uintptr_t base,
+	       uintptr_t node, void *arg, uint64_t *crc)
 {
-	rbtdb_version_t *version = (rbtdb_version_t *) arg;
+	rbtdb_serialize_t *ctx = (rbtdb_serialize_t *) arg;
+	rbtdb_version_t *version = ctx->version;
 	rbtdb_serial_t serial;
 	rdatasetheader_t newheader;
 	rdatasetheader_t *header = (rdatasetheader_t *) data, *next;
@@ -7394,12 +7938,16 @@ rbt_datawriter(FILE *rbtfile, unsigned char *data, void *arg,
 		memmove(&newheader, p, sizeof(rdatasetheader_t));
 		newheader.down = NULL;
 		newheader.next = NULL;
-		off = where;
-		if ((off_t)off != where)
+		off = base + where;
+		if ((off_t)(off - base) != where)
 			return (ISC_R_RANGE);
-		newheader.node = (dns_rbtnode_t *) off;
-		newheader.node_is_relative = 1;
+		newheader.node = (dns_rbtnode_t *) node;
+		newheader.node_is_relative = 0;
+		newheader.next_is_relative = 0;
+		newheader.is_mmapped = 1;
 		newheader.serial = 1;
+		newheader.heap_index = 0;
+		ISC_LINK_INIT(&newheader, link);
 
 		/*
 		 * Round size up to the next pointer sized offset so it
@@ -7408,9 +7956,38 @@ rbt_datawriter(FILE *rbtfile, unsigned char *data, void *arg,
 		cooked = dns_rbt_serialize_align(size);
 		if (next != NULL) {
 			newheader.next = (rdatasetheader_t *) (off + cooked);
-			newheader.next_is_relative = 1;
 		}
 
+		/*
+		 * Record what loading the image in place will need
+		 * without looking at this header again.
+		 */
+		if (RESIGN(header) &&
+		    (header->resign != 0 || header->resign_lsb != 0))
+		{
+			if (ctx->resigncount == ctx->resignsize) {
+				size_t newsize = ctx->resignsize * 2 + 64;
+				uint64_t *resign;
+
+				resign = isc_mem_get(ctx->mctx, newsize *
+						     sizeof(*resign));
+				if (ctx->resign != NULL) {
+					memmove(resign, ctx->resign,
+						ctx->resigncount *
+						sizeof(*resign));
+					isc_mem_put(ctx->mctx, ctx->resign,
+						    ctx->resignsize *
+						    sizeof(*resign));
+				}
+				ctx->resign = resign;
+				ctx->resignsize = newsize;
+			}
+			ctx->resign[ctx->resigncount++] = off;
+		}
+		ctx->records += dns_rdataslab_count(p,
+						    sizeof(rdatasetheader_t));
+		ctx->bytes += size;
+
 #ifdef DEBUG
 		hexdump("writing header", (unsigned char *) &newheader,
 			sizeof(rdatasetheader_t));
@@ -7478,7 +8055,8 @@ init_file_version(void) {
  */
 static isc_result_t
 rbtdb_write_header(FILE *rbtfile, off_t tree_location, off_t nsec_location,
-		   off_t nsec3_location)
+		   off_t nsec3_location, uintptr_t base, off_t resign_location,
+		   rbtdb_serialize_t *ctx)
 {
 	rbtdb_file_header_t header;
 	isc_result_t result;
@@ -7493,6 +8071,11 @@ rbtdb_write_header(FILE *rbtfile, off_t tree_location, off_t nsec_location,
 	header.tree = (uint64_t) tree_location;
 	header.nsec = (uint64_t) nsec_location;
 	header.nsec3 = (uint64_t) nsec3_location;
+	header.base = (uint64_t) base;
+	header.resign = (uint64_t) resign_location;
+	header.resigncount = ctx->resigncount;
+	header.records = ctx->records;
+	header.bytes = ctx->bytes;
 	result = isc_stdio_write(&header, 1, sizeof(rbtdb_file_header_t),
 			      rbtfile, NULL);
 	fflush(rbtfile);
@@ -7515,12 +8098,39 @@ match_header_version(rbtdb_file_header_t *header) {
 	return (true);
 }
 
+/*
+ * Choose the address an image is to be mapped at.  Only 64-bit
+ * address spaces have room to spare for this.
+ *
+ * There are only RBTDB_MAP_SLOTS places to choose from, so a zone
+ * loaded in place lies at one of 4096 well-known addresses: 12 bits of
+ * randomness, rather than the 28 or so ASLR gives a mapping the kernel
+ * places.  A map file holds absolute pointers and is trusted like any
+ * other file named reads its configuration from; this only matters to
+ * someone who can already make named write through a stray pointer.
+ * Operators for whom that is not acceptable should use the text or raw
+ * formats.
+ */
+static uintptr_t
+map_base(void) {
+#if SIZE_MAX > 0xffffffffU
+	uint64_t slot = isc_random_uniform(RBTDB_MAP_SLOTS);
+
+	return ((uintptr_t)(RBTDB_MAP_BASE + (slot << 32)));
+#else
+	return (0);
+#endif
+}
+
 static isc_result_t
 serialize(dns_db_t *db, dns_dbversion_t *ver, FILE *rbtfile) {
 	rbtdb_version_t *version = (rbtdb_version_t *) ver;
 	dns_rbtdb_t *rbtdb;
 	isc_result_t result;
 	off_t tree_location, nsec_location, nsec3_location, header_location;
+	off_t resign_location;
+	rbtdb_serialize_t ctx;
+	uintptr_t base;
 
 	rbtdb = (dns_rbtdb_t *)db;
 
@@ -7528,7 +8138,14 @@ serialize(dns_db_t *db, dns_dbversion_t *ver, FILE *rbtfile) {
 	REQUIRE(rbtfile != NULL);
 
 	/* Ensure we're writing to a plain file */
-	CHECK(isc_file_isplainfilefd(fileno(rbtfile)));
+	result = isc_file_isplainfilefd(fileno(rbtfile));
+	if (result != ISC_R_SUCCESS)
+		return (result);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.version = version;
+	ctx.mctx = rbtdb->common.mctx;
+	base = map_base();
 
 	/*
 	 * first, write out a zeroed header to store rbtdb information
@@ -7536,6 +8153,9 @@ serialize(dns_db_t *db, dns_dbversion_t *ver, FILE *rbtfile) {
 	 * then for each of the three trees, store the current position
 	 * in the file and call dns_rbt_serialize_tree
 	 *
+	 * then write out the addresses of the headers that are due to
+	 * be re-signed
+	 *
 	 * finally, write out the rbtdb header, storing the locations of the
 	 * rbtheaders
 	 *
@@ -7544,17 +8164,29 @@ serialize(dns_db_t *db, dns_dbversion_t *ver, FILE *rbtfile) {
 	 */
 	CHECK(isc_stdio_tell(rbtfile, &header_location));
 	CHECK(rbtdb_zero_header(rbtfile));
-	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->tree, rbt_datawriter,
-				     version, &tree_location));
-	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->nsec, rbt_datawriter,
-				     version, &nsec_location));
-	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->nsec3, rbt_datawriter,
-				     version, &nsec3_location));
+	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->tree, base,
+				     rbt_datawriter, &ctx, &tree_location));
+	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->nsec, base,
+				     rbt_datawriter, &ctx, &nsec_location));
+	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->nsec3, base,
+				     rbt_datawriter, &ctx, &nsec3_location));
+
+	CHECK(isc_stdio_tell(rbtfile, &resign_location));
+	resign_location = dns_rbt_serialize_align(resign_location);
+	CHECK(isc_stdio_seek(rbtfile, resign_location, SEEK_SET));
+	if (ctx.resigncount != 0) {
+		CHECK(isc_stdio_write(ctx.resign, sizeof(ctx.resign[0]),
+				      ctx.resigncount, rbtfile, NULL));
+	}
 
 	CHECK(isc_stdio_seek(rbtfile, header_location, SEEK_SET));
 	CHECK(rbtdb_write_header(rbtfile, tree_location, nsec_location,
-				 nsec3_location));
+				 nsec3_location, base, resign_location, &ctx));
  failure:
+	if (ctx.resign != NULL) {
+		isc_mem_put(ctx.mctx, ctx.resign,
+			    ctx.resignsize * sizeof(ctx.resign[0]));
+	}
 	return (result);
 }
 
@@ -8540,6 +9172,23 @@ rdataset_count(dns_rdataset_t *rdataset) {
 	return (count);
 }
 
+static unsigned char *
+rdataset_getslab(dns_rdataset_t *rdataset) {
+#if DNS_RDATASET_FIXED
+	/*
+	 * In load order the records have to be found through the
+	 * offset table; leave that to the iterator.  Without
+	 * DNS_RDATASET_FIXED there is no offset table, and load order
+	 * is the order of the slab.
+	 */
+	if ((rdataset->attributes & DNS_RDATASETATTR_LOADORDER) != 0) {
+		return (NULL);
+	}
+#endif /* DNS_RDATASET_FIXED */
+
+	return (rdataset->private3);
+}
+
 static isc_result_t
 rdataset_getnoqname(dns_rdataset_t *rdataset, dns_name_t *name,
 		    dns_rdataset_t *nsec, dns_rdataset_t *nsecsig)
@@ -202,7 +202,8 @@ static dns_rdatasetmethods_t question_methods = {
 	NULL, /* clearprefetch */
 	NULL, /* setownercase */
 	NULL, /* getownercase */
-	NULL  /* addglue */
+	NULL, /* addglue */
+	NULL  /* getslab */
 };
 
 void
@@ -315,6 +316,202 @@ swap_rdata(dns_rdata_t *in, unsigned int a, unsigned int b) {
 	in[b] = rdata;
 }
 
+/*
+ * Types whose rdata, in class IN, contain no domain names: they are
+ * rendered exactly as they are stored, and rendering them neither uses
+ * nor adds to the compression table.
+ */
+static inline bool
+towire_verbatim(dns_rdataclass_t rdclass, dns_rdatatype_t type) {
+	if (rdclass != dns_rdataclass_in) {
+		return (false);
+	}
+
+	switch (type) {
+	case dns_rdatatype_a:
+	case dns_rdatatype_aaaa:
+	case dns_rdatatype_hinfo:
+	case dns_rdatatype_txt:
+	case dns_rdatatype_ds:
+	case dns_rdatatype_sshfp:
+	case dns_rdatatype_dnskey:
+	case dns_rdatatype_nsec3:
+	case dns_rdatatype_nsec3param:
+	case dns_rdatatype_tlsa:
+	case dns_rdatatype_smimea:
+	case dns_rdatatype_cds:
+	case dns_rdatatype_cdnskey:
+	case dns_rdatatype_openpgpkey:
+	case dns_rdatatype_spf:
+	case dns_rdatatype_uri:
+	case dns_rdatatype_caa:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+/*
+ * Layout of the records in an rdataslab (RDATASLAB).
+ */
+#if DNS_RDATASET_FIXED
+#define SLAB_OFFSETS(count)	((count) * 4)
+#define SLAB_ORDER		2
+#else /* !DNS_RDATASET_FIXED */
+#define SLAB_OFFSETS(count)	0
+#define SLAB_ORDER		0
+#endif /* DNS_RDATASET_FIXED */
+
+#define SLAB_LENGTH(raw)	((raw)[0] * 256 + (raw)[1])
+#define SLAB_DATA(raw)		((raw) + 2 + SLAB_ORDER)
+#define SLAB_NEXT(raw)		(SLAB_DATA(raw) + SLAB_LENGTH(raw))
+
+/*
+ * Render an rdataset whose rdata are stored in 'slab' and need no
+ * compression by copying the records straight from the slab, instead
+ * of building a dns_rdata_t for each of them.  The output, including
+ * the order of the records and what is left in 'target' on failure,
+ * is the same as that of the general case in towiresorted().
+ */
+static isc_result_t
+towire_slab(dns_rdataset_t *rdataset, unsigned char *slab,
+	    const dns_name_t *owner_name, dns_compress_t *cctx,
+	    isc_buffer_t *target, bool partial, unsigned int *countp)
+{
+	isc_region_t r;
+	isc_result_t result = ISC_R_SUCCESS;
+	isc_buffer_t savedbuffer, rrbuffer;
+	unsigned char *first, *raw;
+	unsigned char *records_fixed[MAX_SHUFFLE];
+	unsigned char **records = NULL;
+	unsigned char header[8];
+	unsigned int i, j = 0, count, added = 0, length;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	uint16_t offset;
+
+	count = slab[0] * 256 + slab[1];
+	if (count == 0) {
+		return (ISC_R_SUCCESS);
+	}
+	first = raw = slab + 2 + SLAB_OFFSETS(count);
+
+	if (count > 1) {
+		if (WANT_CYCLIC(rdataset) &&
+		    rdataset->count != DNS_RDATASET_COUNT_UNDEFINED)
+		{
+			j = rdataset->count % count;
+		}
+
+		/*
+		 * Random order needs the records to be addressable; cyclic
+		 * order alone only needs to know where to start.
+		 */
+		if (WANT_RANDOM(rdataset)) {
+			uint32_t seed = isc_random32();
+
+			records = records_fixed;
+			if (count > MAX_SHUFFLE) {
+				records = isc_mem_get(cctx->mctx,
+						      count * sizeof(*records));
+			}
+			for (i = 0; i < count; i++) {
+				records[i] = raw;
+				raw = SLAB_NEXT(raw);
+			}
+
+			/*
+			 * Shuffle as towiresorted() does.
+			 */
+			for (i = 0; i < count; i++) {
+				unsigned int k = (i + j) % count;
+				unsigned int l = k + seed % (count - k);
+
+				raw = records[k];
+				records[k] = records[l];
+				records[l] = raw;
+			}
+		} else {
+			for (i = 0; i < j; i++) {
+				raw = SLAB_NEXT(raw);
+			}
+		}
+	}
+
+	name = dns_fixedname_initname(&fixed);
+	dns_name_copynf(owner_name, name);
+	dns_rdataset_getownercase(rdataset, name);
+	offset = 0xffff;
+
+	name->attributes |= owner_name->attributes &
+		DNS_NAMEATTR_NOCOMPRESS;
+
+	header[0] = (rdataset->type >> 8) & 0xff;
+	header[1] = rdataset->type & 0xff;
+	header[2] = (rdataset->rdclass >> 8) & 0xff;
+	header[3] = rdataset->rdclass & 0xff;
+	header[4] = (rdataset->ttl >> 24) & 0xff;
+	header[5] = (rdataset->ttl >> 16) & 0xff;
+	header[6] = (rdataset->ttl >> 8) & 0xff;
+	header[7] = rdataset->ttl & 0xff;
+
+	savedbuffer = *target;
+
+	for (i = 0; i < count; i++) {
+		unsigned int k = (i + j) % count;
+
+		if (records != NULL) {
+			raw = records[k];
+		} else if (k == 0) {
+			raw = first;
+		}
+
+		rrbuffer = *target;
+		dns_compress_setmethods(cctx, DNS_COMPRESS_GLOBAL14);
+		result = dns_name_towire2(name, cctx, target, &offset);
+		if (result != ISC_R_SUCCESS) {
+			goto rollback;
+		}
+
+		length = SLAB_LENGTH(raw);
+		isc_buffer_availableregion(target, &r);
+		if (r.length < sizeof(header) + 2 + length) {
+			result = ISC_R_NOSPACE;
+			goto rollback;
+		}
+		memmove(r.base, header, sizeof(header));
+		r.base[sizeof(header)] = (length >> 8) & 0xff;
+		r.base[sizeof(header) + 1] = length & 0xff;
+		memmove(r.base + sizeof(header) + 2, SLAB_DATA(raw), length);
+		isc_buffer_add(target, sizeof(header) + 2 + length);
+		added++;
+
+		raw = SLAB_NEXT(raw);
+	}
+
+	*countp += count;
+	goto cleanup;
+
+ rollback:
+	if (partial && result == ISC_R_NOSPACE) {
+		INSIST(rrbuffer.used < 65536);
+		dns_compress_rollback(cctx, (uint16_t)rrbuffer.used);
+		*countp += added;
+		*target = rrbuffer;
+		goto cleanup;
+	}
+	INSIST(savedbuffer.used < 65536);
+	dns_compress_rollback(cctx, (uint16_t)savedbuffer.used);
+	*countp = 0;
+	*target = savedbuffer;
+
+ cleanup:
+	if (records != NULL && records != records_fixed) {
+		isc_mem_put(cctx->mctx, records, count * sizeof(*records));
+	}
+	return (result);
+}
+
 static isc_result_t
 towiresorted(dns_rdataset_t *rdataset, const dns_name_t *owner_name,
 	     dns_compress_t *cctx, isc_buffer_t *target,
@@ -353,6 +550,18 @@ towiresorted(dns_rdataset_t *rdataset, const dns_name_t *owner_name,
 	want_random = WANT_RANDOM(rdataset);
 	want_cyclic = WANT_CYCLIC(rdataset);
 
+	if ((rdataset->attributes & (DNS_RDATASETATTR_QUESTION |
+				     DNS_RDATASETATTR_NEGATIVE)) == 0 &&
+	    order == NULL && rdataset->methods->getslab != NULL &&
+	    towire_verbatim(rdataset->rdclass, rdataset->type))
+	{
+		unsigned char *slab = (rdataset->methods->getslab)(rdataset);
+		if (slab != NULL) {
+			return (towire_slab(rdataset, slab, owner_name, cctx,
+					    target, partial, countp));
+		}
+	}
+
 	if ((rdataset->attributes & DNS_RDATASETATTR_QUESTION) != 0) {
 		question = true;
 		count = 1;
@@ -597,6 +806,52 @@ dns_rdataset_towire(dns_rdataset_t *rdataset,
 			     NULL, NULL, false, options, countp, NULL));
 }
 
+unsigned int
+dns_rdataset_minwiresize(dns_rdataset_t *rdataset,
+			 const dns_name_t *owner_name)
+{
+	unsigned char *slab = NULL, *raw;
+	unsigned int count, i, header, size;
+
+	REQUIRE(DNS_RDATASET_VALID(rdataset));
+	REQUIRE(rdataset->methods != NULL);
+
+	if ((rdataset->attributes & (DNS_RDATASETATTR_QUESTION |
+				     DNS_RDATASETATTR_NEGATIVE)) != 0)
+	{
+		return (0);
+	}
+
+	/*
+	 * Each record takes at least a compression pointer to its owner
+	 * name (or the root label), then type, class, TTL and length.
+	 */
+	header = (owner_name->length == 1 ? 1 : 2) + 10;
+
+	if (rdataset->methods->getslab != NULL &&
+	    towire_verbatim(rdataset->rdclass, rdataset->type))
+	{
+		slab = (rdataset->methods->getslab)(rdataset);
+	}
+	if (slab == NULL) {
+		return (dns_rdataset_count(rdataset) * header);
+	}
+
+	/*
+	 * The rdata will be copied as they are, so their lengths in the
+	 * slab are exact.
+	 */
+	count = slab[0] * 256 + slab[1];
+	raw = slab + 2 + SLAB_OFFSETS(count);
+	size = count * header;
+	for (i = 0; i < count; i++) {
+		size += SLAB_LENGTH(raw);
+		raw = SLAB_NEXT(raw);
+	}
+
+	return (size);
+}
+
 isc_result_t
 dns_rdataset_additionaldata(dns_rdataset_t *rdataset,
 			    dns_additionaldatafunc_t add, void *arg)
@@ -64,7 +64,8 @@
  * WARNING:
  *	rbtdb.c directly interacts with the slab's raw structures.  If the
  *	structure changes then rbtdb.c also needs to be updated to reflect
- *	the changes.  See the areas tagged with "RDATASLAB".
+ *	the changes.  See the areas tagged with "RDATASLAB".  The same
+ *	applies to towire_slab() in rdataset.c.
  */
 
 struct xrdata {
@@ -17,6 +17,8 @@
 
 #include <isc/atomic.h>
 #include <isc/counter.h>
+#include <isc/heap.h>
+#include <isc/ht.h>
 #include <isc/log.h>
 #include <isc/platform.h>
 #include <isc/print.h>
@@ -62,6 +64,9 @@
 #include <dns/stats.h>
 #include <dns/tsig.h>
 #include <dns/validator.h>
+
+#include "resolver_p.h"
+
 #ifdef WANT_QUERYTRACE
 #define RTRACE(m)       isc_log_write(dns_lctx, \
 				      DNS_LOGCATEGORY_RESOLVER, \
@@ -177,6 +182,52 @@
 #endif
 #define RES_NOBUCKET		0xffffffff
 
+/*
+ * Initial size (in bits) of the per-bucket hash tables that index the
+ * fetch contexts and the client events waiting on them.  The tables
+ * double whenever they hold as many entries as they have chains, so
+ * this only sets how much memory an idle bucket uses.
+ */
+#ifndef RES_FCTXTABLE_BITS
+#define RES_FCTXTABLE_BITS	4
+#endif
+
+/*
+ * Hedged queries.  While hedging is enabled the RTTs of answered UDP
+ * queries are counted in RTT_BUCKETS buckets, four per octave.  Every
+ * RTT_WINDOW samples the HEDGE_PERCENTILE of the counts is taken as
+ * the hedge delay and the counts are halved, so that the delay follows
+ * recent conditions.  The budget is kept in hundredths of a hedge; no
+ * more than HEDGE_MAXCREDIT can be saved up for a burst.
+ */
+#define RTT_BUCKETS		96
+#define RTT_WINDOW		1024
+#define HEDGE_PERCENTILE	95
+#define HEDGE_MINDELAY_US	(10 * US_PER_MSEC)
+#define HEDGE_COST		100
+#define HEDGE_MAXCREDIT		(100 * HEDGE_COST)
+
+/*%
+ * Pooled TCP connections to servers.  Up to TCPPOOL_PIPELINE queries
+ * may be outstanding on a pooled connection at once, and the pool
+ * holds at most TCPPOOL_MAXCONNS connections across all servers.
+ * Idle connections are checked every TCPPOOL_SWEEP seconds.
+ */
+#define TCPPOOL_PIPELINE	16
+#define TCPPOOL_MAXCONNS	256
+#define TCPPOOL_SWEEP		1
+
+/*%
+ * Popular RRsets in the cache are refreshed REFRESH_LEAD seconds before
+ * they expire.  One cache answer in REFRESH_SAMPLE is looked at to
+ * find them, and at most REFRESH_MAXENTRIES are tracked.  RRsets with
+ * a TTL under REFRESH_MINTTL seconds are left to expire.
+ */
+#define REFRESH_LEAD		3
+#define REFRESH_SAMPLE		16
+#define REFRESH_MAXENTRIES	65536
+#define REFRESH_MINTTL		10
+
 /*%
  * Maximum EDNS0 input packet size.
  */
@@ -194,6 +245,39 @@
 
 typedef struct fetchctx fetchctx_t;
 
+/*%
+ * A TCP connection to a server, kept in the resolver's pool so that it
+ * can be shared by concurrent queries and reused by later ones.  Locked
+ * by the resolver's tcplock.
+ */
+typedef struct tcpconn {
+	dns_dispatch_t *		dispatch;
+	isc_sockaddr_t			peer;
+	isc_sockaddr_t			local;
+	unsigned int			queries;	/* in flight */
+	unsigned int			idletime;	/* in seconds */
+	isc_stdtime_t			expires;	/* when idle */
+	bool				pooled;
+	ISC_LINK(struct tcpconn)	link;
+} tcpconn_t;
+
+/*%
+ * An RRset in the cache that may be refreshed before it expires.  It
+ * is either in the refresh heap, ordered by expiry, or being fetched.
+ */
+typedef struct refreshent {
+	dns_resolver_t *		res;
+	dns_fixedname_t			fname;
+	dns_name_t *			name;		/* lower case */
+	dns_rdatatype_t			type;
+	uint32_t			count;		/* lookups, when seen */
+	isc_stdtime_t			expire;
+	unsigned int			index;		/* in refreshheap */
+	bool				refreshed;
+	dns_fetch_t *			fetch;
+	dns_rdataset_t			rdataset;
+} refreshent_t;
+
 typedef struct query {
 	/* Locked by task event serialization. */
 	unsigned int			magic;
@@ -204,6 +288,8 @@ typedef struct query {
 	bool				exclusivesocket;
 	dns_adbaddrinfo_t *		addrinfo;
 	isc_socket_t *			tcpsocket;
+	isc_sockaddr_t			tcplocal;
+	tcpconn_t *			tcpconn;
 	isc_time_t			start;
 	dns_messageid_t			id;
 	dns_dispentry_t *		dispentry;
@@ -232,11 +318,17 @@ struct tried {
 #define VALID_QUERY(query)		ISC_MAGIC_VALID(query, QUERY_MAGIC)
 
 #define RESQUERY_ATTR_CANCELED          0x02
+#define RESQUERY_ATTR_HEDGE             0x04	/*%< Sent as a hedge. */
+#define RESQUERY_ATTR_RACING            0x08	/*%< Racing a hedge. */
 
 #define RESQUERY_CONNECTING(q)          ((q)->connects > 0)
 #define RESQUERY_CANCELED(q)            (((q)->attributes & \
 					  RESQUERY_ATTR_CANCELED) != 0)
 #define RESQUERY_SENDING(q)             ((q)->sends > 0)
+#define RESQUERY_HEDGE(q)               (((q)->attributes & \
+					  RESQUERY_ATTR_HEDGE) != 0)
+#define RESQUERY_RACING(q)              (((q)->attributes & \
+					  RESQUERY_ATTR_RACING) != 0)
 
 typedef enum {
 	fetchstate_init = 0,            /*%< Start event has not run yet. */
@@ -273,6 +365,8 @@ struct fetchctx {
 	bool				want_shutdown;
 	bool				cloned;
 	bool				spilled;
+	bool				indexed;	/* in fctxtable */
+	unsigned int			nevents;
 	isc_event_t			control_event;
 	ISC_LINK(struct fetchctx)       link;
 	ISC_LIST(dns_fetchevent_t)      events;
@@ -282,6 +376,7 @@ struct fetchctx {
 	dns_rdataset_t			nameservers;
 	atomic_uint_fast32_t		attributes;
 	isc_timer_t *			timer;
+	isc_timer_t *			hedgetimer;
 	isc_time_t			expires;
 	isc_interval_t			interval;
 	dns_message_t *			qmessage;
@@ -437,10 +532,20 @@ struct dns_fetch {
 #define DNS_FETCH_MAGIC			ISC_MAGIC('F', 't', 'c', 'h')
 #define DNS_FETCH_VALID(fetch)		ISC_MAGIC_VALID(fetch, DNS_FETCH_MAGIC)
 
+/*%
+ * The fetch contexts of a bucket run on its task and are protected by
+ * its lock.  Besides being on the 'fctxs' list, the ones that can be
+ * shared are indexed by name, type and options in 'fctxtable' (see
+ * fctx_key()), and the client events waiting on them by fetch context,
+ * client address and message ID in 'clients' (see fevent_key()).
+ * The two tables are protected by 'lock' as well.
+ */
 typedef struct fctxbucket {
 	isc_task_t *			task;
 	isc_mutex_t			lock;
 	ISC_LIST(fetchctx_t)		fctxs;
+	isc_ht_t *			fctxtable;
+	isc_ht_t *			clients;
 	atomic_bool			exiting;
 	isc_mem_t *			mctx;
 } fctxbucket_t;
@@ -522,6 +627,32 @@ struct dns_resolver {
 	unsigned int			retryinterval;	/* in milliseconds */
 	unsigned int			nonbackofftries;
 
+	/* Hedged queries. */
+	unsigned int			hedgepct;
+	atomic_int_fast32_t		hedgecredit;
+	atomic_uint_fast32_t		hedgedelay;	/* in microseconds */
+	atomic_uint_fast32_t		rttsamples;
+	atomic_uint_fast32_t		rtthist[RTT_BUCKETS];
+
+	/* Pooled TCP connections, locked by tcplock. */
+	isc_mutex_t			tcplock;
+	ISC_LIST(tcpconn_t)		tcpconns;
+	unsigned int			ntcpconns;
+	unsigned int			tcpmaxconns;	/* per server */
+	unsigned int			tcpidletime;	/* in seconds */
+	isc_timer_t *			tcptimer;
+	bool				tcptimeron;
+
+	/* Refreshing of popular RRsets, locked by refreshlock. */
+	isc_mutex_t			refreshlock;
+	unsigned int			refreshqps;
+	unsigned int			refreshhits;	/* per TTL */
+	unsigned int			refreshtokens;
+	isc_ht_t *			refreshtable;
+	isc_heap_t *			refreshheap;
+	isc_timer_t *			refreshtimer;
+	bool				refreshtimeron;
+
 	/* Atomic */
 	isc_refcount_t			references;
 	atomic_uint_fast32_t		zspill;		/* fetches-per-zone */
@@ -600,6 +731,7 @@ static void resquery_response(isc_task_t *task, isc_event_t *event);
 static void resquery_connected(isc_task_t *task, isc_event_t *event);
 static void fctx_try(fetchctx_t *fctx, bool retrying,
 		     bool badcache);
+static void fctx_hedge(isc_task_t *task, isc_event_t *event);
 static isc_result_t fctx_minimize_qname(fetchctx_t *fctx);
 static void fctx_destroy(fetchctx_t *fctx);
 static bool fctx_unlink(fetchctx_t *fctx);
@@ -1119,6 +1251,679 @@ fctx_startidletimer(fetchctx_t *fctx, isc_interval_t *interval) {
  */
 #define fctx_stopidletimer      fctx_starttimer
 
+static inline void
+fctx_stophedgetimer(fetchctx_t *fctx) {
+	isc_result_t result;
+
+	result = isc_timer_reset(fctx->hedgetimer, isc_timertype_inactive,
+				 NULL, NULL, true);
+	if (result != ISC_R_SUCCESS) {
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "isc_timer_reset(): %s",
+				 isc_result_totext(result));
+	}
+}
+
+/*%
+ * Map an RTT in microseconds to its bucket in res->rtthist: the first
+ * four buckets hold 0-3 us, then each octave is split in four.
+ */
+static inline unsigned int
+rtt_bucket(unsigned int us) {
+	unsigned int msb = 2;
+
+	if (us < 4) {
+		return (us);
+	}
+	while ((us >> (msb + 1)) != 0) {
+		msb++;
+	}
+	return (ISC_MIN((msb - 1) * 4 + ((us >> (msb - 2)) & 3),
+			RTT_BUCKETS - 1));
+}
+
+/*%
+ * The smallest RTT that falls in bucket 'b'.
+ */
+static inline unsigned int
+rtt_bucketmin(unsigned int b) {
+	if (b < 4) {
+		return (b);
+	}
+	return ((4 + b % 4) << (b / 4 - 1));
+}
+
+/*%
+ * Count a query RTT, and recompute the hedge delay once a window's
+ * worth of them has been seen.
+ */
+static void
+rtt_record(dns_resolver_t *res, unsigned int us) {
+	uint32_t count[RTT_BUCKETS];
+	uint32_t total = 0, seen = 0, target, delay;
+	unsigned int b;
+
+	atomic_fetch_add_relaxed(&res->rtthist[rtt_bucket(us)], 1);
+	if ((atomic_fetch_add_relaxed(&res->rttsamples, 1) + 1) %
+	    RTT_WINDOW != 0)
+	{
+		return;
+	}
+
+	for (b = 0; b < RTT_BUCKETS; b++) {
+		count[b] = atomic_load_relaxed(&res->rtthist[b]);
+		total += count[b];
+	}
+	target = (total * HEDGE_PERCENTILE + 99) / 100;
+	for (b = 0; b < RTT_BUCKETS - 1; b++) {
+		seen += count[b];
+		if (seen >= target) {
+			break;
+		}
+	}
+	delay = (b < RTT_BUCKETS - 1) ? rtt_bucketmin(b + 1)
+				      : MAX_SINGLE_QUERY_TIMEOUT_US;
+	atomic_store_relaxed(&res->hedgedelay,
+			     ISC_MAX(delay, HEDGE_MINDELAY_US));
+
+	for (b = 0; b < RTT_BUCKETS; b++) {
+		atomic_fetch_sub_relaxed(&res->rtthist[b], count[b] / 2);
+	}
+}
+
+/*%
+ * Every query sent earns a fraction of a hedge, as set by
+ * dns_resolver_sethedging().
+ */
+static inline void
+hedge_earn(dns_resolver_t *res) {
+	int_fast32_t credit;
+
+	credit = atomic_fetch_add_relaxed(&res->hedgecredit, res->hedgepct);
+	if (credit + (int_fast32_t)res->hedgepct > HEDGE_MAXCREDIT) {
+		atomic_store_relaxed(&res->hedgecredit, HEDGE_MAXCREDIT);
+	}
+}
+
+static inline bool
+hedge_spend(dns_resolver_t *res) {
+	int_fast32_t credit = atomic_load_relaxed(&res->hedgecredit);
+
+	do {
+		if (credit < HEDGE_COST) {
+			return (false);
+		}
+	} while (!atomic_compare_exchange_weak_relaxed(&res->hedgecredit,
+						       &credit,
+						       credit - HEDGE_COST));
+	return (true);
+}
+
+/*
+ * Free 'conn', which must be out of the pool with no queries left.
+ */
+static void
+tcpconn_free(dns_resolver_t *res, tcpconn_t *conn) {
+	isc_socket_t *sock;
+
+	INSIST(!conn->pooled && conn->queries == 0);
+
+	/*
+	 * fctx_cancelquery() leaves the sends on a pooled connection
+	 * alone, as other queries may share it.  Now that none do, the
+	 * last one's send may still be pending, and it has to be
+	 * cancelled before the socket can go.
+	 */
+	sock = dns_dispatch_getsocket(conn->dispatch);
+	if (sock != NULL)
+		isc_socket_cancel(sock, NULL, ISC_SOCKCANCEL_SEND);
+	dns_dispatch_detach(&conn->dispatch);
+	isc_mem_put(res->mctx, conn, sizeof(*conn));
+}
+
+/*
+ * Take 'conn' out of the pool.  It is freed now if it is idle, or else
+ * when its last query is done.  Caller must hold tcplock.
+ */
+static void
+tcpconn_unpool(dns_resolver_t *res, tcpconn_t *conn) {
+	INSIST(conn->pooled);
+
+	ISC_LIST_UNLINK(res->tcpconns, conn, link);
+	res->ntcpconns--;
+	conn->pooled = false;
+	if (conn->queries == 0) {
+		tcpconn_free(res, conn);
+	}
+}
+
+/*
+ * Close the pooled connections that have been idle for too long, and
+ * those the server has closed.  Caller must hold tcplock.
+ */
+static void
+tcppool_prune(dns_resolver_t *res, isc_stdtime_t now) {
+	tcpconn_t *conn, *next;
+
+	for (conn = ISC_LIST_HEAD(res->tcpconns); conn != NULL; conn = next) {
+		next = ISC_LIST_NEXT(conn, link);
+		if ((conn->queries == 0 && conn->expires <= now) ||
+		    dns_dispatch_isshuttingdown(conn->dispatch))
+		{
+			tcpconn_unpool(res, conn);
+		}
+	}
+}
+
+/*
+ * Close all pooled connections, or mark them to be closed when their
+ * queries are done.  Caller must hold tcplock.
+ */
+static void
+tcppool_flush(dns_resolver_t *res) {
+	isc_result_t result;
+
+	while (!ISC_LIST_EMPTY(res->tcpconns)) {
+		tcpconn_unpool(res, ISC_LIST_HEAD(res->tcpconns));
+	}
+	if (res->tcptimeron) {
+		result = isc_timer_reset(res->tcptimer, isc_timertype_inactive,
+					 NULL, NULL, true);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		res->tcptimeron = false;
+	}
+}
+
+static void
+tcppool_sweep(isc_task_t *task, isc_event_t *event) {
+	dns_resolver_t *res = event->ev_arg;
+	isc_stdtime_t now;
+
+	REQUIRE(VALID_RESOLVER(res));
+
+	UNUSED(task);
+
+	isc_stdtime_get(&now);
+	LOCK(&res->tcplock);
+	tcppool_prune(res, now);
+	if (ISC_LIST_EMPTY(res->tcpconns)) {
+		tcppool_flush(res);
+	}
+	UNLOCK(&res->tcplock);
+
+	isc_event_free(&event);
+}
+
+/*
+ * Find a pooled connection to 'peer' from 'local' that can take
+ * another query, preferring the least busy one, and count a query
+ * against it.
+ */
+static isc_result_t
+tcppool_get(dns_resolver_t *res, const isc_sockaddr_t *peer,
+	    const isc_sockaddr_t *local, tcpconn_t **connp)
+{
+	tcpconn_t *conn, *best = NULL;
+	isc_stdtime_t now;
+
+	REQUIRE(connp != NULL && *connp == NULL);
+
+	isc_stdtime_get(&now);
+	LOCK(&res->tcplock);
+	tcppool_prune(res, now);
+	for (conn = ISC_LIST_HEAD(res->tcpconns);
+	     conn != NULL;
+	     conn = ISC_LIST_NEXT(conn, link))
+	{
+		if (conn->queries >= TCPPOOL_PIPELINE ||
+		    !isc_sockaddr_equal(&conn->peer, peer) ||
+		    !isc_sockaddr_eqaddr(&conn->local, local))
+		{
+			continue;
+		}
+		if (best == NULL || conn->queries < best->queries) {
+			best = conn;
+		}
+	}
+	if (best != NULL) {
+		best->queries++;
+		*connp = best;
+	}
+	UNLOCK(&res->tcplock);
+
+	return (best != NULL ? ISC_R_SUCCESS : ISC_R_NOTFOUND);
+}
+
+/*
+ * Add the newly connected TCP dispatch of 'query' to the pool, unless
+ * there are enough connections to its server already.
+ */
+static void
+tcppool_add(dns_resolver_t *res, resquery_t *query) {
+	tcpconn_t *conn;
+	isc_interval_t interval;
+	isc_result_t result;
+	unsigned int n = 0;
+
+	REQUIRE(query->tcpconn == NULL);
+
+	LOCK(&res->tcplock);
+	if (res->tcpmaxconns == 0 || res->ntcpconns >= TCPPOOL_MAXCONNS ||
+	    atomic_load_acquire(&res->exiting))
+	{
+		goto unlock;
+	}
+	for (conn = ISC_LIST_HEAD(res->tcpconns);
+	     conn != NULL;
+	     conn = ISC_LIST_NEXT(conn, link))
+	{
+		if (isc_sockaddr_equal(&conn->peer,
+				       &query->addrinfo->sockaddr))
+		{
+			n++;
+		}
+	}
+	if (n >= res->tcpmaxconns) {
+		goto unlock;
+	}
+
+	conn = isc_mem_get(res->mctx, sizeof(*conn));
+	*conn = (tcpconn_t) {
+		.peer = query->addrinfo->sockaddr,
+		.local = query->tcplocal,
+		.queries = 1,
+		.idletime = res->tcpidletime,
+		.pooled = true,
+	};
+	dns_dispatch_attach(query->dispatch, &conn->dispatch);
+	ISC_LINK_INIT(conn, link);
+	ISC_LIST_APPEND(res->tcpconns, conn, link);
+	res->ntcpconns++;
+	query->tcpconn = conn;
+
+	if (!res->tcptimeron) {
+		isc_interval_set(&interval, TCPPOOL_SWEEP, 0);
+		result = isc_timer_reset(res->tcptimer, isc_timertype_ticker,
+					 NULL, &interval, false);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		res->tcptimeron = true;
+	}
+
+ unlock:
+	UNLOCK(&res->tcplock);
+}
+
+/*
+ * A query on '*connp' is done.  If 'keep' is false the connection is
+ * no longer trusted and leaves the pool.
+ */
+static void
+tcppool_release(dns_resolver_t *res, tcpconn_t **connp, bool keep) {
+	tcpconn_t *conn;
+	isc_stdtime_t now;
+
+	REQUIRE(connp != NULL && *connp != NULL);
+
+	conn = *connp;
+	*connp = NULL;
+
+	isc_stdtime_get(&now);
+	LOCK(&res->tcplock);
+	INSIST(conn->queries > 0);
+	conn->queries--;
+	if (!conn->pooled) {
+		if (conn->queries == 0) {
+			tcpconn_free(res, conn);
+		}
+	} else if (!keep || (conn->queries == 0 && conn->idletime == 0)) {
+		tcpconn_unpool(res, conn);
+	} else if (conn->queries == 0) {
+		conn->expires = now + conn->idletime;
+	}
+	UNLOCK(&res->tcplock);
+}
+
+/*
+ * The server has sent an EDNS TCP keepalive option: don't keep the
+ * connection idle for longer than 'timeout' (in units of 100
+ * milliseconds).
+ */
+static void
+tcppool_setidle(dns_resolver_t *res, tcpconn_t *conn, unsigned int timeout) {
+	LOCK(&res->tcplock);
+	conn->idletime = ISC_MIN(timeout / 10, res->tcpidletime);
+	UNLOCK(&res->tcplock);
+}
+
+/*
+ * Refreshing popular RRsets.
+ *
+ * A sample of the cache answers sent to clients is passed to
+ * dns_resolver_refreshhit(), which starts tracking the RRset.  Shortly
+ * before it expires, the number of times it was looked up since then,
+ * kept by the cache in the RRset's header, tells whether it is popular
+ * enough to be refreshed; the fetches started this way are limited to
+ * 'refreshqps' a second.  After a refresh, the new RRset is tracked
+ * the same way.
+ */
+
+static unsigned int
+refresh_key(const dns_name_t *name, dns_rdatatype_t type,
+	    unsigned char *key)
+{
+	isc_region_t r;
+
+	dns_name_toregion(name, &r);
+	key[0] = (type >> 8) & 0xff;
+	key[1] = type & 0xff;
+	memmove(key + 2, r.base, r.length);
+
+	return (r.length + 2);
+}
+
+static bool
+refresh_higherprio(void *v1, void *v2) {
+	refreshent_t *e1 = v1, *e2 = v2;
+
+	return (e1->expire < e2->expire);
+}
+
+static void
+refresh_setindex(void *what, unsigned int index) {
+	refreshent_t *ent = what;
+
+	ent->index = index;
+}
+
+/*
+ * Stop tracking 'ent'.  Caller must hold refreshlock.
+ */
+static void
+refresh_free(dns_resolver_t *res, refreshent_t *ent) {
+	unsigned char key[2 + DNS_NAME_MAXWIRE];
+	unsigned int keysize;
+	isc_result_t result;
+
+	INSIST(ent->index == 0 && ent->fetch == NULL);
+
+	keysize = refresh_key(ent->name, ent->type, key);
+	result = isc_ht_delete(res->refreshtable, key, keysize);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	isc_mem_put(res->mctx, ent, sizeof(*ent));
+}
+
+/*
+ * Stop tracking all RRsets but those being fetched, which are freed
+ * when their fetch is done.  Caller must hold refreshlock.
+ */
+static void
+refresh_flush(dns_resolver_t *res) {
+	refreshent_t *ent;
+	isc_result_t result;
+
+	while ((ent = isc_heap_element(res->refreshheap, 1)) != NULL) {
+		isc_heap_delete(res->refreshheap, 1);
+		refresh_free(res, ent);
+	}
+	if (res->refreshtimeron) {
+		result = isc_timer_reset(res->refreshtimer,
+					 isc_timertype_inactive,
+					 NULL, NULL, true);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		res->refreshtimeron = false;
+	}
+}
+
+/*
+ * Return the number of times the RRset of 'ent' has been looked up in
+ * the cache since 'ent' last saw it, or 0 if it is no longer there or
+ * has been replaced.
+ */
+static uint32_t
+refresh_hits(dns_resolver_t *res, refreshent_t *ent, isc_stdtime_t now) {
+	dns_db_t *db = NULL;
+	dns_dbnode_t *node = NULL;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+	uint32_t hits = 0;
+
+	if (res->view->cachedb == NULL) {
+		return (0);
+	}
+	dns_db_attach(res->view->cachedb, &db);
+	result = dns_db_findnode(db, ent->name, false, &node);
+	if (result == ISC_R_SUCCESS) {
+		dns_rdataset_init(&rdataset);
+		result = dns_db_findrdataset(db, node, NULL, ent->type, 0,
+					     now, &rdataset, NULL);
+		if (result == ISC_R_SUCCESS) {
+			if (now + rdataset.ttl == ent->expire) {
+				hits = rdataset.count - ent->count;
+			}
+			dns_rdataset_disassociate(&rdataset);
+		}
+		dns_db_detachnode(db, &node);
+	}
+	dns_db_detach(&db);
+
+	return (hits);
+}
+
+/*
+ * Track 'ent' again if its refresh fetch, which finished with 'result',
+ * left a new RRset in ent->rdataset; otherwise stop tracking it.
+ * Caller must hold refreshlock.
+ */
+static void
+refresh_track(dns_resolver_t *res, refreshent_t *ent, isc_result_t result,
+	      isc_stdtime_t now)
+{
+	INSIST(ent->index == 0 && ent->fetch == NULL);
+
+	if ((result == ISC_R_SUCCESS ||
+	     result == DNS_R_CNAME ||
+	     result == DNS_R_DNAME) &&
+	    dns_rdataset_isassociated(&ent->rdataset) &&
+	    ent->rdataset.ttl >= REFRESH_MINTTL &&
+	    res->refreshqps != 0 && !atomic_load_acquire(&res->exiting))
+	{
+		ent->count = ent->rdataset.count;
+		ent->expire = now + ent->rdataset.ttl;
+		ent->refreshed = true;
+		result = isc_heap_insert(res->refreshheap, ent);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		dns_rdataset_disassociate(&ent->rdataset);
+	} else {
+		if (dns_rdataset_isassociated(&ent->rdataset)) {
+			dns_rdataset_disassociate(&ent->rdataset);
+		}
+		refresh_free(res, ent);
+	}
+}
+
+static void
+refresh_done(isc_task_t *task, isc_event_t *event) {
+	dns_fetchevent_t *fevent = (dns_fetchevent_t *)event;
+	refreshent_t *ent = fevent->ev_arg;
+	dns_resolver_t *res = ent->res;
+	dns_fetch_t *fetch;
+	isc_stdtime_t now;
+
+	REQUIRE(event->ev_type == DNS_EVENT_FETCHDONE);
+
+	UNUSED(task);
+
+	if (fevent->node != NULL) {
+		dns_db_detachnode(fevent->db, &fevent->node);
+	}
+	if (fevent->db != NULL) {
+		dns_db_detach(&fevent->db);
+	}
+
+	isc_stdtime_get(&now);
+	LOCK(&res->refreshlock);
+	INSIST(fevent->fetch == ent->fetch);
+	fetch = ent->fetch;
+	ent->fetch = NULL;
+	refresh_track(res, ent, fevent->result, now);
+	UNLOCK(&res->refreshlock);
+
+	/*
+	 * Destroying the last fetch of a resolver that is shutting down
+	 * takes res->lock and sends the shutdown events, so it is done
+	 * without holding refreshlock.
+	 */
+	dns_resolver_destroyfetch(&fetch);
+
+	isc_event_free(&event);
+}
+
+/*
+ * Refresh the RRsets that are about to expire, if they are popular
+ * enough and the budget allows.
+ */
+void
+dns__resolver_refreshtick(dns_resolver_t *res, isc_stdtime_t now) {
+	refreshent_t *ent;
+	isc_result_t result;
+	uint32_t hits;
+	unsigned int bucketnum;
+
+	REQUIRE(VALID_RESOLVER(res));
+
+	LOCK(&res->refreshlock);
+	res->refreshtokens = res->refreshqps;
+	while ((ent = isc_heap_element(res->refreshheap, 1)) != NULL &&
+	       ent->expire <= now + REFRESH_LEAD)
+	{
+		if (ent->expire > now && res->refreshtokens == 0) {
+			break;
+		}
+		isc_heap_delete(res->refreshheap, 1);
+
+		if (ent->expire <= now) {
+			/* The budget ran out before it could be refreshed. */
+			inc_stats(res, dns_resstatscounter_refreshskipped);
+			refresh_free(res, ent);
+			continue;
+		}
+
+		hits = refresh_hits(res, ent, now);
+		if (ent->refreshed && hits > 0) {
+			/*
+			 * Without the refresh, the first of these lookups
+			 * would have missed the cache.
+			 */
+			inc_stats(res, dns_resstatscounter_refreshused);
+		}
+		if (hits < res->refreshhits) {
+			refresh_free(res, ent);
+			continue;
+		}
+
+		res->refreshtokens--;
+		bucketnum = isc_random_uniform(res->nbuckets);
+		dns_rdataset_init(&ent->rdataset);
+		result = dns_resolver_createfetch(res, ent->name, ent->type,
+						  NULL, NULL, NULL, NULL, 0,
+						  DNS_FETCHOPT_PREFETCH, 0,
+						  NULL,
+						  res->buckets[bucketnum].task,
+						  refresh_done, ent,
+						  &ent->rdataset, NULL,
+						  &ent->fetch);
+		if (result != ISC_R_SUCCESS) {
+			refresh_free(res, ent);
+			continue;
+		}
+		inc_stats(res, dns_resstatscounter_refresh);
+	}
+	if (isc_ht_count(res->refreshtable) == 0) {
+		refresh_flush(res);
+	}
+	UNLOCK(&res->refreshlock);
+}
+
+static void
+refresh_tick(isc_task_t *task, isc_event_t *event) {
+	dns_resolver_t *res = event->ev_arg;
+	isc_stdtime_t now;
+
+	UNUSED(task);
+
+	isc_stdtime_get(&now);
+	dns__resolver_refreshtick(res, now);
+
+	isc_event_free(&event);
+}
+
+unsigned int
+dns__resolver_refreshcount(dns_resolver_t *res) {
+	unsigned int count;
+
+	REQUIRE(VALID_RESOLVER(res));
+
+	LOCK(&res->refreshlock);
+	count = isc_ht_count(res->refreshtable);
+	UNLOCK(&res->refreshlock);
+
+	return (count);
+}
+
+isc_result_t
+dns__resolver_refreshnext(dns_resolver_t *res, dns_name_t *name,
+			  dns_rdatatype_t *typep, isc_stdtime_t *expirep,
+			  bool *refreshedp)
+{
+	refreshent_t *ent;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	REQUIRE(VALID_RESOLVER(res));
+	REQUIRE(typep != NULL && expirep != NULL && refreshedp != NULL);
+
+	LOCK(&res->refreshlock);
+	ent = isc_heap_element(res->refreshheap, 1);
+	if (ent != NULL) {
+		dns_name_copynf(ent->name, name);
+		*typep = ent->type;
+		*expirep = ent->expire;
+		*refreshedp = ent->refreshed;
+		result = ISC_R_SUCCESS;
+	}
+	UNLOCK(&res->refreshlock);
+
+	return (result);
+}
+
+isc_result_t
+dns__resolver_refreshdone(dns_resolver_t *res, const dns_name_t *name,
+			  dns_rdatatype_t type, isc_result_t fetchresult,
+			  dns_rdataset_t *rdataset, isc_stdtime_t now)
+{
+	refreshent_t *ent = NULL;
+	unsigned char key[2 + DNS_NAME_MAXWIRE];
+	unsigned int keysize;
+	isc_result_t result;
+
+	REQUIRE(VALID_RESOLVER(res));
+
+	keysize = refresh_key(name, type, key);
+
+	LOCK(&res->refreshlock);
+	result = isc_ht_find(res->refreshtable, key, keysize, (void **)&ent);
+	if (result == ISC_R_SUCCESS) {
+		INSIST(ent->index != 0 && ent->fetch == NULL);
+		isc_heap_delete(res->refreshheap, ent->index);
+		if (rdataset != NULL) {
+			dns_rdataset_clone(rdataset, &ent->rdataset);
+		}
+		refresh_track(res, ent, fetchresult, now);
+	}
+	UNLOCK(&res->refreshlock);
+
+	return (result);
+}
+
 static inline void
 resquery_destroy(resquery_t **queryp) {
 	dns_resolver_t *res;
@@ -1177,7 +1982,6 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 	fetchctx_t *fctx;
 	resquery_t *query;
 	unsigned int rtt, rttms;
-	unsigned int factor;
 	dns_adbfind_t *find;
 	dns_adbaddrinfo_t *addrinfo;
 	isc_socket_t *sock;
@@ -1192,6 +1996,8 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 
 	query->attributes |= RESQUERY_ATTR_CANCELED;
 
+	isc_stdtime_get(&now);
+
 	/*
 	 * Should we update the RTT?
 	 */
@@ -1203,7 +2009,12 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 			 */
 			rtt = (unsigned int)isc_time_microdiff(finish,
 							       &query->start);
-			factor = DNS_ADB_RTTADJDEFAULT;
+
+			if (fctx->res->hedgepct != 0 &&
+			    (query->options & DNS_FETCHOPT_TCP) == 0)
+			{
+				rtt_record(fctx->res, rtt);
+			}
 
 			rttms = rtt / 1000;
 			if (rttms < DNS_RESOLVER_QRYRTTCLASS0) {
@@ -1225,10 +2036,10 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 				inc_stats(fctx->res,
 					  dns_resstatscounter_queryrtt5);
 			}
-		} else {
-			uint32_t value;
-			uint32_t mask;
 
+			dns_adb_adjustsrtt(fctx->adb, query->addrinfo, rtt,
+					   DNS_ADB_RTTADJDEFAULT, now);
+		} else {
 			update_edns_stats(query);
 
 			/*
@@ -1246,45 +2057,16 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 			/*
 			 * We don't have an RTT for this query.  Maybe the
 			 * packet was lost, or maybe this server is very
-			 * slow.  We don't know.  Increase the RTT.
+			 * slow.  We don't know.  Count it as lost, and
+			 * increase the RTT.  Don't increase it as much on
+			 * EDNS queries unless we have seen a EDNS response.
 			 */
 			INSIST(no_response);
-			value = isc_random32();
-			if (query->addrinfo->srtt > 800000)
-				mask = 0x3fff;
-			else if (query->addrinfo->srtt > 400000)
-				mask = 0x7fff;
-			else if (query->addrinfo->srtt > 200000)
-				mask = 0xffff;
-			else if (query->addrinfo->srtt > 100000)
-				mask = 0x1ffff;
-			else if (query->addrinfo->srtt > 50000)
-				mask = 0x3ffff;
-			else if (query->addrinfo->srtt > 25000)
-				mask = 0x7ffff;
-			else
-				mask = 0xfffff;
-
-			/*
-			 * Don't adjust timeout on EDNS queries unless we have
-			 * seen a EDNS response.
-			 */
-			if ((query->options & DNS_FETCHOPT_NOEDNS0) == 0 &&
-			    !EDNSOK(query->addrinfo)) {
-				mask >>= 2;
-			}
-
-			rtt = query->addrinfo->srtt + (value & mask);
-			if (rtt > MAX_SINGLE_QUERY_TIMEOUT_US)
-				rtt = MAX_SINGLE_QUERY_TIMEOUT_US;
-
-			/*
-			 * Replace the current RTT with our value.
-			 */
-			factor = DNS_ADB_RTTADJREPLACE;
+			dns_adb_noresponse(fctx->adb, query->addrinfo,
+					   (query->options &
+					    DNS_FETCHOPT_NOEDNS0) == 0 &&
+					   !EDNSOK(query->addrinfo), now);
 		}
-
-		dns_adb_adjustsrtt(fctx->adb, query->addrinfo, rtt, factor);
 	}
 	if ((query->options & DNS_FETCHOPT_TCP) == 0) {
 		/* Inform the ADB that we're ending a UDP fetch */
@@ -1292,9 +2074,10 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 	}
 
 	/*
-	 * Age RTTs of servers not tried.
+	 * Age RTTs of servers not tried.  Once a server has been measured
+	 * it is chosen by score rather than srtt, and it is the ADB's
+	 * exploration budget that gets it tried again.
 	 */
-	isc_stdtime_get(&now);
 	if (finish != NULL || age_untried)
 		for (addrinfo = ISC_LIST_HEAD(fctx->forwaddrs);
 		     addrinfo != NULL;
@@ -1353,10 +2136,14 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 	}
 	if (RESQUERY_SENDING(query)) {
 		/*
-		 * Cancel the pending send.
+		 * Cancel the pending send, unless the socket is a pooled
+		 * TCP connection: that would also cancel the sends of
+		 * the other queries sharing it.
 		 */
 		if (query->exclusivesocket && query->dispentry != NULL)
 			sock = dns_dispatch_getentrysocket(query->dispentry);
+		else if (query->tcpconn != NULL)
+			sock = NULL;
 		else
 			sock = dns_dispatch_getsocket(query->dispatch);
 		if (sock != NULL)
@@ -1374,6 +2161,13 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 	if (query->tsigkey != NULL)
 		dns_tsigkey_detach(&query->tsigkey);
 
+	/*
+	 * A pooled TCP connection that has let a query time out is not
+	 * used again.
+	 */
+	if (query->tcpconn != NULL)
+		tcppool_release(fctx->res, &query->tcpconn, !no_response);
+
 	if (query->dispatch != NULL)
 		dns_dispatch_detach(&query->dispatch);
 
@@ -1401,6 +2195,36 @@ fctx_cancelqueries(fetchctx_t *fctx, bool no_response,
 	}
 }
 
+/*%
+ * 'winner' has been answered first in a race with a hedge; cancel the
+ * other queries in the race.  They may be slow rather than lost, so
+ * instead of being treated as timed out their servers are told how long
+ * they were waited for, as an unfinished sample rather than an RTT.
+ */
+static void
+fctx_cancelracing(fetchctx_t *fctx, resquery_t *winner) {
+	resquery_t *query, *next_query;
+	isc_time_t now;
+	unsigned int waited;
+
+	FCTXTRACE("cancelracing");
+
+	TIME_NOW(&now);
+	for (query = ISC_LIST_HEAD(fctx->queries);
+	     query != NULL;
+	     query = next_query)
+	{
+		next_query = ISC_LIST_NEXT(query, link);
+		if (query == winner || !RESQUERY_RACING(query)) {
+			continue;
+		}
+		waited = (unsigned int)isc_time_microdiff(&now, &query->start);
+		dns_adb_unfinished(fctx->adb, query->addrinfo, waited,
+				   isc_time_seconds(&now));
+		fctx_cancelquery(&query, NULL, NULL, false, false);
+	}
+}
+
 static void
 fctx_cleanupfinds(fetchctx_t *fctx) {
 	dns_adbfind_t *find, *next_find;
@@ -1474,6 +2298,7 @@ fctx_stopqueries(fetchctx_t *fctx, bool no_response,
 	FCTXTRACE("stopqueries");
 	fctx_cancelqueries(fctx, no_response, age_untried);
 	fctx_stoptimer(fctx);
+	fctx_stophedgetimer(fctx);
 }
 
 static inline void
@@ -1598,6 +2423,159 @@ fcount_decr(fetchctx_t *fctx) {
 	UNLOCK(&dbucket->lock);
 }
 
+#define FCTX_KEYSIZE	(6 + DNS_NAME_MAXWIRE)
+#define FEVENT_KEYSIZE	(sizeof(fetchctx_t *) + 2 + sizeof(isc_sockaddr_t))
+
+/*
+ * Store the 'fctxtable' key of a fetch of 'type' for 'name' with
+ * 'options' in 'key', and return its length.  Like fctx_match(), it
+ * ignores the case of the name.
+ */
+static unsigned int
+fctx_key(const dns_name_t *name, dns_rdatatype_t type, unsigned int options,
+	 unsigned char *key)
+{
+	dns_fixedname_t fixed;
+	dns_name_t *lname;
+	unsigned int len = 0;
+
+	lname = dns_fixedname_initname(&fixed);
+	RUNTIME_CHECK(dns_name_downcase(name, lname, NULL) == ISC_R_SUCCESS);
+
+	key[len++] = type >> 8;
+	key[len++] = type & 0xff;
+	key[len++] = (options >> 24) & 0xff;
+	key[len++] = (options >> 16) & 0xff;
+	key[len++] = (options >> 8) & 0xff;
+	key[len++] = options & 0xff;
+	memmove(key + len, lname->ndata, lname->length);
+
+	return (len + lname->length);
+}
+
+/*
+ * Store the 'clients' key of the event for query 'id' from 'client'
+ * waiting on 'fctx' in 'key', and return its length.  Like
+ * isc_sockaddr_equal(), it compares the port, address and scope of
+ * IP addresses.
+ */
+static unsigned int
+fevent_key(fetchctx_t *fctx, const isc_sockaddr_t *client,
+	   dns_messageid_t id, unsigned char *key)
+{
+	unsigned int len = 0;
+	in_port_t port;
+
+	memmove(key, &fctx, sizeof(fctx));
+	len += sizeof(fctx);
+	key[len++] = id >> 8;
+	key[len++] = id & 0xff;
+
+	switch (client->type.sa.sa_family) {
+	case AF_INET:
+		port = isc_sockaddr_getport(client);
+		key[len++] = port >> 8;
+		key[len++] = port & 0xff;
+		memmove(key + len, &client->type.sin.sin_addr, 4);
+		len += 4;
+		break;
+	case AF_INET6:
+		port = isc_sockaddr_getport(client);
+		key[len++] = port >> 8;
+		key[len++] = port & 0xff;
+		memmove(key + len, &client->type.sin6.sin6_addr, 16);
+		len += 16;
+		memmove(key + len, &client->type.sin6.sin6_scope_id, 4);
+		len += 4;
+		break;
+	default:
+		memmove(key + len, &client->type, client->length);
+		len += client->length;
+		break;
+	}
+
+	return (len);
+}
+
+/*
+ * Make 'fctx' the fetch context that new fetches for its name, type
+ * and options join, in place of any other one.
+ *
+ * Caller must be holding the bucket lock.
+ */
+static void
+fctx_index(fetchctx_t *fctx) {
+	isc_ht_t *fctxtable = fctx->res->buckets[fctx->bucketnum].fctxtable;
+	unsigned char key[FCTX_KEYSIZE];
+	unsigned int keylen;
+	void *old = NULL;
+	isc_result_t result;
+
+	keylen = fctx_key(&fctx->name, fctx->type, fctx->options, key);
+	if (isc_ht_find(fctxtable, key, keylen, &old) == ISC_R_SUCCESS) {
+		((fetchctx_t *)old)->indexed = false;
+		result = isc_ht_delete(fctxtable, key, keylen);
+		INSIST(result == ISC_R_SUCCESS);
+	}
+	result = isc_ht_add(fctxtable, key, keylen, fctx);
+	INSIST(result == ISC_R_SUCCESS);
+	fctx->indexed = true;
+}
+
+/*
+ * Add 'event' to the events of 'fctx'.
+ *
+ * Caller must be holding the bucket lock.
+ */
+static void
+fctx_linkevent(fetchctx_t *fctx, dns_fetchevent_t *event) {
+	unsigned char key[FEVENT_KEYSIZE];
+	unsigned int keylen;
+	isc_result_t result;
+
+	/*
+	 * Make sure that we can store the sigrdataset in the
+	 * first event if it is needed by any of the events.
+	 */
+	if (event->sigrdataset != NULL)
+		ISC_LIST_PREPEND(fctx->events, event, ev_link);
+	else
+		ISC_LIST_APPEND(fctx->events, event, ev_link);
+	fctx->nevents++;
+
+	if (event->client != NULL) {
+		fctxbucket_t *bucket = &fctx->res->buckets[fctx->bucketnum];
+
+		keylen = fevent_key(fctx, event->client, event->id, key);
+		result = isc_ht_add(bucket->clients, key, keylen, event);
+		INSIST(result == ISC_R_SUCCESS);
+	}
+}
+
+/*
+ * Remove 'event' from the events of 'fctx'.
+ *
+ * Caller must be holding the bucket lock.
+ */
+static void
+fctx_unlinkevent(fetchctx_t *fctx, dns_fetchevent_t *event) {
+	unsigned char key[FEVENT_KEYSIZE];
+	unsigned int keylen;
+	isc_result_t result;
+
+	ISC_LIST_UNLINK(fctx->events, event, ev_link);
+	INSIST(fctx->nevents > 0);
+	fctx->nevents--;
+
+	if (event->client != NULL) {
+		fctxbucket_t *bucket = &fctx->res->buckets[fctx->bucketnum];
+
+		keylen = fevent_key(fctx, event->client, event->id, key);
+		result = isc_ht_delete(bucket->clients, key, keylen);
+		INSIST(result == ISC_R_SUCCESS);
+	}
+}
+
 static inline void
 fctx_sendevents(fetchctx_t *fctx, isc_result_t result, int line) {
 	dns_fetchevent_t *event, *next_event;
@@ -1629,7 +2607,7 @@ fctx_sendevents(fetchctx_t *fctx, isc_result_t result, int line) {
 	     event != NULL;
 	     event = next_event) {
 		next_event = ISC_LIST_NEXT(event, ev_link);
-		ISC_LIST_UNLINK(fctx->events, event, ev_link);
+		fctx_unlinkevent(fctx, event);
 		task = event->ev_sender;
 		event->ev_sender = fctx;
 		event->vresult = fctx->vresult;
@@ -1877,6 +2855,34 @@ fctx_addopt(dns_message_t *message, unsigned int version,
 	return (dns_message_setopt(message, rdataset));
 }
 
+unsigned int
+dns_resolver_retrywait(unsigned int us, unsigned int rtt) {
+	/*
+	 * Add a fudge factor to the expected rtt based on the current
+	 * estimate.
+	 */
+	if (rtt < 50000)
+		rtt += 50000;
+	else if (rtt < 100000)
+		rtt += 100000;
+	else
+		rtt += 200000;
+
+	/*
+	 * Always wait for at least the expected rtt.
+	 */
+	if (us < rtt)
+		us = rtt;
+
+	/*
+	 * But don't ever wait for more than 10 seconds.
+	 */
+	if (us > MAX_SINGLE_QUERY_TIMEOUT_US)
+		us = MAX_SINGLE_QUERY_TIMEOUT_US;
+
+	return (us);
+}
+
 static inline void
 fctx_setretryinterval(fetchctx_t *fctx, unsigned int rtt) {
 	unsigned int seconds;
@@ -1893,32 +2899,80 @@ fctx_setretryinterval(fetchctx_t *fctx, unsigned int rtt) {
 		us <<= shift;
 	}
 
-	/*
-	 * Add a fudge factor to the expected rtt based on the current
-	 * estimate.
-	 */
-	if (rtt < 50000)
-		rtt += 50000;
-	else if (rtt < 100000)
-		rtt += 100000;
-	else
-		rtt += 200000;
+	us = dns_resolver_retrywait(us, rtt);
+
+	seconds = us / US_PER_SEC;
+	us -= seconds * US_PER_SEC;
+	isc_interval_set(&fctx->interval, seconds, us * 1000);
+}
+
+/*%
+ * Start the hedge timer for 'query', which has just been sent.  The
+ * delay is the recent HEDGE_PERCENTILE of query RTTs, or the server's
+ * own SRTT if that is longer; there is no hedge if the retry interval
+ * would run out first anyway.  When 'query' is not to be hedged, the
+ * timer is stopped, so that it cannot fire for an earlier query.
+ */
+static void
+fctx_starthedgetimer(fetchctx_t *fctx, resquery_t *query) {
+	dns_resolver_t *res = fctx->res;
+	isc_interval_t interval;
+	isc_time_t expires;
+	unsigned int delay, retry;
+
+	if (res->hedgepct == 0 ||
+	    (query->options & DNS_FETCHOPT_TCP) != 0 ||
+	    ISFORWARDER(query->addrinfo))
+	{
+		fctx_stophedgetimer(fctx);
+		return;
+	}
+
+	delay = atomic_load_relaxed(&res->hedgedelay);
+	if (delay == 0) {
+		/* Not enough RTTs seen yet. */
+		fctx_stophedgetimer(fctx);
+		return;
+	}
+	delay = ISC_MAX(delay, query->addrinfo->srtt);
+
+	retry = fctx->interval.seconds * US_PER_SEC +
+		fctx->interval.nanoseconds / 1000;
+	if (delay >= retry) {
+		fctx_stophedgetimer(fctx);
+		return;
+	}
+
+	isc_interval_set(&interval, delay / US_PER_SEC,
+			 (delay % US_PER_SEC) * 1000);
+	if (isc_time_nowplusinterval(&expires, &interval) != ISC_R_SUCCESS ||
+	    isc_timer_reset(fctx->hedgetimer, isc_timertype_once,
+			    &expires, NULL, true) != ISC_R_SUCCESS)
+	{
+		fctx_stophedgetimer(fctx);
+	}
+}
+
+/*%
+ * Create the socket for a new TCP connection for 'query', bound to its
+ * local address.
+ */
+static isc_result_t
+resquery_tcpsocket(dns_resolver_t *res, resquery_t *query, int pf) {
+	isc_result_t result;
 
-	/*
-	 * Always wait for at least the expected rtt.
-	 */
-	if (us < rtt)
-		us = rtt;
+	result = isc_socket_create(res->socketmgr, pf, isc_sockettype_tcp,
+				   &query->tcpsocket);
+	if (result != ISC_R_SUCCESS)
+		return (result);
 
-	/*
-	 * But don't ever wait for more than 10 seconds.
-	 */
-	if (us > MAX_SINGLE_QUERY_TIMEOUT_US)
-		us = MAX_SINGLE_QUERY_TIMEOUT_US;
+#ifndef BROKEN_TCP_BIND_BEFORE_CONNECT
+	result = isc_socket_bind(query->tcpsocket, &query->tcplocal, 0);
+	if (result != ISC_R_SUCCESS)
+		isc_socket_detach(&query->tcpsocket);
+#endif
 
-	seconds = us / US_PER_SEC;
-	us -= seconds * US_PER_SEC;
-	isc_interval_set(&fctx->interval, seconds, us * 1000);
+	return (result);
 }
 
 static isc_result_t
@@ -1991,6 +3045,7 @@ fctx_query(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo,
 	query->dispatch = NULL;
 	query->exclusivesocket = false;
 	query->tcpsocket = NULL;
+	query->tcpconn = NULL;
 	if (res->view->peers != NULL) {
 		dns_peer_t *peer = NULL;
 		isc_netaddr_t dstip;
@@ -2040,21 +3095,27 @@ fctx_query(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo,
 		isc_sockaddr_setport(&addr, 0);
 		if (query->dscp == -1)
 			query->dscp = dscp;
+		query->tcplocal = addr;
 
-		result = isc_socket_create(res->socketmgr, pf,
-					   isc_sockettype_tcp,
-					   &query->tcpsocket);
-		if (result != ISC_R_SUCCESS)
-			goto cleanup_query;
-
-#ifndef BROKEN_TCP_BIND_BEFORE_CONNECT
-		result = isc_socket_bind(query->tcpsocket, &addr, 0);
-		if (result != ISC_R_SUCCESS)
-			goto cleanup_socket;
-#endif
 		/*
-		 * A dispatch will be created once the connect succeeds.
+		 * Use a pooled connection to the server if there is one
+		 * with room for another query.
 		 */
+		if (res->tcpmaxconns != 0 &&
+		    tcppool_get(res, &addrinfo->sockaddr, &addr,
+				&query->tcpconn) == ISC_R_SUCCESS)
+		{
+			dns_dispatch_attach(query->tcpconn->dispatch,
+					    &query->dispatch);
+		} else {
+			/*
+			 * A dispatch will be created once the connect
+			 * succeeds.
+			 */
+			result = resquery_tcpsocket(res, query, pf);
+			if (result != ISC_R_SUCCESS)
+				goto cleanup_query;
+		}
 	} else {
 		if (have_addr) {
 			unsigned int attrs, attrmask;
@@ -2125,7 +3186,33 @@ fctx_query(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo,
 	ISC_LINK_INIT(query, link);
 	query->magic = QUERY_MAGIC;
 
-	if ((query->options & DNS_FETCHOPT_TCP) != 0) {
+	if ((query->options & DNS_FETCHOPT_TCP) != 0 &&
+	    query->tcpconn != NULL)
+	{
+		/*
+		 * Send straight away over the pooled connection.  If it
+		 * is being closed, or has no query IDs left, it leaves
+		 * the pool and a new connection is made instead.
+		 */
+		result = resquery_send(query);
+		if (result == ISC_R_SHUTTINGDOWN || result == ISC_R_QUOTA) {
+			tcppool_release(res, &query->tcpconn, false);
+			dns_dispatch_detach(&query->dispatch);
+			result = resquery_tcpsocket(res, query,
+					isc_sockaddr_pf(&addrinfo->sockaddr));
+			if (result != ISC_R_SUCCESS)
+				goto cleanup_query;
+		} else if (result != ISC_R_SUCCESS) {
+			goto cleanup_dispatch;
+		} else {
+			inc_stats(res, dns_resstatscounter_tcpreuse);
+			QTRACE("sending via pooled TCP connection");
+		}
+	}
+
+	if ((query->options & DNS_FETCHOPT_TCP) != 0 &&
+	    query->tcpconn == NULL)
+	{
 		/*
 		 * Connect to the remote server.
 		 *
@@ -2140,7 +3227,7 @@ fctx_query(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo,
 			goto cleanup_socket;
 		query->connects++;
 		QTRACE("connecting via TCP");
-	} else {
+	} else if ((query->options & DNS_FETCHOPT_TCP) == 0) {
 		if (dns_adbentry_overquota(addrinfo->entry))
 			goto cleanup_dispatch;
 
@@ -2173,6 +3260,8 @@ fctx_query(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo,
 	isc_socket_detach(&query->tcpsocket);
 
  cleanup_dispatch:
+	if (query->tcpconn != NULL)
+		tcppool_release(res, &query->tcpconn, false);
 	if (query->dispatch != NULL)
 		dns_dispatch_detach(&query->dispatch);
 
@@ -2552,7 +3641,7 @@ resquery_send(resquery_t *query) {
 			unsigned int flags = query->addrinfo->flags;
 			bool reqnsid = res->view->requestnsid;
 			bool sendcookie = res->view->sendcookie;
-			bool tcpkeepalive = false;
+			bool tcpkeepalive = (tcp && res->tcpmaxconns != 0);
 			unsigned char cookie[64];
 			uint16_t padding = 0;
 
@@ -2638,7 +3727,11 @@ resquery_send(resquery_t *query) {
 				ednsopt++;
 			}
 
-			/* Add TCP keepalive option if appropriate */
+			/*
+			 * Add TCP keepalive option if appropriate; always
+			 * when the connection may be pooled, unless the
+			 * server statement says otherwise.
+			 */
 			if ((peer != NULL) && tcp)
 				(void) dns_peer_gettcpkeepalive(peer,
 								&tcpkeepalive);
@@ -2876,8 +3969,9 @@ resquery_connected(isc_task_t *task, isc_event_t *event) {
 	bool retry = false;
 	isc_interval_t interval;
 	isc_result_t result;
-	unsigned int attrs;
+	unsigned int attrs, maxrequests;
 	fetchctx_t *fctx;
+	dns_resolver_t *res;
 
 	REQUIRE(event->ev_type == ISC_SOCKEVENT_CONNECT);
 	REQUIRE(VALID_QUERY(query));
@@ -2896,6 +3990,7 @@ resquery_connected(isc_task_t *task, isc_event_t *event) {
 
 	query->connects--;
 	fctx = query->fctx;
+	res = fctx->res;
 
 	if (RESQUERY_CANCELED(query)) {
 		/*
@@ -2940,12 +4035,18 @@ resquery_connected(isc_task_t *task, isc_event_t *event) {
 				attrs |= DNS_DISPATCHATTR_IPV6;
 			attrs |= DNS_DISPATCHATTR_MAKEQUERY;
 
+			/*
+			 * A connection that may go into the pool has to
+			 * take pipelined queries.
+			 */
+			maxrequests = (res->tcpmaxconns != 0)
+					? TCPPOOL_PIPELINE : 1;
 			result = dns_dispatch_createtcp(query->dispatchmgr,
 							query->tcpsocket,
-							query->fctx->res->taskmgr,
+							res->taskmgr,
 							NULL, NULL,
-							4096, 2, 1, 1, 3,
-							attrs,
+							4096, 2, maxrequests,
+							1, 3, attrs,
 							&query->dispatch);
 
 			/*
@@ -2955,8 +4056,12 @@ resquery_connected(isc_task_t *task, isc_event_t *event) {
 			 */
 			isc_socket_detach(&query->tcpsocket);
 
-			if (result == ISC_R_SUCCESS)
+			if (result == ISC_R_SUCCESS) {
+				inc_stats(res, dns_resstatscounter_tcpconnect);
+				if (res->tcpmaxconns != 0)
+					tcppool_add(res, query);
 				result = resquery_send(query);
+			}
 
 			if (result != ISC_R_SUCCESS) {
 				FCTXTRACE("query canceled: "
@@ -3273,29 +4378,29 @@ add_bad(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo, isc_result_t reason,
 }
 
 /*
- * Sort addrinfo list by RTT.
+ * Sort addrinfo list by score, the expected latency.
  */
 static void
 sort_adbfind(dns_adbfind_t *find, unsigned int bias) {
 	dns_adbaddrinfo_t *best, *curr;
 	dns_adbaddrinfolist_t sorted;
-	unsigned int best_srtt, curr_srtt;
+	unsigned int best_score, curr_score;
 
 	/* Lame N^2 bubble sort. */
 	ISC_LIST_INIT(sorted);
 	while (!ISC_LIST_EMPTY(find->list)) {
 		best = ISC_LIST_HEAD(find->list);
-		best_srtt = best->srtt;
+		best_score = best->score;
 		if (isc_sockaddr_pf(&best->sockaddr) != AF_INET6)
-			best_srtt += bias;
+			best_score += bias;
 		curr = ISC_LIST_NEXT(best, publink);
 		while (curr != NULL) {
-			curr_srtt = curr->srtt;
+			curr_score = curr->score;
 			if (isc_sockaddr_pf(&curr->sockaddr) != AF_INET6)
-				curr_srtt += bias;
-			if (curr_srtt < best_srtt) {
+				curr_score += bias;
+			if (curr_score < best_score) {
 				best = curr;
-				best_srtt = curr_srtt;
+				best_score = curr_score;
 			}
 			curr = ISC_LIST_NEXT(curr, publink);
 		}
@@ -3306,16 +4411,16 @@ sort_adbfind(dns_adbfind_t *find, unsigned int bias) {
 }
 
 /*
- * Sort a list of finds by server RTT.
+ * Sort a list of finds by server score.
  */
 static void
 sort_finds(dns_adbfindlist_t *findlist, unsigned int bias) {
 	dns_adbfind_t *best, *curr;
 	dns_adbfindlist_t sorted;
 	dns_adbaddrinfo_t *addrinfo, *bestaddrinfo;
-	unsigned int best_srtt, curr_srtt;
+	unsigned int best_score, curr_score;
 
-	/* Sort each find's addrinfo list by SRTT. */
+	/* Sort each find's addrinfo list by score. */
 	for (curr = ISC_LIST_HEAD(*findlist);
 	     curr != NULL;
 	     curr = ISC_LIST_NEXT(curr, publink))
@@ -3327,19 +4432,19 @@ sort_finds(dns_adbfindlist_t *findlist, unsigned int bias) {
 		best = ISC_LIST_HEAD(*findlist);
 		bestaddrinfo = ISC_LIST_HEAD(best->list);
 		INSIST(bestaddrinfo != NULL);
-		best_srtt = bestaddrinfo->srtt;
+		best_score = bestaddrinfo->score;
 		if (isc_sockaddr_pf(&bestaddrinfo->sockaddr) != AF_INET6)
-			best_srtt += bias;
+			best_score += bias;
 		curr = ISC_LIST_NEXT(best, publink);
 		while (curr != NULL) {
 			addrinfo = ISC_LIST_HEAD(curr->list);
 			INSIST(addrinfo != NULL);
-			curr_srtt = addrinfo->srtt;
+			curr_score = addrinfo->score;
 			if (isc_sockaddr_pf(&addrinfo->sockaddr) != AF_INET6)
-				curr_srtt += bias;
-			if (curr_srtt < best_srtt) {
+				curr_score += bias;
+			if (curr_score < best_score) {
 				best = curr;
-				best_srtt = curr_srtt;
+				best_score = curr_score;
 			}
 			curr = ISC_LIST_NEXT(curr, publink);
 		}
@@ -3602,7 +4707,7 @@ fctx_getaddresses(fetchctx_t *fctx, bool badcache) {
 			ai->flags |= FCTX_ADDRINFO_FORWARDER;
 			ai->dscp = fwd->dscp;
 			cur = ISC_LIST_HEAD(fctx->forwaddrs);
-			while (cur != NULL && cur->srtt < ai->srtt)
+			while (cur != NULL && cur->score < ai->score)
 				cur = ISC_LIST_NEXT(cur, publink);
 			if (cur != NULL)
 				ISC_LIST_INSERTBEFORE(fctx->forwaddrs, cur,
@@ -3703,7 +4808,7 @@ fctx_getaddresses(fetchctx_t *fctx, bool badcache) {
 				dns_adbaddrinfo_t *cur;
 				ai->flags |= FCTX_ADDRINFO_FORWARDER;
 				cur = ISC_LIST_HEAD(fctx->altaddrs);
-				while (cur != NULL && cur->srtt < ai->srtt)
+				while (cur != NULL && cur->score < ai->score)
 					cur = ISC_LIST_NEXT(cur, publink);
 				if (cur != NULL)
 					ISC_LIST_INSERTBEFORE(fctx->altaddrs,
@@ -3971,7 +5076,7 @@ fctx_nextaddress(fetchctx_t *fctx) {
 		possibly_mark(fctx, addrinfo);
 		if (UNMARKED(addrinfo) &&
 		    (faddrinfo == NULL ||
-		     addrinfo->srtt < faddrinfo->srtt)) {
+		     addrinfo->score < faddrinfo->score)) {
 			if (faddrinfo != NULL)
 				faddrinfo->flags &= ~FCTX_ADDRINFO_MARK;
 			addrinfo->flags |= FCTX_ADDRINFO_MARK;
@@ -4143,9 +5248,16 @@ fctx_try(fetchctx_t *fctx, bool retrying, bool badcache) {
 		UNLOCK(&res->buckets[bucketnum].lock);
 		if (bucket_empty)
 			empty_bucket(res);
-	} else if (retrying) {
+		return;
+	}
+
+	if (retrying) {
 		inc_stats(res, dns_resstatscounter_retry);
 	}
+	if (res->hedgepct != 0) {
+		hedge_earn(res);
+		fctx_starthedgetimer(fctx, ISC_LIST_TAIL(fctx->queries));
+	}
 }
 
 static void
@@ -4321,6 +5433,17 @@ fctx_unlink(fetchctx_t *fctx) {
 	bucketnum = fctx->bucketnum;
 
 	ISC_LIST_UNLINK(res->buckets[bucketnum].fctxs, fctx, link);
+	if (fctx->indexed) {
+		unsigned char key[FCTX_KEYSIZE];
+		unsigned int keylen;
+		isc_result_t result;
+
+		keylen = fctx_key(&fctx->name, fctx->type, fctx->options, key);
+		result = isc_ht_delete(res->buckets[bucketnum].fctxtable,
+				       key, keylen);
+		INSIST(result == ISC_R_SUCCESS);
+		fctx->indexed = false;
+	}
 
 	REQUIRE(atomic_fetch_sub_release(&res->nfctx, 1) > 0);
 
@@ -4391,6 +5514,7 @@ fctx_destroy(fetchctx_t *fctx) {
 	isc_counter_detach(&fctx->qc);
 	fcount_decr(fctx);
 	isc_timer_detach(&fctx->timer);
+	isc_timer_detach(&fctx->hedgetimer);
 	dns_message_destroy(&fctx->rmessage);
 	dns_message_destroy(&fctx->qmessage);
 	if (dns_name_countlabels(&fctx->domain) > 0)
@@ -4467,6 +5591,89 @@ fctx_timeout(isc_task_t *task, isc_event_t *event) {
 	isc_event_free(&event);
 }
 
+/*%
+ * The query sent by fctx_try() has not been answered within the hedge
+ * delay: if the budget allows, send the same query to the next server
+ * as well.  Whichever answers first is used, and the other is canceled
+ * by fctx_cancelracing().
+ */
+static void
+fctx_hedge(isc_task_t *task, isc_event_t *event) {
+	fetchctx_t *fctx = event->ev_arg;
+	dns_resolver_t *res;
+	resquery_t *query, *hedge;
+	dns_adbaddrinfo_t *addrinfo;
+	isc_result_t result;
+
+	REQUIRE(VALID_FCTX(fctx));
+
+	UNUSED(task);
+
+	FCTXTRACE("hedge");
+
+	isc_event_free(&event);
+
+	res = fctx->res;
+
+	/*
+	 * Only hedge a lone UDP query to an authoritative server that
+	 * nothing else is waiting on.  Forwarders are tried in order, and
+	 * the timer may have fired just as the fetch moved to them.
+	 */
+	query = ISC_LIST_HEAD(fctx->queries);
+	if (query == NULL || query != ISC_LIST_TAIL(fctx->queries) ||
+	    RESQUERY_RACING(query) ||
+	    (query->options & DNS_FETCHOPT_TCP) != 0 ||
+	    ISFORWARDER(query->addrinfo) || fctx->forwarding ||
+	    ADDRWAIT(fctx) || SHUTTINGDOWN(fctx) ||
+	    !ISC_LIST_EMPTY(fctx->validators) ||
+	    fctx->qminfetch != NULL || fctx->nsfetch != NULL ||
+	    atomic_load_acquire(&res->exiting))
+	{
+		return;
+	}
+
+	if (!hedge_spend(res)) {
+		FCTXTRACE("hedge budget exhausted");
+		return;
+	}
+
+	addrinfo = fctx_nextaddress(fctx);
+	while (addrinfo != NULL && dns_adbentry_overquota(addrinfo->entry)) {
+		addrinfo = fctx_nextaddress(fctx);
+	}
+	if (addrinfo == NULL || ISFORWARDER(addrinfo) ||
+	    (dns_name_countlabels(&fctx->domain) > 2 &&
+	     isc_counter_increment(fctx->qc) != ISC_R_SUCCESS))
+	{
+		atomic_fetch_add_relaxed(&res->hedgecredit, HEDGE_COST);
+		return;
+	}
+
+	fctx_increference(fctx);
+	result = fctx_query(fctx, addrinfo, fctx->options);
+	if (result != ISC_R_SUCCESS) {
+		/*
+		 * The first query is still going; give it back its
+		 * retry timer.
+		 */
+		LOCK(&res->buckets[fctx->bucketnum].lock);
+		RUNTIME_CHECK(!fctx_decreference(fctx));
+		UNLOCK(&res->buckets[fctx->bucketnum].lock);
+		if (fctx_startidletimer(fctx, &fctx->interval) !=
+		    ISC_R_SUCCESS)
+		{
+			fctx_done(fctx, ISC_R_UNEXPECTED, __LINE__);
+		}
+		return;
+	}
+
+	hedge = ISC_LIST_TAIL(fctx->queries);
+	hedge->attributes |= RESQUERY_ATTR_HEDGE | RESQUERY_ATTR_RACING;
+	query->attributes |= RESQUERY_ATTR_RACING;
+	inc_stats(res, dns_resstatscounter_hedge);
+}
+
 static void
 fctx_shutdown(fetchctx_t *fctx) {
 	isc_event_t *cevent;
@@ -4692,14 +5899,7 @@ fctx_join(fetchctx_t *fctx, isc_task_t *task, const isc_sockaddr_t *client,
 	event->id = id;
 	dns_fixedname_init(&event->foundname);
 
-	/*
-	 * Make sure that we can store the sigrdataset in the
-	 * first event if it is needed by any of the events.
-	 */
-	if (event->sigrdataset != NULL)
-		ISC_LIST_PREPEND(fctx->events, event, ev_link);
-	else
-		ISC_LIST_APPEND(fctx->events, event, ev_link);
+	fctx_linkevent(fctx, event);
 
 	fctx_increference(fctx);
 
@@ -4985,6 +6185,19 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 		goto cleanup_rmessage;
 	}
 
+	fctx->hedgetimer = NULL;
+	iresult = isc_timer_create(res->timermgr, isc_timertype_inactive,
+				   NULL, NULL,
+				   res->buckets[bucketnum].task, fctx_hedge,
+				   fctx, &fctx->hedgetimer);
+	if (iresult != ISC_R_SUCCESS) {
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "isc_timer_create: %s",
+				 isc_result_totext(iresult));
+		result = ISC_R_UNEXPECTED;
+		goto cleanup_timer;
+	}
+
 	/*
 	 * Attach to the view's cache and adb.
 	 */
@@ -4996,6 +6209,8 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 	isc_mem_attach(mctx, &fctx->mctx);
 
 	ISC_LIST_INIT(fctx->events);
+	fctx->nevents = 0;
+	fctx->indexed = false;
 	ISC_LINK_INIT(fctx, link);
 	fctx->magic = FCTX_MAGIC;
 
@@ -5028,6 +6243,9 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 	isc_mem_detach(&fctx->mctx);
 	dns_adb_detach(&fctx->adb);
 	dns_db_detach(&fctx->cache);
+	isc_timer_detach(&fctx->hedgetimer);
+
+ cleanup_timer:
 	isc_timer_detach(&fctx->timer);
 
  cleanup_rmessage:
@@ -7938,6 +9156,20 @@ rctx_opt(respctx_t *rctx) {
 					  dns_resstatscounter_cookiein);
 				seen_cookie = true;
 				break;
+			case DNS_OPT_TCP_KEEPALIVE:
+				/*
+				 * The server's idle timeout (RFC 7828)
+				 * bounds how long a pooled connection is
+				 * kept.
+				 */
+				if (query->tcpconn != NULL && optlen == 2) {
+					tcppool_setidle(fctx->res,
+						query->tcpconn,
+						isc_buffer_getuint16(&optbuf));
+				} else {
+					isc_buffer_forward(&optbuf, optlen);
+				}
+				break;
 			default:
 				isc_buffer_forward(&optbuf, optlen);
 				break;
@@ -9466,6 +10698,20 @@ rctx_done(respctx_t *rctx, isc_result_t result) {
 		   rctx->no_response ? "no response" : "responding",
 		   result);
 
+	/*
+	 * If this query was racing a hedge and its response is being
+	 * used, it has won.
+	 */
+	if (RESQUERY_RACING(query) && !rctx->no_response &&
+	    !rctx->nextitem && !rctx->resend &&
+	    (!rctx->next_server || rctx->get_nameservers))
+	{
+		if (RESQUERY_HEDGE(query)) {
+			inc_stats(fctx->res, dns_resstatscounter_hedgewon);
+		}
+		fctx_cancelracing(fctx, query);
+	}
+
 	/*
 	 * Cancel the query.
 	 *
@@ -9503,6 +10749,7 @@ rctx_done(respctx_t *rctx, isc_result_t result) {
 		 */
 		FCTXTRACE("wait for validator");
 		fctx_cancelqueries(fctx, true, false);
+		fctx_stophedgetimer(fctx);
 		/*
 		 * We must not retransmit while the validator is working;
 		 * it has references to the current rmessage.
@@ -9802,6 +11049,8 @@ destroy(dns_resolver_t *res) {
 	isc_mutex_destroy(&res->lock);
 	for (i = 0; i < res->nbuckets; i++) {
 		INSIST(ISC_LIST_EMPTY(res->buckets[i].fctxs));
+		isc_ht_destroy(&res->buckets[i].fctxtable);
+		isc_ht_destroy(&res->buckets[i].clients);
 		isc_task_shutdown(res->buckets[i].task);
 		isc_task_detach(&res->buckets[i].task);
 		isc_mutex_destroy(&res->buckets[i].lock);
@@ -9837,6 +11086,20 @@ destroy(dns_resolver_t *res) {
 	isc_rwlock_destroy(&res->mbslock);
 #endif
 	isc_timer_detach(&res->spillattimer);
+	LOCK(&res->tcplock);
+	tcppool_flush(res);
+	UNLOCK(&res->tcplock);
+	INSIST(res->ntcpconns == 0);
+	isc_timer_detach(&res->tcptimer);
+	isc_mutex_destroy(&res->tcplock);
+	LOCK(&res->refreshlock);
+	refresh_flush(res);
+	UNLOCK(&res->refreshlock);
+	INSIST(isc_ht_count(res->refreshtable) == 0);
+	isc_ht_destroy(&res->refreshtable);
+	isc_heap_destroy(&res->refreshheap);
+	isc_timer_detach(&res->refreshtimer);
+	isc_mutex_destroy(&res->refreshlock);
 	res->magic = 0;
 	isc_mem_put(res->mctx, res, sizeof(*res));
 }
@@ -9967,6 +11230,26 @@ dns_resolver_create(dns_view_t *view,
 	res->zero_no_soa_ttl = false;
 	res->retryinterval = 30000;
 	res->nonbackofftries = 3;
+	res->hedgepct = 0;
+	atomic_init(&res->hedgecredit, 0);
+	atomic_init(&res->hedgedelay, 0);
+	atomic_init(&res->rttsamples, 0);
+	for (i = 0; i < RTT_BUCKETS; i++) {
+		atomic_init(&res->rtthist[i], 0);
+	}
+	ISC_LIST_INIT(res->tcpconns);
+	res->ntcpconns = 0;
+	res->tcpmaxconns = 0;
+	res->tcpidletime = 10;
+	res->tcptimer = NULL;
+	res->tcptimeron = false;
+	res->refreshqps = 0;
+	res->refreshhits = 16;
+	res->refreshtokens = 0;
+	res->refreshtable = NULL;
+	res->refreshheap = NULL;
+	res->refreshtimer = NULL;
+	res->refreshtimeron = false;
 	res->query_timeout = DEFAULT_QUERY_TIMEOUT;
 	res->maxdepth = DEFAULT_RECURSION_DEPTH;
 	res->maxqueries = DEFAULT_MAX_QUERIES;
@@ -10003,6 +11286,14 @@ dns_resolver_create(dns_view_t *view,
 		isc_mem_setname(res->buckets[i].mctx, name, NULL);
 		isc_task_setname(res->buckets[i].task, name, res);
 		ISC_LIST_INIT(res->buckets[i].fctxs);
+		res->buckets[i].fctxtable = NULL;
+		RUNTIME_CHECK(isc_ht_init(&res->buckets[i].fctxtable,
+					  res->buckets[i].mctx,
+					  RES_FCTXTABLE_BITS) == ISC_R_SUCCESS);
+		res->buckets[i].clients = NULL;
+		RUNTIME_CHECK(isc_ht_init(&res->buckets[i].clients,
+					  res->buckets[i].mctx,
+					  RES_FCTXTABLE_BITS) == ISC_R_SUCCESS);
 		atomic_init(&res->buckets[i].exiting, false);
 		buckets_created++;
 	}
@@ -10046,6 +11337,13 @@ dns_resolver_create(dns_view_t *view,
 
 	isc_mutex_init(&res->lock);
 	isc_mutex_init(&res->primelock);
+	isc_mutex_init(&res->tcplock);
+	isc_mutex_init(&res->refreshlock);
+	RUNTIME_CHECK(isc_ht_init(&res->refreshtable, view->mctx, 8) ==
+		      ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_heap_create(view->mctx, refresh_higherprio,
+				      refresh_setindex, 0,
+				      &res->refreshheap) == ISC_R_SUCCESS);
 
 	task = NULL;
 	result = isc_task_create(taskmgr, 0, &task);
@@ -10056,6 +11354,22 @@ dns_resolver_create(dns_view_t *view,
 	result = isc_timer_create(timermgr, isc_timertype_inactive, NULL, NULL,
 				  task, spillattimer_countdown, res,
 				  &res->spillattimer);
+	if (result == ISC_R_SUCCESS) {
+		result = isc_timer_create(timermgr, isc_timertype_inactive,
+					  NULL, NULL, task, tcppool_sweep, res,
+					  &res->tcptimer);
+		if (result != ISC_R_SUCCESS)
+			isc_timer_detach(&res->spillattimer);
+	}
+	if (result == ISC_R_SUCCESS) {
+		result = isc_timer_create(timermgr, isc_timertype_inactive,
+					  NULL, NULL, task, refresh_tick, res,
+					  &res->refreshtimer);
+		if (result != ISC_R_SUCCESS) {
+			isc_timer_detach(&res->tcptimer);
+			isc_timer_detach(&res->spillattimer);
+		}
+	}
 	isc_task_detach(&task);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_primelock;
@@ -10088,10 +11402,16 @@ dns_resolver_create(dns_view_t *view,
 
 #if USE_ALGLOCK || USE_MBSLOCK
  cleanup_spillattimer:
+	isc_timer_detach(&res->refreshtimer);
+	isc_timer_detach(&res->tcptimer);
 	isc_timer_detach(&res->spillattimer);
 #endif
 
  cleanup_primelock:
+	isc_heap_destroy(&res->refreshheap);
+	isc_ht_destroy(&res->refreshtable);
+	isc_mutex_destroy(&res->refreshlock);
+	isc_mutex_destroy(&res->tcplock);
 	isc_mutex_destroy(&res->primelock);
 	isc_mutex_destroy(&res->lock);
 
@@ -10109,6 +11429,8 @@ dns_resolver_create(dns_view_t *view,
 
  cleanup_buckets:
 	for (i = 0; i < buckets_created; i++) {
+		isc_ht_destroy(&res->buckets[i].fctxtable);
+		isc_ht_destroy(&res->buckets[i].clients);
 		isc_mem_detach(&res->buckets[i].mctx);
 		isc_mutex_destroy(&res->buckets[i].lock);
 		isc_task_shutdown(res->buckets[i].task);
@@ -10293,6 +11615,7 @@ dns_resolver_shutdown(dns_resolver_t *res) {
 	fetchctx_t *fctx;
 	isc_result_t result;
 	bool is_false = false;
+	bool flush_refresh = false;
 
 	REQUIRE(VALID_RESOLVER(res));
 
@@ -10329,8 +11652,22 @@ dns_resolver_shutdown(dns_resolver_t *res) {
 					 isc_timertype_inactive, NULL,
 					 NULL, true);
 		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		LOCK(&res->tcplock);
+		tcppool_flush(res);
+		UNLOCK(&res->tcplock);
+		flush_refresh = true;
 	}
 	UNLOCK(&res->lock);
+
+	/*
+	 * Not under res->lock: refresh_tick() starts fetches while holding
+	 * refreshlock.
+	 */
+	if (flush_refresh) {
+		LOCK(&res->refreshlock);
+		refresh_flush(res);
+		UNLOCK(&res->refreshlock);
+	}
 }
 
 void
@@ -10503,6 +11840,9 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 	unsigned int spillat;
 	unsigned int spillatmin;
 	bool dodestroy = false;
+	unsigned char fkey[FCTX_KEYSIZE], ckey[FEVENT_KEYSIZE];
+	unsigned int keylen;
+	void *data = NULL;
 
 	UNUSED(forwarders);
 
@@ -10543,11 +11883,13 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 	}
 
 	if ((options & DNS_FETCHOPT_UNSHARED) == 0) {
-		for (fctx = ISC_LIST_HEAD(res->buckets[bucketnum].fctxs);
-		     fctx != NULL;
-		     fctx = ISC_LIST_NEXT(fctx, link)) {
-			if (fctx_match(fctx, name, type, options))
-				break;
+		keylen = fctx_key(name, type, options, fkey);
+		result = isc_ht_find(res->buckets[bucketnum].fctxtable,
+				     fkey, keylen, &data);
+		if (result == ISC_R_SUCCESS &&
+		    fctx_match(data, name, type, options))
+		{
+			fctx = data;
 		}
 	}
 
@@ -10555,17 +11897,15 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 	 * Is this a duplicate?
 	 */
 	if (fctx != NULL && client != NULL) {
-		dns_fetchevent_t *fevent;
-		for (fevent = ISC_LIST_HEAD(fctx->events);
-		     fevent != NULL;
-		     fevent = ISC_LIST_NEXT(fevent, ev_link)) {
-			if (fevent->client != NULL && fevent->id == id &&
-			    isc_sockaddr_equal(fevent->client, client)) {
-				result = DNS_R_DUPLICATE;
-				goto unlock;
-			}
-			count++;
+		keylen = fevent_key(fctx, client, id, ckey);
+		data = NULL;
+		result = isc_ht_find(res->buckets[bucketnum].clients,
+				     ckey, keylen, &data);
+		if (result == ISC_R_SUCCESS) {
+			result = DNS_R_DUPLICATE;
+			goto unlock;
 		}
+		count = fctx->nevents;
 	}
 	if (count >= spillatmin && spillatmin != 0) {
 		INSIST(fctx != NULL);
@@ -10584,6 +11924,9 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 		if (result != ISC_R_SUCCESS)
 			goto unlock;
 		new_fctx = true;
+		if ((options & DNS_FETCHOPT_UNSHARED) == 0) {
+			fctx_index(fctx);
+		}
 	} else if (fctx->depth > depth)
 		fctx->depth = depth;
 
@@ -10653,7 +11996,7 @@ dns_resolver_cancelfetch(dns_fetch_t *fetch) {
 		     event = next_event) {
 			next_event = ISC_LIST_NEXT(event, ev_link);
 			if (event->fetch == fetch) {
-				ISC_LIST_UNLINK(fctx->events, event, ev_link);
+				fctx_unlinkevent(fctx, event);
 				break;
 			}
 		}
@@ -11411,3 +12754,186 @@ dns_resolver_setnonbackofftries(dns_resolver_t *resolver, unsigned int tries) {
 
 	resolver->nonbackofftries = tries;
 }
+
+unsigned int
+dns_resolver_gethedging(dns_resolver_t *resolver) {
+	REQUIRE(VALID_RESOLVER(resolver));
+
+	return (resolver->hedgepct);
+}
+
+void
+dns_resolver_sethedging(dns_resolver_t *resolver, unsigned int percent) {
+	REQUIRE(VALID_RESOLVER(resolver));
+	REQUIRE(percent <= 100);
+
+	resolver->hedgepct = percent;
+}
+
+void
+dns_resolver_gettcppool(dns_resolver_t *resolver, unsigned int *maxconns,
+			unsigned int *idletime)
+{
+	REQUIRE(VALID_RESOLVER(resolver));
+	REQUIRE(maxconns != NULL);
+	REQUIRE(idletime != NULL);
+
+	LOCK(&resolver->tcplock);
+	*maxconns = resolver->tcpmaxconns;
+	*idletime = resolver->tcpidletime;
+	UNLOCK(&resolver->tcplock);
+}
+
+void
+dns_resolver_settcppool(dns_resolver_t *resolver, unsigned int maxconns,
+			unsigned int idletime)
+{
+	tcpconn_t *conn;
+
+	REQUIRE(VALID_RESOLVER(resolver));
+	REQUIRE(maxconns <= DNS_RESOLVER_TCPMAXCONNS);
+	REQUIRE(idletime <= DNS_RESOLVER_TCPMAXIDLE);
+
+	LOCK(&resolver->tcplock);
+	resolver->tcpmaxconns = maxconns;
+	resolver->tcpidletime = idletime;
+	if (maxconns == 0 || idletime == 0) {
+		tcppool_flush(resolver);
+	} else {
+		for (conn = ISC_LIST_HEAD(resolver->tcpconns);
+		     conn != NULL;
+		     conn = ISC_LIST_NEXT(conn, link))
+		{
+			conn->idletime = ISC_MIN(conn->idletime, idletime);
+		}
+	}
+	UNLOCK(&resolver->tcplock);
+}
+
+void
+dns_resolver_getrefresh(dns_resolver_t *resolver, unsigned int *qps,
+			unsigned int *hits)
+{
+	REQUIRE(VALID_RESOLVER(resolver));
+	REQUIRE(qps != NULL);
+	REQUIRE(hits != NULL);
+
+	LOCK(&resolver->refreshlock);
+	*qps = resolver->refreshqps;
+	*hits = resolver->refreshhits;
+	UNLOCK(&resolver->refreshlock);
+}
+
+void
+dns_resolver_setrefresh(dns_resolver_t *resolver, unsigned int qps,
+			unsigned int hits)
+{
+	REQUIRE(VALID_RESOLVER(resolver));
+
+	LOCK(&resolver->refreshlock);
+	resolver->refreshqps = qps;
+	resolver->refreshhits = ISC_MAX(hits, 1);
+	if (qps == 0) {
+		refresh_flush(resolver);
+	}
+	UNLOCK(&resolver->refreshlock);
+}
+
+void
+dns_resolver_refreshhit(dns_resolver_t *resolver, const dns_name_t *name,
+			dns_rdataset_t *rdataset)
+{
+	refreshent_t *ent = NULL;
+	unsigned char key[2 + DNS_NAME_MAXWIRE];
+	unsigned int keysize;
+	dns_fixedname_t fixed;
+	dns_name_t *lname;
+	isc_interval_t interval;
+	isc_stdtime_t now;
+	isc_result_t result;
+
+	REQUIRE(VALID_RESOLVER(resolver));
+	REQUIRE(DNS_RDATASET_VALID(rdataset));
+
+	if (resolver->refreshqps == 0 ||
+	    (rdataset->count % REFRESH_SAMPLE) != 0 ||
+	    (rdataset->attributes & (DNS_RDATASETATTR_NEGATIVE |
+				     DNS_RDATASETATTR_STALE)) != 0 ||
+	    rdataset->type == dns_rdatatype_rrsig ||
+	    rdataset->ttl < REFRESH_MINTTL)
+	{
+		return;
+	}
+
+	lname = dns_fixedname_initname(&fixed);
+	RUNTIME_CHECK(dns_name_downcase(name, lname, NULL) == ISC_R_SUCCESS);
+	keysize = refresh_key(lname, rdataset->type, key);
+	isc_stdtime_get(&now);
+
+	LOCK(&resolver->refreshlock);
+	if (resolver->refreshqps == 0 ||
+	    atomic_load_acquire(&resolver->exiting))
+	{
+		goto unlock;
+	}
+
+	result = isc_ht_find(resolver->refreshtable, key, keysize,
+			     (void **)&ent);
+	if (result == ISC_R_SUCCESS) {
+		/*
+		 * If the RRset has been replaced since it was last seen,
+		 * and is not being refreshed right now, start over with
+		 * the new one.
+		 */
+		if (ent->index != 0 && ent->expire != now + rdataset->ttl) {
+			ent->expire = now + rdataset->ttl;
+			ent->count = rdataset->count;
+			ent->refreshed = false;
+			isc_heap_delete(resolver->refreshheap, ent->index);
+			result = isc_heap_insert(resolver->refreshheap, ent);
+			RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		}
+		goto unlock;
+	}
+
+	if (isc_ht_count(resolver->refreshtable) >= REFRESH_MAXENTRIES) {
+		goto unlock;
+	}
+
+	ent = isc_mem_get(resolver->mctx, sizeof(*ent));
+	*ent = (refreshent_t){
+		.res = resolver,
+		.type = rdataset->type,
+		.count = rdataset->count,
+		.expire = now + rdataset->ttl,
+	};
+	ent->name = dns_fixedname_initname(&ent->fname);
+	dns_name_copynf(lname, ent->name);
+	dns_rdataset_init(&ent->rdataset);
+	result = isc_ht_add(resolver->refreshtable, key, keysize, ent);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	result = isc_heap_insert(resolver->refreshheap, ent);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+
+	if (!resolver->refreshtimeron) {
+		isc_interval_set(&interval, 1, 0);
+		result = isc_timer_reset(resolver->refreshtimer,
+					 isc_timertype_ticker, NULL,
+					 &interval, false);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		resolver->refreshtimeron = true;
+	}
+
+ unlock:
+	UNLOCK(&resolver->refreshlock);
+}
+
+unsigned int
+dns_resolver_gethedgedelay(dns_resolver_t *resolver) {
+	REQUIRE(VALID_RESOLVER(resolver));
+
+	if (resolver->hedgepct == 0) {
+		return (0);
+	}
+	return (atomic_load_relaxed(&resolver->hedgedelay));
+}
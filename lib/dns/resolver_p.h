@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_RESOLVER_P_H
+#define DNS_RESOLVER_P_H
+
+#include <stdbool.h>
+
+#include <isc/stdtime.h>
+
+#include <dns/types.h>
+
+/*! \file */
+
+/*%
+ *     Functions below not be used outside this module and its
+ *     associated unit tests.
+ */
+
+ISC_LANG_BEGINDECLS
+
+void
+dns__resolver_refreshtick(dns_resolver_t *res, isc_stdtime_t now);
+/*%<
+ * Do what the once-a-second refresh timer does at time 'now': start
+ * refresh fetches for the popular RRsets about to expire, within the
+ * 'refreshqps' budget, and stop tracking the others that are due.
+ */
+
+unsigned int
+dns__resolver_refreshcount(dns_resolver_t *res);
+/*%<
+ * Return the number of RRsets being tracked for refreshing.
+ */
+
+isc_result_t
+dns__resolver_refreshnext(dns_resolver_t *res, dns_name_t *name,
+			  dns_rdatatype_t *typep, isc_stdtime_t *expirep,
+			  bool *refreshedp);
+/*%<
+ * Copy out the tracked RRset that expires first.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND		no RRset is waiting to be refreshed.
+ */
+
+isc_result_t
+dns__resolver_refreshdone(dns_resolver_t *res, const dns_name_t *name,
+			  dns_rdatatype_t type, isc_result_t fetchresult,
+			  dns_rdataset_t *rdataset, isc_stdtime_t now);
+/*%<
+ * Handle the tracked RRset 'name'/'type' as if its refresh fetch had
+ * finished at 'now' with 'fetchresult' and 'rdataset' (which may be
+ * NULL): it is either tracked again or forgotten.  'name' must be in
+ * lower case.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND		'name'/'type' is not being tracked.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_RESOLVER_P_H */
@@ -1416,7 +1416,8 @@ static dns_rdatasetmethods_t sdb_rdataset_methods = {
 	NULL, /* clearprefetch */
 	NULL, /* setownercase */
 	NULL, /* getownercase */
-	NULL  /* addglue */
+	NULL, /* addglue */
+	NULL  /* getslab */
 };
 
 static void
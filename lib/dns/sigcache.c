@@ -0,0 +1,468 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <isc/atomic.h>
+#include <isc/buffer.h>
+#include <isc/magic.h>
+#include <isc/md.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/region.h>
+#include <isc/serial.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+#include <dns/sigcache.h>
+#include <dns/types.h>
+
+#include <dst/dst.h>
+
+typedef struct dns_scentry dns_scentry_t;
+
+typedef struct dns_scbucket {
+	isc_mutex_t			lock;
+	ISC_LIST(dns_scentry_t)		entries;	/* MRU first */
+} dns_scbucket_t;
+
+struct dns_sigcache {
+	unsigned int			magic;
+	isc_mem_t			*mctx;
+	unsigned int			maxentries;
+	atomic_uint_fast32_t		count;
+	atomic_uint_fast32_t		sweep;
+	unsigned int			nbuckets;
+	dns_scbucket_t			*buckets;
+};
+
+#define SIGCACHE_MAGIC			ISC_MAGIC('S', 'i', 'g', 'C')
+#define VALID_SIGCACHE(m)		ISC_MAGIC_VALID(m, SIGCACHE_MAGIC)
+
+/*
+ * The wildcard name, if any, is stored right after the entry.
+ */
+struct dns_scentry {
+	ISC_LINK(dns_scentry_t)		link;
+	unsigned char			digest[DNS_SIGCACHE_DIGESTLENGTH];
+	isc_stdtime_t			inception;
+	isc_stdtime_t			expire;
+	isc_result_t			result;
+	unsigned int			length;
+};
+
+#define ENTRY_DATA(e)			((unsigned char *)((e) + 1))
+#define ENTRY_SIZE(e)			(sizeof(*(e)) + (e)->length)
+
+/*
+ * Size the table for a few entries per bucket.
+ */
+#define SIGCACHE_BUCKETENTRIES		4
+#define SIGCACHE_MINBUCKETS		16
+#define SIGCACHE_MAXBUCKETS		65536
+
+/*
+ * RRsets up to this size are sorted on the stack.
+ */
+#define SIGCACHE_STACKRDATAS		16
+
+#define CHECK(x) \
+	do { \
+		result = (x); \
+		if (result != ISC_R_SUCCESS) \
+			goto cleanup; \
+	} while (0)
+
+static void
+free_entry(dns_sigcache_t *sc, dns_scbucket_t *bucket, dns_scentry_t *entry) {
+	ISC_LIST_UNLINK(bucket->entries, entry, link);
+	(void)atomic_fetch_sub_relaxed(&sc->count, 1);
+	isc_mem_put(sc->mctx, entry, ENTRY_SIZE(entry));
+}
+
+/*
+ * The digest is already uniformly distributed, so any part of it will
+ * do as the bucket index.
+ */
+static inline dns_scbucket_t *
+get_bucket(dns_sigcache_t *sc, const unsigned char *digest) {
+	uint32_t hashval;
+
+	memmove(&hashval, digest, sizeof(hashval));
+	return (&sc->buckets[hashval & (sc->nbuckets - 1)]);
+}
+
+isc_result_t
+dns_sigcache_create(isc_mem_t *mctx, unsigned int maxentries,
+		    dns_sigcache_t **scp)
+{
+	dns_sigcache_t *sc = NULL;
+	unsigned int i;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(maxentries > 0);
+	REQUIRE(scp != NULL && *scp == NULL);
+
+	sc = isc_mem_get(mctx, sizeof(*sc));
+	memset(sc, 0, sizeof(*sc));
+	isc_mem_attach(mctx, &sc->mctx);
+
+	sc->maxentries = maxentries;
+	atomic_init(&sc->count, 0);
+	atomic_init(&sc->sweep, 0);
+
+	sc->nbuckets = SIGCACHE_MINBUCKETS;
+	while (sc->nbuckets < SIGCACHE_MAXBUCKETS &&
+	       sc->nbuckets * SIGCACHE_BUCKETENTRIES < maxentries)
+	{
+		sc->nbuckets *= 2;
+	}
+
+	sc->buckets = isc_mem_get(mctx, sc->nbuckets * sizeof(sc->buckets[0]));
+	for (i = 0; i < sc->nbuckets; i++) {
+		isc_mutex_init(&sc->buckets[i].lock);
+		ISC_LIST_INIT(sc->buckets[i].entries);
+	}
+
+	sc->magic = SIGCACHE_MAGIC;
+	*scp = sc;
+
+	return (ISC_R_SUCCESS);
+}
+
+void
+dns_sigcache_destroy(dns_sigcache_t **scp) {
+	dns_sigcache_t *sc;
+	unsigned int i;
+
+	REQUIRE(scp != NULL && VALID_SIGCACHE(*scp));
+	sc = *scp;
+	*scp = NULL;
+
+	dns_sigcache_flush(sc);
+	INSIST(atomic_load_relaxed(&sc->count) == 0);
+
+	sc->magic = 0;
+	for (i = 0; i < sc->nbuckets; i++) {
+		isc_mutex_destroy(&sc->buckets[i].lock);
+	}
+	isc_mem_put(sc->mctx, sc->buckets,
+		    sc->nbuckets * sizeof(sc->buckets[0]));
+	isc_mem_putanddetach(&sc->mctx, sc, sizeof(*sc));
+}
+
+/*
+ * Make qsort happy.
+ */
+static int
+rdata_compare_wrapper(const void *rdata1, const void *rdata2) {
+	return (dns_rdata_compare((const dns_rdata_t *)rdata1,
+				  (const dns_rdata_t *)rdata2));
+}
+
+static inline isc_result_t
+digest_uint(isc_md_t *md, uint32_t value, unsigned int size) {
+	unsigned char data[4];
+	isc_buffer_t b;
+
+	isc_buffer_init(&b, data, sizeof(data));
+	if (size == 2) {
+		isc_buffer_putuint16(&b, (uint16_t)value);
+	} else {
+		isc_buffer_putuint32(&b, value);
+	}
+	return (isc_md_update(md, data, isc_buffer_usedlength(&b)));
+}
+
+isc_result_t
+dns_sigcache_digest(const dns_name_t *name, dns_rdataset_t *rdataset,
+		    dns_rdata_t *sigrdata, dst_key_t *key,
+		    unsigned int maxbits, isc_mem_t *mctx,
+		    unsigned char *digest)
+{
+	dns_rdata_t stackrdatas[SIGCACHE_STACKRDATAS];
+	dns_rdata_t *rdatas = stackrdatas;
+	unsigned char keydata[DST_KEY_MAXSIZE];
+	dns_fixedname_t fixed;
+	dns_rdataset_t clone;
+	dns_name_t *owner;
+	isc_buffer_t keybuf;
+	isc_region_t r;
+	isc_md_t *md;
+	isc_result_t result;
+	unsigned int i, n, nalloc, digestlen;
+
+	REQUIRE(name != NULL && dns_name_isabsolute(name));
+	REQUIRE(DNS_RDATASET_VALID(rdataset));
+	REQUIRE(sigrdata != NULL && sigrdata->type == dns_rdatatype_rrsig);
+	REQUIRE(key != NULL);
+	REQUIRE(digest != NULL);
+
+	isc_buffer_init(&keybuf, keydata, sizeof(keydata));
+	result = dst_key_todns(key, &keybuf);
+	if (result != ISC_R_SUCCESS) {
+		return (result);
+	}
+
+	n = dns_rdataset_count(rdataset);
+	if (n == 0) {
+		return (ISC_R_NOMORE);
+	}
+	nalloc = n;
+	if (n > SIGCACHE_STACKRDATAS) {
+		rdatas = isc_mem_get(mctx, nalloc * sizeof(rdatas[0]));
+	}
+
+	i = 0;
+	dns_rdataset_init(&clone);
+	dns_rdataset_clone(rdataset, &clone);
+	for (result = dns_rdataset_first(&clone);
+	     result == ISC_R_SUCCESS && i < n;
+	     result = dns_rdataset_next(&clone))
+	{
+		dns_rdata_init(&rdatas[i]);
+		dns_rdataset_current(&clone, &rdatas[i++]);
+	}
+	dns_rdataset_disassociate(&clone);
+	n = i;
+	qsort(rdatas, n, sizeof(rdatas[0]), rdata_compare_wrapper);
+
+	md = isc_md_new();
+	if (md == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_array;
+	}
+	result = isc_md_init(md, ISC_MD_SHA256);
+	if (result != ISC_R_SUCCESS) {
+		goto cleanup;
+	}
+
+	/*
+	 * The verification parameters.
+	 */
+	CHECK(digest_uint(md, maxbits, 4));
+	isc_buffer_usedregion(&keybuf, &r);
+	CHECK(digest_uint(md, r.length, 2));
+	CHECK(isc_md_update(md, r.base, r.length));
+	dns_rdata_toregion(sigrdata, &r);
+	CHECK(digest_uint(md, r.length, 2));
+	CHECK(isc_md_update(md, r.base, r.length));
+
+	/*
+	 * The RRset, with the owner name in canonical form.
+	 */
+	owner = dns_fixedname_initname(&fixed);
+	RUNTIME_CHECK(dns_name_downcase(name, owner, NULL) == ISC_R_SUCCESS);
+	dns_name_toregion(owner, &r);
+	CHECK(isc_md_update(md, r.base, r.length));
+	CHECK(digest_uint(md, rdataset->type, 2));
+	CHECK(digest_uint(md, rdataset->rdclass, 2));
+	for (i = 0; i < n; i++) {
+		if (i > 0 && dns_rdata_compare(&rdatas[i], &rdatas[i - 1]) == 0)
+		{
+			continue;
+		}
+		dns_rdata_toregion(&rdatas[i], &r);
+		CHECK(digest_uint(md, r.length, 2));
+		CHECK(isc_md_update(md, r.base, r.length));
+	}
+
+	digestlen = DNS_SIGCACHE_DIGESTLENGTH;
+	result = isc_md_final(md, digest, &digestlen);
+	INSIST(result != ISC_R_SUCCESS ||
+	       digestlen == DNS_SIGCACHE_DIGESTLENGTH);
+
+ cleanup:
+	isc_md_free(md);
+ cleanup_array:
+	if (rdatas != stackrdatas) {
+		isc_mem_put(mctx, rdatas, nalloc * sizeof(rdatas[0]));
+	}
+	return (result);
+}
+
+static inline dns_scentry_t *
+find_entry(dns_scbucket_t *bucket, const unsigned char *digest) {
+	dns_scentry_t *entry;
+
+	for (entry = ISC_LIST_HEAD(bucket->entries);
+	     entry != NULL;
+	     entry = ISC_LIST_NEXT(entry, link))
+	{
+		if (memcmp(entry->digest, digest,
+			   DNS_SIGCACHE_DIGESTLENGTH) == 0)
+		{
+			break;
+		}
+	}
+
+	return (entry);
+}
+
+isc_result_t
+dns_sigcache_find(dns_sigcache_t *sc, const unsigned char *digest,
+		  isc_stdtime_t now, isc_result_t *resultp, dns_name_t *wild)
+{
+	dns_scbucket_t *bucket;
+	dns_scentry_t *entry;
+	isc_result_t result;
+
+	REQUIRE(VALID_SIGCACHE(sc));
+	REQUIRE(digest != NULL);
+	REQUIRE(resultp != NULL);
+
+	if (atomic_load_relaxed(&sc->count) == 0) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	bucket = get_bucket(sc, digest);
+
+	LOCK(&bucket->lock);
+	entry = find_entry(bucket, digest);
+	if (entry == NULL) {
+		result = ISC_R_NOTFOUND;
+	} else if (isc_serial_lt(now, entry->inception) ||
+		   isc_serial_lt(entry->expire, now))
+	{
+		free_entry(sc, bucket, entry);
+		result = ISC_R_NOTFOUND;
+	} else {
+		*resultp = entry->result;
+		if (entry->result == DNS_R_FROMWILDCARD && wild != NULL) {
+			dns_name_t name;
+			isc_region_t r;
+
+			dns_name_init(&name, NULL);
+			r.base = ENTRY_DATA(entry);
+			r.length = entry->length;
+			dns_name_fromregion(&name, &r);
+			dns_name_copynf(&name, wild);
+		}
+		if (entry != ISC_LIST_HEAD(bucket->entries)) {
+			ISC_LIST_UNLINK(bucket->entries, entry, link);
+			ISC_LIST_PREPEND(bucket->entries, entry, link);
+		}
+		result = ISC_R_SUCCESS;
+	}
+	UNLOCK(&bucket->lock);
+
+	return (result);
+}
+
+void
+dns_sigcache_add(dns_sigcache_t *sc, const unsigned char *digest,
+		 isc_stdtime_t inception, isc_stdtime_t expire,
+		 isc_result_t result, const dns_name_t *wild)
+{
+	dns_scbucket_t *bucket;
+	dns_scentry_t *entry, *old;
+	isc_region_t r;
+	unsigned int tries;
+
+	REQUIRE(VALID_SIGCACHE(sc));
+	REQUIRE(digest != NULL);
+	REQUIRE(result != DNS_R_FROMWILDCARD ||
+		(wild != NULL && dns_name_isabsolute(wild)));
+
+	if (result == DNS_R_FROMWILDCARD) {
+		dns_name_toregion(wild, &r);
+	} else {
+		r.base = NULL;
+		r.length = 0;
+	}
+
+	entry = isc_mem_get(sc->mctx, sizeof(*entry) + r.length);
+	ISC_LINK_INIT(entry, link);
+	memmove(entry->digest, digest, DNS_SIGCACHE_DIGESTLENGTH);
+	entry->inception = inception;
+	entry->expire = expire;
+	entry->result = result;
+	entry->length = r.length;
+	if (r.length != 0) {
+		memmove(ENTRY_DATA(entry), r.base, r.length);
+	}
+
+	bucket = get_bucket(sc, digest);
+
+	LOCK(&bucket->lock);
+	old = find_entry(bucket, digest);
+	if (old != NULL) {
+		free_entry(sc, bucket, old);
+	}
+	ISC_LIST_PREPEND(bucket->entries, entry, link);
+	(void)atomic_fetch_add_relaxed(&sc->count, 1);
+
+	/*
+	 * Make room in this bucket first, it is already locked.
+	 */
+	while (atomic_load_relaxed(&sc->count) > sc->maxentries) {
+		old = ISC_LIST_TAIL(bucket->entries);
+		if (old == entry) {
+			break;
+		}
+		free_entry(sc, bucket, old);
+	}
+	UNLOCK(&bucket->lock);
+
+	/*
+	 * Then take the least recently used entries from the other
+	 * buckets in turn.
+	 */
+	for (tries = 0;
+	     tries < sc->nbuckets &&
+	     atomic_load_relaxed(&sc->count) > sc->maxentries;
+	     tries++)
+	{
+		uint32_t i = atomic_fetch_add_relaxed(&sc->sweep, 1);
+
+		bucket = &sc->buckets[i & (sc->nbuckets - 1)];
+		LOCK(&bucket->lock);
+		old = ISC_LIST_TAIL(bucket->entries);
+		if (old != NULL && old != entry) {
+			free_entry(sc, bucket, old);
+		}
+		UNLOCK(&bucket->lock);
+	}
+}
+
+void
+dns_sigcache_flush(dns_sigcache_t *sc) {
+	dns_scentry_t *entry;
+	unsigned int i;
+
+	REQUIRE(VALID_SIGCACHE(sc));
+
+	for (i = 0; i < sc->nbuckets; i++) {
+		dns_scbucket_t *bucket = &sc->buckets[i];
+
+		LOCK(&bucket->lock);
+		while ((entry = ISC_LIST_HEAD(bucket->entries)) != NULL) {
+			free_entry(sc, bucket, entry);
+		}
+		UNLOCK(&bucket->lock);
+	}
+}
+
+unsigned int
+dns_sigcache_count(dns_sigcache_t *sc) {
+	REQUIRE(VALID_SIGCACHE(sc));
+
+	return ((unsigned int)atomic_load_relaxed(&sc->count));
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/buffer.h>
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/util.h>
+
+#include <dns/anscache.h>
+#include <dns/compress.h>
+#include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/rdatalist.h>
+#include <dns/rdataset.h>
+
+#include "dnstest.h"
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_test_end();
+
+	return (0);
+}
+
+static void
+setregion(isc_region_t *r, const char *s) {
+	DE_CONST(s, r->base);
+	r->length = strlen(s);
+}
+
+/* stored responses are found under their key and generation only */
+static void
+addfind_test(void **state) {
+	dns_anscache_t *ac = NULL;
+	isc_region_t key, key2, response;
+	unsigned char data[512];
+	isc_buffer_t b;
+	isc_result_t result;
+	unsigned int flags = 0;
+	uint64_t entries, size;
+
+	UNUSED(state);
+
+	result = dns_anscache_create(dt_mctx, 65536, &ac);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	setregion(&key, "key one");
+	setregion(&key2, "key two");
+	setregion(&response, "response one");
+
+	isc_buffer_init(&b, data, sizeof(data));
+	result = dns_anscache_find(ac, &key, 1, &b, &flags);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	dns_anscache_add(ac, &key, 1, &response, 42);
+
+	result = dns_anscache_find(ac, &key, 1, &b, &flags);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(flags, 42);
+	assert_int_equal(isc_buffer_usedlength(&b), response.length);
+	assert_memory_equal(data, response.base, response.length);
+
+	isc_buffer_clear(&b);
+	result = dns_anscache_find(ac, &key2, 1, &b, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	/* A response that doesn't fit isn't copied. */
+	isc_buffer_init(&b, data, response.length - 1);
+	result = dns_anscache_find(ac, &key, 1, &b, NULL);
+	assert_int_equal(result, ISC_R_NOSPACE);
+	assert_int_equal(isc_buffer_usedlength(&b), 0);
+
+	/* Replacing an entry doesn't duplicate it. */
+	setregion(&response, "response one, again");
+	dns_anscache_add(ac, &key, 1, &response, 43);
+	dns_anscache_getstats(ac, &entries, NULL);
+	assert_int_equal(entries, 1);
+
+	isc_buffer_init(&b, data, sizeof(data));
+	result = dns_anscache_find(ac, &key, 1, &b, &flags);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(flags, 43);
+	assert_int_equal(isc_buffer_usedlength(&b), response.length);
+
+	/* A new generation invalidates the entry and removes it. */
+	isc_buffer_clear(&b);
+	result = dns_anscache_find(ac, &key, 2, &b, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+	result = dns_anscache_find(ac, &key, 1, &b, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+	dns_anscache_getstats(ac, &entries, &size);
+	assert_int_equal(entries, 0);
+	assert_int_equal(size, 0);
+
+	dns_anscache_add(ac, &key, 2, &response, 0);
+	dns_anscache_add(ac, &key2, 2, &response, 0);
+	dns_anscache_flush(ac);
+	dns_anscache_getstats(ac, &entries, &size);
+	assert_int_equal(entries, 0);
+	assert_int_equal(size, 0);
+
+	dns_anscache_destroy(&ac);
+	assert_null(ac);
+}
+
+/* the cache stays within its size limit */
+static void
+limit_test(void **state) {
+	dns_anscache_t *ac = NULL;
+	isc_region_t key, response;
+	unsigned char keydata[32];
+	unsigned char data[256];
+	isc_buffer_t b;
+	isc_result_t result;
+	unsigned int i, found = 0;
+	uint64_t entries, size;
+
+	UNUSED(state);
+
+	result = dns_anscache_create(dt_mctx, 16384, &ac);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	memset(data, 0xa5, sizeof(data));
+	response.base = data;
+	response.length = sizeof(data);
+	key.base = keydata;
+
+	for (i = 0; i < 1000; i++) {
+		key.length = snprintf((char *)keydata, sizeof(keydata),
+				      "key%u", i);
+		dns_anscache_add(ac, &key, 1, &response, 0);
+		dns_anscache_getstats(ac, &entries, &size);
+		assert_true(size <= 16384);
+	}
+	assert_true(entries > 0);
+
+	/* The most recent entries are still there. */
+	for (i = 990; i < 1000; i++) {
+		key.length = snprintf((char *)keydata, sizeof(keydata),
+				      "key%u", i);
+		isc_buffer_init(&b, data, sizeof(data));
+		result = dns_anscache_find(ac, &key, 1, &b, NULL);
+		if (result == ISC_R_SUCCESS) {
+			found++;
+		}
+	}
+	assert_true(found > 0);
+
+	/* Responses too large for the cache aren't stored. */
+	setregion(&key, "large");
+	response.length = 16384 / 8;
+	{
+		unsigned char *large = isc_mem_get(dt_mctx, response.length);
+		memset(large, 0, response.length);
+		response.base = large;
+		dns_anscache_add(ac, &key, 1, &response, 0);
+		isc_mem_put(dt_mctx, large, response.length);
+	}
+	isc_buffer_init(&b, data, sizeof(data));
+	result = dns_anscache_find(ac, &key, 1, &b, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	dns_anscache_destroy(&ac);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+#define NNAMES 1000
+
+static uint64_t
+nanotime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void
+addrecord(dns_db_t *db, dns_dbversion_t *version, const char *namestr,
+	  dns_rdatatype_t type, const char *text)
+{
+	isc_result_t result;
+	dns_fixedname_t fname;
+	dns_dbnode_t *node = NULL;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	unsigned char data[512];
+
+	dns_test_namefromstring(namestr, &fname);
+	result = dns_test_rdatafromstring(&rdata, dns_rdataclass_in, type,
+					  data, sizeof(data), text, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.ttl = 300;
+	rdatalist.type = type;
+	rdatalist.rdclass = dns_rdataclass_in;
+	ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+
+	dns_rdataset_init(&rdataset);
+	result = dns_rdatalist_tordataset(&rdatalist, &rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_findnode(db, dns_fixedname_name(&fname), true, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_addrdataset(db, node, version, 0, &rdataset,
+				    DNS_DBADD_MERGE, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_rdataset_disassociate(&rdataset);
+	dns_db_detachnode(db, &node);
+}
+
+/*
+ * Add the 'type' RRset at 'name' in 'db' to 'section' of 'msg'.
+ */
+static void
+addsection(dns_message_t *msg, dns_db_t *db, dns_dbversion_t *version,
+	   const dns_name_t *name, dns_rdatatype_t type, dns_section_t section)
+{
+	isc_result_t result;
+	dns_dbnode_t *node = NULL;
+	dns_name_t *mname = NULL;
+	dns_rdataset_t *rdataset = NULL;
+	isc_buffer_t *b = NULL;
+
+	result = dns_db_findnode(db, name, false, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dns_message_gettemprdataset(msg, &rdataset),
+			 ISC_R_SUCCESS);
+	result = dns_db_findrdataset(db, node, version, type, 0, 0,
+				     rdataset, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_detachnode(db, &node);
+
+	assert_int_equal(dns_message_gettempname(msg, &mname), ISC_R_SUCCESS);
+	isc_buffer_allocate(dt_mctx, &b, DNS_NAME_MAXWIRE);
+	dns_name_init(mname, NULL);
+	assert_int_equal(dns_name_copy(name, mname, b), ISC_R_SUCCESS);
+	dns_message_takebuffer(msg, &b);
+	ISC_LIST_APPEND(mname->list, rdataset, link);
+	dns_message_addname(msg, mname, section);
+}
+
+/*
+ * Look up and render a referral-sized response to 'qname'/A from 'db',
+ * the way the server does on an answer cache miss.
+ */
+static void
+render(dns_message_t *msg, dns_db_t *db, dns_dbversion_t *version,
+       const dns_name_t *qname, const dns_name_t *origin,
+       const dns_name_t *ns1, const dns_name_t *ns2, isc_buffer_t *target)
+{
+	isc_result_t result;
+	dns_compress_t cctx;
+	dns_name_t *question = NULL;
+	dns_rdataset_t *qrdataset = NULL;
+	isc_buffer_t *b = NULL;
+
+	dns_message_reset(msg, DNS_MESSAGE_INTENTRENDER);
+	msg->id = 1;
+	msg->flags = DNS_MESSAGEFLAG_QR | DNS_MESSAGEFLAG_AA;
+
+	assert_int_equal(dns_message_gettempname(msg, &question),
+			 ISC_R_SUCCESS);
+	isc_buffer_allocate(dt_mctx, &b, DNS_NAME_MAXWIRE);
+	dns_name_init(question, NULL);
+	assert_int_equal(dns_name_copy(qname, question, b), ISC_R_SUCCESS);
+	dns_message_takebuffer(msg, &b);
+	assert_int_equal(dns_message_gettemprdataset(msg, &qrdataset),
+			 ISC_R_SUCCESS);
+	dns_rdataset_makequestion(qrdataset, dns_rdataclass_in,
+				  dns_rdatatype_a);
+	ISC_LIST_APPEND(question->list, qrdataset, link);
+	dns_message_addname(msg, question, DNS_SECTION_QUESTION);
+
+	addsection(msg, db, version, qname, dns_rdatatype_a,
+		   DNS_SECTION_ANSWER);
+	addsection(msg, db, version, origin, dns_rdatatype_ns,
+		   DNS_SECTION_AUTHORITY);
+	addsection(msg, db, version, ns1, dns_rdatatype_a,
+		   DNS_SECTION_ADDITIONAL);
+	addsection(msg, db, version, ns2, dns_rdatatype_a,
+		   DNS_SECTION_ADDITIONAL);
+
+	isc_buffer_clear(target);
+	result = dns_compress_init(&cctx, -1, dt_mctx);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_compress_setsensitive(&cctx, true);
+	result = dns_message_renderbegin(msg, &cctx, target);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_message_rendersection(msg, DNS_SECTION_QUESTION, 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_message_rendersection(msg, DNS_SECTION_ANSWER,
+					   DNS_MESSAGERENDER_PARTIAL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_message_rendersection(msg, DNS_SECTION_AUTHORITY,
+					   DNS_MESSAGERENDER_PARTIAL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_message_rendersection(msg, DNS_SECTION_ADDITIONAL, 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_message_renderend(msg);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_compress_invalidate(&cctx);
+}
+
+/*
+ * Compare building responses from the zone database with serving them
+ * from the answer cache, for a skewed query mix over NNAMES names and
+ * a cache that only holds some of the responses.
+ */
+static void
+benchmark(void **state) {
+	isc_result_t result;
+	dns_fixedname_t *fnames, forigin, fns1, fns2;
+	dns_name_t *origin, *ns1, *ns2;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	dns_message_t *msg = NULL;
+	dns_anscache_t *ac = NULL;
+	unsigned char data[4096];
+	isc_buffer_t b;
+	char namestr[sizeof("www4294967295.example.")];
+	unsigned int i, n, hits = 0, misses = 0;
+	unsigned int count = 200000;
+	uint64_t t0, trender, tcache;
+	size_t size;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	dns_test_namefromstring("example.", &forigin);
+	origin = dns_fixedname_name(&forigin);
+	dns_test_namefromstring("ns1.example.", &fns1);
+	ns1 = dns_fixedname_name(&fns1);
+	dns_test_namefromstring("ns2.example.", &fns2);
+	ns2 = dns_fixedname_name(&fns2);
+
+	result = dns_db_create(dt_mctx, "rbt", origin, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_newversion(db, &version);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	addrecord(db, version, "example.", dns_rdatatype_soa,
+		  "ns1.example. hostmaster.example. 1 3600 600 86400 300");
+	addrecord(db, version, "example.", dns_rdatatype_ns, "ns1.example.");
+	addrecord(db, version, "example.", dns_rdatatype_ns, "ns2.example.");
+	addrecord(db, version, "ns1.example.", dns_rdatatype_a, "192.0.2.1");
+	addrecord(db, version, "ns2.example.", dns_rdatatype_a, "192.0.2.2");
+
+	fnames = malloc(NNAMES * sizeof(*fnames));
+	assert_non_null(fnames);
+	for (i = 0; i < NNAMES; i++) {
+		snprintf(namestr, sizeof(namestr), "www%u.example.", i);
+		dns_test_namefromstring(namestr, &fnames[i]);
+		addrecord(db, version, namestr, dns_rdatatype_a, "192.0.2.80");
+	}
+	dns_db_closeversion(db, &version, true);
+	dns_db_currentversion(db, &version);
+
+	result = dns_message_create(dt_mctx, DNS_MESSAGE_INTENTRENDER, &msg);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	srandom(1);
+
+	t0 = nanotime();
+	for (i = 0; i < count; i++) {
+		n = (random() % NNAMES) * (random() % NNAMES) / NNAMES;
+		isc_buffer_init(&b, data, sizeof(data));
+		render(msg, db, version, dns_fixedname_name(&fnames[n]),
+		       origin, ns1, ns2, &b);
+	}
+	trender = nanotime() - t0;
+	printf("%u queries over %u names: rendering %.0f ns/query\n",
+	       count, NNAMES, (double)trender / count);
+
+	/*
+	 * With room for about a quarter of the responses, then for all
+	 * of them.
+	 */
+	for (size = NNAMES / 4 * 200; size <= NNAMES * 200; size *= 4) {
+		result = dns_anscache_create(dt_mctx, size, &ac);
+		assert_int_equal(result, ISC_R_SUCCESS);
+
+		srandom(1);
+		hits = misses = 0;
+
+		t0 = nanotime();
+		for (i = 0; i < count; i++) {
+			dns_name_t *qname;
+			isc_region_t key, r;
+
+			n = (random() % NNAMES) * (random() % NNAMES) / NNAMES;
+			qname = dns_fixedname_name(&fnames[n]);
+			key.base = qname->ndata;
+			key.length = qname->length;
+			isc_buffer_init(&b, data, sizeof(data));
+			result = dns_anscache_find(ac, &key, 1, &b, NULL);
+			if (result == ISC_R_SUCCESS) {
+				data[0] = (i >> 8) & 0xff;
+				data[1] = i & 0xff;
+				memmove(data + 12, qname->ndata,
+					qname->length);
+				hits++;
+				continue;
+			}
+			render(msg, db, version, qname, origin, ns1, ns2, &b);
+			isc_buffer_usedregion(&b, &r);
+			dns_anscache_add(ac, &key, 1, &r, 0);
+			misses++;
+		}
+		tcache = nanotime() - t0;
+
+		printf("%zu byte answer cache: %.0f ns/query, "
+		       "hit ratio %.1f%%\n", size, (double)tcache / count,
+		       100.0 * hits / (hits + misses));
+
+		dns_anscache_destroy(&ac);
+	}
+
+	dns_message_destroy(&msg);
+	dns_db_closeversion(db, &version, false);
+	dns_db_detach(&db);
+	free(fnames);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(addfind_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(limit_test,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
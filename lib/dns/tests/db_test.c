@@ -15,16 +15,24 @@
 #include <stddef.h>
 #include <setjmp.h>
 
+#include <inttypes.h>
+#include <limits.h>
 #include <sched.h> /* IWYU pragma: keep */
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define UNIT_TESTING
 #include <cmocka.h>
 
+#include <isc/print.h>
+#include <isc/thread.h>
+
 #include <dns/db.h>
 #include <dns/dbiterator.h>
 #include <dns/journal.h>
+#include <dns/masterdump.h>
 #include <dns/name.h>
 #include <dns/rdatalist.h>
 
@@ -397,6 +405,550 @@ version_test(void **state) {
 	dns_db_detach(&db);
 }
 
+/*
+ * Add a single-record rdataset of type 'type' with text 'text' at
+ * 'namestr' in 'version'.
+ */
+static void
+addrecord(dns_db_t *db, dns_dbversion_t *version, const char *namestr,
+	  dns_rdatatype_t type, const char *text)
+{
+	isc_result_t result;
+	dns_fixedname_t fname;
+	dns_dbnode_t *node = NULL;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	unsigned char data[BUFLEN];
+
+	dns_test_namefromstring(namestr, &fname);
+	result = dns_test_rdatafromstring(&rdata, dns_rdataclass_in, type,
+					  data, sizeof(data), text, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.ttl = 300;
+	rdatalist.type = type;
+	rdatalist.rdclass = dns_rdataclass_in;
+	ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+
+	dns_rdataset_init(&rdataset);
+	result = dns_rdatalist_tordataset(&rdatalist, &rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_findnode(db, dns_fixedname_name(&fname), true, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_addrdataset(db, node, version, 0, &rdataset, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_rdataset_disassociate(&rdataset);
+	dns_db_detachnode(db, &node);
+}
+
+/* delegations are still found after their NS RRset is replaced */
+static void
+delegation_test(void **state) {
+	isc_result_t result;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	dns_fixedname_t fname, ffound;
+	dns_rdataset_t rdataset;
+	const char *ns[] = { "ns1.example.", "ns2.example." };
+	unsigned int i;
+
+	UNUSED(state);
+
+	result = dns_db_create(dt_mctx, "rbt", dns_rootname, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_test_namefromstring("www.sub.test.", &fname);
+	dns_fixedname_init(&ffound);
+
+	for (i = 0; i < sizeof(ns) / sizeof(ns[0]); i++) {
+		result = dns_db_newversion(db, &version);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		addrecord(db, version, "sub.test.", dns_rdatatype_ns, ns[i]);
+		dns_db_closeversion(db, &version, true);
+
+		dns_rdataset_init(&rdataset);
+		result = dns_db_find(db, dns_fixedname_name(&fname), NULL,
+				     dns_rdatatype_a, 0, 0, NULL,
+				     dns_fixedname_name(&ffound),
+				     &rdataset, NULL);
+		assert_int_equal(result, DNS_R_DELEGATION);
+		assert_int_equal(rdataset.type, dns_rdatatype_ns);
+		dns_rdataset_disassociate(&rdataset);
+	}
+
+	dns_db_detach(&db);
+}
+
+/* covering NSEC records are found in the cache */
+static void
+coveringnsec_test(void **state) {
+	isc_result_t result;
+	dns_db_t *db = NULL;
+	dns_dbnode_t *node = NULL;
+	dns_fixedname_t fname, ffound;
+	dns_rdataset_t rdataset;
+	struct {
+		const char *name;
+		const char *owner;
+	} tests[] = {
+		{ "b.example.", "a.example." },
+		{ "x.a.example.", "a.example." },
+		{ "m.example.", "l.example." },
+		{ "pb.example.", "p.example." },
+		{ "r.example.", NULL },
+		{ "ua.example.", "u.example." },
+		{ "vz.example.", NULL },
+		{ "0.example.", NULL },
+		{ "com.", NULL },
+		{ NULL, NULL }
+	};
+	unsigned int i;
+
+	UNUSED(state);
+
+	result = dns_db_create(dt_mctx, "rbt", dns_rootname, dns_dbtype_cache,
+			       dns_rdataclass_in, 0, NULL, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	addrecord(db, NULL, "a.example.", dns_rdatatype_nsec,
+		  "c.example. A NSEC RRSIG");
+	addrecord(db, NULL, "l.example.", dns_rdatatype_nsec,
+		  "n.example. A NSEC RRSIG");
+	addrecord(db, NULL, "c.example.", dns_rdatatype_a, "192.0.2.1");
+	addrecord(db, NULL, "z.example.", dns_rdatatype_a, "192.0.2.2");
+
+	/*
+	 * An empty node between the NSEC owner and the name is passed
+	 * over; a node with live data stops the search.
+	 */
+	addrecord(db, NULL, "p.example.", dns_rdatatype_nsec,
+		  "t.example. A NSEC RRSIG");
+	dns_test_namefromstring("pa.example.", &fname);
+	result = dns_db_findnode(db, dns_fixedname_name(&fname), true, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_detachnode(db, &node);
+	addrecord(db, NULL, "q.example.", dns_rdatatype_a, "192.0.2.3");
+
+	/* The same holds when the data was cached before the NSEC. */
+	addrecord(db, NULL, "v.example.", dns_rdatatype_a, "192.0.2.4");
+	addrecord(db, NULL, "u.example.", dns_rdatatype_nsec,
+		  "w.example. A NSEC RRSIG");
+
+	for (i = 0; tests[i].name != NULL; i++) {
+		dns_fixedname_t fowner;
+
+		dns_test_namefromstring(tests[i].name, &fname);
+		dns_fixedname_init(&ffound);
+		dns_rdataset_init(&rdataset);
+		result = dns_db_find(db, dns_fixedname_name(&fname), NULL,
+				     dns_rdatatype_a, DNS_DBFIND_COVERINGNSEC,
+				     0, &node, dns_fixedname_name(&ffound),
+				     &rdataset, NULL);
+		if (tests[i].owner == NULL) {
+			assert_int_not_equal(result, DNS_R_COVERINGNSEC);
+		} else {
+			assert_int_equal(result, DNS_R_COVERINGNSEC);
+			assert_int_equal(rdataset.type, dns_rdatatype_nsec);
+			dns_test_namefromstring(tests[i].owner, &fowner);
+			assert_true(dns_name_equal(dns_fixedname_name(&ffound),
+					dns_fixedname_name(&fowner)));
+		}
+		if (dns_rdataset_isassociated(&rdataset)) {
+			dns_rdataset_disassociate(&rdataset);
+		}
+		if (node != NULL) {
+			dns_db_detachnode(db, &node);
+		}
+	}
+
+	dns_db_detach(&db);
+}
+
+/*
+ * Check a zone loaded from a map file against what was written out.
+ */
+static void
+checkmap(dns_db_t *db, uint64_t records, uint64_t bytes) {
+	isc_result_t result;
+	dns_fixedname_t fname, ffound;
+	dns_rdataset_t rdataset;
+	dns_dbversion_t *version = NULL;
+	uint64_t maprecords, mapbytes;
+
+	dns_fixedname_init(&ffound);
+	dns_test_namefromstring("host99.test.", &fname);
+	dns_rdataset_init(&rdataset);
+	result = dns_db_find(db, dns_fixedname_name(&fname), NULL,
+			     dns_rdatatype_a, 0, 0, NULL,
+			     dns_fixedname_name(&ffound), &rdataset, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_rdataset_disassociate(&rdataset);
+
+	dns_test_namefromstring("www.sub.test.", &fname);
+	result = dns_db_find(db, dns_fixedname_name(&fname), NULL,
+			     dns_rdatatype_a, 0, 0, NULL,
+			     dns_fixedname_name(&ffound), &rdataset, NULL);
+	assert_int_equal(result, DNS_R_DELEGATION);
+	dns_rdataset_disassociate(&rdataset);
+
+	result = dns_db_getsigningtime(db, &rdataset,
+				       dns_fixedname_name(&ffound));
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(rdataset.resign, 2000000000);
+	dns_test_namefromstring("host7.test.", &fname);
+	assert_true(dns_name_equal(dns_fixedname_name(&ffound),
+				   dns_fixedname_name(&fname)));
+	dns_rdataset_disassociate(&rdataset);
+
+	dns_db_currentversion(db, &version);
+	result = dns_db_getsize(db, version, &maprecords, &mapbytes);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(maprecords, records);
+	assert_int_equal(mapbytes, bytes);
+	dns_db_closeversion(db, &version, false);
+
+	/* The loaded zone can still be changed. */
+	result = dns_db_newversion(db, &version);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	addrecord(db, version, "host99.test.", dns_rdatatype_aaaa,
+		  "2001:db8::1");
+	addrecord(db, version, "new.test.", dns_rdatatype_a, "192.0.2.1");
+	dns_db_closeversion(db, &version, true);
+
+	dns_test_namefromstring("new.test.", &fname);
+	result = dns_db_find(db, dns_fixedname_name(&fname), NULL,
+			     dns_rdatatype_a, 0, 0, NULL,
+			     dns_fixedname_name(&ffound), &rdataset, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_rdataset_disassociate(&rdataset);
+}
+
+/*
+ * a zone written out in map format loads back both at the address the
+ * file was written for and, while that is taken, somewhere else
+ */
+static void
+map_test(void **state) {
+	isc_result_t result;
+	dns_db_t *db = NULL, *db1 = NULL, *db2 = NULL;
+	dns_dbversion_t *version = NULL;
+	dns_fixedname_t fname;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	dns_dbnode_t *node = NULL;
+	unsigned char data[BUFLEN];
+	char namestr[sizeof("host4294967295.test.")];
+	uint64_t records, bytes;
+	unsigned int i;
+
+	UNUSED(state);
+
+	dns_test_namefromstring("test.", &fname);
+	result = dns_db_create(dt_mctx, "rbt", dns_fixedname_name(&fname),
+			       dns_dbtype_zone, dns_rdataclass_in, 0, NULL,
+			       &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_newversion(db, &version);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	addrecord(db, version, "test.", dns_rdatatype_soa,
+		  "ns.test. hostmaster.test. 1 3600 1200 604800 3600");
+	addrecord(db, version, "test.", dns_rdatatype_ns, "ns.test.");
+	addrecord(db, version, "sub.test.", dns_rdatatype_ns, "ns.sub.test.");
+	for (i = 0; i < 1000; i++) {
+		snprintf(namestr, sizeof(namestr), "host%u.test.", i);
+		addrecord(db, version, namestr, dns_rdatatype_a, "192.0.2.1");
+	}
+
+	/* A signature due to be renewed at the earliest. */
+	dns_test_namefromstring("host7.test.", &fname);
+	result = dns_test_rdatafromstring(&rdata, dns_rdataclass_in,
+					  dns_rdatatype_rrsig, data,
+					  sizeof(data),
+					  "A 8 2 300 20330518033320 "
+					  "20010101000000 1 test. AAAA",
+					  false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.ttl = 300;
+	rdatalist.type = dns_rdatatype_rrsig;
+	rdatalist.covers = dns_rdatatype_a;
+	rdatalist.rdclass = dns_rdataclass_in;
+	ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+	dns_rdataset_init(&rdataset);
+	result = dns_rdatalist_tordataset(&rdatalist, &rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	rdataset.attributes |= DNS_RDATASETATTR_RESIGN;
+	rdataset.resign = 2000000000;
+	result = dns_db_findnode(db, dns_fixedname_name(&fname), true, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_addrdataset(db, node, version, 0, &rdataset, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_rdataset_disassociate(&rdataset);
+	dns_db_detachnode(db, &node);
+
+	dns_db_closeversion(db, &version, true);
+
+	dns_db_currentversion(db, &version);
+	result = dns_db_getsize(db, version, &records, &bytes);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_closeversion(db, &version, false);
+
+	result = dns_master_dump(dt_mctx, db, NULL, &dns_master_style_default,
+				 "map.db", dns_masterformat_map, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_create(dt_mctx, "rbt", dns_db_origin(db),
+			       dns_dbtype_zone, dns_rdataclass_in, 0, NULL,
+			       &db1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_load(db1, "map.db", dns_masterformat_map, 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_create(dt_mctx, "rbt", dns_db_origin(db),
+			       dns_dbtype_zone, dns_rdataclass_in, 0, NULL,
+			       &db2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_load(db2, "map.db", dns_masterformat_map, 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	checkmap(db1, records, bytes);
+	checkmap(db2, records, bytes);
+
+	dns_db_detach(&db2);
+	dns_db_detach(&db1);
+	dns_db_detach(&db);
+	unlink("map.db");
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+#define BENCH_NAMES	100000
+#define BENCH_READERS	4
+#define BENCH_SAMPLES	(1024 * 1024)
+
+/*
+ * Update rates to measure lookups at: none, 10000 a second, and as many
+ * as the writer can manage.
+ */
+static const unsigned int bench_rates[] = { 0, 10000, UINT_MAX };
+
+typedef struct {
+	dns_db_t *db;
+	uint64_t *samples;
+	size_t count;
+	isc_result_t result;
+} bench_reader_t;
+
+static volatile bool bench_done;
+
+static uint64_t
+nanotime(void) {
+	struct timespec ts;
+
+	RUNTIME_CHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Look up random names until told to stop.  cmocka's assertions only
+ * work in the main thread, so an unexpected result is left in
+ * reader->result for it to check.
+ */
+static isc_threadresult_t
+#ifdef WIN32
+WINAPI
+#endif
+bench_read(isc_threadarg_t arg) {
+	bench_reader_t *reader = arg;
+	char namestr[sizeof("host4294967295.test.")];
+	dns_fixedname_t fname, ffound;
+	dns_rdataset_t rdataset;
+	dns_dbnode_t *node = NULL;
+	isc_result_t result;
+	uint64_t t0;
+
+	dns_fixedname_init(&ffound);
+
+	while (!bench_done && reader->count < BENCH_SAMPLES) {
+		snprintf(namestr, sizeof(namestr), "host%u.test.",
+			 (unsigned int)(random() % BENCH_NAMES));
+		dns_test_namefromstring(namestr, &fname);
+
+		dns_rdataset_init(&rdataset);
+		t0 = nanotime();
+		result = dns_db_find(reader->db, dns_fixedname_name(&fname),
+				     NULL, dns_rdatatype_a, 0, 0, &node,
+				     dns_fixedname_name(&ffound),
+				     &rdataset, NULL);
+		reader->samples[reader->count++] = nanotime() - t0;
+
+		if (dns_rdataset_isassociated(&rdataset)) {
+			dns_rdataset_disassociate(&rdataset);
+		}
+		if (node != NULL) {
+			dns_db_detachnode(reader->db, &node);
+		}
+		if (result != ISC_R_SUCCESS && result != DNS_R_DELEGATION &&
+		    result != DNS_R_NXRRSET && result != DNS_R_NXDOMAIN)
+		{
+			reader->result = result;
+			break;
+		}
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+static int
+samplecmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return ((x < y) ? -1 : (x > y) ? 1 : 0);
+}
+
+/*
+ * Run the readers against 'db' for two seconds while it is updated
+ * 'rate' times a second, and print their lookup latency.  Each update
+ * replaces a delegation or an address record and adds a new name, in
+ * its own version; '*updates' counts them across runs, so that the new
+ * names are always new.
+ */
+static void
+bench_run(dns_db_t *db, unsigned int rate, unsigned int *updates) {
+	isc_result_t result;
+	dns_dbversion_t *version = NULL;
+	bench_reader_t readers[BENCH_READERS];
+	isc_thread_t threads[BENCH_READERS];
+	char namestr[sizeof("host4294967295.test.")];
+	uint64_t *all, t0, t, due;
+	size_t total = 0;
+	unsigned int i, n, done = 0;
+
+	bench_done = false;
+	for (i = 0; i < BENCH_READERS; i++) {
+		readers[i].db = db;
+		readers[i].count = 0;
+		readers[i].result = ISC_R_SUCCESS;
+		readers[i].samples = malloc(BENCH_SAMPLES * sizeof(uint64_t));
+		assert_non_null(readers[i].samples);
+		isc_thread_create(bench_read, &readers[i], &threads[i]);
+	}
+
+	t0 = nanotime();
+	while ((t = nanotime() - t0) < 2000000000) {
+		if (rate == 0) {
+			usleep(1000);
+			continue;
+		}
+		if (rate != UINT_MAX) {
+			due = (uint64_t)done * 1000000000 / rate;
+			if (t < due) {
+				usleep((due - t) / 1000);
+				continue;
+			}
+		}
+
+		n = random() % BENCH_NAMES;
+		result = dns_db_newversion(db, &version);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		snprintf(namestr, sizeof(namestr), "host%u.test.", n);
+		if (n % 10 == 0) {
+			addrecord(db, version, namestr, dns_rdatatype_ns,
+				  (*updates % 2 == 0) ? "ns1.example."
+						      : "ns2.example.");
+		} else {
+			addrecord(db, version, namestr, dns_rdatatype_a,
+				  "192.0.2.1");
+		}
+		snprintf(namestr, sizeof(namestr), "host%u.test.",
+			 BENCH_NAMES + *updates);
+		addrecord(db, version, namestr, dns_rdatatype_a, "192.0.2.2");
+		dns_db_closeversion(db, &version, true);
+		(*updates)++;
+		done++;
+	}
+	bench_done = true;
+
+	for (i = 0; i < BENCH_READERS; i++) {
+		isc_thread_join(threads[i], NULL);
+		assert_int_equal(readers[i].result, ISC_R_SUCCESS);
+		total += readers[i].count;
+	}
+
+	all = malloc(total * sizeof(uint64_t));
+	assert_non_null(all);
+	total = 0;
+	for (i = 0; i < BENCH_READERS; i++) {
+		memmove(all + total, readers[i].samples,
+			readers[i].count * sizeof(uint64_t));
+		total += readers[i].count;
+		free(readers[i].samples);
+	}
+	qsort(all, total, sizeof(uint64_t), samplecmp);
+
+	printf("%u updates/second, %zu lookups by %u threads\n",
+	       (unsigned int)(done * 1000000000ULL / t), total,
+	       BENCH_READERS);
+	printf("lookup latency: p50 %" PRIu64 "ns p99 %" PRIu64
+	       "ns p99.9 %" PRIu64 "ns max %" PRIu64 "ns\n",
+	       all[total / 2], all[total * 99 / 100],
+	       all[total * 999 / 1000], all[total - 1]);
+
+	free(all);
+}
+
+/*
+ * Measure the latency of lookups in a zone while it is continuously
+ * updated, as with a stream of dynamic updates or IXFRs.
+ */
+static void
+update_benchmark(void **state) {
+	isc_result_t result;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	char namestr[sizeof("host4294967295.test.")];
+	char text[sizeof("255.255.255.255")];
+	unsigned int i, updates = 0;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	result = dns_db_create(dt_mctx, "rbt", dns_rootname, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_newversion(db, &version);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (i = 0; i < BENCH_NAMES; i++) {
+		snprintf(namestr, sizeof(namestr), "host%u.test.", i);
+		if (i % 10 == 0) {
+			addrecord(db, version, namestr, dns_rdatatype_ns,
+				  "ns.example.");
+		} else {
+			snprintf(text, sizeof(text), "10.%u.%u.%u",
+				 (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+			addrecord(db, version, namestr, dns_rdatatype_a, text);
+		}
+	}
+	dns_db_closeversion(db, &version, true);
+
+	for (i = 0; i < sizeof(bench_rates) / sizeof(bench_rates[0]); i++) {
+		bench_run(db, bench_rates[i], &updates);
+	}
+
+	dns_db_detach(&db);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
 int
 main(void) {
 	const struct CMUnitTest tests[] = {
@@ -409,6 +961,16 @@ main(void) {
 						_setup, _teardown),
 		cmocka_unit_test_setup_teardown(version_test,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(delegation_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(coveringnsec_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(map_test,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(update_benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
 	};
 
 	return (cmocka_run_group_tests(tests, NULL, NULL));
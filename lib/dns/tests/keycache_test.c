@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/print.h>
+#include <isc/util.h>
+
+#include <dns/dnssec.h>
+#include <dns/fixedname.h>
+#include <dns/keycache.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+
+#include <dst/dst.h>
+
+#include "dnstest.h"
+
+#define RSAKEY	"AwEAAdLT1R3qiqCqll3Xzh2qFMvehQ9FODsPftw5U4UjB3QwnJ/3+dph " \
+		"9kZBBeaJagUBVYzoArk6XNydpp3HhSCFDcIiepL6r8XAifW3SqI1KCne " \
+		"OD38kSCl/Qm9P0+3CFWokGVubsSQ+3dpQZxqx5bzOXthbuzAr6X+gDUE " \
+		"LAyHtCQNmJ+4ktdCoj3DNYW0z/xLvrcB2Lns7H+/qWnGPL4f3hr7Vbak " \
+		"Oeay+4J4KGdY2LFxJUVts6QrgAA8gz4mV9YIJFP+C4B3b/Z7qgqZRxmT " \
+		"0pic+fJC5+sq0l8KwavPn0n+HqVuJNvppVKMdTbsmmuk69RFGMjbFkP7 " \
+		"tnCiqC9Zi6s="
+
+#define ECKEY	"4uUcskXf+HJGMmTRWbXgKJBDUS2rqsewUQ+rBia9kjApx21Urr8brgef" \
+		"8v9YDg+uiEEQCDzQkiq6wZDPF8HUYQ=="
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_test_end();
+
+	return (0);
+}
+
+static void
+mkkey(const dns_name_t *name, const char *text, dns_rdata_t *rdata,
+      unsigned char *data, size_t size, dst_key_t **keyp)
+{
+	isc_result_t result;
+
+	result = dns_test_rdatafromstring(rdata, dns_rdataclass_in,
+					  dns_rdatatype_dnskey, data, size,
+					  text, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_dnssec_keyfromrdata(name, rdata, dt_mctx, keyp);
+	assert_int_equal(result, ISC_R_SUCCESS);
+}
+
+/* keys are found by owner name and rdata until they expire */
+static void
+addfind_test(void **state) {
+	dns_keycache_t *kc = NULL;
+	dns_fixedname_t fname, fupper, fother;
+	dns_name_t *name, *upper, *other;
+	dns_rdata_t rdata = DNS_RDATA_INIT, rdata2 = DNS_RDATA_INIT;
+	unsigned char data[512], data2[512];
+	dst_key_t *key = NULL, *found = NULL;
+	isc_result_t result;
+
+	UNUSED(state);
+
+	dns_test_namefromstring("rsa.", &fname);
+	name = dns_fixedname_name(&fname);
+	dns_test_namefromstring("RSA.", &fupper);
+	upper = dns_fixedname_name(&fupper);
+	dns_test_namefromstring("other.", &fother);
+	other = dns_fixedname_name(&fother);
+
+	result = dns_keycache_create(dt_mctx, 100, &kc);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	mkkey(name, "256 3 5 " RSAKEY, &rdata, data, sizeof(data), &key);
+
+	result = dns_keycache_find(kc, name, &rdata, 1000, &found);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	dns_keycache_add(kc, name, &rdata, 2000, key);
+	assert_int_equal(dns_keycache_count(kc), 1);
+
+	result = dns_keycache_find(kc, name, &rdata, 1000, &found);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_ptr_equal(found, key);
+	dst_key_free(&found);
+
+	/* Owner names are compared without regard to case. */
+	result = dns_keycache_find(kc, upper, &rdata, 1000, &found);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_ptr_equal(found, key);
+	dst_key_free(&found);
+
+	/* Same rdata, different owner. */
+	result = dns_keycache_find(kc, other, &rdata, 1000, &found);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	/* Same owner, different rdata. */
+	result = dns_test_rdatafromstring(&rdata2, dns_rdataclass_in,
+					  dns_rdatatype_dnskey, data2,
+					  sizeof(data2), "257 3 5 " RSAKEY,
+					  false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_keycache_find(kc, name, &rdata2, 1000, &found);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	/* Expired entries are removed. */
+	result = dns_keycache_find(kc, name, &rdata, 2000, &found);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+	assert_int_equal(dns_keycache_count(kc), 0);
+
+	/* The cache keeps its own reference. */
+	dns_keycache_add(kc, name, &rdata, 2000, key);
+	dst_key_free(&key);
+	result = dns_keycache_find(kc, name, &rdata, 1000, &found);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dst_key_id(found), 29235);
+	dst_key_free(&found);
+
+	dns_keycache_destroy(&kc);
+	assert_null(kc);
+}
+
+/* the number of cached keys is bounded */
+static void
+limit_test(void **state) {
+	dns_keycache_t *kc = NULL;
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	isc_result_t result;
+	unsigned int flags;
+
+	UNUSED(state);
+
+	dns_test_namefromstring("rsa.", &fname);
+	name = dns_fixedname_name(&fname);
+
+	result = dns_keycache_create(dt_mctx, 3, &kc);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (flags = 256; flags < 256 + 10; flags++) {
+		dns_rdata_t rdata = DNS_RDATA_INIT;
+		unsigned char data[512];
+		char text[1024];
+		dst_key_t *key = NULL, *found = NULL;
+
+		snprintf(text, sizeof(text), "%u 3 5 %s", flags, RSAKEY);
+		mkkey(name, text, &rdata, data, sizeof(data), &key);
+		dns_keycache_add(kc, name, &rdata, 2000, key);
+		dst_key_free(&key);
+
+		assert_true(dns_keycache_count(kc) <= 3);
+
+		/* The newest key is never the one evicted. */
+		result = dns_keycache_find(kc, name, &rdata, 1000, &found);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dst_key_free(&found);
+	}
+	assert_int_equal(dns_keycache_count(kc), 3);
+
+	dns_keycache_flush(kc);
+	assert_int_equal(dns_keycache_count(kc), 0);
+
+	dns_keycache_destroy(&kc);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+#define NKEYS	1000
+
+static uint64_t
+nanotime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Build RSA and ECDSA keys from their DNSKEY records with and without
+ * the cache.
+ */
+static void
+benchmark(void **state) {
+	static const struct {
+		const char *label;
+		const char *text;
+	} keys[] = {
+		{ "RSASHA1", "256 3 5 " RSAKEY },
+		{ "ECDSAP256SHA256", "256 3 13 " ECKEY },
+	};
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	isc_result_t result;
+	unsigned int i, k;
+
+	UNUSED(state);
+
+	dns_test_namefromstring("example.", &fname);
+	name = dns_fixedname_name(&fname);
+
+	for (k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+		dns_keycache_t *kc = NULL;
+		dns_rdata_t rdata = DNS_RDATA_INIT;
+		unsigned char data[512];
+		dst_key_t *key = NULL;
+		uint64_t t0, tparse, tcache;
+
+		result = dns_test_rdatafromstring(&rdata, dns_rdataclass_in,
+						  dns_rdatatype_dnskey,
+						  data, sizeof(data),
+						  keys[k].text, false);
+		assert_int_equal(result, ISC_R_SUCCESS);
+
+		t0 = nanotime();
+		for (i = 0; i < NKEYS; i++) {
+			result = dns_dnssec_keyfromrdata(name, &rdata,
+							 dt_mctx, &key);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			dst_key_free(&key);
+		}
+		tparse = nanotime() - t0;
+
+		result = dns_keycache_create(dt_mctx, 100, &kc);
+		assert_int_equal(result, ISC_R_SUCCESS);
+
+		t0 = nanotime();
+		for (i = 0; i < NKEYS; i++) {
+			result = dns_keycache_find(kc, name, &rdata, 1, &key);
+			if (result != ISC_R_SUCCESS) {
+				result = dns_dnssec_keyfromrdata(name, &rdata,
+								 dt_mctx,
+								 &key);
+				assert_int_equal(result, ISC_R_SUCCESS);
+				dns_keycache_add(kc, name, &rdata, 2, key);
+			}
+			dst_key_free(&key);
+		}
+		tcache = nanotime() - t0;
+
+		printf("%s: %.0f ns/key parsed, %.0f ns/key cached\n",
+		       keys[k].label, (double)tparse / NKEYS,
+		       (double)tcache / NKEYS);
+
+		dns_keycache_destroy(&kc);
+	}
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(addfind_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(limit_test,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/buffer.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdataset.h>
+
+#include "dnstest.h"
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_test_end();
+
+	return (0);
+}
+
+/* Query for WwW.isc.org/A with no EDNS. */
+static unsigned char noedns[] = {
+	0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+	0x03, 'W', 'w', 'W', 0x03, 'i', 's', 'c', 0x03, 'o', 'r', 'g', 0x00,
+	0x00, 0x01, 0x00, 0x01
+};
+
+/*
+ * Query for www.isc.org/AAAA with EDNS: UDP size 1232, extended rcode
+ * 1, DO set and a client cookie.
+ */
+static unsigned char cookie[] = {
+	0x56, 0x78, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x01,
+	0x03, 'w', 'w', 'w', 0x03, 'i', 's', 'c', 0x03, 'o', 'r', 'g', 0x00,
+	0x00, 0x1c, 0x00, 0x01,
+	0x00, 0x00, 0x29, 0x04, 0xd0, 0x01, 0x00, 0x80, 0x00, 0x00, 0x0c,
+	0x00, 0x0a, 0x00, 0x08, 1, 2, 3, 4, 5, 6, 7, 8
+};
+
+/* As above, but with a cookie of invalid length. */
+static unsigned char badopt[] = {
+	0x56, 0x78, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x01,
+	0x03, 'w', 'w', 'w', 0x03, 'i', 's', 'c', 0x03, 'o', 'r', 'g', 0x00,
+	0x00, 0x1c, 0x00, 0x01,
+	0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x80, 0x00, 0x00, 0x0b,
+	0x00, 0x0a, 0x00, 0x07, 1, 2, 3, 4, 5, 6, 7
+};
+
+/* As above, but the OPT rdata overruns the message. */
+static unsigned char truncopt[] = {
+	0x56, 0x78, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x01,
+	0x03, 'w', 'w', 'w', 0x03, 'i', 's', 'c', 0x03, 'o', 'r', 'g', 0x00,
+	0x00, 0x1c, 0x00, 0x01,
+	0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x80, 0x00, 0x00, 0x10,
+	0x00, 0x0a, 0x00, 0x08, 1, 2, 3, 4, 5, 6, 7, 8
+};
+
+/* A query with an A record rather than OPT in the additional section. */
+static unsigned char notopt[] = {
+	0x9a, 0xbc, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x01,
+	0x03, 'w', 'w', 'w', 0x03, 'i', 's', 'c', 0x03, 'o', 'r', 'g', 0x00,
+	0x00, 0x01, 0x00, 0x01,
+	0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10,
+	0x00, 0x04, 192, 0, 2, 1
+};
+
+static isc_result_t
+parse(dns_message_t **msgp, unsigned char *data, size_t length,
+      unsigned int options)
+{
+	isc_buffer_t source;
+
+	isc_buffer_init(&source, data, length);
+	isc_buffer_add(&source, length);
+
+	assert_int_equal(dns_message_create(dt_mctx, DNS_MESSAGE_INTENTPARSE,
+					    msgp),
+			 ISC_R_SUCCESS);
+
+	return (dns_message_parse(*msgp, &source, options));
+}
+
+static void
+check_question(dns_message_t *msg, const char *qname, dns_rdatatype_t qtype)
+{
+	dns_fixedname_t fixed;
+	dns_name_t *name = NULL;
+	dns_rdataset_t *rdataset;
+
+	assert_int_equal(dns_message_firstname(msg, DNS_SECTION_QUESTION),
+			 ISC_R_SUCCESS);
+	dns_message_currentname(msg, DNS_SECTION_QUESTION, &name);
+	dns_test_namefromstring(qname, &fixed);
+	assert_true(dns_name_caseequal(name, dns_fixedname_name(&fixed)));
+
+	rdataset = ISC_LIST_HEAD(name->list);
+	assert_non_null(rdataset);
+	assert_int_equal(rdataset->type, qtype);
+	assert_int_equal(rdataset->rdclass, dns_rdataclass_in);
+	assert_true((rdataset->attributes & DNS_RDATASETATTR_QUESTION) != 0);
+	assert_null(ISC_LIST_NEXT(rdataset, link));
+
+	assert_int_equal(dns_message_nextname(msg, DNS_SECTION_QUESTION),
+			 ISC_R_NOMORE);
+	assert_int_equal(msg->rdclass, dns_rdataclass_in);
+}
+
+/* Parse queries of the usual shape */
+static void
+plainquery_test(void **state) {
+	dns_message_t *msg = NULL;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = parse(&msg, noedns, sizeof(noedns), 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(msg->id, 0x1234);
+	assert_int_equal(msg->flags, DNS_MESSAGEFLAG_RD);
+	check_question(msg, "WwW.isc.org.", dns_rdatatype_a);
+	assert_null(dns_message_getopt(msg));
+	dns_message_destroy(&msg);
+
+	result = parse(&msg, cookie, sizeof(cookie), 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	check_question(msg, "www.isc.org.", dns_rdatatype_aaaa);
+	assert_non_null(dns_message_getopt(msg));
+	assert_int_equal(msg->opt->rdclass, 1232);
+	assert_int_equal(msg->opt->ttl, 0x01008000);
+	assert_int_equal(msg->rcode, 0x10);
+	assert_int_equal(dns_rdataset_first(msg->opt), ISC_R_SUCCESS);
+	dns_rdataset_current(msg->opt, &rdata);
+	assert_int_equal(rdata.type, dns_rdatatype_opt);
+	assert_int_equal(rdata.length, 12);
+	assert_memory_equal(rdata.data, cookie + sizeof(cookie) - 12, 12);
+	assert_int_equal(dns_rdataset_next(msg->opt), ISC_R_NOMORE);
+	dns_message_destroy(&msg);
+}
+
+/* Malformed and unusual queries get the same treatment as before */
+static void
+otherquery_test(void **state) {
+	dns_message_t *msg = NULL;
+	dns_fixedname_t fixed;
+	dns_name_t *name = NULL;
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = parse(&msg, badopt, sizeof(badopt), 0);
+	assert_int_equal(result, DNS_R_OPTERR);
+	dns_message_destroy(&msg);
+
+	result = parse(&msg, truncopt, sizeof(truncopt), 0);
+	assert_int_equal(result, ISC_R_UNEXPECTEDEND);
+	dns_message_destroy(&msg);
+
+	result = parse(&msg, truncopt, sizeof(truncopt),
+		       DNS_MESSAGEPARSE_IGNORETRUNCATION);
+	assert_int_equal(result, DNS_R_RECOVERABLE);
+	check_question(msg, "www.isc.org.", dns_rdatatype_aaaa);
+	dns_message_destroy(&msg);
+
+	result = parse(&msg, notopt, sizeof(notopt), 0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	check_question(msg, "www.isc.org.", dns_rdatatype_a);
+	assert_null(dns_message_getopt(msg));
+	assert_int_equal(dns_message_firstname(msg, DNS_SECTION_ADDITIONAL),
+			 ISC_R_SUCCESS);
+	dns_message_currentname(msg, DNS_SECTION_ADDITIONAL, &name);
+	dns_test_namefromstring("www.isc.org.", &fixed);
+	assert_true(dns_name_equal(name, dns_fixedname_name(&fixed)));
+	dns_message_destroy(&msg);
+
+	/* A response is never taken for a plain query. */
+	noedns[2] |= 0x80;
+	result = parse(&msg, noedns, sizeof(noedns), 0);
+	noedns[2] &= ~0x80;
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true((msg->flags & DNS_MESSAGEFLAG_QR) != 0);
+	check_question(msg, "WwW.isc.org.", dns_rdatatype_a);
+	dns_message_destroy(&msg);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+/*
+ * Parse the query corpus over and over again, reusing the message as
+ * a server does for each client.
+ */
+static void
+benchmark(void **state) {
+	static const char *files[] = {
+		"testdata/dnstap/query.auth",
+		"testdata/dnstap/query.recursive",
+	};
+	struct {
+		unsigned char data[512];
+		size_t length;
+	} queries[4];
+	dns_message_t *msg = NULL;
+	isc_buffer_t source;
+	isc_result_t result;
+	isc_time_t ts1, ts2;
+	unsigned int i, nqueries = 0, count = 2000000;
+	uint64_t t;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		result = dns_test_getdata(files[i], queries[nqueries].data,
+					  sizeof(queries[nqueries].data),
+					  &queries[nqueries].length);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		nqueries++;
+	}
+	memmove(queries[nqueries].data, noedns, sizeof(noedns));
+	queries[nqueries++].length = sizeof(noedns);
+	memmove(queries[nqueries].data, cookie, sizeof(cookie));
+	queries[nqueries++].length = sizeof(cookie);
+
+	result = dns_message_create(dt_mctx, DNS_MESSAGE_INTENTPARSE, &msg);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < count; i++) {
+		unsigned int q = i % nqueries;
+
+		isc_buffer_init(&source, queries[q].data, queries[q].length);
+		isc_buffer_add(&source, queries[q].length);
+		result = dns_message_parse(msg, &source, 0);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_message_reset(msg, DNS_MESSAGE_INTENTPARSE);
+	}
+
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u queries parsed, %f seconds, %f queries/second\n",
+	       count, t / 1000000.0, count / (t / 1000000.0));
+
+	dns_message_destroy(&msg);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(plainquery_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(otherquery_test,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
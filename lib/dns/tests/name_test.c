@@ -15,6 +15,7 @@
 #include <stddef.h>
 #include <setjmp.h>
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <sched.h> /* IWYU pragma: keep */
 #include <stdbool.h>
@@ -296,6 +297,146 @@ compression_test(void **state) {
 	dns_compress_invalidate(&cctx);
 }
 
+/*
+ * Render enough names to grow the compression table, roll part of
+ * them back and render them again; every name must survive the round
+ * trip and the rolled back names must no longer be used as targets.
+ */
+static void
+compression_rollback_test(void **state) {
+	dns_compress_t cctx;
+	dns_decompress_t dctx;
+	dns_fixedname_t fnames[300], fname;
+	dns_name_t *name;
+	dns_name_t prefix;
+	isc_buffer_t source, target;
+	unsigned char buf[16384], out[DNS_NAME_MAXWIRE];
+	char namestr[sizeof("HOST4294967295.Zone4294967295.Example.ORG.")];
+	unsigned int i, rolled = 150, count = 300, uncompressed = 0;
+	unsigned int offsets[300];
+	uint16_t offset;
+	bool sensitive;
+
+	UNUSED(state);
+
+	for (i = 0; i < count; i++) {
+		snprintf(namestr, sizeof(namestr), "%s%u.zone%u.Example.%s",
+			 (i % 2) != 0 ? "HOST" : "host", i, i % 7,
+			 (i % 3) != 0 ? "ORG." : "org.");
+		dns_test_namefromstring(namestr, &fnames[i]);
+		uncompressed += dns_fixedname_name(&fnames[i])->length;
+	}
+
+	for (sensitive = false; ; sensitive = true) {
+		assert_int_equal(dns_compress_init(&cctx, -1, dt_mctx),
+				 ISC_R_SUCCESS);
+		dns_compress_setmethods(&cctx, DNS_COMPRESS_GLOBAL14);
+		dns_compress_setsensitive(&cctx, sensitive);
+		isc_buffer_init(&source, buf, sizeof(buf));
+
+		for (i = 0; i < 200; i++) {
+			offsets[i] = source.used;
+			name = dns_fixedname_name(&fnames[i]);
+			assert_int_equal(dns_name_towire(name, &cctx, &source),
+					 ISC_R_SUCCESS);
+		}
+
+		dns_compress_rollback(&cctx, offsets[rolled]);
+		isc_buffer_subtract(&source, source.used - offsets[rolled]);
+
+		/*
+		 * Only the "zoneN" suffix of a rolled back name is left.
+		 */
+		dns_name_init(&prefix, NULL);
+		name = dns_fixedname_name(&fnames[rolled + 20]);
+		assert_true(dns_compress_findglobal(&cctx, name, &prefix,
+						    &offset));
+		assert_int_equal(dns_name_countlabels(&prefix), 1);
+		assert_true(offset < offsets[rolled]);
+
+		for (i = rolled; i < count; i++) {
+			offsets[i] = source.used;
+			name = dns_fixedname_name(&fnames[i]);
+			assert_int_equal(dns_name_towire(name, &cctx, &source),
+					 ISC_R_SUCCESS);
+		}
+		assert_true(source.used < uncompressed / 2);
+
+		dns_decompress_init(&dctx, -1, DNS_DECOMPRESS_STRICT);
+		dns_decompress_setmethods(&dctx, DNS_COMPRESS_GLOBAL14);
+		isc_buffer_setactive(&source, source.used);
+		for (i = 0; i < count; i++) {
+			name = dns_fixedname_initname(&fname);
+			isc_buffer_init(&target, out, sizeof(out));
+			assert_int_equal(dns_name_fromwire(name, &source,
+							   &dctx, 0, &target),
+					 ISC_R_SUCCESS);
+			assert_true(dns_name_equal(name,
+					dns_fixedname_name(&fnames[i])));
+			if (sensitive) {
+				assert_true(dns_name_caseequal(name,
+					dns_fixedname_name(&fnames[i])));
+			}
+		}
+		dns_decompress_invalidate(&dctx);
+
+		dns_compress_invalidate(&cctx);
+		if (sensitive)
+			break;
+	}
+}
+
+/*
+ * Names which differ in a single byte compare as that byte does after
+ * ASCII case folding, whether it is found a word at a time or in the
+ * tail of a label.
+ */
+static void
+casefold_test(void **state) {
+	unsigned char data1[] = "\021aaaaaaaaaaaaaaaaa\003org";
+	unsigned char data2[] = "\021aaaaaaaaaaaaaaaaa\003org";
+	unsigned int positions[] = { 1, 9, 16, 17 };
+	unsigned int c1, c2, i;
+	dns_name_t name1, name2;
+	isc_region_t r;
+
+	UNUSED(state);
+
+	for (i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+		unsigned int p = positions[i];
+
+		for (c1 = 0; c1 < 256; c1++) {
+			for (c2 = 0; c2 < 256; c2++) {
+				int l1 = isupper(c1) ? tolower(c1) : (int)c1;
+				int l2 = isupper(c2) ? tolower(c2) : (int)c2;
+				int order, expect;
+
+				data1[p] = c1;
+				data2[p] = c2;
+				dns_name_init(&name1, NULL);
+				dns_name_init(&name2, NULL);
+				r.base = data1;
+				r.length = sizeof(data1);
+				dns_name_fromregion(&name1, &r);
+				r.base = data2;
+				r.length = sizeof(data2);
+				dns_name_fromregion(&name2, &r);
+
+				expect = (l1 < l2) ? -1 : (l1 > l2) ? 1 : 0;
+				assert_int_equal(dns_name_equal(&name1, &name2),
+						 expect == 0);
+
+				order = dns_name_compare(&name1, &name2);
+				order = (order < 0) ? -1 : (order > 0) ? 1 : 0;
+				assert_int_equal(order, expect);
+
+				order = dns_name_rdatacompare(&name1, &name2);
+				assert_int_equal(order, expect);
+			}
+		}
+	}
+}
+
 /* is trust-anchor-telemetry test */
 static void
 istat_test(void **state) {
@@ -760,6 +901,165 @@ benchmark_test(void **state) {
 	       (nthreads * 32000000) / (t / 1000000.0));
 }
 
+/*
+ * Benchmark name compression by rendering the names of responses with
+ * 50 resource records: each record has its own owner name and a name
+ * in its rdata, as NS, MX or CNAME records do.
+ */
+static void
+render_benchmark_test(void **state) {
+	dns_compress_t cctx;
+	dns_fixedname_t qname, owners[50], targets[50];
+	isc_buffer_t target;
+	unsigned char buf[65535];
+	char namestr[sizeof("mail4294967295.provider4294967295.example.net.")];
+	unsigned int i, j, count = 100000;
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	uint64_t t;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	dns_test_namefromstring("www.example.com.", &qname);
+	for (i = 0; i < 50; i++) {
+		snprintf(namestr, sizeof(namestr), "host%u.sub%u.example.com.",
+			 i, i % 8);
+		dns_test_namefromstring(namestr, &owners[i]);
+		snprintf(namestr, sizeof(namestr),
+			 "mail%u.provider%u.example.net.", i, i % 4);
+		dns_test_namefromstring(namestr, &targets[i]);
+	}
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < count; i++) {
+		result = dns_compress_init(&cctx, -1, dt_mctx);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_compress_setmethods(&cctx, DNS_COMPRESS_GLOBAL14);
+		isc_buffer_init(&target, buf, sizeof(buf));
+
+		/* Header, question and the fixed part of each record. */
+		isc_buffer_add(&target, 12);
+		result = dns_name_towire(dns_fixedname_name(&qname), &cctx,
+					 &target);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		isc_buffer_add(&target, 4);
+		for (j = 0; j < 50; j++) {
+			result = dns_name_towire(
+				dns_fixedname_name(&owners[j]),
+				&cctx, &target);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			isc_buffer_add(&target, 12);
+			result = dns_name_towire(
+				dns_fixedname_name(&targets[j]),
+				&cctx, &target);
+			assert_int_equal(result, ISC_R_SUCCESS);
+		}
+
+		dns_compress_invalidate(&cctx);
+	}
+
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u 50-RR responses (%u bytes), %f seconds, "
+	       "%f responses/second\n", count, target.used, t / 1000000.0,
+	       count / (t / 1000000.0));
+}
+
+/*
+ * Benchmark the name comparison functions on names which share long
+ * suffixes and differ in case, as names in a zone usually do.
+ */
+static void
+compare_benchmark_test(void **state) {
+	dns_fixedname_t *lower, *upper;
+	char namestr[sizeof("host4294967295.subdomain4294967295.example.com.")];
+	unsigned int i, j, count = 1000, rounds = 5000;
+	unsigned int equal = 0, ordered = 0;
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	uint64_t t;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	lower = isc_mem_get(dt_mctx, count * sizeof(*lower));
+	upper = isc_mem_get(dt_mctx, count * sizeof(*upper));
+	for (i = 0; i < count; i++) {
+		snprintf(namestr, sizeof(namestr),
+			 "host%u.subdomain%u.example.com.", i, i % 10);
+		dns_test_namefromstring(namestr, &lower[i]);
+		snprintf(namestr, sizeof(namestr),
+			 "HOST%u.SubDomain%u.Example.COM.", i, i % 10);
+		dns_test_namefromstring(namestr, &upper[i]);
+	}
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < count; i++) {
+			if (dns_name_equal(dns_fixedname_name(&lower[i]),
+					   dns_fixedname_name(&upper[i])))
+			{
+				equal++;
+			}
+		}
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(equal, count * rounds);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u dns_name_equal() calls, %f seconds, %f calls/second\n",
+	       count * rounds, t / 1000000.0, count * rounds / (t / 1000000.0));
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < count; i++) {
+			if (dns_name_compare(dns_fixedname_name(&lower[i]),
+					     dns_fixedname_name(
+						&upper[(i + j) % count])) < 0)
+			{
+				ordered++;
+			}
+		}
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u dns_name_compare() calls, %f seconds, %f calls/second\n",
+	       count * rounds, t / 1000000.0, count * rounds / (t / 1000000.0));
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < count; i++) {
+			if (dns_name_rdatacompare(dns_fixedname_name(&lower[i]),
+						  dns_fixedname_name(
+						     &upper[(i + j) % count]))
+			    < 0)
+			{
+				ordered++;
+			}
+		}
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u dns_name_rdatacompare() calls, %f seconds, "
+	       "%f calls/second\n", count * rounds, t / 1000000.0,
+	       count * rounds / (t / 1000000.0));
+
+	isc_mem_put(dt_mctx, lower, count * sizeof(*lower));
+	isc_mem_put(dt_mctx, upper, count * sizeof(*upper));
+}
+
 #endif /* DNS_BENCHMARK_TESTS */
 
 int
@@ -768,6 +1068,9 @@ main(int argc, char **argv) {
 		cmocka_unit_test(fullcompare_test),
 		cmocka_unit_test_setup_teardown(compression_test,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(compression_rollback_test,
+						_setup, _teardown),
+		cmocka_unit_test(casefold_test),
 		cmocka_unit_test(istat_test),
 		cmocka_unit_test(init_test),
 		cmocka_unit_test(invalidate_test),
@@ -781,6 +1084,10 @@ main(int argc, char **argv) {
 #ifdef DNS_BENCHMARK_TESTS
 		cmocka_unit_test_setup_teardown(benchmark_test,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(render_benchmark_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(compare_benchmark_test,
+						_setup, _teardown),
 #endif /* DNS_BENCHMARK_TESTS */
 	};
 	int c;
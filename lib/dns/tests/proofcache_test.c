@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/proofcache.h>
+#include <dns/rdataset.h>
+
+#include "dnstest.h"
+
+static dns_db_t *db = NULL;
+static dns_proofcache_t *pc = NULL;
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_test_loaddb(&db, dns_dbtype_zone, "example.",
+				 "testdata/proofcache/example.db");
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_proofcache_create(dt_mctx, &pc);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_proofcache_setmaxentries(pc, 100);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_proofcache_destroy(&pc);
+	dns_db_detach(&db);
+	dns_test_end();
+
+	return (0);
+}
+
+/*
+ * Store the 'type' RRset of 'owner' in the cache.
+ */
+static isc_result_t
+add(uint64_t generation, const char *owner, dns_rdatatype_t type) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_dbnode_t *node = NULL;
+	dns_rdataset_t rdataset, sigrdataset;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, owner, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_findnode(db, name, false, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_rdataset_init(&rdataset);
+	dns_rdataset_init(&sigrdataset);
+	result = dns_db_findrdataset(db, node, NULL, type, 0, 0,
+				     &rdataset, &sigrdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_proofcache_add(pc, generation, name, &rdataset,
+				    &sigrdataset);
+
+	dns_rdataset_disassociate(&rdataset);
+	if (dns_rdataset_isassociated(&sigrdataset)) {
+		dns_rdataset_disassociate(&sigrdataset);
+	}
+	dns_db_detachnode(db, &node);
+
+	return (result);
+}
+
+/*
+ * Look for the proof that 'qname' does not exist; if found, check that
+ * its NSEC records are owned by 'nsec' and 'wild' (NULL if the wildcard
+ * is covered by the same record).
+ */
+static isc_result_t
+find(uint64_t generation, const char *qname, const char *nsec,
+     const char *wild)
+{
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_nxproof_t proof;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, qname, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_nxproof_init(&proof);
+	result = dns_proofcache_findnxdomain(pc, generation, name, &proof);
+	if (result != ISC_R_SUCCESS) {
+		assert_false(dns_rdataset_isassociated(&proof.nsec));
+		return (result);
+	}
+
+	assert_true(dns_rdataset_isassociated(&proof.soa));
+	assert_true(dns_rdataset_isassociated(&proof.soasig));
+	assert_int_equal(proof.soa.type, dns_rdatatype_soa);
+	assert_true(dns_rdataset_isassociated(&proof.nsecsig));
+	assert_int_equal(proof.nsec.type, dns_rdatatype_nsec);
+
+	result = dns_name_fromstring(name, nsec, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(dns_name_equal(name, dns_fixedname_name(&proof.nsecname)));
+
+	if (wild == NULL) {
+		assert_false(dns_rdataset_isassociated(&proof.wild));
+	} else {
+		assert_true(dns_rdataset_isassociated(&proof.wild));
+		assert_true(dns_rdataset_isassociated(&proof.wildsig));
+		result = dns_name_fromstring(name, wild, 0, NULL);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		assert_true(dns_name_equal(name,
+				dns_fixedname_name(&proof.wildname)));
+	}
+
+	dns_nxproof_invalidate(&proof);
+	assert_false(dns_rdataset_isassociated(&proof.soa));
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Look for the proof that 'qname' has no 'type' RRset; if found, check
+ * that its NSEC record is owned by 'qname'.
+ */
+static isc_result_t
+findnodata(uint64_t generation, const char *qname, dns_rdatatype_t type) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_nxproof_t proof;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, qname, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_nxproof_init(&proof);
+	result = dns_proofcache_findnodata(pc, generation, name, type, &proof);
+	if (result != ISC_R_SUCCESS) {
+		assert_false(dns_rdataset_isassociated(&proof.nsec));
+		return (result);
+	}
+
+	assert_true(dns_rdataset_isassociated(&proof.soa));
+	assert_true(dns_rdataset_isassociated(&proof.soasig));
+	assert_true(dns_rdataset_isassociated(&proof.nsecsig));
+	assert_int_equal(proof.nsec.type, dns_rdatatype_nsec);
+	assert_true(dns_name_equal(name, dns_fixedname_name(&proof.nsecname)));
+	assert_false(dns_rdataset_isassociated(&proof.wild));
+
+	dns_nxproof_invalidate(&proof);
+
+	return (ISC_R_SUCCESS);
+}
+
+/* names covered by the cached NSEC records */
+static void
+findnxdomain_test(void **state) {
+	UNUSED(state);
+
+	/* Nothing without the SOA. */
+	assert_int_equal(add(1, "example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "0.example.", "example.", NULL),
+			 ISC_R_NOTFOUND);
+
+	assert_int_equal(add(1, "example.", dns_rdatatype_soa),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "0.example.", "example.", NULL),
+			 ISC_R_SUCCESS);
+
+	/* The wildcard proof is needed as well. */
+	assert_int_equal(find(1, "aa.example.", "a.example.", NULL),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(add(1, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "aa.example.", "a.example.", "example."),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "x.aa.example.", "a.example.", "example."),
+			 ISC_R_SUCCESS);
+
+	/* Existing names and empty non-terminals. */
+	assert_int_equal(find(1, "example.", NULL, NULL), ISC_R_NOTFOUND);
+	assert_int_equal(find(1, "a.example.", NULL, NULL), ISC_R_NOTFOUND);
+	assert_int_equal(find(1, "c.example.", NULL, NULL), ISC_R_NOTFOUND);
+
+	/* The wildcard below the closest encloser must be covered. */
+	assert_int_equal(find(1, "x.a.example.", "a.example.", NULL),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "d.c.example.", NULL, NULL),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(add(1, "b.c.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "d.c.example.", "b.c.example.",
+			      "a.example."),
+			 ISC_R_SUCCESS);
+
+	/* Nothing is cached for the wrong generation. */
+	assert_int_equal(find(2, "0.example.", "example.", NULL),
+			 ISC_R_NOTFOUND);
+
+	assert_int_equal(dns_proofcache_count(pc), 3);
+}
+
+/* delegations and the last NSEC record of the chain */
+static void
+cut_test(void **state) {
+	UNUSED(state);
+
+	assert_int_equal(add(1, "example.", dns_rdatatype_soa),
+			 ISC_R_SUCCESS);
+	assert_int_equal(add(1, "example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(add(1, "sub.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(add(1, "z.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+
+	assert_int_equal(find(1, "t.example.", "sub.example.", "example."),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "x.sub.example.", NULL, NULL),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(find(1, "sub.example.", NULL, NULL),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(find(1, "zz.example.", "z.example.", "example."),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(1, "x.z.example.", "z.example.", NULL),
+			 ISC_R_SUCCESS);
+}
+
+/* types missing from the NSEC record at the query name */
+static void
+findnodata_test(void **state) {
+	UNUSED(state);
+
+	assert_int_equal(add(1, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(findnodata(1, "a.example.", dns_rdatatype_aaaa),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(add(1, "example.", dns_rdatatype_soa),
+			 ISC_R_SUCCESS);
+	assert_int_equal(findnodata(1, "a.example.", dns_rdatatype_aaaa),
+			 ISC_R_SUCCESS);
+	assert_int_equal(findnodata(1, "a.example.", dns_rdatatype_a),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(findnodata(1, "a.example.", dns_rdatatype_any),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(findnodata(1, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_NOTFOUND);
+
+	/* Only the exact owner name proves NODATA. */
+	assert_int_equal(findnodata(1, "aa.example.", dns_rdatatype_aaaa),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(findnodata(1, "example.", dns_rdatatype_mx),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(add(1, "example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(findnodata(1, "example.", dns_rdatatype_mx),
+			 ISC_R_SUCCESS);
+	assert_int_equal(findnodata(1, "example.", dns_rdatatype_ns),
+			 ISC_R_NOTFOUND);
+
+	/* A delegation point gets a referral, not NODATA. */
+	assert_int_equal(add(1, "sub.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(findnodata(1, "sub.example.", dns_rdatatype_ds),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(findnodata(1, "sub.example.", dns_rdatatype_a),
+			 ISC_R_NOTFOUND);
+
+	assert_int_equal(findnodata(2, "a.example.", dns_rdatatype_aaaa),
+			 ISC_R_NOTFOUND);
+}
+
+/* generations, limits and errors */
+static void
+add_test(void **state) {
+	UNUSED(state);
+
+	assert_int_equal(add(1, "example.", dns_rdatatype_soa),
+			 ISC_R_SUCCESS);
+	assert_int_equal(add(1, "example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(add(1, "example.", dns_rdatatype_nsec),
+			 ISC_R_EXISTS);
+	assert_int_equal(add(1, "a.example.", dns_rdatatype_a),
+			 ISC_R_NOTIMPLEMENTED);
+	assert_int_equal(add(1, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_proofcache_count(pc), 2);
+
+	/* A newer generation replaces everything; older ones are ignored. */
+	assert_int_equal(add(2, "z.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_proofcache_count(pc), 1);
+	assert_int_equal(add(1, "sub.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_proofcache_count(pc), 1);
+	assert_int_equal(find(2, "x.z.example.", "z.example.", NULL),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(add(2, "example.", dns_rdatatype_soa),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(2, "x.z.example.", "z.example.", NULL),
+			 ISC_R_SUCCESS);
+	assert_int_equal(find(2, "zz.example.", NULL, NULL),
+			 ISC_R_NOTFOUND);
+
+	/* The oldest records are removed first. */
+	assert_int_equal(add(2, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(add(2, "sub.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	dns_proofcache_setmaxentries(pc, 2);
+	assert_int_equal(dns_proofcache_getmaxentries(pc), 2);
+	assert_int_equal(dns_proofcache_count(pc), 2);
+	assert_int_equal(find(2, "x.z.example.", NULL, NULL),
+			 ISC_R_NOTFOUND);
+	assert_int_equal(add(2, "example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_proofcache_count(pc), 2);
+	assert_int_equal(find(2, "aa.example.", NULL, NULL), ISC_R_NOTFOUND);
+	assert_int_equal(find(2, "t.example.", "sub.example.", "example."),
+			 ISC_R_SUCCESS);
+
+	/* A limit of zero disables the cache. */
+	dns_proofcache_setmaxentries(pc, 0);
+	assert_int_equal(dns_proofcache_count(pc), 0);
+	assert_int_equal(add(2, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_proofcache_count(pc), 0);
+
+	dns_proofcache_setmaxentries(pc, 10);
+	assert_int_equal(add(2, "a.example.", dns_rdatatype_nsec),
+			 ISC_R_SUCCESS);
+	dns_proofcache_flush(pc);
+	assert_int_equal(dns_proofcache_count(pc), 0);
+}
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(findnxdomain_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(cut_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(findnodata_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(add_test,
+						_setup, _teardown),
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/qp.h>
+
+#include "dnstest.h"
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_test_end();
+
+	return (0);
+}
+
+/*
+ * The names are sorted in DNS canonical order.
+ */
+static const char *sorted[] = {
+	"example.",
+	"a.example.",
+	"yljkjljk.a.example.",
+	"Z.a.example.",
+	"zABC.a.EXAMPLE.",
+	"z.example.",
+	"\\001.z.example.",
+	"*.z.example.",
+	"-.z.example.",
+	"0.z.example.",
+	"_.z.example.",
+	"b.z.example.",
+	"{.z.example.",
+	"\\200.z.example.",
+	"\\255.z.example.",
+	"zz.example.",
+	"example\\000.",
+	"example0.",
+	NULL
+};
+
+static const dns_name_t *
+getname(void *data, void *arg) {
+	UNUSED(arg);
+
+	return (dns_fixedname_name(data));
+}
+
+static void
+deleter(void *data, void *arg) {
+	unsigned int *count = arg;
+
+	UNUSED(data);
+
+	(*count)++;
+}
+
+static int
+keycmp(const dns_qpkey_t key1, size_t len1,
+       const dns_qpkey_t key2, size_t len2)
+{
+	int order = memcmp(key1, key2, ISC_MIN(len1, len2));
+
+	if (order == 0) {
+		order = (len1 < len2) ? -1 : (len1 > len2) ? 1 : 0;
+	}
+	return (order);
+}
+
+/* Keys sort in the same order as the names they are made from */
+static void
+qpkey_order(void **state) {
+	dns_fixedname_t fn1, fn2;
+	dns_qpkey_t key1, key2;
+	size_t len1, len2;
+	unsigned int i, j;
+
+	UNUSED(state);
+
+	for (i = 0; sorted[i] != NULL; i++) {
+		dns_test_namefromstring(sorted[i], &fn1);
+		len1 = dns_qpkey_fromname(key1, dns_fixedname_name(&fn1));
+		for (j = 0; sorted[j] != NULL; j++) {
+			int order;
+
+			dns_test_namefromstring(sorted[j], &fn2);
+			len2 = dns_qpkey_fromname(key2,
+						  dns_fixedname_name(&fn2));
+			order = keycmp(key1, len1, key2, len2);
+			if (i < j) {
+				assert_true(order < 0);
+			} else if (i > j) {
+				assert_true(order > 0);
+			} else {
+				assert_int_equal(order, 0);
+			}
+		}
+	}
+}
+
+/* Insert, find and delete names */
+static void
+qp_insert_delete(void **state) {
+	dns_fixedname_t fnames[sizeof(sorted) / sizeof(sorted[0])];
+	dns_fixedname_t fname;
+	dns_qp_t *qp = NULL;
+	isc_result_t result;
+	unsigned int deleted = 0;
+	unsigned int i, count;
+	void *data;
+
+	UNUSED(state);
+
+	result = dns_qp_create(dt_mctx, getname, deleter, &deleted, &qp);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	/* Insert in reverse order for a change. */
+	for (count = 0; sorted[count] != NULL; count++) {
+		;
+	}
+	for (i = count; i-- > 0; ) {
+		dns_test_namefromstring(sorted[i], &fnames[i]);
+		result = dns_qp_insert(qp, &fnames[i]);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	assert_int_equal(dns_qp_count(qp), count);
+
+	/* Duplicates are rejected, case-insensitively. */
+	dns_test_namefromstring("A.Example.", &fname);
+	result = dns_qp_insert(qp, &fname);
+	assert_int_equal(result, ISC_R_EXISTS);
+
+	for (i = 0; i < count; i++) {
+		data = NULL;
+		result = dns_qp_findname(qp, dns_fixedname_name(&fnames[i]),
+					 &data);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		assert_ptr_equal(data, &fnames[i]);
+	}
+
+	data = NULL;
+	dns_test_namefromstring("b.example.", &fname);
+	result = dns_qp_findname(qp, dns_fixedname_name(&fname), &data);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	for (i = 0; i < count; i += 2) {
+		result = dns_qp_deletename(qp,
+					   dns_fixedname_name(&fnames[i]));
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	assert_int_equal(deleted, (count + 1) / 2);
+
+	for (i = 0; i < count; i++) {
+		data = NULL;
+		result = dns_qp_findname(qp, dns_fixedname_name(&fnames[i]),
+					 &data);
+		if ((i % 2) == 0) {
+			assert_int_equal(result, ISC_R_NOTFOUND);
+		} else {
+			assert_int_equal(result, ISC_R_SUCCESS);
+			assert_ptr_equal(data, &fnames[i]);
+		}
+	}
+
+	dns_qp_destroy(&qp);
+	assert_null(qp);
+	assert_int_equal(deleted, count);
+}
+
+/* Find the closest predecessor of names */
+static void
+qp_findprevious(void **state) {
+	dns_fixedname_t fnames[sizeof(sorted) / sizeof(sorted[0])];
+	dns_fixedname_t fname;
+	dns_qp_t *qp = NULL;
+	isc_result_t result;
+	unsigned int i;
+	void *data;
+	struct {
+		const char *name;
+		int previous;
+	} tests[] = {
+		{ "com.", -1 },
+		{ "example.", 0 },
+		{ "0.example.", 0 },
+		{ "b.a.example.", 1 },
+		{ "b.example.", 4 },
+		{ "a.z.example.", 10 },
+		{ "zz.z.example.", 11 },
+		{ "z.zz.example.", 15 },
+		{ "example0.", 17 },
+		{ "zzz.", 17 },
+		{ NULL, 0 }
+	};
+
+	UNUSED(state);
+
+	result = dns_qp_create(dt_mctx, getname, NULL, NULL, &qp);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; sorted[i] != NULL; i++) {
+		dns_test_namefromstring(sorted[i], &fnames[i]);
+		result = dns_qp_insert(qp, &fnames[i]);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+
+	for (i = 0; tests[i].name != NULL; i++) {
+		data = NULL;
+		dns_test_namefromstring(tests[i].name, &fname);
+		result = dns_qp_findprevious(qp, dns_fixedname_name(&fname),
+					     &data);
+		if (tests[i].previous < 0) {
+			assert_int_equal(result, ISC_R_NOTFOUND);
+		} else {
+			assert_int_equal(result, ISC_R_SUCCESS);
+			assert_ptr_equal(data, &fnames[tests[i].previous]);
+		}
+	}
+
+	dns_qp_destroy(&qp);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+/*
+ * The number of names used by the benchmark; a zone this size is
+ * what the qp-trie is meant for.
+ */
+#ifndef QP_BENCHMARK_NAMES
+#define QP_BENCHMARK_NAMES	10000000
+#endif
+
+static const dns_name_t *
+getbenchname(void *data, void *arg) {
+	UNUSED(arg);
+
+	return (data);
+}
+
+/*
+ * Compare the memory use and the lookup speed of a qp-trie with that
+ * of an "rbt" zone database holding the same names.  The database
+ * stores the names in its nodes and the trie does not, so the space
+ * taken by the names themselves is added to the trie's share.
+ */
+static void
+benchmark(void **state) {
+	isc_result_t result;
+	char namestr[sizeof("name4294967296.sub4294967296.example.org.")];
+	dns_name_t *names;
+	unsigned char *wire;
+	size_t wiresize, wireused = 0;
+	isc_mem_t *qpmctx = NULL, *dbmctx = NULL;
+	dns_qp_t *qp = NULL;
+	dns_db_t *db = NULL;
+	dns_dbnode_t *node = NULL, **nodes;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	isc_time_t ts1, ts2;
+	unsigned int i, r;
+	unsigned int count = QP_BENCHMARK_NAMES;
+	uint64_t t;
+
+	UNUSED(state);
+
+	/*
+	 * dns_test_begin() has already turned on the recording of
+	 * allocations, which makes freeing the database nodes take
+	 * time proportional to the number still allocated.
+	 */
+	debug_mem_record = false;
+	isc_mem_debugging = 0;
+
+	isc_mem_create(&qpmctx);
+	isc_mem_create(&dbmctx);
+
+	/*
+	 * Keep the names compact, in one buffer, so that ten million
+	 * of them fit in memory along with both indexes.
+	 */
+	names = malloc(count * sizeof(*names));
+	assert_non_null(names);
+	wiresize = (size_t)count * sizeof(namestr);
+	wire = malloc(wiresize);
+	assert_non_null(wire);
+	/*
+	 * The nodes are empty, so they have to be held on to for the
+	 * database not to clean them up again.
+	 */
+	nodes = malloc(count * sizeof(*nodes));
+	assert_non_null(nodes);
+	name = dns_fixedname_initname(&fixed);
+	for (i = 0; i < count; i++) {
+		isc_region_t region;
+
+		snprintf(namestr, sizeof(namestr), "name%u.sub%u.example.org.",
+			 i, i % 1000);
+		dns_test_namefromstring(namestr, &fixed);
+		dns_name_toregion(name, &region);
+		memmove(wire + wireused, region.base, region.length);
+		dns_name_init(&names[i], NULL);
+		region.base = wire + wireused;
+		dns_name_fromregion(&names[i], &region);
+		wireused += region.length;
+	}
+
+	dns_test_namefromstring("example.org.", &fixed);
+	result = dns_db_create(dbmctx, "rbt", name, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_qp_create(qpmctx, getbenchname, NULL, NULL, &qp);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (i = 0; i < count; i++) {
+		result = dns_qp_insert(qp, &names[i]);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("qp-trie: %u inserts, %f seconds\n", count, t / 1000000.0);
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (i = 0; i < count; i++) {
+		nodes[i] = NULL;
+		result = dns_db_findnode(db, &names[i], true, &nodes[i]);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("rbtdb: %u inserts, %f seconds\n", count, t / 1000000.0);
+
+	printf("%u names: qp-trie %zu bytes in all (%zu for the index, "
+	       "%zu for the names), rbtdb %zu bytes "
+	       "(+%zu for node references)\n",
+	       count,
+	       isc_mem_inuse(qpmctx) + count * sizeof(*names) + wireused,
+	       isc_mem_inuse(qpmctx), count * sizeof(*names) + wireused,
+	       isc_mem_inuse(dbmctx), count * sizeof(*nodes));
+
+	srandom(time(NULL));
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (i = 0; i < count; i++) {
+		void *data = NULL;
+		r = random() % count;
+		result = dns_qp_findname(qp, &names[r], &data);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("qp-trie: %u lookups, %f seconds, %f lookups/second\n",
+	       count, t / 1000000.0, count / (t / 1000000.0));
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (i = 0; i < count; i++) {
+		r = random() % count;
+		result = dns_db_findnode(db, &names[r], false, &node);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_db_detachnode(db, &node);
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("rbtdb: %u lookups, %f seconds, %f lookups/second\n",
+	       count, t / 1000000.0, count / (t / 1000000.0));
+
+	for (i = 0; i < count; i++) {
+		dns_db_detachnode(db, &nodes[i]);
+	}
+	dns_qp_destroy(&qp);
+	dns_db_detach(&db);
+	isc_mem_destroy(&qpmctx);
+	isc_mem_destroy(&dbmctx);
+	free(nodes);
+	free(names);
+	free(wire);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(qpkey_order,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(qp_insert_delete,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(qp_findprevious,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
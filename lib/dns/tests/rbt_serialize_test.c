@@ -38,6 +38,7 @@
 #include <isc/stdio.h>
 #include <isc/string.h>
 #include <isc/task.h>
+#include <isc/time.h>
 #include <isc/timer.h>
 #include <isc/util.h>
 
@@ -127,13 +128,16 @@ delete_data(void *data, void *arg) {
 }
 
 static isc_result_t
-write_data(FILE *file, unsigned char *datap, void *arg, uint64_t *crc) {
+write_data(FILE *file, unsigned char *datap, uintptr_t base, uintptr_t node,
+	   void *arg, uint64_t *crc)
+{
 	isc_result_t result;
 	size_t ret = 0;
 	data_holder_t *data;
 	data_holder_t temp;
 	off_t where;
 
+	UNUSED(node);
 	UNUSED(arg);
 
 	REQUIRE(file != NULL);
@@ -151,7 +155,8 @@ write_data(FILE *file, unsigned char *datap, void *arg, uint64_t *crc) {
 	temp = *data;
 	temp.data = (data->len == 0
 		     ? NULL
-		     : (char *)((uintptr_t)where + sizeof(data_holder_t)));
+		     : (char *)(base + (uintptr_t)where +
+				sizeof(data_holder_t)));
 
 	isc_crc64_update(crc, (void *)&temp, sizeof(temp));
 	ret = fwrite(&temp, sizeof(data_holder_t), 1, file);
@@ -170,13 +175,15 @@ write_data(FILE *file, unsigned char *datap, void *arg, uint64_t *crc) {
 }
 
 static isc_result_t
-fix_data(dns_rbtnode_t *p, void *base, size_t max, void *arg, uint64_t *crc) {
+fix_data(dns_rbtnode_t *p, void *base, size_t max, uintptr_t filebase,
+	 void *arg, uint64_t *crc)
+{
 	data_holder_t *data;
 	size_t size;
 
-	UNUSED(base);
-	UNUSED(max);
-	UNUSED(arg);
+	if (arg != NULL) {
+		(*(unsigned int *)arg)++;
+	}
 
 	REQUIRE(crc != NULL);
 	REQUIRE(p != NULL);
@@ -192,15 +199,25 @@ fix_data(dns_rbtnode_t *p, void *base, size_t max, void *arg, uint64_t *crc) {
 
 	size = max - ((char *)p - (char *)base);
 
-	if (data->len > (int) size || data->data > (const char *) max) {
+	if (data->len > (int) size) {
 		return (ISC_R_INVALIDFILE);
 	}
 
 	isc_crc64_update(crc, (void *)data, sizeof(*data));
 
-	data->data = NULL;
-	if (data->len != 0) {
-		data->data = (char *)data + sizeof(data_holder_t);
+	if (filebase == (uintptr_t)base) {
+		/* Used in place: check, don't write. */
+		if (data->data != (data->len == 0
+				   ? NULL
+				   : (char *)data + sizeof(data_holder_t)))
+		{
+			return (ISC_R_INVALIDFILE);
+		}
+	} else {
+		data->data = NULL;
+		if (data->len != 0) {
+			data->data = (char *)data + sizeof(data_holder_t);
+		}
 	}
 
 	if (data->len > 0) {
@@ -324,7 +341,7 @@ serialize_test(void **state) {
 	 */
 	rbtfile = fopen("./zone.bin", "w+b");
 	assert_non_null(rbtfile);
-	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL,
+	result = dns_rbt_serialize_tree(rbtfile, rbt, 0, write_data, NULL,
 					&offset);
 	assert_true(result == ISC_R_SUCCESS);
 	dns_rbt_destroy(&rbt);
@@ -362,6 +379,139 @@ serialize_test(void **state) {
 	unlink("zone.bin");
 }
 
+/*
+ * Map a tree in at the address it was written for, and at another
+ * address; only the second has to write to the nodes while loading,
+ * but both are checked.
+ */
+#define TEST_MAP_BASE 0x200000000000ULL
+
+static void
+serialize_inplace_test(void **state) {
+	dns_rbt_t *rbt = NULL;
+	isc_result_t result;
+	FILE *rbtfile = NULL;
+	dns_rbt_t *inplace = NULL, *moved = NULL;
+	char namestr[sizeof("extra4294967295.example.")];
+	static data_holder_t extra = { 0, NULL };
+	dns_fixedname_t fname;
+	dns_rbtnode_t *node;
+	unsigned int fixed = 0, i;
+	uintptr_t mapbase;
+	off_t offset;
+	int fd;
+	off_t filesize = 0;
+	char *base, *base2, *p;
+
+	UNUSED(state);
+
+	if (sizeof(void *) < 8) {
+		skip();
+	}
+
+	isc_mem_debugging = ISC_MEM_DEBUGRECORD;
+
+	result = dns_rbt_create(dt_mctx, delete_data, NULL, &rbt);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	add_test_data(dt_mctx, rbt);
+
+	mapbase = (uintptr_t)TEST_MAP_BASE;
+	rbtfile = fopen("./zone.bin", "w+b");
+	assert_non_null(rbtfile);
+	result = dns_rbt_serialize_tree(rbtfile, rbt, mapbase, write_data,
+					NULL, &offset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	fclose(rbtfile);
+	dns_rbt_destroy(&rbt);
+
+	fd = open("zone.bin", O_RDWR);
+	assert_int_not_equal(fd, -1);
+	isc_file_getsizefd(fd, &filesize);
+	base = mmap((void *)mapbase, filesize, PROT_READ|PROT_WRITE,
+		    MAP_FILE|MAP_PRIVATE, fd, 0);
+	assert_true(base != NULL && base != MAP_FAILED);
+	if ((uintptr_t)base != mapbase) {
+		close(fd);
+		munmap(base, filesize);
+		unlink("zone.bin");
+		skip();
+	}
+
+	/* The address is taken now, so this has to be relocated. */
+	base2 = mmap((void *)mapbase, filesize, PROT_READ|PROT_WRITE,
+		     MAP_FILE|MAP_PRIVATE, fd, 0);
+	assert_true(base2 != NULL && base2 != MAP_FAILED);
+	assert_true(base2 != base);
+	close(fd);
+
+	result = dns_rbt_deserialize_tree(base, filesize, 0, dt_mctx,
+					  delete_data, NULL, fix_data, &fixed,
+					  NULL, &inplace);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(fixed, sizeof(testdata) / sizeof(testdata[0]) - 1);
+	check_test_data(inplace);
+
+	fixed = 0;
+	result = dns_rbt_deserialize_tree(base2, filesize, 0, dt_mctx,
+					  delete_data, NULL, fix_data, &fixed,
+					  NULL, &moved);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(fixed, sizeof(testdata) / sizeof(testdata[0]) - 1);
+	check_test_data(moved);
+
+	/*
+	 * Grow the tree used in place until the hash table that came
+	 * with the file has been replaced.
+	 */
+	for (i = 0; i < 1000; i++) {
+		snprintf(namestr, sizeof(namestr), "extra%u.example.", i);
+		dns_test_namefromstring(namestr, &fname);
+		result = dns_rbt_addname(inplace, dns_fixedname_name(&fname),
+					 &extra);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	check_test_data(inplace);
+	for (i = 0; i < 1000; i++) {
+		snprintf(namestr, sizeof(namestr), "extra%u.example.", i);
+		dns_test_namefromstring(namestr, &fname);
+		node = NULL;
+		result = dns_rbt_findnode(inplace, dns_fixedname_name(&fname),
+					  NULL, &node, NULL, 0, NULL, NULL);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+
+	dns_rbt_destroy(&inplace);
+	dns_rbt_destroy(&moved);
+	munmap(base, filesize);
+	munmap(base2, filesize);
+
+	/*
+	 * A change to the file is caught by the CRC even when it is
+	 * used in place.
+	 */
+	fd = open("zone.bin", O_RDWR);
+	assert_int_not_equal(fd, -1);
+	base = mmap((void *)mapbase, filesize, PROT_READ|PROT_WRITE,
+		    MAP_FILE|MAP_PRIVATE, fd, 0);
+	close(fd);
+	assert_true((uintptr_t)base == mapbase);
+	for (p = base; p < base + filesize - 15; p++) {
+		if (memcmp(p, "thisisalongname", 15) == 0) {
+			break;
+		}
+	}
+	assert_true(p < base + filesize - 15);
+	*p = 'T';
+	result = dns_rbt_deserialize_tree(base, filesize, 0, dt_mctx,
+					  delete_data, NULL, fix_data, NULL,
+					  NULL, &inplace);
+	assert_int_equal(result, ISC_R_INVALIDFILE);
+	assert_null(inplace);
+	munmap(base, filesize);
+	unlink("zone.bin");
+}
+
 /* Test reading a corrupt map file */
 static void
 deserialize_corrupt_test(void **state) {
@@ -385,7 +535,7 @@ deserialize_corrupt_test(void **state) {
 	add_test_data(dt_mctx, rbt);
 	rbtfile = fopen("./zone.bin", "w+b");
 	assert_non_null(rbtfile);
-	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL,
+	result = dns_rbt_serialize_tree(rbtfile, rbt, 0, write_data, NULL,
 					&offset);
 	assert_true(result == ISC_R_SUCCESS);
 	dns_rbt_destroy(&rbt);
@@ -453,14 +603,124 @@ serialize_align_test(void **state) {
 	assert_true(dns_rbt_serialize_align(0x301) == 0x308);
 }
 
+#if defined(DNS_BENCHMARK_TESTS)
+
+/*
+ * Map in a large tree and look up every name in it.
+ */
+static void
+load_and_search(const char *label, void *hint, unsigned int count) {
+	isc_result_t result;
+	dns_rbt_t *rbt_deserialized = NULL;
+	char namestr[sizeof("name4294967295.sub4294967295.example.org.")];
+	dns_fixedname_t fname;
+	dns_rbtnode_t *node;
+	isc_time_t ts1, ts2, ts3;
+	int fd;
+	off_t filesize = 0;
+	char *base;
+	unsigned int i;
+
+	fd = open("zone.bin", O_RDWR);
+	assert_int_not_equal(fd, -1);
+	isc_file_getsizefd(fd, &filesize);
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	base = mmap(hint, filesize, PROT_READ|PROT_WRITE,
+		    MAP_FILE|MAP_PRIVATE, fd, 0);
+	assert_true(base != NULL && base != MAP_FAILED);
+	close(fd);
+
+	result = dns_rbt_deserialize_tree(base, filesize, 0, dt_mctx,
+					  delete_data, NULL, fix_data, NULL,
+					  NULL, &rbt_deserialized);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < count; i++) {
+		snprintf(namestr, sizeof(namestr), "name%u.sub%u.example.org.",
+			 i, i % 1000);
+		dns_test_namefromstring(namestr, &fname);
+		node = NULL;
+		result = dns_rbt_findnode(rbt_deserialized,
+					  dns_fixedname_name(&fname), NULL,
+					  &node, NULL, 0, NULL, NULL);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+
+	result = isc_time_now(&ts3);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	printf("%s: %u names (%" PRId64 " bytes) loaded in %f seconds, "
+	       "all found in %f seconds\n", label, count, (int64_t)filesize,
+	       isc_time_microdiff(&ts2, &ts1) / 1000000.0,
+	       isc_time_microdiff(&ts3, &ts2) / 1000000.0);
+
+	dns_rbt_destroy(&rbt_deserialized);
+	munmap(base, filesize);
+}
+
+static void
+deserialize_benchmark(void **state) {
+	dns_rbt_t *rbt = NULL;
+	isc_result_t result;
+	FILE *rbtfile = NULL;
+	char namestr[sizeof("name4294967295.sub4294967295.example.org.")];
+	static data_holder_t data = { 0, NULL };
+	dns_fixedname_t fname;
+	off_t offset;
+	unsigned int i, count = 1000000;
+
+	UNUSED(state);
+
+	isc_mem_debugging = 0;
+
+	result = dns_rbt_create(dt_mctx, delete_data, NULL, &rbt);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < count; i++) {
+		snprintf(namestr, sizeof(namestr), "name%u.sub%u.example.org.",
+			 i, i % 1000);
+		dns_test_namefromstring(namestr, &fname);
+		result = dns_rbt_addname(rbt, dns_fixedname_name(&fname),
+					 &data);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+
+	rbtfile = fopen("./zone.bin", "w+b");
+	assert_non_null(rbtfile);
+	result = dns_rbt_serialize_tree(rbtfile, rbt,
+					(uintptr_t)TEST_MAP_BASE,
+					write_data, NULL, &offset);
+	assert_true(result == ISC_R_SUCCESS);
+	fclose(rbtfile);
+	dns_rbt_destroy(&rbt);
+
+	load_and_search("relocated", NULL, count);
+	load_and_search("in place", (void *)(uintptr_t)TEST_MAP_BASE, count);
+
+	unlink("zone.bin");
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
 int
 main(int argc, char **argv) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test_setup_teardown(serialize_test,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(serialize_inplace_test,
+						_setup, _teardown),
 		cmocka_unit_test_setup_teardown(deserialize_corrupt_test,
 						_setup, _teardown),
 		cmocka_unit_test(serialize_align_test),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(deserialize_benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
 	};
 	int c;
 
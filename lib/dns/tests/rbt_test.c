@@ -1202,6 +1202,88 @@ rbt_nodechain(void **state) {
 	test_context_teardown(ctx);
 }
 
+/*
+ * Test that names stay reachable through the node hash table while it
+ * is being grown incrementally, and that they can be removed from
+ * either the old or the new table.
+ */
+static void
+rbt_incremental_rehash(void **state) {
+	isc_result_t result;
+	dns_rbt_t *mytree = NULL;
+	dns_rbtnode_t *node;
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	char namestr[sizeof("name4294967296.example.org.")];
+	size_t hashsize;
+	unsigned int i, j;
+	const unsigned int count = 20000;
+
+	UNUSED(state);
+
+	result = dns_rbt_create(dt_mctx, NULL, NULL, &mytree);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	hashsize = dns_rbt_hashsize(mytree);
+
+	for (i = 0; i < count; i++) {
+		snprintf(namestr, sizeof(namestr), "name%u.example.org.", i);
+		node = NULL;
+		result = insert_helper(mytree, namestr, &node);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		node->data = (void *) (intptr_t) (i + 1);
+
+		/*
+		 * Every time the table has just grown, check that all
+		 * the names are still found while the old table is
+		 * being drained.
+		 */
+		if (dns_rbt_hashsize(mytree) == hashsize)
+			continue;
+		hashsize = dns_rbt_hashsize(mytree);
+		for (j = 0; j <= i; j++) {
+			snprintf(namestr, sizeof(namestr),
+				 "name%u.example.org.", j);
+			dns_test_namefromstring(namestr, &fname);
+			name = dns_fixedname_name(&fname);
+			node = NULL;
+			result = dns_rbt_findnode(mytree, name, NULL, &node,
+						  NULL, DNS_RBTFIND_EMPTYDATA,
+						  NULL, NULL);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			assert_int_equal((intptr_t) node->data, j + 1);
+		}
+	}
+
+	assert_true(dns_rbt_hashsize(mytree) * 3 > count);
+
+	/* Remove every other name and look the rest up again. */
+	for (i = 0; i < count; i += 2) {
+		snprintf(namestr, sizeof(namestr), "name%u.example.org.", i);
+		dns_test_namefromstring(namestr, &fname);
+		name = dns_fixedname_name(&fname);
+		result = dns_rbt_deletename(mytree, name, false);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+
+	for (i = 0; i < count; i++) {
+		snprintf(namestr, sizeof(namestr), "name%u.example.org.", i);
+		dns_test_namefromstring(namestr, &fname);
+		name = dns_fixedname_name(&fname);
+		node = NULL;
+		result = dns_rbt_findnode(mytree, name, NULL, &node, NULL,
+					  DNS_RBTFIND_EMPTYDATA, NULL, NULL);
+		if ((i % 2) == 0) {
+			assert_int_not_equal(result, ISC_R_SUCCESS);
+		} else {
+			assert_int_equal(result, ISC_R_SUCCESS);
+			assert_int_equal((intptr_t) node->data, i + 1);
+		}
+	}
+
+	dns_rbt_destroy(&mytree);
+}
+
 #if defined(DNS_BENCHMARK_TESTS) && !defined(__SANITIZE_THREAD__)
 
 /*
@@ -1317,6 +1399,59 @@ benchmark(void **state) {
 
 	dns_rbt_destroy(&mytree);
 }
+/*
+ * Benchmark insertion into a large tree, reporting the worst-case time
+ * taken by a single dns_rbt_addnode() call.  This used to be dominated
+ * by rebuilding the whole node hash table whenever it had to grow.
+ */
+static void
+insert_benchmark(void **state) {
+	isc_result_t result;
+	char namestr[sizeof("name18446744073709551616.example.org.")];
+	dns_rbt_t *mytree = NULL;
+	dns_rbtnode_t *node;
+	unsigned int i;
+	unsigned int maxvalue = 4000000;
+	isc_time_t ts0, ts1, ts2;
+	uint64_t t, maxt = 0;
+	unsigned int maxi = 0;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	result = dns_rbt_create(dt_mctx, NULL, NULL, &mytree);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = isc_time_now(&ts0);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < maxvalue; i++) {
+		snprintf(namestr, sizeof(namestr), "name%u.example.org.", i);
+		node = NULL;
+		result = isc_time_now(&ts1);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		result = insert_helper(mytree, namestr, &node);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		result = isc_time_now(&ts2);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		t = isc_time_microdiff(&ts2, &ts1);
+		if (t > maxt) {
+			maxt = t;
+			maxi = i;
+		}
+	}
+
+	t = isc_time_microdiff(&ts2, &ts0);
+
+	printf("%u addnode calls, %f seconds, "
+	       "worst case %" PRIu64 " usec (insertion %u), "
+	       "hash table size %zu\n",
+	       maxvalue, t / 1000000.0, maxt, maxi,
+	       dns_rbt_hashsize(mytree));
+
+	dns_rbt_destroy(&mytree);
+}
 #endif /* defined(DNS_BENCHMARK_TESTS) && !defined(__SANITIZE_THREAD__)  */
 
 int
@@ -1342,8 +1477,12 @@ main(void) {
 						_setup, _teardown),
 		cmocka_unit_test_setup_teardown(rbt_nodechain,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(rbt_incremental_rehash,
+						_setup, _teardown),
 #if defined(DNS_BENCHMARK_TESTS) && !defined(__SANITIZE_THREAD__)
 		cmocka_unit_test_setup_teardown(benchmark, _setup, _teardown),
+		cmocka_unit_test_setup_teardown(insert_benchmark,
+						_setup, _teardown),
 #endif /* defined(DNS_BENCHMARK_TESTS) && !defined(__SANITIZE_THREAD__) */
 	};
 
@@ -15,7 +15,10 @@
 #include <stddef.h>
 #include <setjmp.h>
 
+#include <inttypes.h>
 #include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -23,8 +26,17 @@
 #define UNIT_TESTING
 #include <cmocka.h>
 
+#include <isc/buffer.h>
+#include <isc/print.h>
+#include <isc/time.h>
 #include <isc/util.h>
 
+#include <dns/compress.h>
+#include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/message.h>
+#include <dns/rdata.h>
+#include <dns/rdatalist.h>
 #include <dns/rdataset.h>
 #include <dns/rdatastruct.h>
 
@@ -127,10 +139,541 @@ trimttl(void **state) {
 	assert_int_equal(sigrdataset.ttl, 0);
 }
 
+#define MAXRECORDS	100
+
+static dns_db_t *db = NULL;
+static dns_dbnode_t *node = NULL;
+static dns_fixedname_t fowner;
+static dns_name_t *owner = NULL;
+
+/*
+ * The methods of the rdatasets read from the database, without the
+ * direct access to the slab, to render them the general way.
+ */
+static dns_rdatasetmethods_t nofastpath;
+
+/*
+ * Add 'count' records of type 'type' with 'length' bytes of rdata
+ * each to the node and find them as 'rdataset'.
+ */
+static void
+addrecords(dns_rdatatype_t type, unsigned int length, unsigned int count,
+	   dns_rdataset_t *rdataset)
+{
+	static unsigned char data[MAXRECORDS][16];
+	dns_rdata_t rdata[MAXRECORDS];
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t listset;
+	dns_dbversion_t *version = NULL;
+	isc_result_t result;
+	isc_region_t r;
+	unsigned int i;
+
+	INSIST(count <= MAXRECORDS && length <= sizeof(data[0]));
+
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.rdclass = dns_rdataclass_in;
+	rdatalist.type = type;
+	rdatalist.ttl = 3600;
+	for (i = 0; i < count; i++) {
+		memset(data[i], 0, length);
+		data[i][0] = 10;
+		data[i][length - 2] = i / 7;
+		data[i][length - 1] = i * 37;
+		r.base = data[i];
+		r.length = length;
+		dns_rdata_init(&rdata[i]);
+		dns_rdata_fromregion(&rdata[i], dns_rdataclass_in, type, &r);
+		ISC_LIST_APPEND(rdatalist.rdata, &rdata[i], link);
+	}
+	dns_rdataset_init(&listset);
+	result = dns_rdatalist_tordataset(&rdatalist, &listset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_newversion(db, &version);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_addrdataset(db, node, version, 0, &listset, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_closeversion(db, &version, true);
+	dns_rdataset_disassociate(&listset);
+
+	dns_rdataset_init(rdataset);
+	result = dns_db_findrdataset(db, node, NULL, type, 0, 0, rdataset,
+				     NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dns_rdataset_count(rdataset), count);
+	assert_non_null(rdataset->methods->getslab);
+
+	nofastpath = *rdataset->methods;
+	nofastpath.getslab = NULL;
+}
+
+static void
+opendb(void) {
+	isc_result_t result;
+
+	dns_test_namefromstring("www.example.", &fowner);
+	owner = dns_fixedname_name(&fowner);
+
+	result = dns_db_create(dt_mctx, "rbt", dns_rootname, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_findnode(db, owner, true, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+}
+
+static void
+closedb(void) {
+	dns_db_detachnode(db, &node);
+	dns_db_detach(&db);
+}
+
+/*
+ * Render 'rdataset' into 'buffer', after two bytes of padding so that
+ * compression pointers can be used, with or without the fast path.
+ */
+static isc_result_t
+render(dns_rdataset_t *rdataset, bool fast, bool partial,
+       isc_buffer_t *buffer, unsigned int *countp)
+{
+	const dns_rdatasetmethods_t *methods = rdataset->methods;
+	dns_compress_t cctx;
+	isc_result_t result;
+
+	*countp = 0;
+	result = dns_compress_init(&cctx, -1, dt_mctx);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	isc_buffer_putuint16(buffer, 0);
+	if (!fast) {
+		rdataset->methods = &nofastpath;
+	}
+	if (partial) {
+		result = dns_rdataset_towirepartial(rdataset, owner, &cctx,
+						    buffer, NULL, NULL, 0,
+						    countp, NULL);
+	} else {
+		result = dns_rdataset_towire(rdataset, owner, &cctx, buffer,
+					     0, countp);
+	}
+	rdataset->methods = methods;
+	dns_compress_invalidate(&cctx);
+
+	return (result);
+}
+
+static int
+compare_records(const void *a, const void *b) {
+	return (memcmp(a, b, 16));
+}
+
+/*
+ * Extract the rdata of the records rendered by render() and sort them.
+ */
+static unsigned int
+getrecords(isc_buffer_t *buffer, unsigned char records[][16]) {
+	unsigned char *p = isc_buffer_base(buffer);
+	unsigned char *end = p + isc_buffer_usedlength(buffer);
+	unsigned int count = 0, length;
+
+	p += 2;
+	while (p < end) {
+		while (*p != 0 && *p < 192) {
+			p += *p + 1;
+		}
+		p += (*p == 0) ? 1 : 2;
+		p += 8;
+		length = p[0] * 256 + p[1];
+		p += 2;
+		assert_true(length <= 16 && count < MAXRECORDS);
+		memset(records[count], 0, 16);
+		memmove(records[count], p, length);
+		p += length;
+		count++;
+	}
+	assert_ptr_equal(p, end);
+	qsort(records, count, sizeof(records[0]), compare_records);
+
+	return (count);
+}
+
+/* Rendering a slab directly gives the same result as the general case */
+static void
+towire_slab(void **state) {
+	static const struct {
+		dns_rdatatype_t type;
+		unsigned int length;
+		unsigned int count;
+	} tests[] = {
+		{ dns_rdatatype_a, 4, 1 },
+		{ dns_rdatatype_a, 4, 5 },
+		{ dns_rdatatype_a, 4, 40 },
+		{ dns_rdatatype_aaaa, 16, 3 },
+		{ dns_rdatatype_aaaa, 16, MAXRECORDS },
+	};
+	static const unsigned int attributes[] = {
+		0,
+		DNS_RDATASETATTR_CYCLIC,
+		DNS_RDATASETATTR_RANDOMIZE,
+		DNS_RDATASETATTR_CYCLIC | DNS_RDATASETATTR_RANDOMIZE,
+		DNS_RDATASETATTR_LOADORDER,
+		DNS_RDATASETATTR_LOADORDER | DNS_RDATASETATTR_CYCLIC,
+	};
+	unsigned char buf1[4096], buf2[4096];
+	unsigned char records1[MAXRECORDS][16], records2[MAXRECORDS][16];
+	isc_buffer_t b1, b2;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+	unsigned int i, j, cycle, count1, count2;
+
+	UNUSED(state);
+
+	opendb();
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		addrecords(tests[i].type, tests[i].length, tests[i].count,
+			   &rdataset);
+
+		for (j = 0; j < sizeof(attributes) / sizeof(attributes[0]);
+		     j++)
+		{
+			bool random = (attributes[j] &
+				       DNS_RDATASETATTR_RANDOMIZE) != 0;
+
+			rdataset.attributes &= ~(DNS_RDATASETATTR_CYCLIC |
+						 DNS_RDATASETATTR_RANDOMIZE |
+						 DNS_RDATASETATTR_LOADORDER);
+			rdataset.attributes |= attributes[j];
+
+			for (cycle = 0; cycle < tests[i].count + 2; cycle++) {
+				rdataset.count = cycle;
+
+				isc_buffer_init(&b1, buf1, sizeof(buf1));
+				result = render(&rdataset, true, false, &b1,
+						&count1);
+				assert_int_equal(result, ISC_R_SUCCESS);
+				isc_buffer_init(&b2, buf2, sizeof(buf2));
+				result = render(&rdataset, false, false, &b2,
+						&count2);
+				assert_int_equal(result, ISC_R_SUCCESS);
+
+				assert_int_equal(count1, tests[i].count);
+				assert_int_equal(count2, tests[i].count);
+				assert_int_equal(isc_buffer_usedlength(&b1),
+						 isc_buffer_usedlength(&b2));
+				if (!random) {
+					assert_memory_equal(buf1, buf2,
+						isc_buffer_usedlength(&b1));
+				} else {
+					assert_int_equal(
+						getrecords(&b1, records1),
+						tests[i].count);
+					assert_int_equal(
+						getrecords(&b2, records2),
+						tests[i].count);
+					assert_memory_equal(records1, records2,
+						tests[i].count * 16);
+				}
+			}
+		}
+
+		dns_rdataset_disassociate(&rdataset);
+	}
+
+	closedb();
+}
+
+/* A slab that does not fit is rendered in part or not at all */
+static void
+towire_slab_nospace(void **state) {
+	unsigned char buf1[1024], buf2[1024];
+	isc_buffer_t b1, b2;
+	dns_rdataset_t rdataset;
+	isc_result_t result1, result2;
+	unsigned int size, count1, count2;
+
+	UNUSED(state);
+
+	opendb();
+	addrecords(dns_rdatatype_aaaa, 16, 20, &rdataset);
+	rdataset.attributes |= DNS_RDATASETATTR_CYCLIC;
+	rdataset.count = 7;
+
+	for (size = 2; size < sizeof(buf1); size += 3) {
+		isc_buffer_init(&b1, buf1, size);
+		result1 = render(&rdataset, true, false, &b1, &count1);
+		isc_buffer_init(&b2, buf2, size);
+		result2 = render(&rdataset, false, false, &b2, &count2);
+		assert_int_equal(result1, result2);
+		assert_int_equal(count1, count2);
+		assert_int_equal(isc_buffer_usedlength(&b1),
+				 isc_buffer_usedlength(&b2));
+
+		isc_buffer_init(&b1, buf1, size);
+		result1 = render(&rdataset, true, true, &b1, &count1);
+		isc_buffer_init(&b2, buf2, size);
+		result2 = render(&rdataset, false, true, &b2, &count2);
+		assert_int_equal(result1, result2);
+		assert_int_equal(count1, count2);
+		assert_int_equal(isc_buffer_usedlength(&b1),
+				 isc_buffer_usedlength(&b2));
+		assert_memory_equal(buf1, buf2, isc_buffer_usedlength(&b1));
+		if (result1 == ISC_R_SUCCESS) {
+			assert_int_equal(count1, 20);
+		}
+	}
+
+	dns_rdataset_disassociate(&rdataset);
+	closedb();
+}
+
+/* Answers, which query.c asks for in load order, take the fast path */
+static void
+towire_slab_loadorder(void **state) {
+	unsigned char buf1[1024], buf2[1024];
+	isc_buffer_t b1, b2;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+	unsigned int count1, count2;
+
+	UNUSED(state);
+
+	opendb();
+	addrecords(dns_rdatatype_a, 4, 5, &rdataset);
+	rdataset.attributes |= DNS_RDATASETATTR_LOADORDER;
+
+#if DNS_RDATASET_FIXED
+	assert_null((rdataset.methods->getslab)(&rdataset));
+#else /* DNS_RDATASET_FIXED */
+	assert_non_null((rdataset.methods->getslab)(&rdataset));
+#endif /* DNS_RDATASET_FIXED */
+
+	isc_buffer_init(&b1, buf1, sizeof(buf1));
+	result = render(&rdataset, true, false, &b1, &count1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	isc_buffer_init(&b2, buf2, sizeof(buf2));
+	result = render(&rdataset, false, false, &b2, &count2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(count1, 5);
+	assert_int_equal(count2, 5);
+	assert_int_equal(isc_buffer_usedlength(&b1),
+			 isc_buffer_usedlength(&b2));
+	assert_memory_equal(buf1, buf2, isc_buffer_usedlength(&b1));
+
+	dns_rdataset_disassociate(&rdataset);
+	closedb();
+}
+
+/* The size of a slab can be bounded without rendering it */
+static void
+minwiresize(void **state) {
+	static const struct {
+		dns_rdatatype_t type;
+		unsigned int length;
+		unsigned int count;
+	} tests[] = {
+		{ dns_rdatatype_a, 4, 1 },
+		{ dns_rdatatype_a, 4, 40 },
+		{ dns_rdatatype_aaaa, 16, 3 },
+		{ dns_rdatatype_txt, 11, 9 },
+	};
+	unsigned char buf[4096];
+	isc_buffer_t b;
+	dns_rdataset_t rdataset;
+	const dns_rdatasetmethods_t *methods;
+	isc_result_t result;
+	unsigned int i, count;
+
+	UNUSED(state);
+
+	opendb();
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		addrecords(tests[i].type, tests[i].length, tests[i].count,
+			   &rdataset);
+
+		/*
+		 * Only the first owner name is rendered in full, instead
+		 * of as a compression pointer.
+		 */
+		isc_buffer_init(&b, buf, sizeof(buf));
+		result = render(&rdataset, true, false, &b, &count);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		assert_int_equal(dns_rdataset_minwiresize(&rdataset, owner),
+				 isc_buffer_usedlength(&b) - 2 -
+				 (owner->length - 2));
+
+		/*
+		 * Without the slab, only the fixed part is known.
+		 */
+		methods = rdataset.methods;
+		rdataset.methods = &nofastpath;
+		assert_int_equal(dns_rdataset_minwiresize(&rdataset, owner),
+				 tests[i].count * 12);
+		rdataset.methods = methods;
+
+		dns_rdataset_disassociate(&rdataset);
+	}
+
+	closedb();
+}
+
+/*
+ * An RRset known not to fit is not rendered, and leaves the message as
+ * one which is rendered and rolled back does.
+ */
+static void
+rendersection_predict(void **state) {
+	static const struct {
+		unsigned int space;
+		isc_result_t result;
+		bool predicted;
+	} tests[] = {
+		/* 20 AAAA records take 571 bytes, at least 560 */
+		{ 500, ISC_R_NOSPACE, true },
+		{ 559, ISC_R_NOSPACE, true },
+		{ 560, ISC_R_NOSPACE, false },
+		{ 570, ISC_R_NOSPACE, false },
+		{ 571, ISC_R_SUCCESS, false },
+	};
+	unsigned char buf[1024];
+	isc_buffer_t b;
+	dns_message_t *msg = NULL;
+	dns_name_t *name = NULL;
+	dns_rdataset_t rdataset, *mrdataset = NULL;
+	dns_compress_t cctx;
+	isc_result_t result;
+	unsigned int i;
+
+	UNUSED(state);
+
+	opendb();
+	addrecords(dns_rdatatype_aaaa, 16, 20, &rdataset);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		result = dns_message_create(dt_mctx, DNS_MESSAGE_INTENTRENDER,
+					    &msg);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		result = dns_message_gettempname(msg, &name);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_name_clone(owner, name);
+		result = dns_message_gettemprdataset(msg, &mrdataset);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_rdataset_clone(&rdataset, mrdataset);
+		ISC_LIST_APPEND(name->list, mrdataset, link);
+		dns_message_addname(msg, name, DNS_SECTION_ANSWER);
+		name = NULL;
+		mrdataset = NULL;
+
+		result = dns_compress_init(&cctx, -1, dt_mctx);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		isc_buffer_init(&b, buf,
+				DNS_MESSAGE_HEADERLEN + tests[i].space);
+		result = dns_message_renderbegin(msg, &cctx, &b);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		result = dns_message_rendersection(msg, DNS_SECTION_ANSWER, 0);
+		assert_int_equal(result, tests[i].result);
+		assert_int_equal(dns_message_nospacepredicted(msg),
+				 tests[i].predicted);
+		if (result == ISC_R_SUCCESS) {
+			assert_int_equal(isc_buffer_usedlength(&b),
+					 DNS_MESSAGE_HEADERLEN + 571);
+		} else {
+			assert_int_equal(isc_buffer_usedlength(&b),
+					 DNS_MESSAGE_HEADERLEN);
+		}
+		result = dns_message_renderend(msg);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		assert_int_equal(msg->counts[DNS_SECTION_ANSWER],
+				 tests[i].result == ISC_R_SUCCESS ? 20 : 0);
+
+		dns_compress_invalidate(&cctx);
+		dns_message_destroy(&msg);
+	}
+
+	dns_rdataset_disassociate(&rdataset);
+	closedb();
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+/*
+ * Render large A and AAAA RRsets directly from their slabs and the
+ * general way.
+ */
+static void
+towire_benchmark(void **state) {
+	static const struct {
+		dns_rdatatype_t type;
+		unsigned int length;
+		const char *name;
+	} tests[] = {
+		{ dns_rdatatype_a, 4, "A" },
+		{ dns_rdatatype_aaaa, 16, "AAAA" },
+	};
+	unsigned char buf[4096];
+	isc_buffer_t b;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+	isc_time_t ts1, ts2;
+	unsigned int i, n, count, fast;
+	unsigned int loops = 200000;
+	uint64_t t;
+
+	UNUSED(state);
+
+	debug_mem_record = false;
+
+	opendb();
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		addrecords(tests[i].type, tests[i].length, MAXRECORDS,
+			   &rdataset);
+		rdataset.attributes |= DNS_RDATASETATTR_CYCLIC;
+
+		for (fast = 0; fast < 2; fast++) {
+			result = isc_time_now(&ts1);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			for (n = 0; n < loops; n++) {
+				rdataset.count = n;
+				isc_buffer_init(&b, buf, sizeof(buf));
+				result = render(&rdataset, fast, false, &b,
+						&count);
+				assert_int_equal(result, ISC_R_SUCCESS);
+			}
+			result = isc_time_now(&ts2);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			t = isc_time_microdiff(&ts2, &ts1);
+			printf("%u x %u %s records, %s: %f seconds, "
+			       "%f RRsets/second\n", loops, MAXRECORDS,
+			       tests[i].name, fast ? "from slab" : "general",
+			       t / 1000000.0, loops / (t / 1000000.0));
+		}
+
+		dns_rdataset_disassociate(&rdataset);
+	}
+
+	closedb();
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
 int
 main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test_setup_teardown(trimttl, _setup, _teardown),
+		cmocka_unit_test_setup_teardown(towire_slab,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(towire_slab_nospace,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(towire_slab_loadorder,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(minwiresize,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(rendersection_predict,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(towire_benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
 	};
 
 	return (cmocka_run_group_tests(tests, NULL, NULL));
@@ -26,16 +26,25 @@
 #include <isc/buffer.h>
 #include <isc/print.h>
 #include <isc/socket.h>
+#include <isc/stats.h>
+#include <isc/stdtime.h>
 #include <isc/task.h>
 #include <isc/timer.h>
 #include <isc/util.h>
 
+#include <dns/cache.h>
+#include <dns/db.h>
 #include <dns/dispatch.h>
 #include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdatalist.h>
+#include <dns/rdataset.h>
 #include <dns/resolver.h>
+#include <dns/stats.h>
 #include <dns/view.h>
 
 #include "dnstest.h"
+#include "../resolver_p.h"
 
 static dns_dispatchmgr_t *dispatchmgr = NULL;
 static dns_dispatch_t *dispatch = NULL;
@@ -202,6 +211,486 @@ settimeout_overmax_test(void **state) {
 	destroy_resolver(&resolver);
 }
 
+/* dns_resolver_sethedging */
+static void
+sethedging_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+
+	UNUSED(state);
+
+	mkres(&resolver);
+
+	assert_int_equal(dns_resolver_gethedging(resolver), 0);
+	assert_int_equal(dns_resolver_gethedgedelay(resolver), 0);
+
+	dns_resolver_sethedging(resolver, 5);
+	assert_int_equal(dns_resolver_gethedging(resolver), 5);
+
+	/* No RTTs have been seen yet. */
+	assert_int_equal(dns_resolver_gethedgedelay(resolver), 0);
+
+	dns_resolver_sethedging(resolver, 0);
+	assert_int_equal(dns_resolver_gethedging(resolver), 0);
+
+	destroy_resolver(&resolver);
+}
+
+/* dns_resolver_settcppool */
+static void
+settcppool_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+	unsigned int maxconns, idletime;
+
+	UNUSED(state);
+
+	mkres(&resolver);
+
+	dns_resolver_gettcppool(resolver, &maxconns, &idletime);
+	assert_int_equal(maxconns, 0);
+	assert_int_equal(idletime, 10);
+
+	dns_resolver_settcppool(resolver, 2, 30);
+	dns_resolver_gettcppool(resolver, &maxconns, &idletime);
+	assert_int_equal(maxconns, 2);
+	assert_int_equal(idletime, 30);
+
+	dns_resolver_settcppool(resolver, 0, 30);
+	dns_resolver_gettcppool(resolver, &maxconns, &idletime);
+	assert_int_equal(maxconns, 0);
+
+	destroy_resolver(&resolver);
+}
+
+/* dns_resolver_setrefresh */
+static void
+setrefresh_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+	unsigned int qps, hits;
+
+	UNUSED(state);
+
+	mkres(&resolver);
+
+	dns_resolver_getrefresh(resolver, &qps, &hits);
+	assert_int_equal(qps, 0);
+	assert_int_equal(hits, 16);
+
+	dns_resolver_setrefresh(resolver, 100, 4);
+	dns_resolver_getrefresh(resolver, &qps, &hits);
+	assert_int_equal(qps, 100);
+	assert_int_equal(hits, 4);
+
+	dns_resolver_setrefresh(resolver, 0, 0);
+	dns_resolver_getrefresh(resolver, &qps, &hits);
+	assert_int_equal(qps, 0);
+	assert_int_equal(hits, 1);
+
+	destroy_resolver(&resolver);
+}
+
+/*
+ * The refresh tests below run against a view with a cache and resolver
+ * statistics.  The resolver has no hints, so the refresh fetches it
+ * tries to start fail at once and nothing is sent.
+ */
+static dns_db_t *cachedb = NULL;
+static isc_stats_t *resstats = NULL;
+
+static void
+mkrefresh(dns_resolver_t **resolverp, unsigned int qps, unsigned int hits) {
+	dns_cache_t *cache = NULL;
+	isc_result_t result;
+
+	result = dns_cache_create(dt_mctx, dt_mctx, taskmgr, timermgr,
+				  dns_rdataclass_in, "", "rbt", 0, NULL,
+				  &cache);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_view_setcache(view, cache, false);
+	dns_cache_attachdb(cache, &cachedb);
+	dns_cache_detach(&cache);
+
+	result = isc_stats_create(dt_mctx, &resstats,
+				  dns_resstatscounter_max);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_view_setresstats(view, resstats);
+
+	mkres(resolverp);
+	dns_resolver_setrefresh(*resolverp, qps, hits);
+	dns_resolver_freeze(*resolverp);
+	dns_view_freeze(view);
+}
+
+static void
+destroy_refresh(dns_resolver_t **resolverp) {
+	destroy_resolver(resolverp);
+	isc_stats_detach(&resstats);
+	dns_db_detach(&cachedb);
+}
+
+/*
+ * Wait for the start of a second, so that the steps of a test that
+ * take the current time all see the same one.
+ */
+static isc_stdtime_t
+nextsecond(void) {
+	isc_stdtime_t start, now;
+
+	isc_stdtime_get(&start);
+	do {
+		usleep(1000);
+		isc_stdtime_get(&now);
+	} while (now == start);
+
+	return (now);
+}
+
+/*
+ * Add an A RRset for 'namestr' with address 'addr' to the cache at
+ * 'now'.
+ */
+static void
+addcache(const char *namestr, uint8_t addr, dns_ttl_t ttl,
+	 isc_stdtime_t now)
+{
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_dbnode_t *node = NULL;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	unsigned char data[4] = { 192, 0, 2, 0 };
+	isc_result_t result;
+
+	data[3] = addr;
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, namestr, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	dns_rdata_init(&rdata);
+	DE_CONST(data, rdata.data);
+	rdata.length = sizeof(data);
+	rdata.rdclass = dns_rdataclass_in;
+	rdata.type = dns_rdatatype_a;
+
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.rdclass = dns_rdataclass_in;
+	rdatalist.type = dns_rdatatype_a;
+	rdatalist.ttl = ttl;
+	ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+
+	dns_rdataset_init(&rdataset);
+	result = dns_rdatalist_tordataset(&rdatalist, &rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_findnode(cachedb, name, true, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_db_addrdataset(cachedb, node, NULL, now, &rdataset,
+				    0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_detachnode(cachedb, &node);
+	dns_rdataset_disassociate(&rdataset);
+}
+
+/*
+ * Look up the A RRset of 'namestr' in the cache at 'now', leaving it in
+ * 'rdataset'.
+ */
+static void
+findcache(const char *namestr, isc_stdtime_t now, dns_rdataset_t *rdataset) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_dbnode_t *node = NULL;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, namestr, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_db_findnode(cachedb, name, false, &node);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_rdataset_init(rdataset);
+	result = dns_db_findrdataset(cachedb, node, NULL, dns_rdatatype_a, 0,
+				     now, rdataset, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_detachnode(cachedb, &node);
+}
+
+/*
+ * Answer 'n' queries for the A RRset of 'namestr' from the cache, the
+ * way query.c does.
+ */
+static void
+answer(dns_resolver_t *resolver, const char *namestr, unsigned int n) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_rdataset_t rdataset;
+	isc_stdtime_t now;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, namestr, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	while (n-- > 0) {
+		isc_stdtime_get(&now);
+		findcache(namestr, now, &rdataset);
+		dns_resolver_refreshhit(resolver, name, &rdataset);
+		dns_rdataset_disassociate(&rdataset);
+	}
+}
+
+/*
+ * Answer queries for 'namestr' until one of them is sampled and the
+ * RRset is tracked.  Since the cache starts the lookup counts of its
+ * RRsets at different values, this can take up to 16 answers.
+ */
+static void
+track(dns_resolver_t *resolver, const char *namestr) {
+	unsigned int count, i;
+
+	count = dns__resolver_refreshcount(resolver);
+	for (i = 0; i < 16; i++) {
+		answer(resolver, namestr, 1);
+		if (dns__resolver_refreshcount(resolver) != count) {
+			break;
+		}
+	}
+	assert_int_equal(dns__resolver_refreshcount(resolver), count + 1);
+}
+
+/*
+ * Check that the tracked RRset expiring first is 'namestr', expiring
+ * at 'expire'.
+ */
+static void
+checknext(dns_resolver_t *resolver, const char *namestr,
+	  isc_stdtime_t expire, bool refreshed)
+{
+	dns_fixedname_t fixed, fnext;
+	dns_name_t *name, *next;
+	dns_rdatatype_t type;
+	isc_stdtime_t nextexpire;
+	bool nextrefreshed;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, namestr, 0, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	next = dns_fixedname_initname(&fnext);
+
+	result = dns__resolver_refreshnext(resolver, next, &type,
+					   &nextexpire, &nextrefreshed);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(dns_name_equal(next, name));
+	assert_int_equal(type, dns_rdatatype_a);
+	assert_int_equal(nextexpire, expire);
+	assert_int_equal(nextrefreshed, refreshed);
+}
+
+/* dns_resolver_refreshhit */
+static void
+refreshhit_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+	isc_stdtime_t now;
+
+	UNUSED(state);
+
+	mkrefresh(&resolver, 0, 1);
+
+	now = nextsecond();
+	addcache("a.example.", 1, 3600, now);
+	addcache("short.example.", 1, 5, now);
+
+	/* Nothing is tracked while refreshing is off. */
+	answer(resolver, "a.example.", 16);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 0);
+
+	/* One cache answer in 16 is sampled. */
+	dns_resolver_setrefresh(resolver, 10, 1);
+	answer(resolver, "a.example.", 16);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+	checknext(resolver, "a.example.", now + 3600, false);
+
+	/* Sampling it again does not track it twice. */
+	answer(resolver, "a.example.", 16);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+
+	/* RRsets with short TTLs are not worth refreshing. */
+	answer(resolver, "short.example.", 16);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+
+	/* Turning refreshing off forgets everything. */
+	dns_resolver_setrefresh(resolver, 0, 1);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 0);
+
+	destroy_refresh(&resolver);
+}
+
+/* refresh heap order */
+static void
+refreshorder_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+	isc_stdtime_t now;
+
+	UNUSED(state);
+
+	mkrefresh(&resolver, 10, 2);
+
+	now = nextsecond();
+	addcache("a.example.", 1, 3000, now);
+	addcache("b.example.", 1, 1000, now);
+	addcache("c.example.", 1, 2000, now);
+	track(resolver, "a.example.");
+	track(resolver, "b.example.");
+	track(resolver, "c.example.");
+
+	checknext(resolver, "b.example.", now + 1000, false);
+
+	/* Nothing is due until three seconds before it expires. */
+	dns__resolver_refreshtick(resolver, now + 1000 - 4);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 3);
+
+	/*
+	 * None were looked up again after being tracked, so they are
+	 * not popular enough to refresh.
+	 */
+	dns__resolver_refreshtick(resolver, now + 1000 - 3);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 2);
+	checknext(resolver, "c.example.", now + 2000, false);
+
+	dns__resolver_refreshtick(resolver, now + 2000 - 3);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+	checknext(resolver, "a.example.", now + 3000, false);
+
+	dns__resolver_refreshtick(resolver, now + 3000 - 3);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 0);
+
+	assert_int_equal(isc_stats_get_counter(resstats,
+				dns_resstatscounter_refreshskipped), 0);
+
+	destroy_refresh(&resolver);
+}
+
+/* refresh-popular-qps budget */
+static void
+refreshbudget_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+	isc_stdtime_t now;
+
+	UNUSED(state);
+
+	mkrefresh(&resolver, 2, 1);
+
+	now = nextsecond();
+	addcache("a.example.", 1, 3600, now);
+	addcache("b.example.", 1, 3600, now);
+	addcache("c.example.", 1, 3600, now);
+	addcache("d.example.", 1, 3600, now);
+	track(resolver, "a.example.");
+	track(resolver, "b.example.");
+	track(resolver, "c.example.");
+	track(resolver, "d.example.");
+
+	/*
+	 * All four are popular enough, but only two can be refreshed
+	 * per tick; the others wait for the next one.
+	 */
+	dns__resolver_refreshtick(resolver, now + 3600 - 3);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 2);
+	assert_int_equal(isc_stats_get_counter(resstats,
+				dns_resstatscounter_refreshskipped), 0);
+
+	/* If the budget never allows them, they expire as usual. */
+	dns_resolver_setrefresh(resolver, 1, 1);
+	dns__resolver_refreshtick(resolver, now + 3600 - 2);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+	dns__resolver_refreshtick(resolver, now + 3600);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 0);
+	assert_int_equal(isc_stats_get_counter(resstats,
+				dns_resstatscounter_refreshskipped), 1);
+
+	destroy_refresh(&resolver);
+}
+
+/* tracking refreshed RRsets again */
+static void
+refreshdone_test(void **state) {
+	dns_resolver_t *resolver = NULL;
+	dns_fixedname_t fa, fb, fc;
+	dns_name_t *a, *b, *c;
+	dns_rdataset_t rdataset;
+	isc_stdtime_t now;
+	isc_result_t result;
+
+	UNUSED(state);
+
+	a = dns_fixedname_initname(&fa);
+	b = dns_fixedname_initname(&fb);
+	c = dns_fixedname_initname(&fc);
+	assert_int_equal(dns_name_fromstring(a, "a.example.", 0, NULL),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_name_fromstring(b, "b.example.", 0, NULL),
+			 ISC_R_SUCCESS);
+	assert_int_equal(dns_name_fromstring(c, "c.example.", 0, NULL),
+			 ISC_R_SUCCESS);
+
+	mkrefresh(&resolver, 10, 1);
+
+	now = nextsecond();
+	addcache("a.example.", 1, 3600, now);
+	addcache("b.example.", 1, 3600, now);
+	addcache("c.example.", 1, 3600, now);
+	track(resolver, "a.example.");
+	track(resolver, "b.example.");
+	track(resolver, "c.example.");
+
+	/* A failed refresh stops the tracking. */
+	result = dns__resolver_refreshdone(resolver, b, dns_rdatatype_a,
+					   ISC_R_TIMEDOUT, NULL,
+					   now + 3600 - 3);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 2);
+
+	/* So does one that leaves an RRset with a short TTL. */
+	addcache("c.example.", 2, 5, now + 3600 - 3);
+	findcache("c.example.", now + 3600 - 3, &rdataset);
+	result = dns__resolver_refreshdone(resolver, c, dns_rdatatype_a,
+					   ISC_R_SUCCESS, &rdataset,
+					   now + 3600 - 3);
+	dns_rdataset_disassociate(&rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+
+	/* A successful refresh tracks the new RRset. */
+	addcache("a.example.", 2, 1800, now + 3600 - 3);
+	findcache("a.example.", now + 3600 - 3, &rdataset);
+	result = dns__resolver_refreshdone(resolver, a, dns_rdatatype_a,
+					   ISC_R_SUCCESS, &rdataset,
+					   now + 3600 - 3);
+	dns_rdataset_disassociate(&rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 1);
+	checknext(resolver, "a.example.", now + 3600 - 3 + 1800, true);
+
+	/*
+	 * When it is next due, the lookups of the refreshed RRset count
+	 * as cache misses avoided.
+	 */
+	findcache("a.example.", now + 3600, &rdataset);
+	dns_rdataset_disassociate(&rdataset);
+	dns_resolver_setrefresh(resolver, 10, 100);
+	dns__resolver_refreshtick(resolver, now + 3600 - 3 + 1800 - 3);
+	assert_int_equal(dns__resolver_refreshcount(resolver), 0);
+	assert_int_equal(isc_stats_get_counter(resstats,
+				dns_resstatscounter_refreshused), 1);
+
+	result = dns__resolver_refreshdone(resolver, a, dns_rdatatype_a,
+					   ISC_R_SUCCESS, NULL, now);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	destroy_refresh(&resolver);
+}
+
 int
 main(void) {
 	const struct CMUnitTest tests[] = {
@@ -217,6 +706,20 @@ main(void) {
 						_setup, _teardown),
 		cmocka_unit_test_setup_teardown(settimeout_overmax_test,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(sethedging_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(settcppool_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(setrefresh_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(refreshhit_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(refreshorder_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(refreshbudget_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(refreshdone_test,
+						_setup, _teardown),
 	};
 
 	return (cmocka_run_group_tests(tests, NULL, NULL));
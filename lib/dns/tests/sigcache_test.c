@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/buffer.h>
+#include <isc/print.h>
+#include <isc/stdtime.h>
+#include <isc/util.h>
+
+#include <dns/dnssec.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdatalist.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+#include <dns/sigcache.h>
+
+#include <dst/dst.h>
+
+#include "dnstest.h"
+
+#define MAXRDATA	4
+
+/*
+ * An A RRset built from a list of addresses.
+ */
+typedef struct {
+	dns_rdatalist_t		rdatalist;
+	dns_rdataset_t		rdataset;
+	dns_rdata_t		rdata[MAXRDATA];
+	unsigned char		data[MAXRDATA][4];
+} arrset_t;
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_test_end();
+
+	return (0);
+}
+
+static void
+mkrrset(arrset_t *rrset, const char **addrs, unsigned int n) {
+	isc_result_t result;
+	unsigned int i;
+
+	REQUIRE(n <= MAXRDATA);
+
+	dns_rdatalist_init(&rrset->rdatalist);
+	rrset->rdatalist.ttl = 300;
+	rrset->rdatalist.type = dns_rdatatype_a;
+	rrset->rdatalist.rdclass = dns_rdataclass_in;
+	for (i = 0; i < n; i++) {
+		dns_rdata_init(&rrset->rdata[i]);
+		result = dns_test_rdatafromstring(&rrset->rdata[i],
+						  dns_rdataclass_in,
+						  dns_rdatatype_a,
+						  rrset->data[i],
+						  sizeof(rrset->data[i]),
+						  addrs[i], false);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		ISC_LIST_APPEND(rrset->rdatalist.rdata, &rrset->rdata[i],
+				link);
+	}
+
+	dns_rdataset_init(&rrset->rdataset);
+	result = dns_rdatalist_tordataset(&rrset->rdatalist,
+					  &rrset->rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+}
+
+static dst_key_t *
+loadkey(const dns_name_t *name, dns_keytag_t id, unsigned int alg) {
+	dst_key_t *key = NULL;
+	isc_result_t result;
+
+	result = dst_key_fromfile(name, id, alg,
+				  DST_TYPE_PUBLIC | DST_TYPE_PRIVATE,
+				  "testdata/dst", dt_mctx, &key);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (key);
+}
+
+static void
+sign(const dns_name_t *name, dns_rdataset_t *rdataset, dst_key_t *key,
+     unsigned char *data, size_t size, dns_rdata_t *sigrdata)
+{
+	isc_stdtime_t now, inception, expire;
+	isc_buffer_t b;
+	isc_result_t result;
+
+	isc_stdtime_get(&now);
+	inception = now - 3600;
+	expire = now + 3600;
+
+	isc_buffer_init(&b, data, size);
+	result = dns_dnssec_sign(name, rdataset, key, &inception, &expire,
+				 dt_mctx, &b, sigrdata);
+	assert_int_equal(result, ISC_R_SUCCESS);
+}
+
+/* the digest identifies the verification, whatever the RRset order */
+static void
+digest_test(void **state) {
+	const char *addrs[] = { "10.0.0.1", "10.0.0.2", "10.0.0.3" };
+	const char *reversed[] = { "10.0.0.2", "10.0.0.1" };
+	dns_fixedname_t fname, fupper, fzone;
+	dns_name_t *name, *upper, *zone;
+	arrset_t rrset, rrset2, rrset3;
+	dns_rdata_t sigrdata = DNS_RDATA_INIT;
+	dns_rdata_t sigrdata2 = DNS_RDATA_INIT;
+	unsigned char sigdata[1024], sigdata2[1024];
+	unsigned char d1[DNS_SIGCACHE_DIGESTLENGTH];
+	unsigned char d2[DNS_SIGCACHE_DIGESTLENGTH];
+	dst_key_t *key;
+	isc_result_t result;
+
+	UNUSED(state);
+
+	if (!dst_algorithm_supported(DST_ALG_RSASHA256)) {
+		skip();
+	}
+
+	dns_test_namefromstring("www.test.", &fname);
+	name = dns_fixedname_name(&fname);
+	dns_test_namefromstring("WWW.TEST.", &fupper);
+	upper = dns_fixedname_name(&fupper);
+	dns_test_namefromstring("test.", &fzone);
+	zone = dns_fixedname_name(&fzone);
+
+	key = loadkey(zone, 11349, DST_ALG_RSASHA256);
+
+	mkrrset(&rrset, addrs, 2);
+	mkrrset(&rrset2, reversed, 2);
+	mkrrset(&rrset3, addrs, 3);
+	sign(name, &rrset.rdataset, key, sigdata, sizeof(sigdata), &sigrdata);
+
+	result = dns_dnssec_verify(name, &rrset.rdataset, key, false, 0,
+				   dt_mctx, &sigrdata, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_sigcache_digest(name, &rrset.rdataset, &sigrdata, key,
+				     0, dt_mctx, d1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	/* Rdata order and owner name case do not matter. */
+	result = dns_sigcache_digest(upper, &rrset2.rdataset, &sigrdata, key,
+				     0, dt_mctx, d2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_memory_equal(d1, d2, sizeof(d1));
+
+	/* Everything else does. */
+	result = dns_sigcache_digest(name, &rrset3.rdataset, &sigrdata, key,
+				     0, dt_mctx, d2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(memcmp(d1, d2, sizeof(d1)) != 0);
+
+	result = dns_sigcache_digest(zone, &rrset.rdataset, &sigrdata, key,
+				     0, dt_mctx, d2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(memcmp(d1, d2, sizeof(d1)) != 0);
+
+	result = dns_sigcache_digest(name, &rrset.rdataset, &sigrdata, key,
+				     4096, dt_mctx, d2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(memcmp(d1, d2, sizeof(d1)) != 0);
+
+	sign(name, &rrset3.rdataset, key, sigdata2, sizeof(sigdata2),
+	     &sigrdata2);
+	result = dns_sigcache_digest(name, &rrset.rdataset, &sigrdata2, key,
+				     0, dt_mctx, d2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(memcmp(d1, d2, sizeof(d1)) != 0);
+
+	if (dst_algorithm_supported(DST_ALG_ECDSA256)) {
+		dst_key_t *eckey = loadkey(zone, 49130, DST_ALG_ECDSA256);
+
+		result = dns_sigcache_digest(name, &rrset.rdataset,
+					     &sigrdata, eckey, 0, dt_mctx,
+					     d2);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		assert_true(memcmp(d1, d2, sizeof(d1)) != 0);
+		dst_key_free(&eckey);
+	}
+
+	dns_rdataset_disassociate(&rrset.rdataset);
+	dns_rdataset_disassociate(&rrset2.rdataset);
+	dns_rdataset_disassociate(&rrset3.rdataset);
+	dst_key_free(&key);
+}
+
+/* results are found until the signature expires */
+static void
+addfind_test(void **state) {
+	dns_sigcache_t *sc = NULL;
+	dns_fixedname_t fwild, ffound;
+	dns_name_t *wild, *found;
+	unsigned char d1[DNS_SIGCACHE_DIGESTLENGTH];
+	unsigned char d2[DNS_SIGCACHE_DIGESTLENGTH];
+	isc_result_t result, vresult;
+
+	UNUSED(state);
+
+	memset(d1, 1, sizeof(d1));
+	memset(d2, 2, sizeof(d2));
+	dns_test_namefromstring("*.example.", &fwild);
+	wild = dns_fixedname_name(&fwild);
+	found = dns_fixedname_initname(&ffound);
+
+	result = dns_sigcache_create(dt_mctx, 100, &sc);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	result = dns_sigcache_find(sc, d1, 1500, &vresult, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	dns_sigcache_add(sc, d1, 1000, 2000, ISC_R_SUCCESS, NULL);
+	assert_int_equal(dns_sigcache_count(sc), 1);
+
+	vresult = ISC_R_UNEXPECTED;
+	result = dns_sigcache_find(sc, d1, 1500, &vresult, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(vresult, ISC_R_SUCCESS);
+
+	result = dns_sigcache_find(sc, d2, 1500, &vresult, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+
+	/* Not yet valid. */
+	result = dns_sigcache_find(sc, d1, 999, &vresult, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+	assert_int_equal(dns_sigcache_count(sc), 0);
+
+	/* The wildcard name is kept with the result. */
+	dns_sigcache_add(sc, d2, 1000, 2000, DNS_R_FROMWILDCARD, wild);
+	result = dns_sigcache_find(sc, d2, 2000, &vresult, found);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(vresult, DNS_R_FROMWILDCARD);
+	assert_true(dns_name_equal(found, wild));
+
+	/* Replace a result. */
+	dns_sigcache_add(sc, d2, 1000, 2000, DNS_R_SIGINVALID, NULL);
+	assert_int_equal(dns_sigcache_count(sc), 1);
+	result = dns_sigcache_find(sc, d2, 1000, &vresult, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(vresult, DNS_R_SIGINVALID);
+
+	/* Expired. */
+	result = dns_sigcache_find(sc, d2, 2001, &vresult, NULL);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+	assert_int_equal(dns_sigcache_count(sc), 0);
+
+	dns_sigcache_destroy(&sc);
+	assert_null(sc);
+}
+
+/* the number of cached results is bounded */
+static void
+limit_test(void **state) {
+	dns_sigcache_t *sc = NULL;
+	isc_result_t result, vresult;
+	unsigned int i;
+
+	UNUSED(state);
+
+	result = dns_sigcache_create(dt_mctx, 3, &sc);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < 10; i++) {
+		unsigned char digest[DNS_SIGCACHE_DIGESTLENGTH];
+
+		memset(digest, i, sizeof(digest));
+		dns_sigcache_add(sc, digest, 1000, 2000, ISC_R_SUCCESS, NULL);
+		assert_true(dns_sigcache_count(sc) <= 3);
+
+		/* The newest result is never the one evicted. */
+		result = dns_sigcache_find(sc, digest, 1500, &vresult, NULL);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	assert_int_equal(dns_sigcache_count(sc), 3);
+
+	dns_sigcache_flush(sc);
+	assert_int_equal(dns_sigcache_count(sc), 0);
+
+	dns_sigcache_destroy(&sc);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+#define NVERIFY	1000
+
+static uint64_t
+nanotime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Verify RSA and ECDSA signatures with and without the cache.
+ */
+static void
+benchmark(void **state) {
+	static const struct {
+		const char *label;
+		dns_keytag_t id;
+		unsigned int alg;
+	} keys[] = {
+		{ "RSASHA256", 11349, DST_ALG_RSASHA256 },
+		{ "ECDSAP256SHA256", 49130, DST_ALG_ECDSA256 },
+	};
+	const char *addrs[] = { "10.0.0.1", "10.0.0.2" };
+	dns_fixedname_t fname, fzone;
+	dns_name_t *name, *zone;
+	arrset_t rrset;
+	isc_stdtime_t now;
+	isc_result_t result, vresult;
+	unsigned int i, k;
+
+	UNUSED(state);
+
+	dns_test_namefromstring("www.test.", &fname);
+	name = dns_fixedname_name(&fname);
+	dns_test_namefromstring("test.", &fzone);
+	zone = dns_fixedname_name(&fzone);
+	mkrrset(&rrset, addrs, 2);
+	isc_stdtime_get(&now);
+
+	for (k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+		dns_sigcache_t *sc = NULL;
+		dns_rdata_t sigrdata = DNS_RDATA_INIT;
+		unsigned char sigdata[1024];
+		unsigned char digest[DNS_SIGCACHE_DIGESTLENGTH];
+		dst_key_t *key;
+		uint64_t t0, tverify, tcache;
+
+		if (!dst_algorithm_supported(keys[k].alg)) {
+			continue;
+		}
+
+		key = loadkey(zone, keys[k].id, keys[k].alg);
+		sign(name, &rrset.rdataset, key, sigdata, sizeof(sigdata),
+		     &sigrdata);
+
+		t0 = nanotime();
+		for (i = 0; i < NVERIFY; i++) {
+			result = dns_dnssec_verify(name, &rrset.rdataset, key,
+						   false, 0, dt_mctx,
+						   &sigrdata, NULL);
+			assert_int_equal(result, ISC_R_SUCCESS);
+		}
+		tverify = nanotime() - t0;
+
+		result = dns_sigcache_create(dt_mctx, 100, &sc);
+		assert_int_equal(result, ISC_R_SUCCESS);
+
+		t0 = nanotime();
+		for (i = 0; i < NVERIFY; i++) {
+			result = dns_sigcache_digest(name, &rrset.rdataset,
+						     &sigrdata, key, 0,
+						     dt_mctx, digest);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			result = dns_sigcache_find(sc, digest, now, &vresult,
+						   NULL);
+			if (result != ISC_R_SUCCESS) {
+				vresult = dns_dnssec_verify(name,
+							    &rrset.rdataset,
+							    key, false, 0,
+							    dt_mctx,
+							    &sigrdata, NULL);
+				dns_sigcache_add(sc, digest, now - 3600,
+						 now + 3600, vresult, NULL);
+			}
+			assert_int_equal(vresult, ISC_R_SUCCESS);
+		}
+		tcache = nanotime() - t0;
+
+		printf("%s: %.0f ns/signature verified, %.0f ns/signature "
+		       "cached\n", keys[k].label, (double)tverify / NVERIFY,
+		       (double)tcache / NVERIFY);
+
+		dns_sigcache_destroy(&sc);
+		dst_key_free(&key);
+	}
+
+	dns_rdataset_disassociate(&rrset.rdataset);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(digest_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(addfind_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(limit_test,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#if HAVE_CMOCKA
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include <inttypes.h>
+#include <sched.h> /* IWYU pragma: keep */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UNIT_TESTING
+#include <cmocka.h>
+
+#include <isc/atomic.h>
+#include <isc/buffer.h>
+#include <isc/event.h>
+#include <isc/print.h>
+#include <isc/stdtime.h>
+#include <isc/task.h>
+#include <isc/util.h>
+
+#include <dns/dnssec.h>
+#include <dns/events.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdatalist.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+#include <dns/verifypool.h>
+
+#include <dst/dst.h>
+
+#include "dnstest.h"
+
+#define MAXRDATA	4
+
+/*
+ * An A RRset built from a list of addresses.
+ */
+typedef struct {
+	dns_rdatalist_t		rdatalist;
+	dns_rdataset_t		rdataset;
+	dns_rdata_t		rdata[MAXRDATA];
+	unsigned char		data[MAXRDATA][4];
+} arrset_t;
+
+static atomic_bool done;
+static isc_result_t vresult;
+static bool vignore;
+
+static int
+_setup(void **state) {
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_test_begin(NULL, true);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (0);
+}
+
+static int
+_teardown(void **state) {
+	UNUSED(state);
+
+	dns_test_end();
+
+	return (0);
+}
+
+static void
+mkrrset(arrset_t *rrset, const char **addrs, unsigned int n) {
+	isc_result_t result;
+	unsigned int i;
+
+	REQUIRE(n <= MAXRDATA);
+
+	dns_rdatalist_init(&rrset->rdatalist);
+	rrset->rdatalist.ttl = 300;
+	rrset->rdatalist.type = dns_rdatatype_a;
+	rrset->rdatalist.rdclass = dns_rdataclass_in;
+	for (i = 0; i < n; i++) {
+		dns_rdata_init(&rrset->rdata[i]);
+		result = dns_test_rdatafromstring(&rrset->rdata[i],
+						  dns_rdataclass_in,
+						  dns_rdatatype_a,
+						  rrset->data[i],
+						  sizeof(rrset->data[i]),
+						  addrs[i], false);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		ISC_LIST_APPEND(rrset->rdatalist.rdata, &rrset->rdata[i],
+				link);
+	}
+
+	dns_rdataset_init(&rrset->rdataset);
+	result = dns_rdatalist_tordataset(&rrset->rdatalist,
+					  &rrset->rdataset);
+	assert_int_equal(result, ISC_R_SUCCESS);
+}
+
+static dst_key_t *
+loadkey(const dns_name_t *name, dns_keytag_t id, unsigned int alg) {
+	dst_key_t *key = NULL;
+	isc_result_t result;
+
+	result = dst_key_fromfile(name, id, alg,
+				  DST_TYPE_PUBLIC | DST_TYPE_PRIVATE,
+				  "testdata/dst", dt_mctx, &key);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	return (key);
+}
+
+/*
+ * Sign 'rdataset' with a signature valid from 'inception' to 'expire'
+ * seconds from now.
+ */
+static void
+sign(const dns_name_t *name, dns_rdataset_t *rdataset, dst_key_t *key,
+     int inception, int expire, unsigned char *data, size_t size,
+     dns_rdata_t *sigrdata)
+{
+	isc_stdtime_t now, from, to;
+	isc_buffer_t b;
+	isc_result_t result;
+
+	isc_stdtime_get(&now);
+	from = now + inception;
+	to = now + expire;
+
+	isc_buffer_init(&b, data, size);
+	result = dns_dnssec_sign(name, rdataset, key, &from, &to,
+				 dt_mctx, &b, sigrdata);
+	assert_int_equal(result, ISC_R_SUCCESS);
+}
+
+static void
+verify_done(isc_task_t *task, isc_event_t *event) {
+	dns_verifyevent_t *vevent = (dns_verifyevent_t *)event;
+
+	UNUSED(task);
+
+	assert_int_equal(event->ev_type, DNS_EVENT_VERIFYDONE);
+	assert_ptr_equal(event->ev_arg, &done);
+
+	vresult = vevent->result;
+	vignore = vevent->ignoretime;
+	isc_event_free(&event);
+	atomic_store(&done, true);
+}
+
+static atomic_bool blocked;
+
+static void
+block_action(isc_task_t *task, isc_event_t *event) {
+	UNUSED(task);
+
+	isc_event_free(&event);
+	while (atomic_load(&blocked)) {
+		dns_test_nap(1000);
+	}
+}
+
+/*
+ * Verify 'sigrdata' on 'pool' and wait for the result.
+ */
+static isc_result_t
+poolverify(dns_verifypool_t *pool, const dns_name_t *name,
+	   dns_rdataset_t *rdataset, dst_key_t *key, bool acceptexpired,
+	   dns_rdata_t *sigrdata, bool *ignorep)
+{
+	isc_result_t result;
+
+	atomic_store(&done, false);
+	vresult = ISC_R_UNSET;
+	vignore = false;
+
+	result = dns_verifypool_verify(pool, name, rdataset, key,
+				       acceptexpired, 0, sigrdata, maintask,
+				       verify_done, &done);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	/*
+	 * The signature has been copied; scribble over the original.
+	 */
+	memset(sigrdata->data, 0xff, sigrdata->length);
+
+	while (!atomic_load(&done)) {
+		dns_test_nap(1000);
+	}
+
+	*ignorep = vignore;
+	return (vresult);
+}
+
+/* create and attach to a verify pool */
+static void
+create_test(void **state) {
+	dns_verifypool_t *pool = NULL, *pool2 = NULL;
+	isc_result_t result;
+
+	UNUSED(state);
+
+	result = dns_verifypool_create(dt_mctx, taskmgr, 3, &pool);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_equal(dns_verifypool_size(pool), 3);
+
+	dns_verifypool_attach(pool, &pool2);
+	assert_ptr_equal(pool, pool2);
+	dns_verifypool_detach(&pool);
+	assert_null(pool);
+	assert_int_equal(dns_verifypool_size(pool2), 3);
+	dns_verifypool_detach(&pool2);
+	assert_null(pool2);
+}
+
+/* verify signatures on the pool, and let go of it from a task */
+static void
+verify_test(void **state) {
+	const char *addrs[] = { "10.0.0.1", "10.0.0.2" };
+	const char *other[] = { "10.0.0.1", "10.0.0.3" };
+	dns_verifypool_t *pool = NULL;
+	dns_fixedname_t fname, fzone;
+	dns_name_t *name, *zone;
+	arrset_t rrset, rrset2;
+	dns_rdata_t sigrdata = DNS_RDATA_INIT;
+	unsigned char sigdata[1024];
+	dst_key_t *key;
+	isc_event_t *event;
+	isc_result_t result;
+	bool ignore;
+
+	UNUSED(state);
+
+	dns_test_namefromstring("www.test.", &fname);
+	name = dns_fixedname_name(&fname);
+	dns_test_namefromstring("test.", &fzone);
+	zone = dns_fixedname_name(&fzone);
+	mkrrset(&rrset, addrs, 2);
+	mkrrset(&rrset2, other, 2);
+	key = loadkey(zone, 11349, DST_ALG_RSASHA256);
+
+	result = dns_verifypool_create(dt_mctx, taskmgr, 2, &pool);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	/* A good signature. */
+	sign(name, &rrset.rdataset, key, -3600, 3600, sigdata,
+	     sizeof(sigdata), &sigrdata);
+	result = poolverify(pool, name, &rrset.rdataset, key, false,
+			    &sigrdata, &ignore);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_false(ignore);
+
+	/* The same signature over other data. */
+	dns_rdata_reset(&sigrdata);
+	sign(name, &rrset.rdataset, key, -3600, 3600, sigdata,
+	     sizeof(sigdata), &sigrdata);
+	result = poolverify(pool, name, &rrset2.rdataset, key, false,
+			    &sigrdata, &ignore);
+	assert_int_equal(result, DNS_R_SIGINVALID);
+
+	/* An expired signature. */
+	dns_rdata_reset(&sigrdata);
+	sign(name, &rrset.rdataset, key, -7200, -3600, sigdata,
+	     sizeof(sigdata), &sigrdata);
+	result = poolverify(pool, name, &rrset.rdataset, key, false,
+			    &sigrdata, &ignore);
+	assert_int_equal(result, DNS_R_SIGEXPIRED);
+
+	/* The same, accepting expired signatures. */
+	dns_rdata_reset(&sigrdata);
+	sign(name, &rrset.rdataset, key, -7200, -3600, sigdata,
+	     sizeof(sigdata), &sigrdata);
+	result = poolverify(pool, name, &rrset.rdataset, key, true,
+			    &sigrdata, &ignore);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(ignore);
+
+	/*
+	 * Drop the last reference to the pool on 'maintask', when the
+	 * result of a verification still in progress is freed: hold the
+	 * task up until the pool has been detached here.
+	 */
+	dns_rdata_reset(&sigrdata);
+	sign(name, &rrset.rdataset, key, -3600, 3600, sigdata,
+	     sizeof(sigdata), &sigrdata);
+	atomic_store(&blocked, true);
+	event = isc_event_allocate(dt_mctx, maintask, 1, block_action, NULL,
+				   sizeof(*event));
+	isc_task_send(maintask, &event);
+	atomic_store(&done, false);
+	vresult = ISC_R_UNSET;
+	result = dns_verifypool_verify(pool, name, &rrset.rdataset, key,
+				       false, 0, &sigrdata, maintask,
+				       verify_done, &done);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_verifypool_detach(&pool);
+	atomic_store(&blocked, false);
+	while (!atomic_load(&done)) {
+		dns_test_nap(1000);
+	}
+	assert_int_equal(vresult, ISC_R_SUCCESS);
+
+	dst_key_free(&key);
+	dns_rdataset_disassociate(&rrset.rdataset);
+	dns_rdataset_disassociate(&rrset2.rdataset);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+#define NSTORM		4000
+#define NLIGHT		(NSTORM / 10)
+
+static uint64_t
+nanotime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * The state of the benchmark: a burst of signatures to verify and, in
+ * between them, cheap events standing in for the completion of
+ * unsigned fetches, all sent to the same task.
+ */
+static struct {
+	dns_verifypool_t	*pool;
+	const dns_name_t	*name;
+	dns_rdataset_t		*rdataset;
+	dst_key_t		*key;
+	dns_rdata_t		*sigrdata;
+	uint64_t		sent[NLIGHT];
+	uint64_t		latency[NLIGHT];
+	atomic_uint_fast32_t	pending;
+} storm;
+
+static void
+light_action(isc_task_t *task, isc_event_t *event) {
+	uint64_t *sent = event->ev_arg;
+
+	UNUSED(task);
+
+	storm.latency[sent - storm.sent] = nanotime() - *sent;
+	isc_event_free(&event);
+	atomic_fetch_sub(&storm.pending, 1);
+}
+
+static void
+storm_done(isc_task_t *task, isc_event_t *event) {
+	dns_verifyevent_t *vevent = (dns_verifyevent_t *)event;
+
+	UNUSED(task);
+
+	assert_int_equal(vevent->result, ISC_R_SUCCESS);
+	isc_event_free(&event);
+	atomic_fetch_sub(&storm.pending, 1);
+}
+
+static void
+storm_action(isc_task_t *task, isc_event_t *event) {
+	isc_result_t result;
+
+	isc_event_free(&event);
+
+	if (storm.pool != NULL) {
+		result = dns_verifypool_verify(storm.pool, storm.name,
+					       storm.rdataset, storm.key,
+					       false, 0, storm.sigrdata,
+					       task, storm_done, NULL);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		return;
+	}
+
+	result = dns_dnssec_verify(storm.name, storm.rdataset, storm.key,
+				   false, 0, dt_mctx, storm.sigrdata, NULL);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	atomic_fetch_sub(&storm.pending, 1);
+}
+
+static int
+cmp64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/*
+ * Send the storm and the light events to 'task' and report how long
+ * the light events were kept waiting.
+ */
+static void
+runstorm(isc_task_t *task, const char *label) {
+	isc_event_t *event;
+	unsigned int i, l = 0;
+	uint64_t t0;
+
+	atomic_store(&storm.pending, NSTORM + NLIGHT);
+
+	t0 = nanotime();
+	for (i = 0; i < NSTORM; i++) {
+		event = isc_event_allocate(dt_mctx, task, 1, storm_action,
+					   NULL, sizeof(*event));
+		isc_task_send(task, &event);
+		if (i % (NSTORM / NLIGHT) == 0) {
+			storm.sent[l] = nanotime();
+			event = isc_event_allocate(dt_mctx, task, 2,
+						   light_action,
+						   &storm.sent[l],
+						   sizeof(*event));
+			isc_task_send(task, &event);
+			l++;
+		}
+	}
+	INSIST(l == NLIGHT);
+
+	while (atomic_load(&storm.pending) != 0) {
+		dns_test_nap(1000);
+	}
+
+	qsort(storm.latency, NLIGHT, sizeof(storm.latency[0]), cmp64);
+	printf("%s: %.1f ms total, light event latency p50 %.0f us, "
+	       "p99 %.0f us, max %.0f us\n", label,
+	       (double)(nanotime() - t0) / 1000000,
+	       (double)storm.latency[NLIGHT / 2] / 1000,
+	       (double)storm.latency[NLIGHT * 99 / 100] / 1000,
+	       (double)storm.latency[NLIGHT - 1] / 1000);
+}
+
+/*
+ * Compare the latency of cheap events queued behind a burst of
+ * signature verifications, with the verifications done inline and on
+ * a verify pool.
+ */
+static void
+benchmark(void **state) {
+	const char *addrs[] = { "10.0.0.1", "10.0.0.2" };
+	dns_fixedname_t fname, fzone;
+	dns_name_t *name, *zone;
+	arrset_t rrset;
+	dns_rdata_t sigrdata = DNS_RDATA_INIT;
+	unsigned char sigdata[1024];
+	dst_key_t *key;
+	isc_task_t *task = NULL;
+	isc_result_t result;
+	char label[64];
+
+	UNUSED(state);
+
+	dns_test_namefromstring("www.test.", &fname);
+	name = dns_fixedname_name(&fname);
+	dns_test_namefromstring("test.", &fzone);
+	zone = dns_fixedname_name(&fzone);
+	mkrrset(&rrset, addrs, 2);
+	key = loadkey(zone, 11349, DST_ALG_RSASHA256);
+	sign(name, &rrset.rdataset, key, -3600, 3600, sigdata,
+	     sizeof(sigdata), &sigrdata);
+
+	result = isc_task_create(taskmgr, 0, &task);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	storm.name = name;
+	storm.rdataset = &rrset.rdataset;
+	storm.key = key;
+	storm.sigrdata = &sigrdata;
+
+	storm.pool = NULL;
+	runstorm(task, "inline");
+
+	result = dns_verifypool_create(dt_mctx, taskmgr, ncpus,
+				       &storm.pool);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	snprintf(label, sizeof(label), "verify pool (%d tasks)", ncpus);
+	runstorm(task, label);
+	dns_verifypool_detach(&storm.pool);
+
+	isc_task_detach(&task);
+	dst_key_free(&key);
+	dns_rdataset_disassociate(&rrset.rdataset);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
+int
+main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(create_test,
+						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(verify_test,
+						_setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark,
+						_setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+	};
+
+	return (cmocka_run_group_tests(tests, NULL, NULL));
+}
+
+#else /* HAVE_CMOCKA */
+
+#include <stdio.h>
+
+int
+main(void) {
+	printf("1..0 # Skipped: cmocka not available\n");
+	return (0);
+}
+
+#endif
@@ -15,6 +15,7 @@
 #include <stddef.h>
 #include <setjmp.h>
 
+#include <inttypes.h>
 #include <sched.h> /* IWYU pragma: keep */
 #include <stdbool.h>
 #include <stdlib.h>
@@ -28,11 +29,14 @@
 #include <isc/atomic.h>
 #include <isc/buffer.h>
 #include <isc/print.h>
+#include <isc/random.h>
 #include <isc/task.h>
+#include <isc/time.h>
 #include <isc/timer.h>
 #include <isc/util.h>
 
 #include <dns/db.h>
+#include <dns/fixedname.h>
 #include <dns/name.h>
 #include <dns/view.h>
 #include <dns/zone.h>
@@ -343,6 +347,340 @@ asyncload_zt(void **state) {
 	dns_view_detach(&view);
 }
 
+/*
+ * Detach zones created by dns_test_makezone() with a view.
+ */
+static void
+detach_zones(dns_zone_t **zones, unsigned int nzones) {
+	isc_result_t result;
+	unsigned int i;
+
+	/* These steps are necessary so the zones can be detached properly */
+	result = dns_test_setupzonemgr();
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (i = 0; i < nzones; i++) {
+		result = dns_test_managezone(zones[i]);
+		assert_int_equal(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < nzones; i++) {
+		dns_test_releasezone(zones[i]);
+	}
+	dns_test_closezonemgr();
+
+	for (i = 0; i < nzones; i++) {
+		dns_zone_detach(&zones[i]);
+	}
+}
+
+static bool
+isleaf(dns_zt_t *zt, const char *name) {
+	dns_fixedname_t fixed;
+
+	dns_test_namefromstring(name, &fixed);
+	return (dns_zt_isleaf(zt, dns_fixedname_name(&fixed)));
+}
+
+/* zones with no zone below them, and the zone table generation */
+static void
+leaf(void **state) {
+	dns_view_t *view = NULL;
+	dns_zone_t *zones[3] = { NULL, NULL, NULL };
+	isc_result_t result;
+	uint64_t generation;
+
+	UNUSED(state);
+
+	result = dns_test_makeview("view", &view);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	generation = dns_zt_getgeneration(view->zonetable);
+
+	result = dns_test_makezone("example", &zones[0], view, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_not_equal(dns_zt_getgeneration(view->zonetable),
+			     generation);
+	assert_true(isleaf(view->zonetable, "example."));
+
+	result = dns_test_makezone("sub.sub.example", &zones[1], view, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	result = dns_test_makezone("other", &zones[2], view, false);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	assert_false(isleaf(view->zonetable, "example."));
+	assert_true(isleaf(view->zonetable, "sub.sub.example."));
+	assert_true(isleaf(view->zonetable, "other."));
+	/* not zones */
+	assert_false(isleaf(view->zonetable, "sub.example."));
+	assert_false(isleaf(view->zonetable, "www.other."));
+	assert_false(isleaf(view->zonetable, "."));
+
+	generation = dns_zt_getgeneration(view->zonetable);
+	result = dns_zt_unmount(view->zonetable, zones[1]);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_int_not_equal(dns_zt_getgeneration(view->zonetable),
+			     generation);
+	assert_false(isleaf(view->zonetable, "sub.sub.example."));
+
+	generation = dns_zt_getgeneration(view->zonetable);
+	result = dns_zt_unmount(view->zonetable, zones[1]);
+	assert_int_equal(result, ISC_R_NOTFOUND);
+	assert_int_equal(dns_zt_getgeneration(view->zonetable), generation);
+
+	result = dns_zt_mount(view->zonetable, zones[1]);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	assert_true(isleaf(view->zonetable, "sub.sub.example."));
+
+	detach_zones(zones, 3);
+	dns_view_detach(&view);
+}
+
+#if defined(DNS_BENCHMARK_TESTS)
+
+#define BENCH_ZONES		100
+#define BENCH_QUERIES		(1 << 16)
+#define BENCH_BATCH		32
+#define BENCH_KEEP		4
+#define BENCH_ROUNDS		16
+
+/*
+ * What a query does to find the data to answer from: look the zone up,
+ * attach its database and open its current version.
+ */
+static void
+lookup(dns_zt_t *zt, const dns_name_t *name) {
+	dns_zone_t *zone = NULL;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	isc_result_t result;
+
+	result = dns_zt_find(zt, name, 0, NULL, &zone);
+	assert_true(result == ISC_R_SUCCESS || result == DNS_R_PARTIALMATCH);
+	result = dns_zone_getdb(zone, &db);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	dns_db_currentversion(db, &version);
+
+	dns_db_closeversion(db, &version, false);
+	dns_db_detach(&db);
+	dns_zone_detach(&zone);
+}
+
+typedef struct {
+	uint64_t		ztgeneration;
+	uint64_t		generation;
+	dns_zone_t		*zone;
+	dns_db_t		*db;
+	dns_dbversion_t		*version;
+} keptzone_t;
+
+static void
+release(keptzone_t *kz) {
+	if (kz->zone != NULL) {
+		dns_db_closeversion(kz->db, &kz->version, false);
+		dns_db_detach(&kz->db);
+		dns_zone_detach(&kz->zone);
+	}
+}
+
+/*
+ * The same, for a batch of queries received together, keeping what was
+ * found for zones looked up twice, with no zone below them, for the rest
+ * of the batch, as query_getzonedb() does.
+ */
+static unsigned int
+lookup_batch(dns_zt_t *zt, dns_name_t **names, unsigned int n) {
+	keptzone_t kept[BENCH_KEEP];
+	const dns_zone_t *missed[BENCH_KEEP];
+	unsigned int i, j, next = 0, nextmissed = 0, hits = 0;
+
+	memset(kept, 0, sizeof(kept));
+	memset(missed, 0, sizeof(missed));
+
+	for (i = 0; i < n; i++) {
+		dns_zone_t *zone = NULL;
+		dns_db_t *db = NULL;
+		dns_dbversion_t *version = NULL;
+		keptzone_t *kz = NULL;
+		uint64_t ztgeneration, generation;
+		isc_result_t result;
+
+		for (j = 0; j < BENCH_KEEP; j++) {
+			if (kept[j].zone != NULL &&
+			    dns_name_issubdomain(names[i],
+					 dns_zone_getorigin(kept[j].zone)) &&
+			    kept[j].ztgeneration == dns_zt_getgeneration(zt) &&
+			    kept[j].generation ==
+			    dns_zone_getgeneration(kept[j].zone))
+			{
+				kz = &kept[j];
+				break;
+			}
+		}
+
+		if (kz != NULL) {
+			dns_zone_attach(kz->zone, &zone);
+			dns_db_attach(kz->db, &db);
+			dns_db_attachversion(db, kz->version, &version);
+			hits++;
+		} else {
+			ztgeneration = dns_zt_getgeneration(zt);
+			result = dns_zt_find(zt, names[i], 0, NULL, &zone);
+			assert_true(result == ISC_R_SUCCESS ||
+				    result == DNS_R_PARTIALMATCH);
+			generation = dns_zone_getgeneration(zone);
+			result = dns_zone_getdb(zone, &db);
+			assert_int_equal(result, ISC_R_SUCCESS);
+			dns_db_currentversion(db, &version);
+
+			for (j = 0; j < BENCH_KEEP; j++) {
+				if (missed[j] == zone) {
+					break;
+				}
+			}
+			if (j == BENCH_KEEP) {
+				missed[nextmissed] = zone;
+				nextmissed = (nextmissed + 1) % BENCH_KEEP;
+			} else if (dns_zt_isleaf(zt, dns_zone_getorigin(zone))) {
+				kz = &kept[next];
+				next = (next + 1) % BENCH_KEEP;
+				release(kz);
+				kz->ztgeneration = ztgeneration;
+				kz->generation = generation;
+				dns_zone_attach(zone, &kz->zone);
+				dns_db_attach(db, &kz->db);
+				dns_db_attachversion(db, version,
+						     &kz->version);
+			}
+		}
+
+		dns_db_closeversion(db, &version, false);
+		dns_db_detach(&db);
+		dns_zone_detach(&zone);
+	}
+
+	for (j = 0; j < BENCH_KEEP; j++) {
+		release(&kept[j]);
+	}
+
+	return (hits);
+}
+
+/*
+ * Replay a query stream over a zone table of one parent zone and
+ * BENCH_ZONES delegated zones below it.  The popularity of the zones
+ * follows Zipf's law, a few names are in the parent zone, and every
+ * query has a different name.
+ */
+static void
+benchmark(void **state) {
+	dns_view_t *view = NULL;
+	dns_zone_t *zones[BENCH_ZONES + 1];
+	dns_fixedname_t *fnames;
+	dns_name_t **names;
+	double weights[BENCH_ZONES], total = 0;
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	unsigned int i, j, round, hits = 0;
+	uint64_t t;
+
+	UNUSED(state);
+
+	result = dns_test_makeview("view", &view);
+	assert_int_equal(result, ISC_R_SUCCESS);
+
+	for (i = 0; i <= BENCH_ZONES; i++) {
+		char name[64];
+		dns_db_t *db = NULL;
+		dns_fixedname_t fn;
+
+		if (i == BENCH_ZONES) {
+			snprintf(name, sizeof(name), "example.");
+		} else {
+			snprintf(name, sizeof(name), "z%u.example.", i);
+		}
+		/*
+		 * Static-stub zones can be given an empty database
+		 * without having to load them.
+		 */
+		zones[i] = NULL;
+		result = dns_zone_create(&zones[i], dt_mctx);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_zone_settype(zones[i], dns_zone_staticstub);
+		dns_test_namefromstring(name, &fn);
+		result = dns_zone_setorigin(zones[i], dns_fixedname_name(&fn));
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_zone_setview(zones[i], view);
+		dns_zone_setclass(zones[i], view->rdclass);
+		result = dns_view_addzone(view, zones[i]);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		result = dns_db_create(dt_mctx, "rbt",
+				       dns_zone_getorigin(zones[i]),
+				       dns_dbtype_zone, dns_rdataclass_in,
+				       0, NULL, &db);
+		assert_int_equal(result, ISC_R_SUCCESS);
+		dns_zone_setdb(zones[i], db);
+		dns_db_detach(&db);
+	}
+
+	for (i = 0; i < BENCH_ZONES; i++) {
+		weights[i] = 1.0 / (i + 1);
+		total += weights[i];
+	}
+
+	fnames = isc_mem_get(dt_mctx, BENCH_QUERIES * sizeof(fnames[0]));
+	names = isc_mem_get(dt_mctx, BENCH_QUERIES * sizeof(names[0]));
+	for (i = 0; i < BENCH_QUERIES; i++) {
+		char name[64];
+		double r = (double)isc_random32() / UINT32_MAX * total;
+
+		for (j = 0; j < BENCH_ZONES - 1 && r > weights[j]; j++) {
+			r -= weights[j];
+		}
+		if (isc_random_uniform(20) == 0) {
+			snprintf(name, sizeof(name), "q%u.example.", i);
+		} else {
+			snprintf(name, sizeof(name), "q%u.z%u.example.", i, j);
+		}
+		dns_test_namefromstring(name, &fnames[i]);
+		names[i] = dns_fixedname_name(&fnames[i]);
+	}
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_QUERIES; i++) {
+			lookup(view->zonetable, names[i]);
+		}
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u queries, one at a time: %f seconds, %f queries/s\n",
+	       BENCH_ROUNDS * BENCH_QUERIES, t / 1000000.0,
+	       (double)BENCH_ROUNDS * BENCH_QUERIES * 1000000.0 / t);
+
+	result = isc_time_now(&ts1);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_QUERIES; i += BENCH_BATCH) {
+			hits += lookup_batch(view->zonetable, &names[i],
+					     BENCH_BATCH);
+		}
+	}
+	result = isc_time_now(&ts2);
+	assert_int_equal(result, ISC_R_SUCCESS);
+	t = isc_time_microdiff(&ts2, &ts1);
+	printf("%u queries, in batches of %u: %f seconds, %f queries/s, "
+	       "%.1f%% found in the batch\n",
+	       BENCH_ROUNDS * BENCH_QUERIES, BENCH_BATCH, t / 1000000.0,
+	       (double)BENCH_ROUNDS * BENCH_QUERIES * 1000000.0 / t,
+	       100.0 * hits / (BENCH_ROUNDS * BENCH_QUERIES));
+
+	isc_mem_put(dt_mctx, names, BENCH_QUERIES * sizeof(names[0]));
+	isc_mem_put(dt_mctx, fnames, BENCH_QUERIES * sizeof(fnames[0]));
+	detach_zones(zones, BENCH_ZONES + 1);
+	dns_view_detach(&view);
+}
+#endif /* defined(DNS_BENCHMARK_TESTS) */
+
 int
 main(void) {
 	const struct CMUnitTest tests[] = {
@@ -351,6 +689,10 @@ main(void) {
 						_setup, _teardown),
 		cmocka_unit_test_setup_teardown(asyncload_zt,
 						_setup, _teardown),
+		cmocka_unit_test_setup_teardown(leaf, _setup, _teardown),
+#if defined(DNS_BENCHMARK_TESTS)
+		cmocka_unit_test_setup_teardown(benchmark, _setup, _teardown),
+#endif /* defined(DNS_BENCHMARK_TESTS) */
 	};
 
 	return (cmocka_run_group_tests(tests, NULL, NULL));
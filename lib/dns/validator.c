@@ -16,6 +16,7 @@
 #include <isc/mem.h>
 #include <isc/md.h>
 #include <isc/print.h>
+#include <isc/stats.h>
 #include <isc/string.h>
 #include <isc/task.h>
 #include <isc/util.h>
@@ -25,6 +26,7 @@
 #include <dns/dnssec.h>
 #include <dns/ds.h>
 #include <dns/events.h>
+#include <dns/keycache.h>
 #include <dns/keytable.h>
 #include <dns/keyvalues.h>
 #include <dns/log.h>
@@ -37,7 +39,10 @@
 #include <dns/rdatatype.h>
 #include <dns/resolver.h>
 #include <dns/result.h>
+#include <dns/sigcache.h>
+#include <dns/stats.h>
 #include <dns/validator.h>
+#include <dns/verifypool.h>
 #include <dns/view.h>
 
 /*! \file
@@ -68,6 +73,10 @@
 #define VALATTR_TRIEDVERIFY             0x0004  /*%< We have found a key and
 						 * have attempted a verify. */
 #define VALATTR_INSECURITY              0x0010 /*%< Attempting proveunsecure. */
+#define VALATTR_VERIFYING               0x0020 /*%< Waiting for the verify
+						* pool. */
+#define VALATTR_VERIFYDONE              0x0040 /*%< The verify pool result
+						* is in 'vresult'. */
 
 /*!
  * NSEC proofs to be looked for.
@@ -97,6 +106,8 @@
 
 #define SHUTDOWN(v)          (((v)->attributes & VALATTR_SHUTDOWN) != 0)
 #define CANCELED(v)          (((v)->attributes & VALATTR_CANCELED) != 0)
+#define VERIFYING(v)         (((v)->attributes & VALATTR_VERIFYING) != 0)
+#define VERIFYDONE(v)        (((v)->attributes & VALATTR_VERIFYDONE) != 0)
 
 #define NEGATIVE(r)       (((r)->attributes & DNS_RDATASETATTR_NEGATIVE) != 0)
 #define NXDOMAIN(r)       (((r)->attributes & DNS_RDATASETATTR_NXDOMAIN) != 0)
@@ -110,6 +121,9 @@ select_signing_key(dns_validator_t *val, dns_rdataset_t *rdataset);
 static isc_result_t
 validate_answer(dns_validator_t *val, bool resume);
 
+static void
+verify_done(isc_task_t *task, isc_event_t *event);
+
 static isc_result_t
 validate_dnskey(dns_validator_t *val);
 
@@ -237,7 +251,9 @@ exit_check(dns_validator_t *val) {
 
 	INSIST(val->event == NULL);
 
-	if (val->fetch != NULL || val->subvalidator != NULL) {
+	if (val->fetch != NULL || val->subvalidator != NULL ||
+	    VERIFYING(val))
+	{
 		return (false);
 	}
 
@@ -1101,6 +1117,47 @@ create_validator(dns_validator_t *val, dns_name_t *name, dns_rdatatype_t type,
 	return (result);
 }
 
+static inline void
+inc_stat(dns_validator_t *val, isc_statscounter_t counter) {
+	if (val->view->resstats != NULL) {
+		isc_stats_increment(val->view->resstats, counter);
+	}
+}
+
+/*%
+ * Build a dst_key_t for the DNSKEY record 'rdata', owned by 'name' and
+ * taken from 'rdataset'.  The key is taken from, or added to, the
+ * view's key cache if it has one; a cached key is kept until
+ * 'rdataset' expires.
+ */
+static isc_result_t
+get_dstkey(dns_validator_t *val, const dns_name_t *name, dns_rdata_t *rdata,
+	   dns_rdataset_t *rdataset, dst_key_t **keyp)
+{
+	dns_keycache_t *keycache = val->view->keycache;
+	isc_result_t result;
+
+	if (keycache == NULL || rdata->type != dns_rdatatype_dnskey) {
+		return (dns_dnssec_keyfromrdata(name, rdata, val->view->mctx,
+						keyp));
+	}
+
+	result = dns_keycache_find(keycache, name, rdata, val->start, keyp);
+	if (result == ISC_R_SUCCESS) {
+		inc_stat(val, dns_resstatscounter_keycachehit);
+		return (ISC_R_SUCCESS);
+	}
+
+	inc_stat(val, dns_resstatscounter_keycachemiss);
+	result = dns_dnssec_keyfromrdata(name, rdata, val->view->mctx, keyp);
+	if (result == ISC_R_SUCCESS && rdataset->ttl != 0) {
+		dns_keycache_add(keycache, name, rdata,
+				 val->start + rdataset->ttl, *keyp);
+	}
+
+	return (result);
+}
+
 /*%
  * Try to find a key that could have signed val->siginfo among those in
  * 'rdataset'.  If found, build a dst_key_t for it and point val->key at
@@ -1117,7 +1174,7 @@ static isc_result_t
 select_signing_key(dns_validator_t *val, dns_rdataset_t *rdataset) {
 	isc_result_t result;
 	dns_rdata_rrsig_t *siginfo = val->siginfo;
-	isc_buffer_t b;
+	isc_region_t r;
 	dns_rdata_t rdata = DNS_RDATA_INIT;
 	dst_key_t *oldkey = val->key;
 	bool foundold;
@@ -1136,11 +1193,20 @@ select_signing_key(dns_validator_t *val, dns_rdataset_t *rdataset) {
 	do {
 		dns_rdataset_current(rdataset, &rdata);
 
-		isc_buffer_init(&b, rdata.data, rdata.length);
-		isc_buffer_add(&b, rdata.length);
+		/*
+		 * The algorithm and key tag can be read from the rdata, so
+		 * don't build keys that cannot have made the signature.
+		 */
+		dns_rdata_toregion(&rdata, &r);
+		if (r.length < 4 || r.base[3] != siginfo->algorithm ||
+		    dst_region_computeid(&r) != siginfo->keyid)
+		{
+			goto next;
+		}
+
 		INSIST(val->key == NULL);
-		result = dst_key_fromdns(&siginfo->signer, rdata.rdclass, &b,
-					 val->view->mctx, &val->key);
+		result = get_dstkey(val, &siginfo->signer, &rdata, rdataset,
+				    &val->key);
 		if (result != ISC_R_SUCCESS) {
 			goto failure;
 		}
@@ -1161,6 +1227,7 @@ select_signing_key(dns_validator_t *val, dns_rdataset_t *rdataset) {
 			}
 		}
 		dst_key_free(&val->key);
+	next:
 		dns_rdata_reset(&rdata);
 		result = dns_rdataset_next(rdataset);
 	} while (result == ISC_R_SUCCESS);
@@ -1403,8 +1470,8 @@ selfsigned_dnskey(dns_validator_t *val) {
 				continue;
 			}
 
-			result = dns_dnssec_keyfromrdata(name, &keyrdata, mctx,
-							 &dstkey);
+			result = get_dstkey(val, name, &keyrdata, rdataset,
+					    &dstkey);
 			if (result != ISC_R_SUCCESS) {
 				continue;
 			}
@@ -1430,26 +1497,125 @@ selfsigned_dnskey(dns_validator_t *val) {
 	return (answer);
 }
 
+/*%
+ * Remember the outcome of verifying the signature identified by
+ * 'digest' in the view's signature cache.  Only outcomes that depend
+ * on nothing but the signature, the RRset and the key are stored; an
+ * expired or not yet valid signature is checked again next time.
+ */
+static void
+cache_verify(dns_validator_t *val, const unsigned char *digest,
+	     dns_rdata_t *rdata, isc_result_t result, dns_name_t *wild)
+{
+	dns_rdata_rrsig_t sig;
+
+	switch (result) {
+	case ISC_R_SUCCESS:
+	case DNS_R_FROMWILDCARD:
+	case DNS_R_SIGINVALID:
+	case DNS_R_KEYUNAUTHORIZED:
+		break;
+	default:
+		return;
+	}
+
+	if (dns_rdata_tostruct(rdata, &sig, NULL) != ISC_R_SUCCESS) {
+		return;
+	}
+	dns_sigcache_add(val->view->sigcache, digest, sig.timesigned,
+			 sig.timeexpire, result, wild);
+	dns_rdata_freestruct(&sig);
+}
+
 /*%
  * Attempt to verify the rdataset using the given key and rdata (RRSIG).
  * The signature was good and from a wildcard record and the QNAME does
  * not match the wildcard we need to look for a NOQNAME proof.
  *
+ * If the view has a signature cache, the result of an earlier
+ * verification of the same signature over the same data is used
+ * instead of doing the public key operation again.
+ *
+ * If 'offload' is true and the view has a verify pool, the public key
+ * operation is handed to the pool and DNS_R_WAIT is returned; when
+ * the result arrives verify_done() resumes validate_answer(), which
+ * calls here again to pick it up.
+ *
  * Returns:
  * \li	ISC_R_SUCCESS if the verification succeeds.
+ * \li	DNS_R_WAIT if the verification has been handed to the verify
+ *	pool.
  * \li	Others if the verification fails.
  */
 static isc_result_t
 verify(dns_validator_t *val, dst_key_t *key, dns_rdata_t *rdata,
-       uint16_t keyid)
+       uint16_t keyid, bool offload)
 {
 	isc_result_t result;
 	dns_fixedname_t fixed;
 	bool ignore = false;
+	bool cached = false;
 	dns_name_t *wild;
+	unsigned char digest[DNS_SIGCACHE_DIGESTLENGTH];
+
+	if (VERIFYDONE(val)) {
+		val->attributes &= ~VALATTR_VERIFYDONE;
+		result = val->vresult;
+		ignore = val->vignore;
+		wild = dns_fixedname_name(&val->vwild);
+		if (val->vcached && !ignore) {
+			cache_verify(val, val->vdigest, rdata, result, wild);
+		}
+		goto found;
+	}
 
 	val->attributes |= VALATTR_TRIEDVERIFY;
 	wild = dns_fixedname_initname(&fixed);
+
+	if (val->view->sigcache != NULL) {
+		isc_stdtime_t now;
+
+		result = dns_sigcache_digest(val->event->name,
+					     val->event->rdataset, rdata, key,
+					     val->view->maxbits,
+					     val->view->mctx, digest);
+		cached = (result == ISC_R_SUCCESS);
+
+		isc_stdtime_get(&now);
+		if (cached &&
+		    dns_sigcache_find(val->view->sigcache, digest, now,
+				      &result, wild) == ISC_R_SUCCESS)
+		{
+			inc_stat(val, dns_resstatscounter_sigcachehit);
+			validator_log(val, ISC_LOG_DEBUG(3),
+				      "found verify result in cache");
+			goto found;
+		}
+		if (cached) {
+			inc_stat(val, dns_resstatscounter_sigcachemiss);
+		}
+	}
+
+	if (offload && val->view->verifypool != NULL) {
+		result = dns_verifypool_verify(val->view->verifypool,
+					       val->event->name,
+					       val->event->rdataset, key,
+					       val->view->acceptexpired,
+					       val->view->maxbits, rdata,
+					       val->task, verify_done, val);
+		if (result == ISC_R_SUCCESS) {
+			val->attributes |= VALATTR_VERIFYING;
+			val->vcached = cached;
+			if (cached) {
+				memmove(val->vdigest, digest, sizeof(digest));
+			}
+			validator_log(val, ISC_LOG_DEBUG(3),
+				      "verifying rdataset (keyid=%u) "
+				      "in verify pool", keyid);
+			return (DNS_R_WAIT);
+		}
+	}
+
  again:
 	result = dns_dnssec_verify(val->event->name, val->event->rdataset,
 				   key, ignore, val->view->maxbits,
@@ -1460,7 +1626,11 @@ verify(dns_validator_t *val, dst_key_t *key, dns_rdata_t *rdata,
 		ignore = true;
 		goto again;
 	}
+	if (cached && !ignore) {
+		cache_verify(val, digest, rdata, result, wild);
+	}
 
+ found:
 	if (ignore &&
 	    (result == ISC_R_SUCCESS || result == DNS_R_FROMWILDCARD))
 	{
@@ -1577,7 +1747,10 @@ validate_answer(dns_validator_t *val, bool resume) {
 		do {
 			isc_result_t tresult;
 			vresult = verify(val, val->key, &rdata,
-					 val->siginfo->keyid);
+					 val->siginfo->keyid, true);
+			if (vresult == DNS_R_WAIT) {
+				return (DNS_R_WAIT);
+			}
 			if (vresult == ISC_R_SUCCESS) {
 				break;
 			}
@@ -1639,6 +1812,52 @@ validate_answer(dns_validator_t *val, bool resume) {
 	return (vresult);
 }
 
+/*%
+ * The verify pool has verified a signature for validate_answer().
+ */
+static void
+verify_done(isc_task_t *task, isc_event_t *event) {
+	dns_verifyevent_t *vevent;
+	dns_validator_t *val;
+	bool want_destroy;
+	isc_result_t result;
+
+	UNUSED(task);
+	INSIST(event->ev_type == DNS_EVENT_VERIFYDONE);
+	vevent = (dns_verifyevent_t *)event;
+	val = vevent->ev_arg;
+
+	validator_log(val, ISC_LOG_DEBUG(3), "in verify_done");
+	LOCK(&val->lock);
+	INSIST(VERIFYING(val));
+	val->attributes &= ~VALATTR_VERIFYING;
+	if (CANCELED(val)) {
+		validator_done(val, ISC_R_CANCELED);
+	} else {
+		val->vresult = vevent->result;
+		val->vignore = vevent->ignoretime;
+		dns_fixedname_init(&val->vwild);
+		if (vevent->result == DNS_R_FROMWILDCARD) {
+			dns_name_copynf(dns_fixedname_name(&vevent->wild),
+					dns_fixedname_name(&val->vwild));
+		}
+		val->attributes |= VALATTR_VERIFYDONE;
+		result = validate_answer(val, true);
+		if (result != DNS_R_WAIT) {
+			validator_done(val, result);
+		}
+	}
+
+	want_destroy = exit_check(val);
+	UNLOCK(&val->lock);
+
+	isc_event_free(&event);
+
+	if (want_destroy) {
+		destroy(val);
+	}
+}
+
 /*%
  * Check whether this DNSKEY (keyrdata) signed the DNSKEY RRset
  * (val->event->rdataset).
@@ -1664,10 +1883,8 @@ check_signer(dns_validator_t *val, dns_rdata_t *keyrdata,
 			continue;
 		}
 		if (dstkey == NULL) {
-			result = dns_dnssec_keyfromrdata(val->event->name,
-							 keyrdata,
-							 val->view->mctx,
-							 &dstkey);
+			result = get_dstkey(val, val->event->name, keyrdata,
+					    val->event->rdataset, &dstkey);
 			if (result != ISC_R_SUCCESS) {
 				/*
 				 * This really shouldn't happen, but...
@@ -1675,7 +1892,7 @@ check_signer(dns_validator_t *val, dns_rdata_t *keyrdata,
 				continue;
 			}
 		}
-		result = verify(val, dstkey, &rdata, sig.keyid);
+		result = verify(val, dstkey, &rdata, sig.keyid, false);
 		if (result == ISC_R_SUCCESS) {
 			break;
 		}
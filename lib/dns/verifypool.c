@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/atomic.h>
+#include <isc/event.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/refcount.h>
+#include <isc/string.h>
+#include <isc/task.h>
+#include <isc/util.h>
+
+#include <dns/dnssec.h>
+#include <dns/events.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+#include <dns/verifypool.h>
+
+#include <dst/dst.h>
+
+struct dns_verifypool {
+	unsigned int			magic;
+	isc_mem_t			*mctx;
+	isc_refcount_t			references;
+	unsigned int			ntasks;
+	isc_task_t			**tasks;
+	atomic_uint_fast32_t		next;
+};
+
+#define VERIFYPOOL_MAGIC		ISC_MAGIC('V', 'f', 'y', 'P')
+#define VALID_VERIFYPOOL(m)		ISC_MAGIC_VALID(m, VERIFYPOOL_MAGIC)
+
+/*
+ * The worker threads are shared with the tasks waiting for the
+ * results, so let them run between verifications.
+ */
+#define VERIFYPOOL_QUANTUM		1
+
+static void
+destroy(dns_verifypool_t *pool) {
+	unsigned int i;
+
+	pool->magic = 0;
+	for (i = 0; i < pool->ntasks; i++) {
+		if (pool->tasks[i] != NULL) {
+			isc_task_detach(&pool->tasks[i]);
+		}
+	}
+	isc_mem_put(pool->mctx, pool->tasks,
+		    pool->ntasks * sizeof(pool->tasks[0]));
+	isc_refcount_destroy(&pool->references);
+	isc_mem_putanddetach(&pool->mctx, pool, sizeof(*pool));
+}
+
+isc_result_t
+dns_verifypool_create(isc_mem_t *mctx, isc_taskmgr_t *taskmgr,
+		      unsigned int ntasks, dns_verifypool_t **poolp)
+{
+	dns_verifypool_t *pool;
+	isc_result_t result;
+	unsigned int i;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(taskmgr != NULL);
+	REQUIRE(ntasks > 0);
+	REQUIRE(poolp != NULL && *poolp == NULL);
+
+	pool = isc_mem_get(mctx, sizeof(*pool));
+	*pool = (dns_verifypool_t) {
+		.ntasks = ntasks
+	};
+	isc_mem_attach(mctx, &pool->mctx);
+	isc_refcount_init(&pool->references, 1);
+	atomic_init(&pool->next, 0);
+
+	pool->tasks = isc_mem_get(mctx, ntasks * sizeof(pool->tasks[0]));
+	memset(pool->tasks, 0, ntasks * sizeof(pool->tasks[0]));
+
+	/*
+	 * Bind the tasks to the worker threads in turn.
+	 */
+	for (i = 0; i < ntasks; i++) {
+		result = isc_task_create_bound(taskmgr, VERIFYPOOL_QUANTUM,
+					       &pool->tasks[i], i);
+		if (result != ISC_R_SUCCESS) {
+			goto cleanup;
+		}
+		isc_task_setname(pool->tasks[i], "verifypool", pool);
+	}
+
+	pool->magic = VERIFYPOOL_MAGIC;
+	*poolp = pool;
+
+	return (ISC_R_SUCCESS);
+
+ cleanup:
+	destroy(pool);
+	return (result);
+}
+
+void
+dns_verifypool_attach(dns_verifypool_t *source, dns_verifypool_t **targetp) {
+	REQUIRE(VALID_VERIFYPOOL(source));
+	REQUIRE(targetp != NULL && *targetp == NULL);
+
+	isc_refcount_increment(&source->references);
+
+	*targetp = source;
+}
+
+void
+dns_verifypool_detach(dns_verifypool_t **poolp) {
+	dns_verifypool_t *pool;
+
+	REQUIRE(poolp != NULL && VALID_VERIFYPOOL(*poolp));
+	pool = *poolp;
+	*poolp = NULL;
+
+	if (isc_refcount_decrement(&pool->references) == 1) {
+		destroy(pool);
+	}
+}
+
+unsigned int
+dns_verifypool_size(dns_verifypool_t *pool) {
+	REQUIRE(VALID_VERIFYPOOL(pool));
+
+	return (pool->ntasks);
+}
+
+/*
+ * Free whatever the request still holds, and the event.
+ */
+static void
+verifyevent_destroy(isc_event_t *event) {
+	dns_verifyevent_t *vevent = (dns_verifyevent_t *)event;
+	dns_verifypool_t *pool = vevent->pool;
+
+	if (dns_rdataset_isassociated(&vevent->rdataset)) {
+		dns_rdataset_disassociate(&vevent->rdataset);
+	}
+	if (vevent->key != NULL) {
+		dst_key_free(&vevent->key);
+	}
+	if (vevent->task != NULL) {
+		isc_task_detach(&vevent->task);
+	}
+	isc_mem_put(pool->mctx, vevent, vevent->ev_size);
+	dns_verifypool_detach(&pool);
+}
+
+/*
+ * Runs on a pool task: verify the signature, then send the event
+ * on to the caller.
+ */
+static void
+verify_action(isc_task_t *task, isc_event_t *event) {
+	dns_verifyevent_t *vevent = (dns_verifyevent_t *)event;
+	dns_name_t *wild;
+	isc_task_t *reply;
+	isc_result_t result;
+	bool ignore = false;
+
+	UNUSED(task);
+
+	INSIST(event->ev_type == DNS_EVENT_VERIFYSIG);
+
+	wild = dns_fixedname_initname(&vevent->wild);
+ again:
+	result = dns_dnssec_verify(dns_fixedname_name(&vevent->name),
+				   &vevent->rdataset, vevent->key, ignore,
+				   vevent->maxbits, vevent->pool->mctx,
+				   &vevent->sigrdata, wild);
+	if ((result == DNS_R_SIGEXPIRED || result == DNS_R_SIGFUTURE) &&
+	    vevent->acceptexpired && !ignore)
+	{
+		ignore = true;
+		goto again;
+	}
+
+	vevent->result = result;
+	vevent->ignoretime = ignore;
+
+	/*
+	 * The data is not needed any more; let it go here rather than on
+	 * the caller's thread.
+	 */
+	dns_rdataset_disassociate(&vevent->rdataset);
+	dst_key_free(&vevent->key);
+
+	reply = vevent->task;
+	vevent->task = NULL;
+	vevent->ev_type = DNS_EVENT_VERIFYDONE;
+	vevent->ev_action = vevent->action;
+	vevent->ev_arg = vevent->arg;
+	isc_task_sendanddetach(&reply, &event);
+}
+
+isc_result_t
+dns_verifypool_verify(dns_verifypool_t *pool, const dns_name_t *name,
+		      dns_rdataset_t *rdataset, dst_key_t *key,
+		      bool acceptexpired, unsigned int maxbits,
+		      dns_rdata_t *sigrdata, isc_task_t *task,
+		      isc_taskaction_t action, void *arg)
+{
+	dns_verifyevent_t *vevent;
+	isc_region_t r;
+	uint32_t i;
+
+	REQUIRE(VALID_VERIFYPOOL(pool));
+	REQUIRE(name != NULL && dns_name_isabsolute(name));
+	REQUIRE(DNS_RDATASET_VALID(rdataset));
+	REQUIRE(key != NULL);
+	REQUIRE(sigrdata != NULL && sigrdata->type == dns_rdatatype_rrsig);
+	REQUIRE(task != NULL);
+	REQUIRE(action != NULL);
+
+	/*
+	 * The RRSIG rdata is copied right after the event.
+	 */
+	dns_rdata_toregion(sigrdata, &r);
+	vevent = (dns_verifyevent_t *)
+		isc_event_allocate(pool->mctx, pool, DNS_EVENT_VERIFYSIG,
+				   verify_action, NULL,
+				   sizeof(*vevent) + r.length);
+	vevent->ev_destroy = verifyevent_destroy;
+	vevent->ev_destroy_arg = NULL;
+
+	vevent->result = ISC_R_UNSET;
+	vevent->ignoretime = false;
+	dns_fixedname_init(&vevent->wild);
+	vevent->pool = NULL;
+	dns_verifypool_attach(pool, &vevent->pool);
+	vevent->task = NULL;
+	isc_task_attach(task, &vevent->task);
+	vevent->action = action;
+	vevent->arg = arg;
+	dns_name_copynf(name, dns_fixedname_initname(&vevent->name));
+	dns_rdataset_init(&vevent->rdataset);
+	dns_rdataset_clone(rdataset, &vevent->rdataset);
+	vevent->key = NULL;
+	dst_key_attach(key, &vevent->key);
+	memmove(vevent + 1, r.base, r.length);
+	r.base = (unsigned char *)(vevent + 1);
+	dns_rdata_init(&vevent->sigrdata);
+	dns_rdata_fromregion(&vevent->sigrdata, sigrdata->rdclass,
+			     sigrdata->type, &r);
+	vevent->acceptexpired = acceptexpired;
+	vevent->maxbits = maxbits;
+
+	i = atomic_fetch_add_relaxed(&pool->next, 1);
+	isc_task_send(pool->tasks[i % pool->ntasks], (isc_event_t **)&vevent);
+
+	return (ISC_R_SUCCESS);
+}
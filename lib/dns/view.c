@@ -31,6 +31,7 @@
 
 #include <dns/acl.h>
 #include <dns/adb.h>
+#include <dns/anscache.h>
 #include <dns/badcache.h>
 #include <dns/cache.h>
 #include <dns/db.h>
@@ -40,6 +41,7 @@
 #include <dns/dnssec.h>
 #include <dns/events.h>
 #include <dns/forward.h>
+#include <dns/keycache.h>
 #include <dns/keytable.h>
 #include <dns/keyvalues.h>
 #include <dns/master.h>
@@ -54,9 +56,11 @@
 #include <dns/result.h>
 #include <dns/rpz.h>
 #include <dns/rrl.h>
+#include <dns/sigcache.h>
 #include <dns/stats.h>
 #include <dns/time.h>
 #include <dns/tsig.h>
+#include <dns/verifypool.h>
 #include <dns/zone.h>
 #include <dns/zt.h>
 
@@ -211,6 +215,7 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	view->staleanswerttl = 1;
 	view->staleanswersok = dns_stale_answer_conf;
 	view->staleanswersenable = false;
+	view->staleanswerrevalidate = false;
 	view->nocookieudp = 0;
 	view->padding = 0;
 	view->pad_acl = NULL;
@@ -241,6 +246,10 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	if (result != ISC_R_SUCCESS) {
 		goto cleanup_dynkeys;
 	}
+	view->anscache = NULL;
+	view->keycache = NULL;
+	view->sigcache = NULL;
+	view->verifypool = NULL;
 	view->v6bias = 0;
 	view->dtenv = NULL;
 	view->dttypes = 0;
@@ -537,6 +546,14 @@ destroy(dns_view_t *view) {
 	dns_aclenv_destroy(&view->aclenv);
 	if (view->failcache != NULL)
 		dns_badcache_destroy(&view->failcache);
+	if (view->anscache != NULL)
+		dns_anscache_destroy(&view->anscache);
+	if (view->keycache != NULL)
+		dns_keycache_destroy(&view->keycache);
+	if (view->sigcache != NULL)
+		dns_sigcache_destroy(&view->sigcache);
+	if (view->verifypool != NULL)
+		dns_verifypool_detach(&view->verifypool);
 	isc_mutex_destroy(&view->new_zone_lock);
 	isc_mutex_destroy(&view->lock);
 	isc_refcount_destroy(&view->references);
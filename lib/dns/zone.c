@@ -60,6 +60,7 @@
 #include <dns/nsec3.h>
 #include <dns/peer.h>
 #include <dns/private.h>
+#include <dns/proofcache.h>
 #include <dns/rcode.h>
 #include <dns/rdata.h>
 #include <dns/rdataclass.h>
@@ -201,6 +202,8 @@ struct dns_zone {
 
 	isc_rwlock_t		dblock;
 	dns_db_t		*db;		/* Locked by dblock */
+	atomic_uint_fast64_t	generation;	/* See zone_newgeneration() */
+	dns_proofcache_t	*proofcache;
 
 	/* Locked */
 	dns_zonemgr_t		*zmgr;
@@ -738,6 +741,9 @@ LIBDNS_EXTERNAL_DATA unsigned int dns_zone_mkey_month = MONTH;
 
 #define SEND_BUFFER_SIZE 2048
 
+/*% Last generation number handed out to a zone. */
+static atomic_uint_fast64_t zone_generations;
+
 static void zone_settimer(dns_zone_t *, isc_time_t *);
 static void cancel_refresh(dns_zone_t *);
 static void zone_debuglog(dns_zone_t *zone, const char *, int debuglevel,
@@ -752,6 +758,7 @@ static isc_result_t update_one_rr(dns_db_t *db, dns_dbversion_t *ver,
 				  dns_name_t *name, dns_ttl_t ttl,
 				  dns_rdata_t *rdata);
 static void zone_unload(dns_zone_t *zone);
+static void zone_newgeneration(dns_zone_t *zone);
 static void zone_expire(dns_zone_t *zone);
 static void zone_iattach(dns_zone_t *source, dns_zone_t **target);
 static void zone_idetach(dns_zone_t **zonep);
@@ -920,6 +927,8 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	zone->locked = false;
 #endif
 	zone->db = NULL;
+	atomic_init(&zone->generation, 0);
+	zone_newgeneration(zone);
 	zone->zmgr = NULL;
 	ISC_LINK_INIT(zone, link);
 	isc_refcount_init(&zone->erefs, 1);
@@ -1076,6 +1085,11 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	if (result != ISC_R_SUCCESS) {
 		goto free_refs;
 	}
+	zone->proofcache = NULL;
+	result = dns_proofcache_create(mctx, &zone->proofcache);
+	if (result != ISC_R_SUCCESS) {
+		goto free_stats;
+	}
 
 	/* Must be after magic is set. */
 	dns_zone_setdbtype(zone, dbargc_default, dbargv_default);
@@ -1086,6 +1100,9 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	*zonep = zone;
 	return (ISC_R_SUCCESS);
 
+ free_stats:
+	isc_stats_detach(&zone->gluecachestats);
+
  free_refs:
 	isc_refcount_decrement(&zone->erefs);
 	isc_refcount_destroy(&zone->erefs);
@@ -1216,6 +1233,7 @@ zone_free(dns_zone_t *zone) {
 	if (zone->db != NULL) {
 		zone_detachdb(zone);
 	}
+	dns_proofcache_destroy(&zone->proofcache);
 	if (zone->rpzs != NULL) {
 		REQUIRE(zone->rpz_num < zone->rpzs->p.num_zones);
 		dns_rpz_detach_rpzs(&zone->rpzs);
@@ -11407,6 +11425,20 @@ dns_zone_setmaxrecords(dns_zone_t *zone, uint32_t val) {
 	zone->maxrecords = val;
 }
 
+void
+dns_zone_setproofcachesize(dns_zone_t *zone, uint32_t size) {
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	dns_proofcache_setmaxentries(zone->proofcache, size);
+}
+
+dns_proofcache_t *
+dns_zone_getproofcache(dns_zone_t *zone) {
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	return (zone->proofcache);
+}
+
 static bool
 notify_isqueued(dns_zone_t *zone, unsigned int flags, dns_name_t *name,
 		isc_sockaddr_t *addr, dns_tsigkey_t *key)
@@ -15865,12 +15897,43 @@ zone_replacedb(dns_zone_t *zone, dns_db_t *db, bool dump) {
 	return (result);
 }
 
+/*
+ * Give the zone a generation number that no zone has used before.
+ * Consumers such as the view's answer cache tag what they derive
+ * from the zone contents with it.
+ */
+static void
+zone_newgeneration(dns_zone_t *zone) {
+	atomic_store(&zone->generation,
+		     atomic_fetch_add(&zone_generations, 1) + 1);
+}
+
+static isc_result_t
+zone_dbupdate_callback(dns_db_t *db, void *fn_arg) {
+	dns_zone_t *zone = fn_arg;
+
+	UNUSED(db);
+
+	zone_newgeneration(zone);
+	return (ISC_R_SUCCESS);
+}
+
+uint64_t
+dns_zone_getgeneration(dns_zone_t *zone) {
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	return (atomic_load(&zone->generation));
+}
+
 /* The caller must hold the dblock as a writer. */
 static inline void
 zone_attachdb(dns_zone_t *zone, dns_db_t *db) {
 	REQUIRE(zone->db == NULL && db != NULL);
 
 	dns_db_attach(db, &zone->db);
+	(void)dns_db_updatenotify_register(zone->db, zone_dbupdate_callback,
+					   zone);
+	zone_newgeneration(zone);
 }
 
 /* The caller must hold the dblock as a writer. */
@@ -15878,6 +15941,14 @@ static inline void
 zone_detachdb(dns_zone_t *zone) {
 	REQUIRE(zone->db != NULL);
 
+	(void)dns_db_updatenotify_unregister(zone->db, zone_dbupdate_callback,
+					     zone);
+	zone_newgeneration(zone);
+	/*
+	 * The proof cache holds records of the database; don't let it
+	 * keep the database alive.
+	 */
+	dns_proofcache_flush(zone->proofcache);
 	dns_db_detach(&zone->db);
 }
 
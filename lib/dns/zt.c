@@ -49,6 +49,7 @@ struct dns_zt {
 
 	/* Atomic */
 	atomic_bool		flush;
+	atomic_uint_fast64_t	generation;
 	isc_refcount_t		references;
 	isc_refcount_t		loads_pending;
 
@@ -97,6 +98,7 @@ dns_zt_create(isc_mem_t *mctx, dns_rdataclass_t rdclass, dns_zt_t **ztp) {
 	isc_mem_attach(mctx, &zt->mctx);
 	isc_refcount_init(&zt->references, 1);
 	atomic_init(&zt->flush, false);
+	atomic_init(&zt->generation, 0);
 	zt->rdclass = rdclass;
 	zt->magic = ZTMAGIC;
 	zt->loaddone = NULL;
@@ -129,8 +131,10 @@ dns_zt_mount(dns_zt_t *zt, dns_zone_t *zone) {
 	RWLOCK(&zt->rwlock, isc_rwlocktype_write);
 
 	result = dns_rbt_addname(zt->table, name, zone);
-	if (result == ISC_R_SUCCESS)
+	if (result == ISC_R_SUCCESS) {
 		dns_zone_attach(zone, &dummy);
+		(void)atomic_fetch_add_release(&zt->generation, 1);
+	}
 
 	RWUNLOCK(&zt->rwlock, isc_rwlocktype_write);
 
@@ -149,6 +153,9 @@ dns_zt_unmount(dns_zt_t *zt, dns_zone_t *zone) {
 	RWLOCK(&zt->rwlock, isc_rwlocktype_write);
 
 	result = dns_rbt_deletename(zt->table, name, false);
+	if (result == ISC_R_SUCCESS) {
+		(void)atomic_fetch_add_release(&zt->generation, 1);
+	}
 
 	RWUNLOCK(&zt->rwlock, isc_rwlocktype_write);
 
@@ -205,6 +212,37 @@ dns_zt_find(dns_zt_t *zt, const dns_name_t *name, unsigned int options,
 	return (result);
 }
 
+bool
+dns_zt_isleaf(dns_zt_t *zt, const dns_name_t *name) {
+	isc_result_t result;
+	dns_rbtnode_t *node = NULL;
+	bool leaf = false;
+
+	REQUIRE(VALID_ZT(zt));
+
+	RWLOCK(&zt->rwlock, isc_rwlocktype_read);
+	result = dns_rbt_findnode(zt->table, name, NULL, &node, NULL, 0,
+				  NULL, NULL);
+	if (result == ISC_R_SUCCESS) {
+		/*
+		 * Every zone below this one would be in the subtree
+		 * under the node.  A subtree left with no zones in it
+		 * makes us answer false, which is safe.
+		 */
+		leaf = (node->down == NULL);
+	}
+	RWUNLOCK(&zt->rwlock, isc_rwlocktype_read);
+
+	return (leaf);
+}
+
+uint64_t
+dns_zt_getgeneration(dns_zt_t *zt) {
+	REQUIRE(VALID_ZT(zt));
+
+	return (atomic_load_acquire(&zt->generation));
+}
+
 void
 dns_zt_attach(dns_zt_t *zt, dns_zt_t **ztp) {
 
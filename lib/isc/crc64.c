@@ -13,6 +13,7 @@
 
 #include <isc/assertions.h>
 #include <isc/crc64.h>
+#include <isc/once.h>
 #include <isc/string.h>
 #include <isc/types.h>
 #include <isc/util.h>
@@ -116,21 +117,64 @@ isc_crc64_init(uint64_t *crc) {
 	*crc = 0xffffffffffffffffULL;
 }
 
+/*%<
+ * Tables for processing eight bytes at a time: crc64_slices[n][i] is
+ * the CRC of byte 'i' followed by n + 1 zero bytes.
+ */
+static uint64_t crc64_slices[7][256];
+static isc_once_t crc64_once = ISC_ONCE_INIT;
+
+static void
+crc64_initslices(void) {
+	uint64_t crc;
+	int i, n;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc64_table[i];
+		for (n = 0; n < 7; n++) {
+			crc = crc64_table[crc >> 56] ^ (crc << 8);
+			crc64_slices[n][i] = crc;
+		}
+	}
+}
+
 void
 isc_crc64_update(uint64_t *crc, const void *data, size_t len) {
 	const unsigned char *p = data;
+	uint64_t c;
 	int i;
 
 	REQUIRE(crc != NULL);
 	REQUIRE(data != NULL);
 
+	RUNTIME_CHECK(isc_once_do(&crc64_once, crc64_initslices) ==
+		      ISC_R_SUCCESS);
+
+	c = *crc;
+	while (len >= 8U) {
+		c ^= ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+		     ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+		     ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+		     ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+		c = crc64_slices[6][c >> 56] ^
+		    crc64_slices[5][(c >> 48) & 0xff] ^
+		    crc64_slices[4][(c >> 40) & 0xff] ^
+		    crc64_slices[3][(c >> 32) & 0xff] ^
+		    crc64_slices[2][(c >> 24) & 0xff] ^
+		    crc64_slices[1][(c >> 16) & 0xff] ^
+		    crc64_slices[0][(c >> 8) & 0xff] ^
+		    crc64_table[c & 0xff];
+		p += 8;
+		len -= 8;
+	}
+
 	while (len-- > 0U) {
-		i = ((int) (*crc >> 56) ^ *p++) & 0xff;
-		*crc = crc64_table[i] ^ (*crc << 8);
+		i = ((int) (c >> 56) ^ *p++) & 0xff;
+		c = crc64_table[i] ^ (c << 8);
 	}
+	*crc = c;
 }
 
-
 void
 isc_crc64_final(uint64_t *crc) {
 	REQUIRE(crc != NULL);
@@ -26,6 +26,12 @@ typedef struct isc_ht_node isc_ht_node_t;
 #define ISC_HT_MAGIC			ISC_MAGIC('H', 'T', 'a', 'b')
 #define ISC_HT_VALID(ht)		ISC_MAGIC_VALID(ht, ISC_HT_MAGIC)
 
+/*
+ * Tables grow by doubling, once they hold as many nodes as they have
+ * chains, up to 2^32 chains or what the address space allows.
+ */
+#define HT_MAXSIZE			((uint64_t)1 << 32)
+
 struct isc_ht_node {
 	void *value;
 	isc_ht_node_t *next;
@@ -111,6 +117,38 @@ isc_ht_destroy(isc_ht_t **htp) {
 
 }
 
+/*
+ * Double the number of chains in 'ht', moving every node to the chain
+ * it hashes to in the new table.
+ */
+static void
+grow(isc_ht_t *ht) {
+	isc_ht_node_t **table;
+	size_t i, size = ht->size * 2;
+
+	table = isc_mem_get(ht->mctx, size * sizeof(isc_ht_node_t *));
+	for (i = 0; i < size; i++) {
+		table[i] = NULL;
+	}
+
+	for (i = 0; i < ht->size; i++) {
+		isc_ht_node_t *node = ht->table[i];
+		while (node != NULL) {
+			isc_ht_node_t *next = node->next;
+			uint32_t hash = isc_hash_function(node->key,
+							  node->keysize, true);
+			node->next = table[hash & (size - 1)];
+			table[hash & (size - 1)] = node;
+			node = next;
+		}
+	}
+
+	isc_mem_put(ht->mctx, ht->table, ht->size * sizeof(isc_ht_node_t *));
+	ht->table = table;
+	ht->size = size;
+	ht->mask = size - 1;
+}
+
 isc_result_t
 isc_ht_add(isc_ht_t *ht, const unsigned char *key,
 	   uint32_t keysize, void *value)
@@ -121,6 +159,12 @@ isc_ht_add(isc_ht_t *ht, const unsigned char *key,
 	REQUIRE(ISC_HT_VALID(ht));
 	REQUIRE(key != NULL && keysize > 0);
 
+	if (ht->count >= ht->size && (uint64_t)ht->size < HT_MAXSIZE &&
+	    ht->size < SIZE_MAX / 2 / sizeof(isc_ht_node_t *))
+	{
+		grow(ht);
+	}
+
 	hash = isc_hash_function(key, keysize, true);
 	node = ht->table[hash & ht->mask];
 	while (node != NULL) {
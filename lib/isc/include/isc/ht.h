@@ -25,6 +25,8 @@ typedef struct isc_ht_iter isc_ht_iter_t;
 
 /*%
  * Initialize hashtable at *htp, using memory context and size of (1<<bits)
+ * chains.  The table doubles in size whenever it holds as many nodes as
+ * it has chains, so 'bits' only needs to fit the expected load.
  *
  * Requires:
  *\li	'htp' is not NULL and '*htp' is NULL.
@@ -49,7 +51,8 @@ isc_ht_destroy(isc_ht_t **htp);
 
 /*%
  * Add a node to hashtable, pointed by binary key 'key' of size 'keysize';
- * set its value to 'value'
+ * set its value to 'value'.  This may grow the table, so it must not be
+ * called while an iterator over 'ht' is in use.
  *
  * Requires:
  *\li	'ht' is a valid hashtable
@@ -147,6 +147,16 @@ typedef void (*isc_nm_recv_cb_t)(isc_nmhandle_t *handle, isc_region_t *region,
  *          isc_nm_listentcpdns(), or isc_nm_read().
  */
 
+typedef void (*isc_nm_batch_cb_t)(void *cbarg);
+/*%<
+ * Callback function called when the datagrams read from a UDP socket
+ * in one pass of its worker's event loop have all been passed to the
+ * receive callback.  It is called in the same thread, so work that can
+ * be shared by the requests received together can be kept until then.
+ *
+ * 'cbarg'  the callback argument passed to isc_nm_listenudp().
+ */
+
 typedef void (*isc_nm_cb_t)(isc_nmhandle_t *handle, isc_result_t result,
 			    void *cbarg);
 /*%<
@@ -161,7 +171,7 @@ typedef void (*isc_nm_cb_t)(isc_nmhandle_t *handle, isc_result_t result,
 
 isc_result_t
 isc_nm_listenudp(isc_nm_t *mgr, isc_nmiface_t *iface,
-		 isc_nm_recv_cb_t cb, void *cbarg,
+		 isc_nm_recv_cb_t cb, isc_nm_batch_cb_t batchcb, void *cbarg,
 		 size_t extrasize, isc_nmsocket_t **sockp);
 /*%<
  * Start listening for UDP packets on interface 'iface' using net manager
@@ -170,7 +180,8 @@ isc_nm_listenudp(isc_nm_t *mgr, isc_nmiface_t *iface,
  * On success, 'sockp' will be updated to contain a new listening UDP socket.
  *
  * When a packet is received on the socket, 'cb' will be called with 'cbarg'
- * as its argument.
+ * as its argument.  If 'batchcb' is not NULL, it is called with 'cbarg'
+ * after each batch of packets (see isc_nm_batch_cb_t).
  *
  * When handles are allocated for the socket, 'extrasize' additional bytes
  * will be allocated along with the handle for an associated object
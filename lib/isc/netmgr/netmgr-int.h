@@ -396,6 +396,15 @@ struct isc_nmsocket {
 	uv_os_sock_t			fd;
 	union uv_any_handle		uv_handle;
 
+	/*%
+	 * UDP sockets with a batch callback: 'batchcheck' runs after
+	 * every pass of the event loop, and calls 'batchcb' if 'batched'
+	 * says datagrams were read.
+	 */
+	uv_check_t			batchcheck;
+	bool				batched;
+	isc_nm_batch_cb_t		batchcb;
+
 	/*% Peer address */
 	isc_sockaddr_t			peer;
 
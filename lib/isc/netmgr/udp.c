@@ -40,9 +40,12 @@ udp_recv_cb(uv_udp_t *handle, ssize_t nrecv, const uv_buf_t *buf,
 static void
 udp_send_cb(uv_udp_send_t *req, int status);
 
+static void
+udp_check_cb(uv_check_t *handle);
+
 isc_result_t
 isc_nm_listenudp(isc_nm_t *mgr, isc_nmiface_t *iface,
-		 isc_nm_recv_cb_t cb, void *cbarg,
+		 isc_nm_recv_cb_t cb, isc_nm_batch_cb_t batchcb, void *cbarg,
 		 size_t extrahandlesize, isc_nmsocket_t **sockp)
 {
 	isc_nmsocket_t *nsock = NULL;
@@ -81,6 +84,7 @@ isc_nm_listenudp(isc_nm_t *mgr, isc_nmiface_t *iface,
 		INSIST(csock->rcb.recv == NULL && csock->rcbarg == NULL);
 		csock->rcb.recv = cb;
 		csock->rcbarg = cbarg;
+		csock->batchcb = batchcb;
 		csock->fd = socket(family, SOCK_DGRAM, 0);
 		INSIST(csock->fd >= 0);
 
@@ -153,6 +157,13 @@ isc__nm_async_udplisten(isc__networker_t *worker, isc__netievent_t *ev0) {
 	uv_send_buffer_size(&sock->uv_handle.handle,
 			    &(int){16 * 1024 * 1024});
 	uv_udp_recv_start(&sock->uv_handle.udp, isc__nm_alloc_cb, udp_recv_cb);
+
+	if (sock->batchcb != NULL) {
+		sock->batched = false;
+		uv_check_init(&worker->loop, &sock->batchcheck);
+		uv_handle_set_data((uv_handle_t *)&sock->batchcheck, sock);
+		uv_check_start(&sock->batchcheck, udp_check_cb);
+	}
 }
 
 static void
@@ -163,13 +174,30 @@ udp_close_cb(uv_handle_t *handle) {
 	isc_nmsocket_detach((isc_nmsocket_t **)&sock->uv_handle.udp.data);
 }
 
+/*
+ * The UDP handle holds the reference to the socket, so it is only
+ * closed once the check handle, which lives in the socket, is.
+ */
+static void
+udp_batchcheck_close_cb(uv_handle_t *handle) {
+	isc_nmsocket_t *sock = uv_handle_get_data(handle);
+
+	uv_close((uv_handle_t *) &sock->uv_handle.udp, udp_close_cb);
+}
+
 static void
 stop_udp_child(isc_nmsocket_t *sock) {
 	REQUIRE(sock->type == isc_nm_udpsocket);
 	REQUIRE(sock->tid == isc_nm_tid());
 
 	uv_udp_recv_stop(&sock->uv_handle.udp);
-	uv_close((uv_handle_t *) &sock->uv_handle.udp, udp_close_cb);
+	if (sock->batchcb != NULL) {
+		uv_check_stop(&sock->batchcheck);
+		uv_close((uv_handle_t *) &sock->batchcheck,
+			 udp_batchcheck_close_cb);
+	} else {
+		uv_close((uv_handle_t *) &sock->uv_handle.udp, udp_close_cb);
+	}
 
 	isc__nm_incstats(sock->mgr, sock->statsindex[STATID_CLOSE]);
 
@@ -338,6 +366,7 @@ udp_recv_cb(uv_udp_t *handle, ssize_t nrecv, const uv_buf_t *buf,
 
 	INSIST(sock->rcb.recv != NULL);
 	sock->rcb.recv(nmhandle, &region, sock->rcbarg);
+	sock->batched = true;
 	isc__nm_free_uvbuf(sock, buf);
 
 	/*
@@ -347,6 +376,25 @@ udp_recv_cb(uv_udp_t *handle, ssize_t nrecv, const uv_buf_t *buf,
 	isc_nmhandle_unref(nmhandle);
 }
 
+/*
+ * libuv reads a number of datagrams each time a socket is readable,
+ * then runs the check handles.  Let the batch callback know that the
+ * batch is over, so it can release what it kept for it.
+ */
+static void
+udp_check_cb(uv_check_t *handle) {
+	isc_nmsocket_t *sock = uv_handle_get_data((uv_handle_t *)handle);
+
+	REQUIRE(VALID_NMSOCK(sock));
+
+	if (!sock->batched) {
+		return;
+	}
+
+	sock->batched = false;
+	sock->batchcb(sock->rcbarg);
+}
+
 /*
  * isc__nm_udp_send sends buf to a peer on a socket.
  * It tries to find a proper sibling/child socket so that we won't have
@@ -87,11 +87,40 @@ isc_crc64_test(void **state) {
 	       "81E5EB73C8E7874A", 1);
 }
 
+/* the result does not depend on how the input is split up */
+static void
+isc_crc64_split_test(void **state) {
+	unsigned char buf[1024];
+	uint64_t crc1, crc2;
+	size_t i, len;
+
+	UNUSED(state);
+
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (unsigned char)(i * 7 + (i >> 8));
+	}
+
+	isc_crc64_init(&crc1);
+	isc_crc64_update(&crc1, buf, sizeof(buf));
+	isc_crc64_final(&crc1);
+
+	for (len = 1; len < 20; len++) {
+		isc_crc64_init(&crc2);
+		for (i = 0; i < sizeof(buf); i += len) {
+			isc_crc64_update(&crc2, buf + i,
+					 ISC_MIN(len, sizeof(buf) - i));
+		}
+		isc_crc64_final(&crc2);
+		assert_true(crc1 == crc2);
+	}
+}
+
 int
 main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(isc_crc64_init_test),
 		cmocka_unit_test(isc_crc64_test),
+		cmocka_unit_test(isc_crc64_split_test),
 	};
 
 	return (cmocka_run_group_tests(tests, NULL, NULL));
@@ -34,6 +34,7 @@
 #include <isc/util.h>
 
 #include <dns/adb.h>
+#include <dns/anscache.h>
 #include <dns/badcache.h>
 #include <dns/db.h>
 #include <dns/dispatch.h>
@@ -53,6 +54,7 @@
 #include <dns/tsig.h>
 #include <dns/view.h>
 #include <dns/zone.h>
+#include <dns/zt.h>
 
 #include <ns/client.h>
 #include <ns/interfacemgr.h>
@@ -109,6 +111,19 @@
 #define MANAGER_MAGIC			ISC_MAGIC('N', 'S', 'C', 'm')
 #define VALID_MANAGER(m)		ISC_MAGIC_VALID(m, MANAGER_MAGIC)
 
+/*
+ * Per-request arena blocks.  The data follows the header, suitably
+ * aligned.
+ */
+struct ns_arenablock {
+	ISC_LINK(ns_arenablock_t)	link;
+	size_t				size;
+};
+
+#define ARENA_ALIGN(n)		(((n) + 15) & ~((size_t)15))
+#define ARENA_HEADERSIZE	ARENA_ALIGN(sizeof(ns_arenablock_t))
+#define ARENA_DATA(b)		((unsigned char *)(b) + ARENA_HEADERSIZE)
+
 /*
  * Enable ns_client_dropport() by default.
  */
@@ -126,6 +141,8 @@ static void clientmgr_attach(ns_clientmgr_t *source, ns_clientmgr_t **targetp);
 static void clientmgr_detach(ns_clientmgr_t **mp);
 static void clientmgr_destroy(ns_clientmgr_t *manager);
 static void ns_client_endrequest(ns_client_t *client);
+static void arena_reset(ns_client_t *client, bool everything);
+static bool arena_owns(void *arg, const void *item);
 static void ns_client_dumpmessage(ns_client_t *client, const char *reason);
 static void compute_cookie(ns_client_t *client, uint32_t when,
 			   uint32_t nonce, const unsigned char *secret,
@@ -214,6 +231,11 @@ ns_client_endrequest(ns_client_t *client) {
 	dns_ecs_init(&client->ecs);
 	dns_message_reset(client->message, DNS_MESSAGE_INTENTPARSE);
 
+	/*
+	 * Everything allocated for the request goes at once.
+	 */
+	arena_reset(client, false);
+
 	/*
 	 * Clean up from recursion - normally this would be done in
 	 * fetch_callback(), but if we're shutting down and canceling then
@@ -396,6 +418,186 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *message) {
 	isc_nmhandle_unref(client->handle);
 }
 
+isc_result_t
+ns_client_sendcached(ns_client_t *client, unsigned int *flagsp) {
+	isc_result_t result;
+	unsigned char *data;
+	isc_buffer_t buffer = { .magic = 0 };
+	isc_buffer_t tcpbuffer = { .magic = 0 };
+	isc_region_t key, r;
+	dns_name_t *qname = client->query.qname;
+	unsigned int flags;
+	size_t respsize;
+
+	REQUIRE(NS_CLIENT_VALID(client));
+	REQUIRE(client->view != NULL && client->view->anscache != NULL);
+	REQUIRE(client->query.anscache.keylen != 0);
+
+	CTRACE("sendcached");
+
+	result = client_allocsendbuf(client, &buffer, &tcpbuffer, 0, &data);
+	if (result != ISC_R_SUCCESS) {
+		goto done;
+	}
+
+	key.base = client->query.anscache.key;
+	key.length = client->query.anscache.keylen;
+	result = dns_anscache_find(client->view->anscache, &key,
+				   client->query.anscache.generation,
+				   &buffer, flagsp);
+	if (result != ISC_R_SUCCESS) {
+		goto done;
+	}
+
+	/*
+	 * The stored response was rendered for a question that differs
+	 * from this one at most in the case of the name: fix up the
+	 * ID, the per-query header flags and the question name.
+	 */
+	isc_buffer_usedregion(&buffer, &r);
+	INSIST(r.length >= DNS_MESSAGE_HEADERLEN + qname->length);
+	flags = (r.base[2] << 8) | r.base[3];
+	flags &= ~(DNS_MESSAGEFLAG_RD | DNS_MESSAGEFLAG_RA |
+		   DNS_MESSAGEFLAG_CD);
+	flags |= client->message->flags & (DNS_MESSAGEFLAG_RD |
+					   DNS_MESSAGEFLAG_CD);
+	if ((client->attributes & NS_CLIENTATTR_RA) != 0) {
+		flags |= DNS_MESSAGEFLAG_RA;
+	}
+	r.base[0] = (client->message->id >> 8) & 0xff;
+	r.base[1] = client->message->id & 0xff;
+	r.base[2] = (flags >> 8) & 0xff;
+	r.base[3] = flags & 0xff;
+	memmove(r.base + DNS_MESSAGE_HEADERLEN, qname->ndata, qname->length);
+
+	respsize = r.length;
+	if (client->sendcb != NULL) {
+		client->sendcb(&buffer);
+	} else {
+		if (TCP_CLIENT(client)) {
+			isc_buffer_add(&tcpbuffer, r.length);
+		}
+		isc_nmhandle_ref(client->handle);
+		result = client_sendpkg(client,
+					TCP_CLIENT(client) ? &tcpbuffer
+							   : &buffer);
+		if (result != ISC_R_SUCCESS) {
+			/* We won't get a callback to clean it up */
+			isc_nmhandle_unref(client->handle);
+		}
+		result = ISC_R_SUCCESS;
+	}
+
+	switch (isc_sockaddr_pf(&client->peeraddr)) {
+	case AF_INET:
+		isc_stats_increment(TCP_CLIENT(client)
+				    ? client->sctx->tcpoutstats4
+				    : client->sctx->udpoutstats4,
+				    ISC_MIN((int)respsize / 16, 256));
+		break;
+	case AF_INET6:
+		isc_stats_increment(TCP_CLIENT(client)
+				    ? client->sctx->tcpoutstats6
+				    : client->sctx->udpoutstats6,
+				    ISC_MIN((int)respsize / 16, 256));
+		break;
+	default:
+		INSIST(0);
+		ISC_UNREACHABLE();
+	}
+
+	ns_stats_increment(client->sctx->nsstats, ns_statscounter_response);
+	dns_rcodestats_increment(client->sctx->rcodestats,
+				 (dns_rcode_t)(flags & 0x000f));
+	if ((client->attributes & NS_CLIENTATTR_WANTOPT) != 0) {
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_edns0out);
+	}
+
+	return (ISC_R_SUCCESS);
+
+ done:
+	if (client->tcpbuf != NULL) {
+		isc_mem_put(client->mctx, client->tcpbuf,
+			    NS_CLIENT_TCP_BUFFER_SIZE);
+		client->tcpbuf = NULL;
+	}
+
+	return (ISC_R_NOTFOUND);
+}
+
+/*%
+ * Store the rendered response in the view's answer cache.  Only
+ * complete authoritative answers whose records all come from the zone
+ * the query was answered from are stored, as only changes to that zone
+ * invalidate them.
+ */
+static void
+client_anscache_add(ns_client_t *client, isc_buffer_t *buffer) {
+	dns_message_t *message = client->message;
+	dns_zone_t *authzone = client->query.authzone;
+	dns_name_t *origin, *name;
+	dns_section_t section;
+	isc_region_t key, r;
+	isc_result_t result;
+
+	if (client->query.restarts != 0 || authzone == NULL ||
+	    (message->flags & (DNS_MESSAGEFLAG_AA | DNS_MESSAGEFLAG_TC)) !=
+	    DNS_MESSAGEFLAG_AA ||
+	    (message->rcode != dns_rcode_noerror &&
+	     message->rcode != dns_rcode_nxdomain))
+	{
+		return;
+	}
+
+	origin = dns_zone_getorigin(authzone);
+	for (section = DNS_SECTION_ANSWER;
+	     section <= DNS_SECTION_ADDITIONAL;
+	     section++)
+	{
+		for (result = dns_message_firstname(message, section);
+		     result == ISC_R_SUCCESS;
+		     result = dns_message_nextname(message, section))
+		{
+			dns_zone_t *zone = NULL;
+			isc_result_t tresult;
+			bool inzone;
+
+			name = NULL;
+			dns_message_currentname(message, section, &name);
+			if (!dns_name_issubdomain(name, origin)) {
+				return;
+			}
+			if (section != DNS_SECTION_ADDITIONAL) {
+				continue;
+			}
+
+			/*
+			 * Additional data may come from a zone below
+			 * this one.
+			 */
+			tresult = dns_zt_find(client->view->zonetable, name,
+					      0, NULL, &zone);
+			inzone = ((tresult == ISC_R_SUCCESS ||
+				   tresult == DNS_R_PARTIALMATCH) &&
+				  zone == authzone);
+			if (zone != NULL) {
+				dns_zone_detach(&zone);
+			}
+			if (!inzone) {
+				return;
+			}
+		}
+	}
+
+	key.base = client->query.anscache.key;
+	key.length = client->query.anscache.keylen;
+	isc_buffer_usedregion(buffer, &r);
+	dns_anscache_add(client->view->anscache, &key,
+			 client->query.anscache.generation, &r,
+			 (unsigned int)client->query.anscache.counter);
+}
+
 void
 ns_client_send(ns_client_t *client) {
 	isc_result_t result;
@@ -408,6 +610,7 @@ ns_client_send(ns_client_t *client) {
 	unsigned int render_opts;
 	unsigned int preferred_glue;
 	bool opt_included = false;
+	bool truncpredicted = false;
 	size_t respsize;
 	dns_aclenv_t *env;
 #ifdef HAVE_DNSTAP
@@ -525,6 +728,8 @@ ns_client_send(ns_client_t *client) {
 					   render_opts);
 	if (result == ISC_R_NOSPACE) {
 		client->message->flags |= DNS_MESSAGEFLAG_TC;
+		truncpredicted =
+			dns_message_nospacepredicted(client->message);
 		goto renderend;
 	}
 	if (result != ISC_R_SUCCESS)
@@ -535,6 +740,8 @@ ns_client_send(ns_client_t *client) {
 					   render_opts);
 	if (result == ISC_R_NOSPACE) {
 		client->message->flags |= DNS_MESSAGEFLAG_TC;
+		truncpredicted =
+			dns_message_nospacepredicted(client->message);
 		goto renderend;
 	}
 	if (result != ISC_R_SUCCESS)
@@ -549,6 +756,10 @@ ns_client_send(ns_client_t *client) {
 	if (result != ISC_R_SUCCESS)
 		goto done;
 
+	if ((client->query.attributes & NS_QUERYATTR_ANSCACHE) != 0) {
+		client_anscache_add(client, &buffer);
+	}
+
 #ifdef HAVE_DNSTAP
 	memset(&zr, 0, sizeof(zr));
 	if (((client->message->flags & DNS_MESSAGEFLAG_AA) != 0) &&
@@ -675,6 +886,10 @@ ns_client_send(ns_client_t *client) {
 	if ((client->message->flags & DNS_MESSAGEFLAG_TC) != 0)
 		ns_stats_increment(client->sctx->nsstats,
 				   ns_statscounter_truncatedresp);
+	if (truncpredicted) {
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_truncpredicted);
+	}
 
 	if (result == ISC_R_SUCCESS) {
 		return;
@@ -1397,7 +1612,7 @@ process_keytag(ns_client_t *client, isc_buffer_t *buf, size_t optlen) {
 		return (ISC_R_SUCCESS);
 	}
 
-	client->keytag = isc_mem_get(client->mctx, optlen);
+	client->keytag = ns_client_arenaget(client, optlen);
 	{
 		client->keytag_len = (uint16_t)optlen;
 		memmove(client->keytag, isc_buffer_current(buf), optlen);
@@ -1541,11 +1756,11 @@ ns__client_reset_cb(void *client0) {
 			    NS_CLIENT_TCP_BUFFER_SIZE);
 	}
 
-	if (client->keytag != NULL) {
-		isc_mem_put(client->mctx, client->keytag,
-			    client->keytag_len);
-		client->keytag_len = 0;
-	}
+	/*
+	 * The keytag was in the arena, released by ns_client_endrequest().
+	 */
+	client->keytag = NULL;
+	client->keytag_len = 0;
 
 	client->state = NS_CLIENTSTATE_READY;
 	INSIST(client->recursionquota == NULL);
@@ -1563,6 +1778,7 @@ ns__client_put_cb(void *client0) {
 	 * Call this first because it requires a valid client.
 	 */
 	ns_query_free(client);
+	arena_reset(client, true);
 
 	client->magic = 0;
 	client->shuttingdown = true;
@@ -1632,6 +1848,7 @@ ns__client_request(isc_nmhandle_t *handle, isc_region_t *region, void *arg) {
 #ifdef HAVE_DNSTAP
 	dns_dtmsgtype_t dtmsgtype;
 #endif
+
 	ifp = (ns_interface_t *) arg;
 
 	mgr = ifp->clientmgr;
@@ -1672,6 +1889,8 @@ ns__client_request(isc_nmhandle_t *handle, isc_region_t *region, void *arg) {
 	}
 	if (isc_nmhandle_is_stream(handle)) {
 		client->attributes |= NS_CLIENTATTR_TCP;
+	} else {
+		ns__query_batchbegin();
 	}
 
 	INSIST(client->recursionquota == NULL);
@@ -2195,6 +2414,13 @@ ns__client_request(isc_nmhandle_t *handle, isc_region_t *region, void *arg) {
 	isc_task_unpause(client->task);
 }
 
+void
+ns__client_batchdone(void *arg) {
+	UNUSED(arg);
+
+	ns__query_batchdone();
+}
+
 void
 ns__client_tcpconn(isc_nmhandle_t *handle, isc_result_t result, void *arg) {
 	ns_server_t *sctx = (ns_server_t *) arg;
@@ -2277,6 +2503,7 @@ ns__client_setup(ns_client_t *client, ns_clientmgr_t *mgr, bool new) {
 		if (result != ISC_R_SUCCESS) {
 			goto cleanup;
 		}
+		dns_message_settempowner(client->message, arena_owns, client);
 
 
 		client->recvbuf = isc_mem_get(client->mctx,
@@ -2298,6 +2525,7 @@ ns__client_setup(ns_client_t *client, ns_clientmgr_t *mgr, bool new) {
 		dns_message_t *message = client->message;
 		isc_mem_t *oldmctx = client->mctx;
 		ns_query_t query = client->query;
+		ns_clientarena_t arena = client->arena;
 
 		*client = (ns_client_t) {
 			.magic = 0,
@@ -2307,7 +2535,8 @@ ns__client_setup(ns_client_t *client, ns_clientmgr_t *mgr, bool new) {
 			.task = task,
 			.recvbuf = recvbuf,
 			.message = message,
-			.query = query
+			.query = query,
+			.arena = arena
 		};
 	}
 
@@ -2824,15 +3053,16 @@ ns_client_sourceip(dns_clientinfo_t *ci, isc_sockaddr_t **addrp) {
 dns_rdataset_t *
 ns_client_newrdataset(ns_client_t *client) {
 	dns_rdataset_t *rdataset;
-	isc_result_t result;
 
 	REQUIRE(NS_CLIENT_VALID(client));
 
-	rdataset = NULL;
-	result = dns_message_gettemprdataset(client->message, &rdataset);
-	if (result != ISC_R_SUCCESS) {
-		return (NULL);
+	rdataset = ISC_LIST_HEAD(client->arena.rdatasets);
+	if (rdataset != NULL) {
+		ISC_LIST_UNLINK(client->arena.rdatasets, rdataset, link);
+	} else {
+		rdataset = ns_client_arenaget(client, sizeof(*rdataset));
 	}
+	dns_rdataset_init(rdataset);
 
 	return (rdataset);
 }
@@ -2850,18 +3080,125 @@ ns_client_putrdataset(ns_client_t *client, dns_rdataset_t **rdatasetp) {
 		if (dns_rdataset_isassociated(rdataset)) {
 			dns_rdataset_disassociate(rdataset);
 		}
-		dns_message_puttemprdataset(client->message, rdatasetp);
+		if (arena_owns(client, rdataset)) {
+			ISC_LIST_PREPEND(client->arena.rdatasets, rdataset,
+					 link);
+			*rdatasetp = NULL;
+		} else {
+			dns_message_puttemprdataset(client->message,
+						    rdatasetp);
+		}
 	}
 }
 
+static ns_arenablock_t *
+arena_newblock(ns_client_t *client, size_t size) {
+	ns_arenablock_t *block;
+
+	block = isc_mem_get(client->mctx, ARENA_HEADERSIZE + size);
+	ISC_LINK_INIT(block, link);
+	block->size = size;
+
+	return (block);
+}
+
+static void
+arena_reset(ns_client_t *client, bool everything) {
+	ns_clientarena_t *arena = &client->arena;
+	ns_arenablock_t *block;
+
+	while ((block = ISC_LIST_HEAD(arena->blocks)) != NULL) {
+		ISC_LIST_UNLINK(arena->blocks, block, link);
+		isc_mem_put(client->mctx, block,
+			    ARENA_HEADERSIZE + block->size);
+	}
+
+	if (everything && arena->first != NULL) {
+		isc_mem_put(client->mctx, arena->first,
+			    ARENA_HEADERSIZE + arena->first->size);
+		arena->first = NULL;
+	}
+
+	arena->current = arena->first;
+	arena->used = 0;
+	ISC_LIST_INIT(arena->names);
+	ISC_LIST_INIT(arena->rdatasets);
+}
+
+/*
+ * Whether a temporary name or rdataset in the client message came
+ * from the arena; see dns_message_settempowner().
+ */
+static bool
+arena_owns(void *arg, const void *item) {
+	ns_client_t *client = arg;
+	ns_clientarena_t *arena = &client->arena;
+	const unsigned char *p = item;
+	ns_arenablock_t *block;
+
+	block = arena->first;
+	if (block != NULL && p >= ARENA_DATA(block) &&
+	    p < ARENA_DATA(block) + block->size)
+	{
+		return (true);
+	}
+
+	for (block = ISC_LIST_HEAD(arena->blocks); block != NULL;
+	     block = ISC_LIST_NEXT(block, link))
+	{
+		if (p >= ARENA_DATA(block) &&
+		    p < ARENA_DATA(block) + block->size)
+		{
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+void *
+ns_client_arenaget(ns_client_t *client, size_t size) {
+	ns_clientarena_t *arena;
+	ns_arenablock_t *block;
+	unsigned char *p;
+
+	REQUIRE(NS_CLIENT_VALID(client));
+	REQUIRE(size > 0);
+
+	arena = &client->arena;
+	size = ARENA_ALIGN(size);
+
+	if (size > NS_CLIENT_ARENA_SIZE / 4) {
+		block = arena_newblock(client, size);
+		ISC_LIST_APPEND(arena->blocks, block, link);
+		return (ARENA_DATA(block));
+	}
+
+	if (arena->first == NULL) {
+		arena->first = arena_newblock(client, NS_CLIENT_ARENA_SIZE);
+		arena->current = arena->first;
+		arena->used = 0;
+	} else if (arena->current->size - arena->used < size) {
+		block = arena_newblock(client, NS_CLIENT_ARENA_SIZE);
+		ISC_LIST_APPEND(arena->blocks, block, link);
+		arena->current = block;
+		arena->used = 0;
+	}
+
+	p = ARENA_DATA(arena->current) + arena->used;
+	arena->used += size;
+
+	return (p);
+}
+
 isc_result_t
 ns_client_newnamebuf(ns_client_t *client) {
 	isc_buffer_t *dbuf;
 
 	CTRACE("ns_client_newnamebuf");
 
-	dbuf = NULL;
-	isc_buffer_allocate(client->mctx, &dbuf, 1024);
+	dbuf = ns_client_arenaget(client, sizeof(*dbuf) + 1024);
+	isc_buffer_init(dbuf, dbuf + 1, 1024);
 	ISC_LIST_APPEND(client->query.namebufs, dbuf, link);
 
 	CTRACE("ns_client_newnamebuf: done");
@@ -2872,18 +3209,16 @@ dns_name_t *
 ns_client_newname(ns_client_t *client, isc_buffer_t *dbuf, isc_buffer_t *nbuf) {
 	dns_name_t *name;
 	isc_region_t r;
-	isc_result_t result;
 
 	REQUIRE((client->query.attributes & NS_QUERYATTR_NAMEBUFUSED) == 0);
 
 	CTRACE("ns_client_newname");
 
-	name = NULL;
-	result = dns_message_gettempname(client->message, &name);
-	if (result != ISC_R_SUCCESS) {
-		CTRACE("ns_client_newname: "
-		       "dns_message_gettempname failed: done");
-		return (NULL);
+	name = ISC_LIST_HEAD(client->arena.names);
+	if (name != NULL) {
+		ISC_LIST_UNLINK(client->arena.names, name, link);
+	} else {
+		name = ns_client_arenaget(client, sizeof(*name));
 	}
 	isc_buffer_availableregion(dbuf, &r);
 	isc_buffer_init(nbuf, r.base, r.length);
@@ -2969,7 +3304,15 @@ ns_client_releasename(ns_client_t *client, dns_name_t **namep) {
 		       != 0);
 		client->query.attributes &= ~NS_QUERYATTR_NAMEBUFUSED;
 	}
-	dns_message_puttempname(client->message, namep);
+	if (arena_owns(client, name)) {
+		if (dns_name_dynamic(name)) {
+			dns_name_free(name, client->mctx);
+		}
+		ISC_LIST_PREPEND(client->arena.names, name, link);
+		*namep = NULL;
+	} else {
+		dns_message_puttempname(client->message, namep);
+	}
 	CTRACE("ns_client_releasename: done");
 }
 
@@ -3009,8 +3352,8 @@ client_getdbversion(ns_client_t *client) {
 	return (dbversion);
 }
 
-ns_dbversion_t *
-ns_client_findversion(ns_client_t *client, dns_db_t *db) {
+static ns_dbversion_t *
+findversion(ns_client_t *client, dns_db_t *db, dns_dbversion_t *version) {
 	ns_dbversion_t *dbversion;
 
 	for (dbversion = ISC_LIST_HEAD(client->query.activeversions);
@@ -3032,7 +3375,11 @@ ns_client_findversion(ns_client_t *client, dns_db_t *db) {
 			return (NULL);
 		}
 		dns_db_attach(db, &dbversion->db);
-		dns_db_currentversion(db, &dbversion->version);
+		if (version != NULL) {
+			dns_db_attachversion(db, version, &dbversion->version);
+		} else {
+			dns_db_currentversion(db, &dbversion->version);
+		}
 		dbversion->acl_checked = false;
 		dbversion->queryok = false;
 		ISC_LIST_APPEND(client->query.activeversions,
@@ -3041,3 +3388,17 @@ ns_client_findversion(ns_client_t *client, dns_db_t *db) {
 
 	return (dbversion);
 }
+
+ns_dbversion_t *
+ns_client_findversion(ns_client_t *client, dns_db_t *db) {
+	return (findversion(client, db, NULL));
+}
+
+ns_dbversion_t *
+ns_client_attachversion(ns_client_t *client, dns_db_t *db,
+			dns_dbversion_t *version)
+{
+	REQUIRE(version != NULL);
+
+	return (findversion(client, db, version));
+}
@@ -100,6 +100,12 @@
  * Number of tasks to be used by clients - those are used only when recursing
  */
 
+#define NS_CLIENT_ARENA_SIZE			8192
+/*%<
+ * Size of the blocks of the per-request arena (see ns_client_arenaget()).
+ * Requests larger than a quarter of this get a block of their own.
+ */
+
 /*!
  * Client object states.  Ordering is significant: higher-numbered
  * states are generally "more active", meaning that the client can
@@ -187,6 +193,23 @@ struct ns_clientmgr {
 #endif
 };
 
+typedef struct ns_arenablock ns_arenablock_t;
+
+/*%
+ * Memory for objects that only live as long as a request.  The first
+ * block is kept from one request to the next; any others, and any large
+ * allocations, are freed at the end of the request.  Temporary names
+ * and rdatasets released during the request are kept for reuse.
+ */
+typedef struct ns_clientarena {
+	ns_arenablock_t			*first;
+	ns_arenablock_t			*current;
+	size_t				used;	/*%< in 'current' */
+	ISC_LIST(ns_arenablock_t)	blocks;
+	ISC_LIST(dns_name_t)		names;
+	ISC_LIST(dns_rdataset_t)	rdatasets;
+} ns_clientarena_t;
+
 /*% nameserver client structure */
 struct ns_client {
 	unsigned int		magic;
@@ -219,6 +242,7 @@ struct ns_client {
 	void			(*shutdown)(void *arg, isc_result_t result);
 	void 			*shutdown_arg;
 	ns_query_t		query;
+	ns_clientarena_t	arena;
 	isc_time_t		requesttime;
 	isc_stdtime_t		now;
 	isc_time_t		tnow;
@@ -327,6 +351,20 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *msg);
  * send msg as a response using client->message->id for the id.
  */
 
+isc_result_t
+ns_client_sendcached(ns_client_t *client, unsigned int *flagsp);
+/*%<
+ * Finish processing the current client request by sending the response
+ * stored in the view's answer cache under client->query.anscache,
+ * with the id, the RD, RA and CD flags and the case of the question
+ * name taken from the request.  On success, the flags the response
+ * was stored with are returned in '*flagsp'.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS		the response was sent
+ *\li	#ISC_R_NOTFOUND		nothing was sent
+ */
+
 void
 ns_client_error(ns_client_t *client, isc_result_t result);
 /*%<
@@ -500,6 +538,13 @@ ns__client_request(isc_nmhandle_t *handle, isc_region_t *region, void *arg);
  * (Not intended for use outside this module and associated tests.)
  */
 
+void
+ns__client_batchdone(void *arg);
+/*%<
+ * Called after a batch of UDP client requests has been handled.
+ * (Not intended for use outside this module and associated tests.)
+ */
+
  void
  ns__client_tcpconn(isc_nmhandle_t *handle, isc_result_t result, void *arg);
 
@@ -515,19 +560,37 @@ void
 ns_client_putrdataset(ns_client_t *client, dns_rdataset_t **rdatasetp);
 /*%<
  * Get and release temporary rdatasets in the client message;
- * used in query.c and in plugins.
+ * used in query.c and in plugins.  The rdatasets come from the
+ * per-request arena; they may also be released with
+ * dns_message_puttemprdataset(), or left in the message for
+ * dns_message_reset().
+ */
+
+void *
+ns_client_arenaget(ns_client_t *client, size_t size);
+/*%<
+ * Allocate 'size' bytes of memory that remain valid until the end of
+ * the current request, when they are all released at once.  The memory
+ * must not be freed otherwise.
+ *
+ * Requires:
+ *\li	'client' is a valid client.
+ *\li	'size' > 0.
  */
 
 isc_result_t
 ns_client_newnamebuf(ns_client_t *client);
 /*%<
- * Allocate a name buffer for the client message.
+ * Allocate a name buffer for the client message from the per-request
+ * arena.
  */
 
 dns_name_t *
 ns_client_newname(ns_client_t *client, isc_buffer_t *dbuf, isc_buffer_t *nbuf);
 /*%<
- * Get a temporary name for the client message.
+ * Get a temporary name for the client message from the per-request
+ * arena.  Like the rdatasets from ns_client_newrdataset(), it may be
+ * released with ns_client_releasename() or dns_message_puttempname().
  */
 
 isc_buffer_t *
@@ -546,9 +609,9 @@ ns_client_keepname(ns_client_t *client, dns_name_t *name, isc_buffer_t *dbuf);
 void
 ns_client_releasename(ns_client_t *client, dns_name_t **namep);
 /*%<
- * Release 'name' back to the pool of temporary names for the client
- * message. If it is using a name buffer, relinquish its exclusive
- * rights on the buffer.
+ * Release 'name' back to the temporary names for the client message.
+ * If it is using a name buffer, relinquish its exclusive rights on the
+ * buffer.
  */
 
 isc_result_t
@@ -574,6 +637,15 @@ ns_client_findversion(ns_client_t *client, dns_db_t *db);
  * allocated by ns_client_newdbversion().
  */
 
+ns_dbversion_t *
+ns_client_attachversion(ns_client_t *client, dns_db_t *db,
+			dns_dbversion_t *version);
+/*%<
+ * Like ns_client_findversion(), but if this is the first query related
+ * to 'db', use 'version' (which must be open) instead of the current
+ * version of 'db'.
+ */
+
 isc_result_t
 ns__client_setup(ns_client_t *client, ns_clientmgr_t *manager, bool new);
 /*%<
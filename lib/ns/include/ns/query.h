@@ -20,6 +20,8 @@
 #include <isc/buffer.h>
 #include <isc/netaddr.h>
 
+#include <dns/name.h>
+#include <dns/proofcache.h>
 #include <dns/rdataset.h>
 #include <dns/resolver.h>
 #include <dns/rpz.h>
@@ -93,6 +95,23 @@ struct ns_query {
 
 	ns_query_recparam_t		recparam;
 
+	struct {
+		/*
+		 * Zone pointer, type, class, flags, UDP size and the
+		 * lower-cased query name in wire format.
+		 */
+		unsigned char		key[DNS_NAME_MAXWIRE + 16];
+		unsigned int		keylen;
+		uint64_t		generation;
+		isc_statscounter_t	counter;
+	} anscache;
+
+	struct {
+		dns_nxproof_t		proof;		/* bound on a hit */
+		uint64_t		generation;
+		bool			store;
+	} proofcache;
+
 	dns_keytag_t root_key_sentinel_keyid;
 	bool root_key_sentinel_is_ta;
 	bool root_key_sentinel_not_ta;
@@ -115,6 +134,7 @@ struct ns_query {
 #define NS_QUERYATTR_DNS64EXCLUDE	0x08000
 #define NS_QUERYATTR_RRL_CHECKED	0x10000
 #define NS_QUERYATTR_REDIRECT		0x20000
+#define NS_QUERYATTR_ANSCACHE		0x40000
 
 typedef struct query_ctx query_ctx_t;
 
@@ -256,4 +276,23 @@ ns__query_start(query_ctx_t *qctx);
  * (Must not be used outside this module and its associated unit tests.)
  */
 
+void
+ns__query_batchbegin(void);
+/*%<
+ * Note that the calling thread is processing a batch of UDP requests,
+ * so zone lookups can be shared by the queries in it until
+ * ns__query_batchdone() is called.
+ *
+ * (Must not be used outside this module and ns__client_request().)
+ */
+
+void
+ns__query_batchdone(void);
+/*%<
+ * Release what was kept for the batch of UDP requests that the calling
+ * thread has just processed.
+ *
+ * (Must not be used outside this module and ns__client_request().)
+ */
+
 #endif /* NS_QUERY_H */
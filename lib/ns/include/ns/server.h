@@ -19,7 +19,9 @@
 
 #include <isc/log.h>
 #include <isc/fuzz.h>
+#include <isc/ht.h>
 #include <isc/magic.h>
+#include <isc/mutex.h>
 #include <isc/quota.h>
 #include <isc/random.h>
 #include <isc/sockaddr.h>
@@ -124,6 +126,10 @@ struct ns_server {
 	isc_stats_t *		tcpoutstats4;
 	isc_stats_t *		tcpinstats6;
 	isc_stats_t *		tcpoutstats6;
+
+	/*% Stale RRsets being refreshed in the background */
+	isc_mutex_t		refreshlock;
+	isc_ht_t *		refreshing;
 };
 
 struct ns_altsecret {
@@ -106,7 +106,20 @@ enum {
 
 	ns_statscounter_reclimitdropped = 66,
 
-	ns_statscounter_max = 67,
+	ns_statscounter_synthfallback = 67,
+
+	ns_statscounter_anscachehit = 68,
+	ns_statscounter_anscachemiss = 69,
+
+	ns_statscounter_truncpredicted = 70,
+
+	ns_statscounter_proofcachehit = 71,
+	ns_statscounter_proofcachemiss = 72,
+
+	ns_statscounter_stalerevalidate = 73,
+	ns_statscounter_stalerefresh = 74,
+
+	ns_statscounter_max = 75,
 };
 
 void
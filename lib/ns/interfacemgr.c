@@ -453,8 +453,8 @@ ns_interface_listenudp(ns_interface_t *ifp) {
 	/* Reserve space for an ns_client_t with the netmgr handle */
 	result = isc_nm_listenudp(ifp->mgr->nm,
 				  (isc_nmiface_t *) &ifp->addr,
-				  ns__client_request, ifp,
-				  sizeof(ns_client_t),
+				  ns__client_request, ns__client_batchdone,
+				  ifp, sizeof(ns_client_t),
 				  &ifp->udplistensocket);
 	return (result);
 }
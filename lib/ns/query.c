@@ -16,6 +16,7 @@
 #include <string.h>
 
 #include <isc/hex.h>
+#include <isc/ht.h>
 #include <isc/mem.h>
 #include <isc/print.h>
 #include <isc/random.h>
@@ -43,6 +44,7 @@
 #include <dns/nsec.h>
 #include <dns/nsec3.h>
 #include <dns/order.h>
+#include <dns/proofcache.h>
 #include <dns/rdata.h>
 #include <dns/rdataclass.h>
 #include <dns/rdatalist.h>
@@ -390,6 +392,9 @@ query_setup(ns_client_t *client, dns_rdatatype_t qtype);
 static isc_result_t
 query_lookup(query_ctx_t *qctx);
 
+static bool
+stale_allowed(dns_view_t *view, dns_db_t *db);
+
 static void
 fetch_callback(isc_task_t *task, isc_event_t *event);
 
@@ -559,6 +564,7 @@ query_send(ns_client_t *client) {
 		counter = ns_statscounter_failure;
 
 	inc_stats(client, counter);
+	client->query.anscache.counter = counter;
 	ns_client_send(client);
 	isc_nmhandle_unref(client->handle);
 }
@@ -640,7 +646,6 @@ ns_query_cancel(ns_client_t *client) {
 
 static inline void
 query_reset(ns_client_t *client, bool everything) {
-	isc_buffer_t *dbuf, *dbuf_next;
 	ns_dbversion_t *dbversion, *dbversion_next;
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_reset");
@@ -679,13 +684,13 @@ query_reset(ns_client_t *client, bool everything) {
 		ns_client_putrdataset(client, &client->query.dns64_aaaa);
 	if (client->query.dns64_sigaaaa != NULL)
 		ns_client_putrdataset(client, &client->query.dns64_sigaaaa);
-	if (client->query.dns64_aaaaok != NULL) {
-		isc_mem_put(client->mctx, client->query.dns64_aaaaok,
-			    client->query.dns64_aaaaoklen *
-			    sizeof(bool));
-		client->query.dns64_aaaaok =  NULL;
-		client->query.dns64_aaaaoklen =  0;
-	}
+	/*
+	 * The name buffers and dns64_aaaaok are in the client's arena,
+	 * which is released at the end of the request.
+	 */
+	ISC_LIST_INIT(client->query.namebufs);
+	client->query.dns64_aaaaok = NULL;
+	client->query.dns64_aaaaoklen = 0;
 
 	ns_client_putrdataset(client, &client->query.redirect.rdataset);
 	ns_client_putrdataset(client, &client->query.redirect.sigrdataset);
@@ -698,17 +703,10 @@ query_reset(ns_client_t *client, bool everything) {
 	if (client->query.redirect.zone != NULL)
 		dns_zone_detach(&client->query.redirect.zone);
 
-	query_freefreeversions(client, everything);
+	dns_nxproof_invalidate(&client->query.proofcache.proof);
+	client->query.proofcache.store = false;
 
-	for (dbuf = ISC_LIST_HEAD(client->query.namebufs);
-	     dbuf != NULL;
-	     dbuf = dbuf_next) {
-		dbuf_next = ISC_LIST_NEXT(dbuf, link);
-		if (dbuf_next != NULL || everything) {
-			ISC_LIST_UNLINK(client->query.namebufs, dbuf, link);
-			isc_buffer_free(&dbuf);
-		}
-	}
+	query_freefreeversions(client, everything);
 
 	if (client->query.restarts > 0) {
 		/*
@@ -798,16 +796,11 @@ ns_query_init(ns_client_t *client) {
 	client->query.redirect.is_zone = false;
 	client->query.redirect.fname =
 		dns_fixedname_initname(&client->query.redirect.fixed);
+	dns_nxproof_init(&client->query.proofcache.proof);
 	query_reset(client, false);
 	result = ns_client_newdbversion(client, 3);
 	if (result != ISC_R_SUCCESS) {
 		isc_mutex_destroy(&client->query.fetchlock);
-		return (result);
-	}
-	result = ns_client_newnamebuf(client);
-	if (result != ISC_R_SUCCESS) {
-		query_freefreeversions(client, true);
-		isc_mutex_destroy(&client->query.fetchlock);
 	}
 
 	return (result);
@@ -1055,6 +1048,169 @@ query_validatezonedb(ns_client_t *client, const dns_name_t *name,
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * Zone lookups kept for the UDP requests a worker thread receives
+ * together (see isc_nm_batch_cb_t), so that a burst of queries for the
+ * same zones looks each of them up, attaches its database and opens
+ * its current version once.  An entry is used for a name at or below
+ * the zone's origin only while no zone below it is mounted, and only
+ * until the zone table or the zone changes generation.  A zone is only
+ * kept once it has been looked up twice in the batch, so that a stream
+ * of queries for many different zones costs little more than it would
+ * without batching.
+ */
+#define QUERY_BATCHZONES	4
+
+typedef struct query_batchzone {
+	dns_view_t		*view;
+	uint64_t		ztgeneration;
+	uint64_t		generation;
+	dns_zone_t		*zone;
+	dns_db_t		*db;
+	dns_dbversion_t		*version;
+} query_batchzone_t;
+
+ISC_THREAD_LOCAL bool batch_active = false;
+ISC_THREAD_LOCAL unsigned int batch_next = 0;
+ISC_THREAD_LOCAL query_batchzone_t batch_zones[QUERY_BATCHZONES];
+ISC_THREAD_LOCAL unsigned int batch_nextmissed = 0;
+ISC_THREAD_LOCAL const dns_zone_t *batch_missed[QUERY_BATCHZONES];
+
+static void
+batchzone_release(query_batchzone_t *bz) {
+	if (bz->zone == NULL) {
+		return;
+	}
+
+	dns_db_closeversion(bz->db, &bz->version, false);
+	dns_db_detach(&bz->db);
+	dns_zone_detach(&bz->zone);
+	dns_view_detach(&bz->view);
+}
+
+void
+ns__query_batchbegin(void) {
+	batch_active = true;
+}
+
+void
+ns__query_batchdone(void) {
+	unsigned int i;
+
+	for (i = 0; i < QUERY_BATCHZONES; i++) {
+		batchzone_release(&batch_zones[i]);
+		batch_missed[i] = NULL;
+	}
+	batch_next = 0;
+	batch_nextmissed = 0;
+	batch_active = false;
+}
+
+/*
+ * Whether 'client' is one of the UDP requests of a batch.  TCP requests
+ * handled by the same thread while a batch is open are not part of it.
+ */
+static inline bool
+batching(ns_client_t *client) {
+	return (batch_active && !TCP(client));
+}
+
+/*
+ * Return the zone kept for 'name' in this batch, if any.
+ */
+static query_batchzone_t *
+batchzone_find(ns_client_t *client, const dns_name_t *name,
+	       unsigned int options)
+{
+	query_batchzone_t *bz;
+	unsigned int i;
+
+	if (!batching(client)) {
+		return (NULL);
+	}
+
+	for (i = 0; i < QUERY_BATCHZONES; i++) {
+		dns_name_t *origin;
+
+		bz = &batch_zones[i];
+		if (bz->zone == NULL || bz->view != client->view) {
+			continue;
+		}
+
+		origin = dns_zone_getorigin(bz->zone);
+		if (!dns_name_issubdomain(name, origin) ||
+		    ((options & DNS_GETDB_NOEXACT) != 0 &&
+		     dns_name_equal(name, origin)))
+		{
+			continue;
+		}
+
+		if (bz->ztgeneration !=
+		    dns_zt_getgeneration(client->view->zonetable) ||
+		    bz->generation != dns_zone_getgeneration(bz->zone))
+		{
+			batchzone_release(bz);
+			continue;
+		}
+
+		return (bz);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Keep 'zone' and 'db' for the rest of this batch if it has been looked
+ * up before in this batch and no zone can be found below it.  The
+ * generations must have been read before the zone was found and its
+ * database attached, so that a change that happened since makes the
+ * entry useless rather than wrong.
+ */
+static void
+batchzone_add(ns_client_t *client, uint64_t ztgeneration,
+	      uint64_t generation, dns_zone_t *zone, dns_db_t *db)
+{
+	query_batchzone_t *bz;
+	unsigned int i;
+
+	/*
+	 * The zones in 'batch_missed' are only compared, never used, so
+	 * they need not be attached.
+	 */
+	for (i = 0; i < QUERY_BATCHZONES; i++) {
+		if (batch_missed[i] == zone) {
+			break;
+		}
+	}
+	if (i == QUERY_BATCHZONES) {
+		batch_missed[batch_nextmissed] = zone;
+		batch_nextmissed = (batch_nextmissed + 1) % QUERY_BATCHZONES;
+		return;
+	}
+
+	/*
+	 * A mirror zone stops being used as soon as it expires, without
+	 * its generation changing; leave those alone.
+	 */
+	if (dns_zone_gettype(zone) == dns_zone_mirror ||
+	    !dns_zt_isleaf(client->view->zonetable,
+			   dns_zone_getorigin(zone)))
+	{
+		return;
+	}
+
+	bz = &batch_zones[batch_next];
+	batch_next = (batch_next + 1) % QUERY_BATCHZONES;
+	batchzone_release(bz);
+
+	bz->generation = generation;
+	bz->ztgeneration = ztgeneration;
+	dns_view_attach(client->view, &bz->view);
+	dns_zone_attach(zone, &bz->zone);
+	dns_db_attach(db, &bz->db);
+	dns_db_currentversion(db, &bz->version);
+}
+
 static inline isc_result_t
 query_getzonedb(ns_client_t *client, const dns_name_t *name,
 		dns_rdatatype_t qtype, unsigned int options,
@@ -1065,10 +1221,22 @@ query_getzonedb(ns_client_t *client, const dns_name_t *name,
 	dns_zone_t *zone = NULL;
 	dns_db_t *db = NULL;
 	bool partial = false;
+	query_batchzone_t *bz;
+	uint64_t ztgeneration = 0, generation = 0;
 
 	REQUIRE(zonep != NULL && *zonep == NULL);
 	REQUIRE(dbp != NULL && *dbp == NULL);
 
+	bz = batchzone_find(client, name, options);
+	if (bz != NULL) {
+		partial = !dns_name_equal(name, dns_zone_getorigin(bz->zone));
+		dns_zone_attach(bz->zone, &zone);
+		dns_db_attach(bz->db, &db);
+		(void)ns_client_attachversion(client, db, bz->version);
+		result = ISC_R_SUCCESS;
+		goto validate;
+	}
+
 	/*%
 	 * Find a zone database to answer the query.
 	 */
@@ -1077,17 +1245,29 @@ query_getzonedb(ns_client_t *client, const dns_name_t *name,
 		ztoptions |= DNS_ZTFIND_NOEXACT;
 	}
 
+	if (batching(client)) {
+		ztgeneration = dns_zt_getgeneration(client->view->zonetable);
+	}
 	result = dns_zt_find(client->view->zonetable, name, ztoptions, NULL,
 			     &zone);
 
 	if (result == DNS_R_PARTIALMATCH)
 		partial = true;
-	if (result == ISC_R_SUCCESS || result == DNS_R_PARTIALMATCH)
+	if (result == ISC_R_SUCCESS || result == DNS_R_PARTIALMATCH) {
+		if (batching(client)) {
+			generation = dns_zone_getgeneration(zone);
+		}
 		result = dns_zone_getdb(zone, &db);
+	}
 
 	if (result != ISC_R_SUCCESS)
 		goto fail;
 
+	if (batching(client)) {
+		batchzone_add(client, ztgeneration, generation, zone, db);
+	}
+
+ validate:
 	result = query_validatezonedb(client, name, qtype, options, zone, db,
 				      versionp);
 
@@ -2492,6 +2672,12 @@ query_prefetch(ns_client_t *client, dns_name_t *qname,
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_prefetch");
 
+	/*
+	 * Let the resolver know about the cache hit, so that popular
+	 * RRsets can be refreshed before they expire.
+	 */
+	dns_resolver_refreshhit(client->view->resolver, qname, rdataset);
+
 	if (client->query.prefetch != NULL ||
 	    client->view->prefetch_trigger == 0U ||
 	    rdataset->ttl > client->view->prefetch_trigger ||
@@ -2538,6 +2724,158 @@ query_prefetch(ns_client_t *client, dns_name_t *qname,
 			   ns_statscounter_prefetch);
 }
 
+/*%
+ * A background refresh of a stale RRset, and its key in the server's
+ * table of RRsets being refreshed: the view, the type and the
+ * lower-cased owner name.
+ */
+typedef struct stalerefresh {
+	ns_client_t *		client;
+	unsigned int		keysize;
+	unsigned char		key[sizeof(void *) + 2 + DNS_NAME_MAXWIRE];
+} stalerefresh_t;
+
+static void
+stalerefresh_done(isc_task_t *task, isc_event_t *event) {
+	dns_fetchevent_t *devent = (dns_fetchevent_t *)event;
+	stalerefresh_t *refresh;
+	ns_client_t *client;
+	isc_result_t result;
+
+	UNUSED(task);
+
+	REQUIRE(event->ev_type == DNS_EVENT_FETCHDONE);
+	refresh = devent->ev_arg;
+	client = refresh->client;
+	REQUIRE(NS_CLIENT_VALID(client));
+	REQUIRE(task == client->task);
+
+	CTRACE(ISC_LOG_DEBUG(3), "stalerefresh_done");
+
+	LOCK(&client->query.fetchlock);
+	if (client->query.prefetch != NULL) {
+		INSIST(devent->fetch == client->query.prefetch);
+		client->query.prefetch = NULL;
+	}
+	UNLOCK(&client->query.fetchlock);
+
+	LOCK(&client->sctx->refreshlock);
+	result = isc_ht_delete(client->sctx->refreshing, refresh->key,
+			       refresh->keysize);
+	UNLOCK(&client->sctx->refreshlock);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	isc_mem_put(client->mctx, refresh, sizeof(*refresh));
+
+	free_devent(client, &event, &devent);
+	isc_nmhandle_unref(client->handle);
+}
+
+/*%
+ * A stale answer is being sent straight away in stale-while-revalidate
+ * mode.  Give it the stale answer TTL, and refresh it in the
+ * background unless a fetch for the same RRset is already running.
+ */
+static void
+query_stalerefresh(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_name_t *qname = client->query.qname;
+	stalerefresh_t *refresh;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_rdataset_t *tmprdataset;
+	isc_sockaddr_t *peeraddr;
+	isc_region_t r;
+	isc_result_t result;
+	unsigned int options;
+	char namebuf[DNS_NAME_FORMATSIZE];
+
+	CCTRACE(ISC_LOG_DEBUG(3), "query_stalerefresh");
+
+	qctx->rdataset->ttl = qctx->view->staleanswerttl;
+	if (qctx->sigrdataset != NULL &&
+	    dns_rdataset_isassociated(qctx->sigrdataset))
+	{
+		qctx->sigrdataset->ttl = qctx->view->staleanswerttl;
+	}
+	inc_stats(client, ns_statscounter_stalerevalidate);
+
+	if (client->query.prefetch != NULL) {
+		return;
+	}
+
+	if (client->recursionquota == NULL) {
+		result = isc_quota_attach(&client->sctx->recursionquota,
+					  &client->recursionquota);
+		if (result != ISC_R_SUCCESS) {
+			return;
+		}
+	}
+
+	refresh = isc_mem_get(client->mctx, sizeof(*refresh));
+	refresh->client = client;
+	name = dns_fixedname_initname(&fixed);
+	RUNTIME_CHECK(dns_name_downcase(qname, name, NULL) == ISC_R_SUCCESS);
+	dns_name_toregion(name, &r);
+	memmove(refresh->key, &qctx->view, sizeof(void *));
+	refresh->key[sizeof(void *)] = (qctx->type >> 8) & 0xff;
+	refresh->key[sizeof(void *) + 1] = qctx->type & 0xff;
+	memmove(refresh->key + sizeof(void *) + 2, r.base, r.length);
+	refresh->keysize = sizeof(void *) + 2 + r.length;
+
+	LOCK(&client->sctx->refreshlock);
+	result = isc_ht_add(client->sctx->refreshing, refresh->key,
+			    refresh->keysize, refresh);
+	UNLOCK(&client->sctx->refreshlock);
+	if (result != ISC_R_SUCCESS) {
+		/* Another client is refreshing it already. */
+		isc_mem_put(client->mctx, refresh, sizeof(*refresh));
+		return;
+	}
+
+	tmprdataset = ns_client_newrdataset(client);
+	if (tmprdataset == NULL) {
+		goto cleanup;
+	}
+
+	if (!TCP(client)) {
+		peeraddr = &client->peeraddr;
+	} else {
+		peeraddr = NULL;
+	}
+
+	isc_nmhandle_ref(client->handle);
+	options = client->query.fetchoptions | DNS_FETCHOPT_PREFETCH;
+	result = dns_resolver_createfetch(client->view->resolver,
+					  qname, qctx->type, NULL, NULL,
+					  NULL, peeraddr, client->message->id,
+					  options, 0, NULL, client->task,
+					  stalerefresh_done, refresh,
+					  tmprdataset, NULL,
+					  &client->query.prefetch);
+	if (result != ISC_R_SUCCESS) {
+		ns_client_putrdataset(client, &tmprdataset);
+		isc_nmhandle_unref(client->handle);
+		goto cleanup;
+	}
+
+	inc_stats(client, ns_statscounter_stalerefresh);
+	if (isc_log_wouldlog(ns_lctx, ISC_LOG_INFO)) {
+		dns_name_format(qname, namebuf, sizeof(namebuf));
+		isc_log_write(ns_lctx, NS_LOGCATEGORY_SERVE_STALE,
+			      NS_LOGMODULE_QUERY, ISC_LOG_INFO,
+			      "%s stale answer used, refreshing", namebuf);
+	}
+	return;
+
+ cleanup:
+	LOCK(&client->sctx->refreshlock);
+	result = isc_ht_delete(client->sctx->refreshing, refresh->key,
+			       refresh->keysize);
+	UNLOCK(&client->sctx->refreshlock);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	isc_mem_put(client->mctx, refresh, sizeof(*refresh));
+}
+
 static inline void
 rpz_clean(dns_zone_t **zonep, dns_db_t **dbp, dns_dbnode_t **nodep,
 	  dns_rdataset_t **rdatasetp)
@@ -4674,7 +5012,7 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 		flags |= DNS_DNS64_DNSSEC;
 
 	count = dns_rdataset_count(rdataset);
-	aaaaok = isc_mem_get(client->mctx, sizeof(bool) * count);
+	aaaaok = ns_client_arenaget(client, sizeof(bool) * count);
 
 	isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
 	if (dns_dns64_aaaaok(dns64, &netaddr, client->signer,
@@ -4682,19 +5020,13 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 	{
 		for (i = 0; i < count; i++) {
 			if (aaaaok != NULL && !aaaaok[i]) {
-				SAVE(client->query.dns64_aaaaok, aaaaok);
+				client->query.dns64_aaaaok = aaaaok;
 				client->query.dns64_aaaaoklen = count;
 				break;
 			}
 		}
-		if (aaaaok != NULL)
-			isc_mem_put(client->mctx, aaaaok,
-				    sizeof(bool) * count);
 		return (true);
 	}
-	if (aaaaok != NULL)
-		isc_mem_put(client->mctx, aaaaok,
-			    sizeof(bool) * count);
 	return (false);
 }
 
@@ -5228,6 +5560,327 @@ root_key_sentinel_detect(query_ctx_t *qctx) {
 	}
 }
 
+/*%
+ * Can the response to this query be taken from, or stored in, the
+ * view's answer cache?  Only plain authoritative answers qualify, and
+ * only when the rendered response depends on nothing but the zone
+ * contents, the question and the client properties that go into the
+ * cache key (see query_anscache_key()).
+ */
+static bool
+query_anscache_ok(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_view_t *view = qctx->view;
+	dns_zonetype_t ztype;
+
+	if (view->anscache == NULL || qctx->event != NULL ||
+	    client->query.restarts != 0 || !qctx->is_zone ||
+	    !qctx->authoritative || qctx->zone == NULL ||
+	    RECURSIONOK(client) || dns_rdatatype_ismeta(qctx->qtype))
+	{
+		return (false);
+	}
+
+	ztype = dns_zone_gettype(qctx->zone);
+	if (ztype != dns_zone_master && ztype != dns_zone_slave) {
+		return (false);
+	}
+
+	/*
+	 * Signed requests and EDNS options make the response specific
+	 * to this client.
+	 */
+	if (client->message->tsigkey != NULL ||
+	    client->message->sig0key != NULL ||
+	    client->ednsversion > 0 ||
+	    (client->attributes & (NS_CLIENTATTR_WANTNSID |
+				   NS_CLIENTATTR_WANTCOOKIE |
+				   NS_CLIENTATTR_HAVECOOKIE |
+				   NS_CLIENTATTR_WANTEXPIRE |
+				   NS_CLIENTATTR_HAVEECS |
+				   NS_CLIENTATTR_WANTPAD |
+				   NS_CLIENTATTR_USEKEEPALIVE)) != 0)
+	{
+		return (false);
+	}
+
+	/*
+	 * So do the view features that rewrite, reorder, rate-limit or
+	 * log responses per client.
+	 */
+	if (view->rrl != NULL || view->sortlist != NULL ||
+	    view->nocasecompress != NULL || view->dns64cnt != 0 ||
+	    (view->rpzs != NULL && view->rpzs->p.num_zones != 0) ||
+	    !ISC_LIST_EMPTY(view->dlz_searched) ||
+	    view->hooktable != NULL || view->dtenv != NULL)
+	{
+		return (false);
+	}
+
+	return (true);
+}
+
+/*%
+ * Build the answer cache key for this query: the zone, the question
+ * with the name lower-cased, and everything about the client that
+ * changes how the response is rendered.
+ */
+static void
+query_anscache_key(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	unsigned char *key = client->query.anscache.key;
+	dns_fixedname_t fixed;
+	dns_name_t *qname;
+	unsigned int len = 0;
+	unsigned char flags = 0;
+	uint16_t udpsize;
+
+	qname = dns_fixedname_initname(&fixed);
+	RUNTIME_CHECK(dns_name_downcase(client->query.qname, qname, NULL) ==
+		      ISC_R_SUCCESS);
+	INSIST(sizeof(qctx->zone) + 7 + qname->length <=
+	       sizeof(client->query.anscache.key));
+
+	memmove(key, &qctx->zone, sizeof(qctx->zone));
+	len += sizeof(qctx->zone);
+	key[len++] = qctx->qtype >> 8;
+	key[len++] = qctx->qtype & 0xff;
+	key[len++] = client->message->rdclass >> 8;
+	key[len++] = client->message->rdclass & 0xff;
+
+	if ((client->message->flags & DNS_MESSAGEFLAG_RD) != 0) {
+		flags |= 0x01;
+	}
+	if ((client->message->flags & DNS_MESSAGEFLAG_CD) != 0) {
+		flags |= 0x02;
+	}
+	if ((client->attributes & NS_CLIENTATTR_WANTDNSSEC) != 0) {
+		flags |= 0x04;
+	}
+	if ((client->attributes & NS_CLIENTATTR_WANTAD) != 0) {
+		flags |= 0x08;
+	}
+	if ((client->attributes & NS_CLIENTATTR_WANTOPT) != 0) {
+		flags |= 0x10;
+	}
+	if (TCP(client)) {
+		flags |= 0x20;
+	}
+	if (isc_sockaddr_pf(&client->peeraddr) == AF_INET6) {
+		flags |= 0x40;
+	}
+	key[len++] = flags;
+
+	udpsize = TCP(client) ? 0 : client->udpsize;
+	key[len++] = udpsize >> 8;
+	key[len++] = udpsize & 0xff;
+
+	memmove(key + len, qname->ndata, qname->length);
+	len += qname->length;
+
+	client->query.anscache.keylen = len;
+}
+
+/*%
+ * Look the query up in the view's answer cache.  On a hit the cached
+ * response has been sent and ISC_R_SUCCESS is returned; otherwise the
+ * query is marked so that its response is stored once rendered, if it
+ * is going to be built from the zone's current database and version.
+ */
+static isc_result_t
+query_anscache(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	isc_result_t result;
+	unsigned int counter = 0;
+
+	CCTRACE(ISC_LOG_DEBUG(3), "query_anscache");
+
+	/*
+	 * The generation must be read before the database is checked,
+	 * so that an update committed in between invalidates whatever
+	 * we store.
+	 */
+	client->query.anscache.generation =
+		dns_zone_getgeneration(qctx->zone);
+	query_anscache_key(qctx);
+
+	result = ns_client_sendcached(client, &counter);
+	if (result == ISC_R_SUCCESS) {
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_anscachehit);
+		inc_stats(client, ns_statscounter_authans);
+		inc_stats(client, (isc_statscounter_t)counter);
+		return (ISC_R_SUCCESS);
+	}
+
+	ns_stats_increment(client->sctx->nsstats,
+			   ns_statscounter_anscachemiss);
+
+	if (dns_zone_getdb(qctx->zone, &db) == ISC_R_SUCCESS) {
+		if (db == qctx->db) {
+			dns_db_currentversion(db, &version);
+			if (version == qctx->version) {
+				client->query.attributes |=
+					NS_QUERYATTR_ANSCACHE;
+			}
+			dns_db_closeversion(db, &version, false);
+		}
+		dns_db_detach(&db);
+	}
+
+	return (ISC_R_NOTFOUND);
+}
+
+/*%
+ * Can this query be answered from, or its NXDOMAIN or NODATA proof
+ * stored in, the zone's proof cache?  Only DNSSEC queries to signed
+ * zones qualify, and only when nothing but the zone contents decides
+ * whether the response is negative and what goes in it.
+ */
+static bool
+query_proofcache_ok(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_view_t *view = qctx->view;
+
+	if (!qctx->is_zone || qctx->zone == NULL || qctx->dns64 ||
+	    qctx->need_wildcardproof || qctx->sigrdataset == NULL ||
+	    !WANTDNSSEC(client) || qctx->qtype == dns_rdatatype_soa ||
+	    (client->sctx->options & NS_SERVER_NOSOA) != 0 ||
+	    dns_proofcache_getmaxentries(
+		    dns_zone_getproofcache(qctx->zone)) == 0)
+	{
+		return (false);
+	}
+
+	if ((view->rpzs != NULL && view->rpzs->p.num_zones != 0) ||
+	    view->redirect != NULL || view->redirectzone != NULL)
+	{
+		return (false);
+	}
+
+	return (dns_db_issecure(qctx->db));
+}
+
+/*%
+ * Look for an NSEC proof that the query name has no data of the query
+ * type, or does not exist, in the zone's proof cache.  On a hit,
+ * qctx->fname, qctx->rdataset and qctx->sigrdataset hold the NSEC
+ * RRset at or covering the name, the rest of the proof is in
+ * client->query.proofcache.proof, and DNS_R_NXRRSET or DNS_R_NXDOMAIN
+ * is returned.  Otherwise, the proof is stored once found in the
+ * zone's current database and version, if that is where the query is
+ * being answered from.
+ */
+static isc_result_t
+query_proofcache(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_proofcache_t *pc = dns_zone_getproofcache(qctx->zone);
+	dns_nxproof_t *proof = &client->query.proofcache.proof;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	isc_result_t result;
+
+	CCTRACE(ISC_LOG_DEBUG(3), "query_proofcache");
+
+	/*
+	 * As in query_anscache(), the generation must be read before
+	 * the database is checked.
+	 */
+	client->query.proofcache.generation =
+		dns_zone_getgeneration(qctx->zone);
+
+	/*
+	 * query_nodata() would look up A records for a DNS64 AAAA
+	 * query, using the node that was not found.
+	 */
+	result = ISC_R_NOTFOUND;
+	if (qctx->qtype != dns_rdatatype_aaaa ||
+	    ISC_LIST_EMPTY(qctx->view->dns64))
+	{
+		result = dns_proofcache_findnodata(
+				pc, client->query.proofcache.generation,
+				client->query.qname, qctx->qtype, proof);
+	}
+	if (result == ISC_R_SUCCESS) {
+		result = DNS_R_NXRRSET;
+	} else {
+		result = dns_proofcache_findnxdomain(
+				pc, client->query.proofcache.generation,
+				client->query.qname, proof);
+		if (result == ISC_R_SUCCESS) {
+			result = DNS_R_NXDOMAIN;
+		}
+	}
+	if (result != ISC_R_NOTFOUND) {
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_proofcachehit);
+		dns_name_copynf(dns_fixedname_name(&proof->nsecname),
+				qctx->fname);
+		dns_rdataset_clone(&proof->nsec, qctx->rdataset);
+		dns_rdataset_clone(&proof->nsecsig, qctx->sigrdataset);
+		return (result);
+	}
+
+	if (dns_zone_getdb(qctx->zone, &db) == ISC_R_SUCCESS) {
+		if (db == qctx->db) {
+			dns_db_currentversion(db, &version);
+			client->query.proofcache.store =
+				(version == qctx->version);
+			dns_db_closeversion(db, &version, false);
+		}
+		dns_db_detach(&db);
+	}
+
+	return (ISC_R_NOTFOUND);
+}
+
+/*%
+ * Store the SOA and NSEC RRsets of the NXDOMAIN or NODATA response
+ * being built in the zone's proof cache.
+ */
+static void
+query_proofcache_store(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_message_t *message = client->message;
+	dns_proofcache_t *pc = dns_zone_getproofcache(qctx->zone);
+	dns_name_t *name;
+	dns_rdataset_t *rdataset, *sigrdataset;
+	isc_result_t result;
+
+	ns_stats_increment(client->sctx->nsstats,
+			   ns_statscounter_proofcachemiss);
+
+	for (result = dns_message_firstname(message, DNS_SECTION_AUTHORITY);
+	     result == ISC_R_SUCCESS;
+	     result = dns_message_nextname(message, DNS_SECTION_AUTHORITY))
+	{
+		name = NULL;
+		dns_message_currentname(message, DNS_SECTION_AUTHORITY,
+					&name);
+		for (rdataset = ISC_LIST_HEAD(name->list);
+		     rdataset != NULL;
+		     rdataset = ISC_LIST_NEXT(rdataset, link))
+		{
+			if (rdataset->type != dns_rdatatype_soa &&
+			    rdataset->type != dns_rdatatype_nsec)
+			{
+				continue;
+			}
+			sigrdataset = NULL;
+			if (dns_message_findtype(name, dns_rdatatype_rrsig,
+						 rdataset->type,
+						 &sigrdataset) == ISC_R_SUCCESS)
+			{
+				(void)dns_proofcache_add(pc,
+					client->query.proofcache.generation,
+					name, rdataset, sigrdataset);
+			}
+		}
+	}
+}
+
 /*%
  * Starting point for a client query or a chaining query.
  *
@@ -5438,6 +6091,20 @@ ns__query_start(query_ctx_t *qctx) {
 		}
 	}
 
+	/*
+	 * If this question has already been answered from the current
+	 * version of the zone, send the stored response.
+	 */
+	if (query_anscache_ok(qctx) &&
+	    query_anscache(qctx) == ISC_R_SUCCESS)
+	{
+		qctx_clean(qctx);
+		qctx_freedata(qctx);
+		isc_nmhandle_unref(qctx->client->handle);
+		qctx->detach_client = true;
+		return (ISC_R_SUCCESS);
+	}
+
 	return (query_lookup(qctx));
 
  cleanup:
@@ -5457,6 +6124,7 @@ query_lookup(query_ctx_t *qctx) {
 	dns_clientinfo_t ci;
 	dns_name_t *rpzqname = NULL;
 	unsigned int dboptions;
+	bool revalidate = false;
 
 	CCTRACE(ISC_LOG_DEBUG(3), "query_lookup");
 
@@ -5498,6 +6166,19 @@ query_lookup(query_ctx_t *qctx) {
 		}
 	}
 
+	/*
+	 * If the name is known not to exist, or to have no data of this
+	 * type, in this version of the zone, don't look for it in the
+	 * database.
+	 */
+	qctx->client->query.proofcache.store = false;
+	if (query_proofcache_ok(qctx)) {
+		result = query_proofcache(qctx);
+		if (result != ISC_R_NOTFOUND) {
+			return (query_gotanswer(qctx, result));
+		}
+	}
+
 	/*
 	 * Now look for an answer in the database.
 	 */
@@ -5512,6 +6193,19 @@ query_lookup(query_ctx_t *qctx) {
 	    (qctx->type != dns_rdatatype_null || !dns_name_istat(rpzqname)))
 		dboptions |= DNS_DBFIND_COVERINGNSEC;
 
+	/*
+	 * In stale-while-revalidate mode a stale answer in the cache is
+	 * sent at once rather than after a failed attempt to refresh it.
+	 */
+	if (!qctx->is_zone && qctx->view->staleanswerrevalidate &&
+	    RECURSIONOK(qctx->client) && qctx->type != dns_rdatatype_any &&
+	    (dboptions & DNS_DBFIND_STALEOK) == 0 &&
+	    stale_allowed(qctx->view, qctx->db))
+	{
+		dboptions |= DNS_DBFIND_STALEOK;
+		revalidate = true;
+	}
+
 	result = dns_db_findext(qctx->db, rpzqname, qctx->version, qctx->type,
 				dboptions, qctx->client->now, &qctx->node,
 				qctx->fname, &cm, &ci,
@@ -5533,6 +6227,22 @@ query_lookup(query_ctx_t *qctx) {
 		dns_cache_updatestats(qctx->view->cache, result);
 	}
 
+	if (revalidate && dns_rdataset_isassociated(qctx->rdataset) &&
+	    STALE(qctx->rdataset))
+	{
+		switch (result) {
+		case ISC_R_SUCCESS:
+		case DNS_R_CNAME:
+		case DNS_R_DNAME:
+		case DNS_R_NCACHENXDOMAIN:
+		case DNS_R_NCACHENXRRSET:
+			query_stalerefresh(qctx);
+			break;
+		default:
+			break;
+		}
+	}
+
 	if ((qctx->client->query.dboptions & DNS_DBFIND_STALEOK) != 0) {
 		char namebuf[DNS_NAME_FORMATSIZE];
 		bool success;
@@ -6694,41 +7404,48 @@ root_key_sentinel_return_servfail(query_ctx_t *qctx, isc_result_t result) {
 }
 
 /*%
- * If serving stale answers is allowed, set up 'qctx' to look for one and
- * return true; otherwise, return false.
+ * Return true if 'view' may answer from stale data in its cache 'db'.
  */
 static bool
-query_usestale(query_ctx_t *qctx) {
-	bool staleanswersok = false;
+stale_allowed(dns_view_t *view, dns_db_t *db) {
 	dns_ttl_t stale_ttl = 0;
 	isc_result_t result;
 
-	qctx_clean(qctx);
-	qctx_freedata(qctx);
-
 	/*
 	 * Stale answers only make sense if stale_ttl > 0 but we want rndc to
 	 * be able to control returning stale answers if they are configured.
 	 */
-	dns_db_attach(qctx->client->view->cachedb, &qctx->db);
-	result = dns_db_getservestalettl(qctx->db, &stale_ttl);
-	if (result == ISC_R_SUCCESS && stale_ttl > 0)  {
-		switch (qctx->client->view->staleanswersok) {
-		case dns_stale_answer_yes:
-			staleanswersok = true;
-			break;
-		case dns_stale_answer_conf:
-			staleanswersok =
-				qctx->client->view->staleanswersenable;
-			break;
-		case dns_stale_answer_no:
-			staleanswersok = false;
-			break;
-		}
-	} else {
-		staleanswersok = false;
+	result = dns_db_getservestalettl(db, &stale_ttl);
+	if (result != ISC_R_SUCCESS || stale_ttl == 0) {
+		return (false);
 	}
 
+	switch (view->staleanswersok) {
+	case dns_stale_answer_yes:
+		return (true);
+	case dns_stale_answer_conf:
+		return (view->staleanswersenable);
+	case dns_stale_answer_no:
+		return (false);
+	}
+
+	return (false);
+}
+
+/*%
+ * If serving stale answers is allowed, set up 'qctx' to look for one and
+ * return true; otherwise, return false.
+ */
+static bool
+query_usestale(query_ctx_t *qctx) {
+	bool staleanswersok;
+
+	qctx_clean(qctx);
+	qctx_freedata(qctx);
+
+	dns_db_attach(qctx->client->view->cachedb, &qctx->db);
+	staleanswersok = stale_allowed(qctx->client->view, qctx->db);
+
 	if (staleanswersok) {
 		qctx->client->query.dboptions |= DNS_DBFIND_STALEOK;
 		inc_stats(qctx->client, ns_statscounter_trystale);
@@ -8487,6 +9204,10 @@ query_sign_nodata(query_ctx_t *qctx) {
 		query_addnxrrsetnsec(qctx);
 	}
 
+	if (qctx->client->query.proofcache.store && !qctx->nxrewrite) {
+		query_proofcache_store(qctx);
+	}
+
 	return (ns_query_done(qctx));
 }
 
@@ -8625,6 +9346,12 @@ query_nxdomain(query_ctx_t *qctx, bool empty_wild) {
 		query_addwildcardproof(qctx, false, false);
 	}
 
+	if (!empty_wild && qctx->client->query.proofcache.store &&
+	    !qctx->nxrewrite && !qctx->redirected)
+	{
+		query_proofcache_store(qctx);
+	}
+
 	/*
 	 * Set message rcode.
 	 */
@@ -9400,6 +10127,7 @@ query_coveringnsec(query_ctx_t *qctx) {
 		/*
 		 * No covering NSEC was found; proceed with recursion.
 		 */
+		inc_stats(qctx->client, ns_statscounter_synthfallback);
 		qctx->findcoveringnsec = false;
 		if (qctx->fname != NULL) {
 			ns_client_releasename(qctx->client, &qctx->fname);
@@ -9927,23 +10655,38 @@ query_addsoa(query_ctx_t *qctx, unsigned int override_ttl,
 	/*
 	 * Find the SOA.
 	 */
-	result = dns_db_getoriginnode(qctx->db, &node);
-	if (result == ISC_R_SUCCESS) {
-		result = dns_db_findrdataset(qctx->db, node, qctx->version,
-					     dns_rdatatype_soa, 0,
-					     client->now,
-					     rdataset, sigrdataset);
+	if (dns_rdataset_isassociated(&client->query.proofcache.proof.soa)) {
+		/*
+		 * The proof cache found it already.
+		 */
+		dns_rdataset_clone(&client->query.proofcache.proof.soa,
+				   rdataset);
+		if (sigrdataset != NULL) {
+			dns_rdataset_clone(
+				&client->query.proofcache.proof.soasig,
+				sigrdataset);
+		}
+		result = ISC_R_SUCCESS;
 	} else {
-		dns_fixedname_t foundname;
-		dns_name_t *fname;
+		result = dns_db_getoriginnode(qctx->db, &node);
+		if (result == ISC_R_SUCCESS) {
+			result = dns_db_findrdataset(qctx->db, node,
+						     qctx->version,
+						     dns_rdatatype_soa, 0,
+						     client->now,
+						     rdataset, sigrdataset);
+		} else {
+			dns_fixedname_t foundname;
+			dns_name_t *fname;
 
-		fname = dns_fixedname_initname(&foundname);
+			fname = dns_fixedname_initname(&foundname);
 
-		result = dns_db_findext(qctx->db, name, qctx->version,
-					dns_rdatatype_soa,
-					client->query.dboptions,
-					0, &node, fname, &cm, &ci,
-					rdataset, sigrdataset);
+			result = dns_db_findext(qctx->db, name, qctx->version,
+						dns_rdatatype_soa,
+						client->query.dboptions,
+						0, &node, fname, &cm, &ci,
+						rdataset, sigrdataset);
+		}
 	}
 	if (result != ISC_R_SUCCESS) {
 		/*
@@ -10312,6 +11055,48 @@ query_addbestns(query_ctx_t *qctx) {
 	}
 }
 
+/*%
+ * Add the NSEC RRset covering the wildcard from the proof found in the
+ * zone's proof cache, if there is one.
+ */
+static void
+query_addcachedwildcardproof(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_nxproof_t *proof = &client->query.proofcache.proof;
+	isc_buffer_t *dbuf, b;
+	dns_name_t *fname = NULL;
+	dns_rdataset_t *rdataset = NULL, *sigrdataset = NULL;
+
+	if (!dns_rdataset_isassociated(&proof->wild)) {
+		return;
+	}
+
+	dbuf = ns_client_getnamebuf(client);
+	if (dbuf == NULL) {
+		return;
+	}
+	fname = ns_client_newname(client, dbuf, &b);
+	rdataset = ns_client_newrdataset(client);
+	sigrdataset = ns_client_newrdataset(client);
+	if (fname != NULL && rdataset != NULL && sigrdataset != NULL) {
+		dns_name_copynf(dns_fixedname_name(&proof->wildname), fname);
+		dns_rdataset_clone(&proof->wild, rdataset);
+		dns_rdataset_clone(&proof->wildsig, sigrdataset);
+		query_addrrset(qctx, &fname, &rdataset, &sigrdataset,
+			       dbuf, DNS_SECTION_AUTHORITY);
+	}
+
+	if (rdataset != NULL) {
+		ns_client_putrdataset(client, &rdataset);
+	}
+	if (sigrdataset != NULL) {
+		ns_client_putrdataset(client, &sigrdataset);
+	}
+	if (fname != NULL) {
+		ns_client_releasename(client, &fname);
+	}
+}
+
 static void
 query_addwildcardproof(query_ctx_t *qctx, bool ispositive,
 		       bool nodata)
@@ -10338,6 +11123,17 @@ query_addwildcardproof(query_ctx_t *qctx, bool ispositive,
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_addwildcardproof");
 
+	/*
+	 * The proof cache has already found the NSEC covering the
+	 * wildcard, if it isn't the one covering the query name.
+	 */
+	if (!ispositive && !nodata &&
+	    dns_rdataset_isassociated(&client->query.proofcache.proof.nsec))
+	{
+		query_addcachedwildcardproof(qctx);
+		return;
+	}
+
 	dns_clientinfomethods_init(&cm, ns_client_sourceip);
 	dns_clientinfo_init(&ci, client, NULL);
 
@@ -13,6 +13,7 @@
 
 #include <stdbool.h>
 
+#include <isc/ht.h>
 #include <isc/mem.h>
 #include <isc/stats.h>
 #include <isc/util.h>
@@ -99,6 +100,9 @@ ns_server_create(isc_mem_t *mctx, ns_matchview_t matchingview,
 
 	ISC_LIST_INIT(sctx->altsecrets);
 
+	isc_mutex_init(&sctx->refreshlock);
+	CHECKFATAL(isc_ht_init(&sctx->refreshing, mctx, 8));
+
 	sctx->magic = SCTX_MAGIC;
 	*sctxp = sctx;
 
@@ -135,6 +139,10 @@ ns_server_detach(ns_server_t **sctxp) {
 		isc_quota_destroy(&sctx->tcpquota);
 		isc_quota_destroy(&sctx->xfroutquota);
 
+		INSIST(isc_ht_count(sctx->refreshing) == 0);
+		isc_ht_destroy(&sctx->refreshing);
+		isc_mutex_destroy(&sctx->refreshlock);
+
 		if (sctx->server_id != NULL) {
 			isc_mem_free(sctx->mctx, sctx->server_id);
 		}